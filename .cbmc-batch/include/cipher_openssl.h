@@ -32,6 +32,7 @@ struct aws_cryptosdk_sig_ctx {
     EVP_PKEY *pkey;
     EVP_MD_CTX *ctx;
     bool is_sign;
+    bool is_pristine;
 };
 
 struct aws_cryptosdk_md_context {
@@ -25,14 +25,22 @@
 #include <aws/core/utils/memory/stl/AWSVector.h>
 #include <aws/cryptosdk/materials.h>
 #include <aws/kms/KMSClient.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <mutex>
 
 namespace Aws {
 namespace Cryptosdk {
+namespace Private {
+class KmsKeyringImpl;
+}  // namespace Private
+
 namespace KmsKeyring {
 class ClientSupplier;
 class DiscoveryFilter;
+struct HedgeCounters;
 
 /**
  * @defgroup kms_keyring KMS keyring (AWS SDK for C++)
@@ -96,6 +104,65 @@ class AWS_CRYPTOSDK_CPP_API Builder {
      */
     Builder &WithKmsClient(const std::shared_ptr<KMS::KMSClient> &kms_client);
 
+    /**
+     * When enabled, the KmsKeyring makes its KMS calls concurrently instead of one at a time, using
+     * the asynchronous APIs of the KMS client (and therefore the client's executor):
+     *
+     * (1) On encryption, the Encrypt calls for the additional CMKs are all sent at once, after the data
+     *     key has been generated. EDKs are still added in the order the CMKs were configured, and if any
+     *     call fails, encryption fails.
+     *
+     * (2) On decryption, a Decrypt call is sent at once for every EDK which the keyring could decrypt,
+     *     and the data key from the first call to succeed is used. The remaining calls are left to
+     *     finish in the background, so this can cost more KMS requests than sequential decryption.
+     *
+     * This is disabled by default.
+     */
+    Builder &WithConcurrentKmsCalls(bool concurrent = true);
+
+    /**
+     * Enables a pool of data keys that the KmsKeyring generates ahead of time with KMS GenerateDataKey,
+     * so that encryption does not have to wait for a KMS round trip to get a new data key.
+     *
+     * Keys are pooled separately for each combination of generator CMK, data key length and encryption
+     * context. A background thread starts filling the pool for a combination once it has been used for
+     * encryption twice without a key ready, and keeps up to depth keys ready for it. Each prefetched key is
+     * used for exactly one message, and keys that are not used within max_age are discarded, as are the keys
+     * of combinations that have not been used for that long. At most 64 combinations are tracked at a time.
+     *
+     * This is only useful for workloads that reuse a small set of encryption contexts but cannot share data
+     * keys between messages with the caching CMM. It costs up to depth extra GenerateDataKey calls for every
+     * combination used more than once, including keys that expire unused. Plaintext data keys are kept in
+     * memory until used or discarded.
+     *
+     * A depth of 0 (the default) or a max_age of 0 disables prefetching. This has no effect on keyrings built
+     * in discovery mode.
+     */
+    Builder &WithDataKeyPrefetch(size_t depth, std::chrono::milliseconds max_age);
+
+    /**
+     * Enables hedged KMS Decrypt calls, to keep a slow KMS response from holding up decryption when the
+     * keyring could decrypt more than one EDK of the message (for example, EDKs under the same multi-region
+     * key in several regions).
+     *
+     * Decryption still tries one EDK at a time, but if a Decrypt call has not returned after the hedging
+     * delay, a Decrypt call for the next EDK is sent as well, and the data key from whichever call succeeds
+     * first is used. The hedging delay is the given percentile (between 0 and 100, e.g. 95) of the latency
+     * of the recent successful KMS calls of this keyring. Until enough calls have been made to estimate it,
+     * initial_delay is used instead.
+     *
+     * If counters is not nullptr, the number of hedge calls sent and the number of them that returned the
+     * data key are added to it.
+     *
+     * Calls left running when another call wins are allowed to finish in the background, so this can cost
+     * more KMS requests than plain sequential decryption. A percentile of 0 (the default) disables hedging.
+     * This has no effect if WithConcurrentKmsCalls is enabled, as all Decrypt calls are then sent at once.
+     */
+    Builder &WithHedgedDecrypt(
+        double percentile,
+        std::chrono::milliseconds initial_delay,
+        const std::shared_ptr<HedgeCounters> &counters = nullptr);
+
     /**
      * Creates a new KmsKeyring object or returns NULL if parameters are invalid.
      *
@@ -169,9 +236,35 @@ class AWS_CRYPTOSDK_CPP_API Builder {
     aws_cryptosdk_keyring *BuildDiscovery(std::shared_ptr<KmsKeyring::DiscoveryFilter> discovery_filter) const;
 
    private:
+    /**
+     * Applies the options that do not affect construction of the keyring.
+     */
+    aws_cryptosdk_keyring *Configure(Private::KmsKeyringImpl *keyring) const;
+
     std::shared_ptr<KMS::KMSClient> kms_client;
     Aws::Vector<Aws::String> grant_tokens;
     std::shared_ptr<ClientSupplier> client_supplier;
+    bool concurrent_kms_calls                     = false;
+    size_t prefetch_depth                         = 0;
+    std::chrono::milliseconds prefetch_max_age    = std::chrono::milliseconds(0);
+    double hedge_percentile                       = 0;
+    std::chrono::milliseconds hedge_initial_delay = std::chrono::milliseconds(0);
+    std::shared_ptr<HedgeCounters> hedge_counters;
+};
+
+/**
+ * Counts of hedged KMS Decrypt calls; see Builder::WithHedgedDecrypt. Can be shared between keyrings.
+ */
+struct AWS_CRYPTOSDK_CPP_API HedgeCounters {
+    /**
+     * Number of Decrypt calls sent because an earlier call took longer than the hedging delay.
+     */
+    std::atomic<uint64_t> fired{ 0 };
+
+    /**
+     * Number of the calls counted in fired which returned the data key that was used.
+     */
+    std::atomic<uint64_t> won{ 0 };
 };
 
 /**
@@ -204,15 +297,45 @@ class AWS_CRYPTOSDK_CPP_API CachingClientSupplier : public ClientSupplier {
      * If a client is already cached for this region, returns that one and provides a no-op callable.
      * If a client is not already cached for this region, returns a KMS client with default settings
      * and provides a callable which will cache the client. Never returns nullptr.
+     *
+     * Looking up a cached client does not take any lock.
      */
     std::shared_ptr<KMS::KMSClient> GetClient(const Aws::String &region, std::function<void()> &report_success);
 
+    /**
+     * Creates and caches a KMS client with default settings for each of these regions that does not have
+     * one cached yet, e.g. at startup.
+     *
+     * If connect is true, this also sends one KMS ListKeys request in each of these regions, all at once,
+     * and waits for the responses. This leaves an open connection in each client, so that the first
+     * encryption or decryption in the region does not pay for a TLS handshake. The responses are ignored,
+     * so the request may well be denied by IAM policy without any harm.
+     */
+    void PrewarmClients(const Aws::Vector<Aws::String> &regions, bool connect = true);
+
    protected:
+    typedef Aws::Map<Aws::String, std::shared_ptr<Aws::KMS::KMSClient>> ClientMap;
+
+    /**
+     * Makes the current contents of cache visible to GetClient. Must be called with cache_mutex held,
+     * after every change to cache.
+     */
+    void PublishCache();
+
     mutable std::mutex cache_mutex;
     /**
-     * Region -> KMS Client.
+     * Region -> KMS Client. Changes to it are made with cache_mutex held, and then published.
+     */
+    ClientMap cache;
+
+   private:
+    /**
+     * The latest published copy of cache, which GetClient reads without locking. Published copies are
+     * never changed, and are kept until this supplier is destroyed since a reader may still be using an
+     * older one. Clients are only ever added, so there are never more copies than cached regions.
      */
-    Aws::Map<Aws::String, std::shared_ptr<Aws::KMS::KMSClient>> cache;
+    std::atomic<const ClientMap *> published_cache{ nullptr };
+    Aws::Vector<std::shared_ptr<const ClientMap>> published_caches;
 };
 
 /**
@@ -17,11 +17,255 @@
 
 #include <assert.h>
 #include <aws/cryptosdk/cpp/kms_keyring.h>
+#include <aws/core/utils/memory/stl/AWSDeque.h>
+#include <aws/kms/model/GenerateDataKeyResult.h>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
 
 namespace Aws {
 namespace Cryptosdk {
 namespace Private {
 
+/**
+ * Keeps exponentially weighted moving averages of KMS call latency, error rate and AccessDenied rate for
+ * each region. A discovery keyring uses these to try the EDKs of the fastest healthy region first. The rates
+ * also decay towards zero over time, so that a region demoted by a burst of failures is tried again later
+ * even if no call reaches it in between. Thread safe.
+ */
+class AWS_CRYPTOSDK_CPP_API RegionLatencyTracker {
+   public:
+    /**
+     * Weight of each new sample in the moving averages.
+     */
+    static constexpr double SMOOTHING = 0.2;
+
+    /**
+     * Regions with at least this moving error rate are ranked after all healthy regions.
+     */
+    static constexpr double UNHEALTHY_ERROR_RATE = 0.5;
+
+    /**
+     * Regions with at least this moving AccessDenied rate rank as if they had never been called.
+     */
+    static constexpr double MOSTLY_DENIED_RATE = 0.5;
+
+    /**
+     * Default time over which the error and AccessDenied rates of a region halve without any call to it.
+     */
+    static constexpr std::chrono::seconds DEFAULT_RATE_HALF_LIFE = std::chrono::seconds(30);
+
+    explicit RegionLatencyTracker(std::chrono::steady_clock::duration rate_half_life = DEFAULT_RATE_HALF_LIFE)
+        : rate_half_life(rate_half_life) {}
+
+    /**
+     * Number of latencies of recent successful calls kept for LatencyPercentile.
+     */
+    static constexpr size_t LATENCY_WINDOW = 256;
+
+    /**
+     * LatencyPercentile returns its fallback until this many latencies have been recorded.
+     */
+    static constexpr size_t MIN_LATENCY_SAMPLES = 16;
+
+    /**
+     * Records a call to region that succeeded after the given latency.
+     */
+    void RecordSuccess(const Aws::String &region, std::chrono::steady_clock::duration latency);
+
+    /**
+     * Records a call to region that failed after the given latency, other than with AccessDenied.
+     */
+    void RecordFailure(const Aws::String &region, std::chrono::steady_clock::duration latency);
+
+    /**
+     * Records a call to region that was answered with AccessDenied after the given latency. This says
+     * nothing about the health of the region, so it does not count towards its error rate, but a region
+     * whose keys this keyring may not use is no better to try first than one never called.
+     */
+    void RecordAccessDenied(const Aws::String &region, std::chrono::steady_clock::duration latency);
+
+    /**
+     * Returns the rank of region; regions with lower ranks should be tried first. The rank of a healthy
+     * region is the average latency in milliseconds of its calls, whatever their outcome. Regions with no
+     * calls recorded, or whose calls are mostly denied, rank after every other healthy region, and
+     * unhealthy regions after those.
+     */
+    double Rank(const Aws::String &region) const;
+
+    /**
+     * Returns the given percentile (between 0 and 100) of the latencies of recent successful calls to any
+     * region, or fallback if fewer than MIN_LATENCY_SAMPLES have been recorded.
+     */
+    std::chrono::steady_clock::duration LatencyPercentile(
+        double percentile, std::chrono::steady_clock::duration fallback) const;
+
+   private:
+    struct Stats {
+        double latency_ms  = 0;
+        double error_rate  = 0;
+        double denied_rate = 0;
+        bool have_latency  = false;
+        /* When the rates were last decayed */
+        std::chrono::steady_clock::time_point updated;
+    };
+
+    /* Returns rate as it stands at now, after decaying since updated */
+    double Decayed(
+        double rate, std::chrono::steady_clock::time_point updated, std::chrono::steady_clock::time_point now) const;
+
+    /* Must be called with lock held. Decays the rates of region and records the latency of a call to it. */
+    Stats &Record(const Aws::String &region, std::chrono::steady_clock::duration latency);
+
+    const std::chrono::steady_clock::duration rate_half_life;
+    mutable std::mutex lock;
+    Aws::Map<Aws::String, Stats> stats;
+    /* Ring buffer of the latest LATENCY_WINDOW latencies; next_latency is where the next one goes */
+    Aws::Vector<std::chrono::steady_clock::duration> recent_latencies;
+    size_t next_latency = 0;
+};
+
+/**
+ * A thread, started on first use, which waits for KMS calls that an OnDecrypt stopped waiting for once it had a
+ * winner. The clients those calls use are only released once they have finished, and on this thread, never on
+ * one of the clients' own executor threads. The destructor waits for every call handed over.
+ */
+class AWS_CRYPTOSDK_CPP_API PendingCallReaper {
+   public:
+    PendingCallReaper() = default;
+    ~PendingCallReaper();
+
+    // non-copyable
+    PendingCallReaper(const PendingCallReaper &) = delete;
+    PendingCallReaper &operator=(const PendingCallReaper &) = delete;
+
+    /**
+     * Runs wait on the reaper thread, after those handed over before it, and then destroys it. wait should
+     * block until the calls it stands for have finished, and hold whatever they use until then.
+     */
+    void Adopt(std::function<void()> wait);
+
+   private:
+    void Run();
+
+    std::mutex lock;
+    std::condition_variable wake;
+    bool stopping = false;
+    Aws::Deque<std::function<void()>> waits;
+    std::thread reaper;
+};
+
+/**
+ * Data keys generated ahead of time with KMS GenerateDataKey; see KmsKeyring::Builder::WithDataKeyPrefetch.
+ *
+ * Keys are pooled per (CMK, data key length, encryption context), since a GenerateDataKey result is bound
+ * to the encryption context it was generated with. A group is created by the first Take for it, but a
+ * background thread only keeps it filled to the configured depth once ADMIT_AFTER_MISSES Takes have found
+ * it empty, so that encryption contexts used only once cost no extra GenerateDataKey calls. At most
+ * MAX_GROUPS groups are kept. Keys older than the maximum age are discarded, as are groups that have not
+ * been used for that long. Every key is handed out at most once.
+ */
+class AWS_CRYPTOSDK_CPP_API DataKeyPrefetchPool {
+   public:
+    /**
+     * Number of Takes that must find a group empty before the background thread starts filling it.
+     */
+    static constexpr unsigned ADMIT_AFTER_MISSES = 2;
+
+    /**
+     * Maximum number of groups. When a Take needs a new one, idle groups are discarded first, then the
+     * least recently used group that is not being filled, preferring groups not yet filled at all.
+     */
+    static constexpr size_t MAX_GROUPS = 64;
+
+    /**
+     * @param supplier Supplies the KMS clients used for the GenerateDataKey calls.
+     * @param grant_tokens Grant tokens to send with the GenerateDataKey calls.
+     * @param depth Number of keys to keep ready for each group.
+     * @param max_age Age after which an unused key is discarded.
+     * @param start_filler Whether to start the background thread. If false, the pool is only
+     *        filled by calls to FillOne.
+     */
+    DataKeyPrefetchPool(
+        std::shared_ptr<KmsKeyring::ClientSupplier> supplier,
+        const Aws::Vector<Aws::String> &grant_tokens,
+        size_t depth,
+        std::chrono::milliseconds max_age,
+        bool start_filler = true);
+
+    /**
+     * Stops the background thread, waiting for a GenerateDataKey call in progress to finish.
+     */
+    ~DataKeyPrefetchPool();
+
+    // non-copyable
+    DataKeyPrefetchPool(const DataKeyPrefetchPool &) = delete;
+    DataKeyPrefetchPool &operator=(const DataKeyPrefetchPool &) = delete;
+
+    /**
+     * Moves a prefetched data key for these parameters into result and returns true, or returns false
+     * if none is ready, in which case the caller must generate the key itself. Either way, the group is
+     * marked as used, and once it has been found empty ADMIT_AFTER_MISSES times the background thread
+     * keeps it filled.
+     */
+    bool Take(
+        const Aws::String &key_id,
+        int data_key_len,
+        const Aws::Map<Aws::String, Aws::String> &enc_ctx,
+        Aws::KMS::Model::GenerateDataKeyResult &result);
+
+    /**
+     * Discards expired keys and idle groups, then makes one GenerateDataKey call for a group below
+     * its depth, if there is one. Returns true if a key was added to the pool, and false if no group
+     * needed one or the call failed.
+     */
+    bool FillOne();
+
+   private:
+    struct PrefetchedKey {
+        Aws::KMS::Model::GenerateDataKeyResult result;
+        std::chrono::steady_clock::time_point created;
+    };
+
+    struct Group {
+        Aws::String key_id;
+        int data_key_len;
+        Aws::Map<Aws::String, Aws::String> enc_ctx;
+        Aws::Deque<PrefetchedKey> keys;
+        std::chrono::steady_clock::time_point last_used;
+        /* Takes that found no key, counted up to ADMIT_AFTER_MISSES; only then is the group filled */
+        unsigned misses;
+        /* True while the background thread is generating a key for this group */
+        bool filling;
+    };
+
+    static Aws::String GroupId(
+        const Aws::String &key_id, int data_key_len, const Aws::Map<Aws::String, Aws::String> &enc_ctx);
+
+    /* Must be called with lock held */
+    void DiscardExpired(std::chrono::steady_clock::time_point now);
+
+    /* Must be called with lock held. Makes room for a new group, returning false if there is none. */
+    bool MakeRoom(std::chrono::steady_clock::time_point now);
+
+    void RunFiller();
+
+    std::shared_ptr<KmsKeyring::ClientSupplier> supplier;
+    const Aws::Vector<Aws::String> grant_tokens;
+    const size_t depth;
+    const std::chrono::milliseconds max_age;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    bool stopping;
+    /* Incremented by every Take, so that the background thread does not miss one while filling */
+    uint64_t take_count;
+    Aws::Map<Aws::String, Group> groups;
+    std::thread filler;
+};
+
 class AWS_CRYPTOSDK_CPP_API KmsKeyringImpl : public aws_cryptosdk_keyring {
     /* This entire class is a private implementation anyway, as users only handle
      * pointers to instances as (struct aws_cryptosdk_keyring *) types.
@@ -83,6 +327,38 @@ class AWS_CRYPTOSDK_CPP_API KmsKeyringImpl : public aws_cryptosdk_keyring {
      * construction.
      */
     std::shared_ptr<KmsKeyring::DiscoveryFilter> discovery_filter;
+
+    /**
+     * True if KMS calls are made concurrently; see KmsKeyring::Builder::WithConcurrentKmsCalls.
+     */
+    bool concurrent_kms_calls = false;
+
+    /**
+     * Latency and error statistics of the KMS calls made by this keyring. Discovery keyrings try
+     * EDKs in order of the rank of their region. This is shared with any concurrent calls that
+     * outlive the OnDecrypt that started them.
+     */
+    std::shared_ptr<RegionLatencyTracker> region_latency;
+
+    /**
+     * Data keys generated ahead of time, or nullptr if prefetching is disabled; see
+     * KmsKeyring::Builder::WithDataKeyPrefetch.
+     */
+    std::shared_ptr<DataKeyPrefetchPool> data_key_pool;
+
+    /**
+     * Hedging policy for Decrypt calls; see KmsKeyring::Builder::WithHedgedDecrypt. Hedging is enabled
+     * if and only if hedge_counters is not nullptr.
+     */
+    double hedge_percentile                       = 0;
+    std::chrono::milliseconds hedge_initial_delay = std::chrono::milliseconds(0);
+    std::shared_ptr<KmsKeyring::HedgeCounters> hedge_counters;
+
+    /**
+     * Waits for the Decrypt calls that concurrent and hedged OnDecrypt leave running once they have a
+     * winner. Declared last, so that it is destroyed, and those calls are waited for, first.
+     */
+    PendingCallReaper decrypt_reaper;
 };
 
 /**
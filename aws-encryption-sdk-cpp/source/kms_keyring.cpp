@@ -28,6 +28,13 @@
 #include <aws/kms/model/EncryptResult.h>
 #include <aws/kms/model/GenerateDataKeyRequest.h>
 #include <aws/kms/model/GenerateDataKeyResult.h>
+#include <aws/kms/model/ListKeysRequest.h>
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <future>
+#include <limits>
+#include <thread>
 
 namespace Aws {
 namespace Cryptosdk {
@@ -45,12 +52,280 @@ static void DestroyKeyring(struct aws_cryptosdk_keyring *keyring) {
     Aws::Delete(keyring_data_ptr);
 }
 
-static int OnDecrypt(
+/**
+ * Applies the checks that decide whether this keyring should ask KMS to decrypt edk. On success sets
+ * key_arn to the CMK the EDK names and kms_region to its region.
+ */
+static bool IsDecryptCandidate(
+    const Aws::Cryptosdk::Private::KmsKeyringImpl *self,
+    const struct aws_cryptosdk_edk *edk,
+    Aws::String &key_arn,
+    Aws::String &kms_region,
+    Aws::StringStream &error_buf) {
+    if (!aws_byte_buf_eq(&edk->provider_id, &self->key_provider)) {
+        // EDK belongs to a different non KMS keyring. Skip.
+        return false;
+    }
+
+    key_arn = Private::aws_string_from_c_aws_byte_buf(&edk->provider_info);
+
+    /* If there are no key IDs in the list, keyring is in "discovery" mode and will attempt KMS calls with
+     * every key ARN it comes across in the message, so long as the key ARN is authorized by the
+     * DiscoveryFilter (matches the partition and an account ID).
+     *
+     * If there are key IDs in the list, it will cross check the ARN it reads with that list
+     * before attempting KMS calls. Note that if caller provided key IDs in anything other than
+     * a CMK ARN format, the SDK will not attempt to decrypt those data keys, because the EDK
+     * data format always specifies the CMK with the full (non-alias) ARN.
+     */
+    if (self->key_ids.size() &&
+        std::find(self->key_ids.begin(), self->key_ids.end(), key_arn) == self->key_ids.end()) {
+        // This keyring does not have access to the CMK used to encrypt this data key. Skip.
+        return false;
+    }
+    // self->discovery_filter is non-null only if self was constructed via BuildDiscovery, which
+    // in turn implies discovery mode
+    if (self->discovery_filter && !self->discovery_filter->IsAuthorized(key_arn)) {
+        // The DiscoveryFilter blocks the CMK used to encrypt this data key. Skip.
+        return false;
+    }
+
+    kms_region = Private::parse_region_from_kms_key_arn(key_arn);
+    if (kms_region.empty()) {
+        error_buf << "Error: Malformed ciphertext. Provider ID field of KMS EDK is invalid KMS CMK ARN: " << key_arn
+                  << " ";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Hands the data key from a successful KMS Decrypt of the EDK under key_arn to the caller.
+ */
+static int AcceptDecryptOutcome(
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const Aws::KMS::Model::DecryptOutcome &outcome,
+    const Aws::String &key_arn) {
+    const Aws::String &outcome_key_id = outcome.GetResult().GetKeyId();
+    if (outcome_key_id != key_arn) {
+        // Since we specified the key ARN explicitly in the request,
+        // KMS had better use that key to decrypt
+        return aws_raise_error(AWS_ERROR_INVALID_STATE);
+    }
+
+    int ret =
+        aws_byte_buf_dup_from_aws_utils(request_alloc, unencrypted_data_key, outcome.GetResult().GetPlaintext());
+    if (ret == AWS_OP_SUCCESS) {
+        aws_cryptosdk_keyring_trace_add_record_c_str(
+            request_alloc,
+            keyring_trace,
+            KEY_PROVIDER_STR,
+            key_arn.c_str(),
+            AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY | AWS_CRYPTOSDK_WRAPPING_KEY_VERIFIED_ENC_CTX);
+    }
+    return ret;
+}
+
+/**
+ * Feeds the outcome of a KMS call to kms_region, started at start, into the keyring's region statistics.
+ */
+template <typename Outcome>
+static void RecordRegionOutcome(
+    Aws::Cryptosdk::Private::RegionLatencyTracker &tracker,
+    const Aws::String &kms_region,
+    const Outcome &outcome,
+    std::chrono::steady_clock::time_point start) {
+    auto latency = std::chrono::steady_clock::now() - start;
+    if (outcome.IsSuccess()) {
+        tracker.RecordSuccess(kms_region, latency);
+    } else if (outcome.GetError().GetErrorType() == KMS::KMSErrors::ACCESS_DENIED) {
+        tracker.RecordAccessDenied(kms_region, latency);
+    } else {
+        tracker.RecordFailure(kms_region, latency);
+    }
+}
+
+namespace {
+/**
+ * An EDK that passed IsDecryptCandidate, with the rank of its region at the time of the call.
+ */
+struct DecryptTarget {
+    const struct aws_cryptosdk_edk *edk;
+    Aws::String key_arn;
+    Aws::String kms_region;
+    double rank;
+};
+
+struct DecryptCandidate {
+    Aws::String key_arn;
+    Aws::String kms_region;
+    std::shared_ptr<KMS::KMSClient> kms_client;
+    std::function<void()> report_success;
+    Aws::KMS::Model::DecryptRequest kms_request;
+};
+
+/**
+ * State shared between the caller and the completion handlers of a set of concurrent Decrypt calls.
+ * It is reference counted because handlers may still be running after the caller has taken a winner.
+ */
+struct DecryptRace {
+    std::mutex lock;
+    std::condition_variable done;
+    size_t pending;
+    bool have_winner;
+    size_t winner;
+    Aws::KMS::Model::DecryptOutcome winning_outcome;
+    Aws::StringStream errors;
+
+    explicit DecryptRace(size_t pending) : pending(pending), have_winner(false), winner(0) {}
+};
+}  // namespace
+
+/**
+ * Sends a KMS Decrypt for candidate, which is candidates[idx], through DecryptAsync. The caller must have
+ * counted the call in race->pending.
+ */
+static void SendDecrypt(
+    const std::shared_ptr<DecryptRace> &race,
+    const DecryptCandidate &candidate,
+    size_t idx,
+    const std::shared_ptr<Aws::Cryptosdk::Private::RegionLatencyTracker> &region_latency,
+    bool report_errors) {
+    auto start             = std::chrono::steady_clock::now();
+    Aws::String kms_region = candidate.kms_region;
+    /* The handler keeps only the race alive. Clients are released on the keyring's reaper thread (see
+     * FinishDecryptRace), never on one of their own executor threads.
+     */
+    candidate.kms_client->DecryptAsync(
+        candidate.kms_request,
+        [race, idx, report_errors, region_latency, kms_region, start](
+            const KMS::KMSClient *,
+            const Aws::KMS::Model::DecryptRequest &,
+            const Aws::KMS::Model::DecryptOutcome &outcome,
+            const std::shared_ptr<const Aws::Client::AsyncCallerContext> &) {
+            RecordRegionOutcome(*region_latency, kms_region, outcome, start);
+            std::unique_lock<std::mutex> lock(race->lock);
+            if (outcome.IsSuccess()) {
+                if (!race->have_winner) {
+                    race->have_winner     = true;
+                    race->winner          = idx;
+                    race->winning_outcome = outcome;
+                }
+            } else if (report_errors) {
+                race->errors << "Error: " << outcome.GetError().GetExceptionName()
+                             << " Message:" << outcome.GetError().GetMessage() << " ";
+            }
+            race->pending--;
+            race->done.notify_all();
+        });
+}
+
+/**
+ * Uses the winner of race, if any, once it has one or no calls are pending. race->lock must be held.
+ */
+static int FinishDecryptRace(
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const std::shared_ptr<DecryptRace> &race,
+    Aws::Vector<DecryptCandidate> &candidates,
+    Aws::Cryptosdk::Private::PendingCallReaper &reaper,
+    Aws::StringStream &error_buf) {
+    if (race->pending) {
+        /* Outstanding calls refer to their clients, so keep the clients until those calls finish */
+        Aws::Vector<std::shared_ptr<KMS::KMSClient>> clients;
+        for (auto &candidate : candidates) clients.push_back(candidate.kms_client);
+        reaper.Adopt([race, clients] {
+            std::unique_lock<std::mutex> lock(race->lock);
+            race->done.wait(lock, [&race] { return !race->pending; });
+        });
+    }
+
+    if (!race->have_winner) {
+        error_buf << race->errors.str();
+        return AWS_OP_SUCCESS;
+    }
+    DecryptCandidate &winner = candidates[race->winner];
+    winner.report_success();
+    return AcceptDecryptOutcome(
+        request_alloc, unencrypted_data_key, keyring_trace, race->winning_outcome, winner.key_arn);
+}
+
+/**
+ * Sends a KMS Decrypt for every candidate at once through DecryptAsync and uses the first one to succeed.
+ */
+static int DecryptConcurrently(
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    Aws::Vector<DecryptCandidate> &candidates,
+    const std::shared_ptr<Aws::Cryptosdk::Private::RegionLatencyTracker> &region_latency,
+    Aws::Cryptosdk::Private::PendingCallReaper &reaper,
+    bool report_errors,
+    Aws::StringStream &error_buf) {
+    auto race = Aws::MakeShared<DecryptRace>(AWS_CRYPTO_SDK_KMS_CLASS_TAG, candidates.size());
+    for (size_t idx = 0; idx < candidates.size(); idx++) {
+        SendDecrypt(race, candidates[idx], idx, region_latency, report_errors);
+    }
+
+    std::unique_lock<std::mutex> lock(race->lock);
+    race->done.wait(lock, [&race] { return race->have_winner || !race->pending; });
+    return FinishDecryptRace(
+        request_alloc, unencrypted_data_key, keyring_trace, race, candidates, reaper, error_buf);
+}
+
+/**
+ * Sends a KMS Decrypt for one candidate at a time, as sequential decryption does, except that when the calls
+ * in flight have not returned after hedge_delay, the next candidate is sent as well. Uses the first one to
+ * succeed.
+ */
+static int DecryptHedged(
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    Aws::Vector<DecryptCandidate> &candidates,
+    const std::shared_ptr<Aws::Cryptosdk::Private::RegionLatencyTracker> &region_latency,
+    std::chrono::steady_clock::duration hedge_delay,
+    KmsKeyring::HedgeCounters &hedge_counters,
+    Aws::Cryptosdk::Private::PendingCallReaper &reaper,
+    bool report_errors,
+    Aws::StringStream &error_buf) {
+    auto race = Aws::MakeShared<DecryptRace>(AWS_CRYPTO_SDK_KMS_CLASS_TAG, 0);
+    Aws::Vector<bool> hedged(candidates.size(), false);
+    size_t sent = 0;
+
+    std::unique_lock<std::mutex> lock(race->lock);
+    while (!race->have_winner && sent < candidates.size()) {
+        if (race->pending) {
+            if (race->done.wait_for(lock, hedge_delay, [&race] { return race->have_winner || !race->pending; })) {
+                // Either there is a winner, or every call so far failed and the next one is not a hedge
+                continue;
+            }
+            hedged[sent] = true;
+            hedge_counters.fired++;
+        }
+        race->pending++;
+        lock.unlock();
+        SendDecrypt(race, candidates[sent], sent, region_latency, report_errors);
+        lock.lock();
+        sent++;
+    }
+
+    race->done.wait(lock, [&race] { return race->have_winner || !race->pending; });
+    if (race->have_winner && hedged[race->winner]) hedge_counters.won++;
+    return FinishDecryptRace(
+        request_alloc, unencrypted_data_key, keyring_trace, race, candidates, reaper, error_buf);
+}
+
+static int OnDecryptIndexed(
     struct aws_cryptosdk_keyring *keyring,
     struct aws_allocator *request_alloc,
     struct aws_byte_buf *unencrypted_data_key,
     struct aws_array_list *keyring_trace,
     const struct aws_array_list *edks,
+    const struct aws_cryptosdk_edk_index *edk_index,
     const struct aws_hash_table *enc_ctx,
     enum aws_cryptosdk_alg_id alg) {
     (void)alg;
@@ -62,52 +337,45 @@ static int OnDecrypt(
 
     Aws::StringStream error_buf;
     const auto enc_ctx_cpp = aws_map_from_c_aws_hash_table(enc_ctx);
+    Aws::Vector<DecryptCandidate> candidates;
+
+    const size_t *positions = NULL;
+    size_t num_elems        = aws_array_list_length(edks);
+    if (edk_index && aws_cryptosdk_edk_index_find(
+                         edk_index, aws_byte_cursor_from_buf(&self->key_provider), NULL, &positions, &num_elems)) {
+        return AWS_OP_ERR;
+    }
 
-    size_t num_elems = aws_array_list_length(edks);
-    for (unsigned int idx = 0; idx < num_elems; idx++) {
+    Aws::Vector<DecryptTarget> targets;
+    for (size_t i = 0; i < num_elems; i++) {
+        size_t idx = positions ? positions[i] : i;
         struct aws_cryptosdk_edk *edk;
         int rv = aws_array_list_get_at_ptr(edks, (void **)&edk, idx);
         if (rv != AWS_OP_SUCCESS) {
             continue;
         }
 
-        if (!aws_byte_buf_eq(&edk->provider_id, &self->key_provider)) {
-            // EDK belongs to a different non KMS keyring. Skip.
-            continue;
-        }
-
-        const Aws::String key_arn = Private::aws_string_from_c_aws_byte_buf(&edk->provider_info);
-
-        /* If there are no key IDs in the list, keyring is in "discovery" mode and will attempt KMS calls with
-         * every key ARN it comes across in the message, so long as the key ARN is authorized by the
-         * DiscoveryFilter (matches the partition and an account ID).
-         *
-         * If there are key IDs in the list, it will cross check the ARN it reads with that list
-         * before attempting KMS calls. Note that if caller provided key IDs in anything other than
-         * a CMK ARN format, the SDK will not attempt to decrypt those data keys, because the EDK
-         * data format always specifies the CMK with the full (non-alias) ARN.
-         */
-        if (self->key_ids.size() &&
-            std::find(self->key_ids.begin(), self->key_ids.end(), key_arn) == self->key_ids.end()) {
-            // This keyring does not have access to the CMK used to encrypt this data key. Skip.
-            continue;
-        }
-        // self->discovery_filter is non-null only if self was constructed via BuildDiscovery, which
-        // in turn implies discovery mode
-        if (self->discovery_filter && !self->discovery_filter->IsAuthorized(key_arn)) {
-            // The DiscoveryFilter blocks the CMK used to encrypt this data key. Skip.
-            continue;
+        DecryptTarget target{ edk, "", "", 0 };
+        if (IsDecryptCandidate(self, edk, target.key_arn, target.kms_region, error_buf)) {
+            targets.push_back(std::move(target));
         }
+    }
 
-        Aws::String kms_region = Private::parse_region_from_kms_key_arn(key_arn);
-        if (kms_region.empty()) {
-            error_buf << "Error: Malformed ciphertext. Provider ID field of KMS EDK is invalid KMS CMK ARN: " << key_arn
-                      << " ";
-            continue;
-        }
+    /* In discovery mode the EDK order is whatever the encrypting side chose, which is often a region far
+     * from here. Try the fastest healthy region first instead, then regions not called yet, then unhealthy
+     * ones. The sort is stable, so EDKs in regions of equal rank (including all of them before any calls
+     * were made) keep their order in the message.
+     */
+    if (self->key_ids.empty() && targets.size() > 1) {
+        for (auto &target : targets) target.rank = self->region_latency->Rank(target.kms_region);
+        std::stable_sort(targets.begin(), targets.end(), [](const DecryptTarget &a, const DecryptTarget &b) {
+            return a.rank < b.rank;
+        });
+    }
 
+    for (const auto &target : targets) {
         std::function<void()> report_success;
-        auto kms_client = self->kms_client_supplier->GetClient(kms_region, report_success);
+        auto kms_client = self->kms_client_supplier->GetClient(target.kms_region, report_success);
         if (!kms_client) {
             // Client supplier does not serve this region. Skip.
             continue;
@@ -115,11 +383,18 @@ static int OnDecrypt(
 
         Aws::KMS::Model::DecryptRequest kms_request;
         kms_request.WithGrantTokens(self->grant_tokens)
-            .WithKeyId(key_arn)
-            .WithCiphertextBlob(aws_utils_byte_buffer_from_c_aws_byte_buf(&edk->ciphertext))
+            .WithKeyId(target.key_arn)
+            .WithCiphertextBlob(aws_utils_byte_buffer_from_c_aws_byte_buf(&target.edk->ciphertext))
             .WithEncryptionContext(enc_ctx_cpp);
 
+        if (self->concurrent_kms_calls || self->hedge_counters) {
+            candidates.push_back({ target.key_arn, target.kms_region, kms_client, report_success, kms_request });
+            continue;
+        }
+
+        auto start                              = std::chrono::steady_clock::now();
         Aws::KMS::Model::DecryptOutcome outcome = kms_client->Decrypt(kms_request);
+        RecordRegionOutcome(*self->region_latency, target.kms_region, outcome, start);
         if (!outcome.IsSuccess()) {
             // Failing on this call is normal behavior in "discovery" mode, but not in standard mode.
             if (self->key_ids.size()) {
@@ -130,24 +405,35 @@ static int OnDecrypt(
         }
         report_success();
 
-        const Aws::String &outcome_key_id = outcome.GetResult().GetKeyId();
-        if (outcome_key_id == key_arn) {
-            int ret = aws_byte_buf_dup_from_aws_utils(
-                request_alloc, unencrypted_data_key, outcome.GetResult().GetPlaintext());
-            if (ret == AWS_OP_SUCCESS) {
-                aws_cryptosdk_keyring_trace_add_record_c_str(
-                    request_alloc,
-                    keyring_trace,
-                    KEY_PROVIDER_STR,
-                    key_arn.c_str(),
-                    AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY | AWS_CRYPTOSDK_WRAPPING_KEY_VERIFIED_ENC_CTX);
-            }
-            return ret;
+        return AcceptDecryptOutcome(request_alloc, unencrypted_data_key, keyring_trace, outcome, target.key_arn);
+    }
+
+    if (!candidates.empty()) {
+        int rv;
+        if (self->concurrent_kms_calls) {
+            rv = DecryptConcurrently(
+                request_alloc,
+                unencrypted_data_key,
+                keyring_trace,
+                candidates,
+                self->region_latency,
+                self->decrypt_reaper,
+                self->key_ids.size() > 0,
+                error_buf);
         } else {
-            // Since we specified the key ARN explicitly in the request,
-            // KMS had better use that key to decrypt
-            return aws_raise_error(AWS_ERROR_INVALID_STATE);
+            rv = DecryptHedged(
+                request_alloc,
+                unencrypted_data_key,
+                keyring_trace,
+                candidates,
+                self->region_latency,
+                self->region_latency->LatencyPercentile(self->hedge_percentile, self->hedge_initial_delay),
+                *self->hedge_counters,
+                self->decrypt_reaper,
+                self->key_ids.size() > 0,
+                error_buf);
         }
+        if (rv || unencrypted_data_key->buffer) return rv;
     }
 
     AWS_LOGSTREAM_ERROR(
@@ -157,6 +443,56 @@ static int OnDecrypt(
     return AWS_OP_SUCCESS;
 }
 
+static int OnDecrypt(
+    struct aws_cryptosdk_keyring *keyring,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    return OnDecryptIndexed(keyring, request_alloc, unencrypted_data_key, keyring_trace, edks, NULL, enc_ctx, alg);
+}
+
+/**
+ * Returns the client for the region of key_id, which the keyring was configured with, or nullptr if the
+ * client supplier does not serve that region.
+ */
+static std::shared_ptr<KMS::KMSClient> GetEncryptClient(
+    const Aws::Cryptosdk::Private::KmsKeyringImpl *self,
+    const Aws::String &key_id,
+    std::function<void()> &report_success) {
+    // Already checked on keyring build that this will succeed.
+    Aws::String kms_region = Private::parse_region_from_kms_key_arn(key_id);
+
+    /* Client supplier is allowed to return NULL if, for example, user wants to exclude particular
+     * regions. But if it does so here it means that user configured keyring with a KMS key that was
+     * incompatible with the client supplier in use.
+     */
+    return self->kms_client_supplier->GetClient(kms_region, report_success);
+}
+
+static Aws::KMS::Model::EncryptRequest EncryptRequestFor(
+    const Aws::Cryptosdk::Private::KmsKeyringImpl *self,
+    const Aws::String &key_id,
+    const Aws::Utils::ByteBuffer &unencrypted_data_key,
+    const Aws::Map<Aws::String, Aws::String> &enc_ctx) {
+    Aws::KMS::Model::EncryptRequest kms_request;
+    kms_request.WithKeyId(key_id)
+        .WithGrantTokens(self->grant_tokens)
+        .WithPlaintext(unencrypted_data_key)
+        .WithEncryptionContext(enc_ctx);
+    return kms_request;
+}
+
+namespace {
+struct EncryptCall {
+    std::shared_ptr<KMS::KMSClient> kms_client;
+    std::function<void()> report_success;
+    Aws::KMS::Model::EncryptOutcomeCallable outcome;
+};
+}  // namespace
+
 static int OnEncrypt(
     struct aws_cryptosdk_keyring *keyring,
     struct aws_allocator *request_alloc,
@@ -218,39 +554,40 @@ static int OnEncrypt(
         }
         Aws::String key_id = self->key_ids.front();
 
-        // Already checked on keyring build that this will succeed.
-        Aws::String kms_region = Private::parse_region_from_kms_key_arn(key_id);
-
-        std::function<void()> report_success;
-        auto kms_client = self->kms_client_supplier->GetClient(kms_region, report_success);
-        if (!kms_client) {
-            /* Client supplier is allowed to return NULL if, for example, user wants to exclude particular
-             * regions. But if we are here it means that user configured keyring with a KMS key that was
-             * incompatible with the client supplier in use.
-             */
-            return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
-        }
-        Aws::KMS::Model::GenerateDataKeyRequest kms_request;
-        kms_request.WithKeyId(key_id)
-            .WithGrantTokens(self->grant_tokens)
-            .WithNumberOfBytes((int)alg_prop->data_key_len)
-            .WithEncryptionContext(enc_ctx_cpp);
-
-        Aws::KMS::Model::GenerateDataKeyOutcome outcome = kms_client->GenerateDataKey(kms_request);
-        if (!outcome.IsSuccess()) {
-            AWS_LOGSTREAM_ERROR(AWS_CRYPTO_SDK_KMS_CLASS_TAG, "Invalid encryption materials algorithm properties");
-            return aws_raise_error(AWS_CRYPTOSDK_ERR_KMS_FAILURE);
+        Aws::KMS::Model::GenerateDataKeyResult generated;
+        if (!self->data_key_pool ||
+            !self->data_key_pool->Take(key_id, (int)alg_prop->data_key_len, enc_ctx_cpp, generated)) {
+            // Already checked on keyring build that this will succeed.
+            Aws::String kms_region = Private::parse_region_from_kms_key_arn(key_id);
+
+            std::function<void()> report_success;
+            auto kms_client = self->kms_client_supplier->GetClient(kms_region, report_success);
+            if (!kms_client) {
+                /* Client supplier is allowed to return NULL if, for example, user wants to exclude particular
+                 * regions. But if we are here it means that user configured keyring with a KMS key that was
+                 * incompatible with the client supplier in use.
+                 */
+                return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+            }
+            Aws::KMS::Model::GenerateDataKeyRequest kms_request;
+            kms_request.WithKeyId(key_id)
+                .WithGrantTokens(self->grant_tokens)
+                .WithNumberOfBytes((int)alg_prop->data_key_len)
+                .WithEncryptionContext(enc_ctx_cpp);
+
+            Aws::KMS::Model::GenerateDataKeyOutcome outcome = kms_client->GenerateDataKey(kms_request);
+            if (!outcome.IsSuccess()) {
+                AWS_LOGSTREAM_ERROR(AWS_CRYPTO_SDK_KMS_CLASS_TAG, "Invalid encryption materials algorithm properties");
+                return aws_raise_error(AWS_CRYPTOSDK_ERR_KMS_FAILURE);
+            }
+            report_success();
+            generated = outcome.GetResult();
         }
-        report_success();
         rv = append_key_dup_to_edks(
-            request_alloc,
-            &my_edks.list,
-            &outcome.GetResult().GetCiphertextBlob(),
-            &outcome.GetResult().GetKeyId(),
-            &self->key_provider);
+            request_alloc, &my_edks.list, &generated.GetCiphertextBlob(), &generated.GetKeyId(), &self->key_provider);
         if (rv != AWS_OP_SUCCESS) return rv;
 
-        rv = aws_byte_buf_dup_from_aws_utils(request_alloc, unencrypted_data_key, outcome.GetResult().GetPlaintext());
+        rv = aws_byte_buf_dup_from_aws_utils(request_alloc, unencrypted_data_key, generated.GetPlaintext());
         if (rv != AWS_OP_SUCCESS) return rv;
         generated_new_data_key = true;
         aws_cryptosdk_keyring_trace_add_record_c_str(
@@ -264,30 +601,44 @@ static int OnEncrypt(
 
     const auto unencrypted_data_key_cpp = aws_utils_byte_buffer_from_c_aws_byte_buf(unencrypted_data_key);
 
-    size_t num_key_ids = self->key_ids.size();
-    for (size_t key_id_idx = generated_new_data_key ? 1 : 0; key_id_idx < num_key_ids; ++key_id_idx) {
-        Aws::String key_id = self->key_ids[key_id_idx];
+    size_t num_key_ids   = self->key_ids.size();
+    size_t first_key_idx = generated_new_data_key ? 1 : 0;
 
-        // Already checked on keyring build that this will succeed.
-        Aws::String kms_region = Private::parse_region_from_kms_key_arn(key_id);
-
-        std::function<void()> report_success;
-        auto kms_client = self->kms_client_supplier->GetClient(kms_region, report_success);
-        if (!kms_client) {
-            /* Client supplier is allowed to return NULL if, for example, user wants to exclude particular
-             * regions. But if we are here it means that user configured keyring with a KMS key that was
-             * incompatible with the client supplier in use.
-             */
+    /* With concurrent KMS calls, all Encrypt requests are sent before any outcome is examined. Outcomes
+     * are still handled in key order below, so EDKs and errors are the same as with sequential calls.
+     */
+    Aws::Vector<EncryptCall> calls;
+    for (size_t key_id_idx = first_key_idx; self->concurrent_kms_calls && key_id_idx < num_key_ids; ++key_id_idx) {
+        EncryptCall call;
+        if (!(call.kms_client = GetEncryptClient(self, self->key_ids[key_id_idx], call.report_success))) {
             rv = aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
-            goto out;
+            break;
         }
-        Aws::KMS::Model::EncryptRequest kms_request;
-        kms_request.WithKeyId(key_id)
-            .WithGrantTokens(self->grant_tokens)
-            .WithPlaintext(unencrypted_data_key_cpp)
-            .WithEncryptionContext(enc_ctx_cpp);
+        call.outcome = call.kms_client->EncryptCallable(
+            EncryptRequestFor(self, self->key_ids[key_id_idx], unencrypted_data_key_cpp, enc_ctx_cpp));
+        calls.push_back(std::move(call));
+    }
+    // Every call must finish before its client may be released
+    for (auto &call : calls) call.outcome.wait();
+    if (rv != AWS_OP_SUCCESS) goto out;
 
-        Aws::KMS::Model::EncryptOutcome outcome = kms_client->Encrypt(kms_request);
+    for (size_t key_id_idx = first_key_idx; key_id_idx < num_key_ids; ++key_id_idx) {
+        Aws::String key_id = self->key_ids[key_id_idx];
+
+        std::function<void()> report_success;
+        Aws::KMS::Model::EncryptOutcome outcome;
+        if (self->concurrent_kms_calls) {
+            EncryptCall &call = calls[key_id_idx - first_key_idx];
+            outcome           = call.outcome.get();
+            report_success    = call.report_success;
+        } else {
+            auto kms_client = GetEncryptClient(self, key_id, report_success);
+            if (!kms_client) {
+                rv = aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+                goto out;
+            }
+            outcome = kms_client->Encrypt(EncryptRequestFor(self, key_id, unencrypted_data_key_cpp, enc_ctx_cpp));
+        }
         if (!outcome.IsSuccess()) {
             AWS_LOGSTREAM_ERROR(
                 AWS_CRYPTO_SDK_KMS_CLASS_TAG,
@@ -326,6 +677,307 @@ out:
 
 Aws::Cryptosdk::Private::KmsKeyringImpl::~KmsKeyringImpl() {}
 
+constexpr double Aws::Cryptosdk::Private::RegionLatencyTracker::SMOOTHING;
+constexpr double Aws::Cryptosdk::Private::RegionLatencyTracker::UNHEALTHY_ERROR_RATE;
+constexpr double Aws::Cryptosdk::Private::RegionLatencyTracker::MOSTLY_DENIED_RATE;
+constexpr std::chrono::seconds Aws::Cryptosdk::Private::RegionLatencyTracker::DEFAULT_RATE_HALF_LIFE;
+constexpr size_t Aws::Cryptosdk::Private::RegionLatencyTracker::LATENCY_WINDOW;
+constexpr size_t Aws::Cryptosdk::Private::RegionLatencyTracker::MIN_LATENCY_SAMPLES;
+
+double Aws::Cryptosdk::Private::RegionLatencyTracker::Decayed(
+    double rate, std::chrono::steady_clock::time_point updated, std::chrono::steady_clock::time_point now) const {
+    if (now <= updated) return rate;
+    double half_lives = std::chrono::duration<double>(now - updated).count() /
+                        std::chrono::duration<double>(rate_half_life).count();
+    return rate * std::exp2(-half_lives);
+}
+
+Aws::Cryptosdk::Private::RegionLatencyTracker::Stats &Aws::Cryptosdk::Private::RegionLatencyTracker::Record(
+    const Aws::String &region, std::chrono::steady_clock::duration latency) {
+    auto now            = std::chrono::steady_clock::now();
+    Stats &region_stats = stats[region];
+    region_stats.error_rate  = Decayed(region_stats.error_rate, region_stats.updated, now);
+    region_stats.denied_rate = Decayed(region_stats.denied_rate, region_stats.updated, now);
+    region_stats.updated     = now;
+
+    double latency_ms = std::chrono::duration<double, std::milli>(latency).count();
+    if (region_stats.have_latency) {
+        region_stats.latency_ms += SMOOTHING * (latency_ms - region_stats.latency_ms);
+    } else {
+        region_stats.latency_ms   = latency_ms;
+        region_stats.have_latency = true;
+    }
+    return region_stats;
+}
+
+void Aws::Cryptosdk::Private::RegionLatencyTracker::RecordSuccess(
+    const Aws::String &region, std::chrono::steady_clock::duration latency) {
+    std::lock_guard<std::mutex> guard(lock);
+    Stats &region_stats = Record(region, latency);
+    region_stats.error_rate -= SMOOTHING * region_stats.error_rate;
+    region_stats.denied_rate -= SMOOTHING * region_stats.denied_rate;
+
+    // Only successful calls say how long a Decrypt takes, which is what hedging needs to know
+    if (recent_latencies.size() < LATENCY_WINDOW) {
+        recent_latencies.push_back(latency);
+    } else {
+        recent_latencies[next_latency] = latency;
+    }
+    next_latency = (next_latency + 1) % LATENCY_WINDOW;
+}
+
+void Aws::Cryptosdk::Private::RegionLatencyTracker::RecordFailure(
+    const Aws::String &region, std::chrono::steady_clock::duration latency) {
+    std::lock_guard<std::mutex> guard(lock);
+    Stats &region_stats = Record(region, latency);
+    region_stats.error_rate += SMOOTHING * (1 - region_stats.error_rate);
+}
+
+void Aws::Cryptosdk::Private::RegionLatencyTracker::RecordAccessDenied(
+    const Aws::String &region, std::chrono::steady_clock::duration latency) {
+    std::lock_guard<std::mutex> guard(lock);
+    Stats &region_stats = Record(region, latency);
+    region_stats.denied_rate += SMOOTHING * (1 - region_stats.denied_rate);
+}
+
+double Aws::Cryptosdk::Private::RegionLatencyTracker::Rank(const Aws::String &region) const {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = stats.find(region);
+    // Every recorded call has a latency, so an unknown region is one that was never called
+    if (it == stats.end()) return std::numeric_limits<double>::max();
+    auto now = std::chrono::steady_clock::now();
+    if (Decayed(it->second.error_rate, it->second.updated, now) >= UNHEALTHY_ERROR_RATE) {
+        return std::numeric_limits<double>::infinity();
+    }
+    if (Decayed(it->second.denied_rate, it->second.updated, now) >= MOSTLY_DENIED_RATE) {
+        return std::numeric_limits<double>::max();
+    }
+    return it->second.latency_ms;
+}
+
+std::chrono::steady_clock::duration Aws::Cryptosdk::Private::RegionLatencyTracker::LatencyPercentile(
+    double percentile, std::chrono::steady_clock::duration fallback) const {
+    Aws::Vector<std::chrono::steady_clock::duration> latencies;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (recent_latencies.size() < MIN_LATENCY_SAMPLES) return fallback;
+        latencies = recent_latencies;
+    }
+
+    // Nearest-rank percentile
+    double rank = std::ceil(percentile / 100 * latencies.size());
+    size_t idx  = rank < 1 ? 0 : std::min((size_t)rank - 1, latencies.size() - 1);
+    std::nth_element(latencies.begin(), latencies.begin() + idx, latencies.end());
+    return latencies[idx];
+}
+
+Aws::Cryptosdk::Private::PendingCallReaper::~PendingCallReaper() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    if (reaper.joinable()) reaper.join();
+}
+
+void Aws::Cryptosdk::Private::PendingCallReaper::Adopt(std::function<void()> wait) {
+    std::lock_guard<std::mutex> guard(lock);
+    waits.push_back(std::move(wait));
+    if (!reaper.joinable()) reaper = std::thread(&PendingCallReaper::Run, this);
+    wake.notify_one();
+}
+
+void Aws::Cryptosdk::Private::PendingCallReaper::Run() {
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;) {
+        wake.wait(guard, [this] { return stopping || !waits.empty(); });
+        // Even when stopping, every call handed over is waited for
+        if (waits.empty()) return;
+
+        std::function<void()> wait = std::move(waits.front());
+        waits.pop_front();
+        guard.unlock();
+        wait();
+        // Release whatever the wait held, such as clients, without holding the lock
+        wait = nullptr;
+        guard.lock();
+    }
+}
+
+constexpr unsigned Aws::Cryptosdk::Private::DataKeyPrefetchPool::ADMIT_AFTER_MISSES;
+constexpr size_t Aws::Cryptosdk::Private::DataKeyPrefetchPool::MAX_GROUPS;
+
+Aws::Cryptosdk::Private::DataKeyPrefetchPool::DataKeyPrefetchPool(
+    std::shared_ptr<KmsKeyring::ClientSupplier> supplier,
+    const Aws::Vector<Aws::String> &grant_tokens,
+    size_t depth,
+    std::chrono::milliseconds max_age,
+    bool start_filler)
+    : supplier(supplier), grant_tokens(grant_tokens), depth(depth), max_age(max_age), stopping(false), take_count(0) {
+    if (start_filler) {
+        filler = std::thread(&DataKeyPrefetchPool::RunFiller, this);
+    }
+}
+
+Aws::Cryptosdk::Private::DataKeyPrefetchPool::~DataKeyPrefetchPool() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    if (filler.joinable()) filler.join();
+}
+
+Aws::String Aws::Cryptosdk::Private::DataKeyPrefetchPool::GroupId(
+    const Aws::String &key_id, int data_key_len, const Aws::Map<Aws::String, Aws::String> &enc_ctx) {
+    // Strings are length prefixed, so that different parameters can never produce the same ID
+    Aws::StringStream id;
+    id << key_id.size() << ':' << key_id << data_key_len << ';';
+    for (const auto &entry : enc_ctx) {
+        id << entry.first.size() << ':' << entry.first << entry.second.size() << ':' << entry.second;
+    }
+    return id.str();
+}
+
+bool Aws::Cryptosdk::Private::DataKeyPrefetchPool::Take(
+    const Aws::String &key_id,
+    int data_key_len,
+    const Aws::Map<Aws::String, Aws::String> &enc_ctx,
+    Aws::KMS::Model::GenerateDataKeyResult &result) {
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> guard(lock);
+
+    Aws::String group_id = GroupId(key_id, data_key_len, enc_ctx);
+    auto it              = groups.find(group_id);
+    if (it == groups.end()) {
+        if (!MakeRoom(now)) return false;
+        Group group{ key_id, data_key_len, enc_ctx, {}, now, 0, false };
+        it = groups.emplace(group_id, std::move(group)).first;
+    }
+    Group &group    = it->second;
+    group.last_used = now;
+
+    while (!group.keys.empty() && group.keys.front().created + max_age <= now) group.keys.pop_front();
+    bool have_key = !group.keys.empty();
+    if (have_key) {
+        result = std::move(group.keys.front().result);
+        group.keys.pop_front();
+    } else if (group.misses < ADMIT_AFTER_MISSES) {
+        group.misses++;
+    }
+
+    // Only groups being filled need the background thread
+    if (group.misses >= ADMIT_AFTER_MISSES) {
+        take_count++;
+        wake.notify_one();
+    }
+    return have_key;
+}
+
+void Aws::Cryptosdk::Private::DataKeyPrefetchPool::DiscardExpired(std::chrono::steady_clock::time_point now) {
+    for (auto it = groups.begin(); it != groups.end();) {
+        Group &group = it->second;
+        // Keys are appended as they are generated, so the oldest are at the front
+        while (!group.keys.empty() && group.keys.front().created + max_age <= now) group.keys.pop_front();
+        if (!group.filling && group.last_used + max_age <= now) {
+            it = groups.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+bool Aws::Cryptosdk::Private::DataKeyPrefetchPool::MakeRoom(std::chrono::steady_clock::time_point now) {
+    if (groups.size() < MAX_GROUPS) return true;
+    DiscardExpired(now);
+    if (groups.size() < MAX_GROUPS) return true;
+
+    auto victim = groups.end();
+    for (auto it = groups.begin(); it != groups.end(); ++it) {
+        const Group &group = it->second;
+        if (group.filling) continue;
+        if (victim == groups.end()) {
+            victim = it;
+            continue;
+        }
+        // Prefer groups that are not kept filled yet, then the least recently used
+        bool admitted        = group.misses >= ADMIT_AFTER_MISSES;
+        bool victim_admitted = victim->second.misses >= ADMIT_AFTER_MISSES;
+        if (admitted != victim_admitted) {
+            if (!admitted) victim = it;
+        } else if (group.last_used < victim->second.last_used) {
+            victim = it;
+        }
+    }
+    if (victim == groups.end()) return false;
+    groups.erase(victim);
+    return true;
+}
+
+bool Aws::Cryptosdk::Private::DataKeyPrefetchPool::FillOne() {
+    Aws::String group_id;
+    Aws::String key_id;
+    Aws::KMS::Model::GenerateDataKeyRequest kms_request;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        DiscardExpired(std::chrono::steady_clock::now());
+        auto it = std::find_if(groups.begin(), groups.end(), [this](const std::pair<const Aws::String, Group> &entry) {
+            return entry.second.misses >= ADMIT_AFTER_MISSES && !entry.second.filling &&
+                   entry.second.keys.size() < depth;
+        });
+        if (it == groups.end()) return false;
+
+        Group &group  = it->second;
+        group.filling = true;
+        group_id      = it->first;
+        key_id        = group.key_id;
+        kms_request.WithKeyId(group.key_id)
+            .WithGrantTokens(grant_tokens)
+            .WithNumberOfBytes(group.data_key_len)
+            .WithEncryptionContext(group.enc_ctx);
+    }
+
+    std::function<void()> report_success;
+    auto kms_client = supplier->GetClient(Private::parse_region_from_kms_key_arn(key_id), report_success);
+    Aws::KMS::Model::GenerateDataKeyOutcome outcome;
+    if (kms_client) {
+        outcome = kms_client->GenerateDataKey(kms_request);
+        if (outcome.IsSuccess()) {
+            report_success();
+        } else {
+            AWS_LOGSTREAM_WARN(
+                AWS_CRYPTO_SDK_KMS_CLASS_TAG,
+                "Data key prefetch failed: " << outcome.GetError().GetExceptionName()
+                                             << " Message: " << outcome.GetError().GetMessage());
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    // A group is never discarded while it is being filled
+    Group &group  = groups.at(group_id);
+    group.filling = false;
+    if (!kms_client || !outcome.IsSuccess()) return false;
+    group.keys.push_back({ outcome.GetResult(), std::chrono::steady_clock::now() });
+    return true;
+}
+
+void Aws::Cryptosdk::Private::DataKeyPrefetchPool::RunFiller() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (!stopping) {
+        uint64_t seen_take_count = take_count;
+        guard.unlock();
+        bool added = FillOne();
+        guard.lock();
+        if (!added) {
+            /* Nothing to do until the next Take, but wake up after max_age anyway to discard expired keys.
+             * After a failed call this also keeps the thread from retrying faster than the keys are used.
+             */
+            wake.wait_for(
+                guard, max_age, [this, seen_take_count] { return stopping || take_count != seen_take_count; });
+        }
+    }
+}
+
 Aws::Cryptosdk::Private::KmsKeyringImpl::KmsKeyringImpl(
     const Aws::Vector<Aws::String> &key_ids,
     const Aws::Vector<Aws::String> &grant_tokens,
@@ -333,9 +985,11 @@ Aws::Cryptosdk::Private::KmsKeyringImpl::KmsKeyringImpl(
     : key_provider(aws_byte_buf_from_c_str(KEY_PROVIDER_STR)),
       kms_client_supplier(client_supplier),
       grant_tokens(grant_tokens),
-      key_ids(key_ids) {
+      key_ids(key_ids),
+      region_latency(Aws::MakeShared<RegionLatencyTracker>(AWS_CRYPTO_SDK_KMS_CLASS_TAG)) {
     static const aws_cryptosdk_keyring_vt kms_keyring_vt = {
-        sizeof(struct aws_cryptosdk_keyring_vt), KEY_PROVIDER_STR, &DestroyKeyring, &OnEncrypt, &OnDecrypt
+        sizeof(struct aws_cryptosdk_keyring_vt), KEY_PROVIDER_STR, &DestroyKeyring, &OnEncrypt, &OnDecrypt,
+        &OnDecryptIndexed
     };
 
     aws_cryptosdk_keyring_base_init(this, &kms_keyring_vt);
@@ -370,21 +1024,55 @@ std::shared_ptr<KmsKeyring::CachingClientSupplier> KmsKeyring::CachingClientSupp
 
 std::shared_ptr<KMS::KMSClient> KmsKeyring::CachingClientSupplier::GetClient(
     const Aws::String &region, std::function<void()> &report_success) {
-    {
-        std::unique_lock<std::mutex> lock(cache_mutex);
-        if (cache.find(region) != cache.end()) {
+    const ClientMap *clients = published_cache.load(std::memory_order_acquire);
+    if (clients) {
+        auto it = clients->find(region);
+        if (it != clients->end()) {
             report_success = [] {};  // no-op lambda
-            return cache.at(region);
+            return it->second;
         }
     }
     auto client    = CreateDefaultKmsClient(region);
     report_success = [this, region, client] {
         std::unique_lock<std::mutex> lock(this->cache_mutex);
-        this->cache[region] = client;
+        // If another call cached a client for this region first, keep that one
+        if (this->cache.emplace(region, client).second) {
+            this->PublishCache();
+        }
     };
     return client;
 }
 
+void KmsKeyring::CachingClientSupplier::PrewarmClients(const Aws::Vector<Aws::String> &regions, bool connect) {
+    Aws::Vector<std::shared_ptr<KMS::KMSClient>> clients;
+    {
+        std::unique_lock<std::mutex> lock(cache_mutex);
+        bool added = false;
+        for (const auto &region : regions) {
+            auto it = cache.find(region);
+            if (it == cache.end()) {
+                it    = cache.emplace(region, CreateDefaultKmsClient(region)).first;
+                added = true;
+            }
+            clients.push_back(it->second);
+        }
+        if (added) PublishCache();
+    }
+
+    if (!connect) return;
+    Aws::Vector<Aws::KMS::Model::ListKeysOutcomeCallable> calls;
+    for (const auto &client : clients) {
+        calls.push_back(client->ListKeysCallable(Aws::KMS::Model::ListKeysRequest().WithLimit(1)));
+    }
+    for (auto &call : calls) call.wait();
+}
+
+void KmsKeyring::CachingClientSupplier::PublishCache() {
+    auto copy = Aws::MakeShared<const ClientMap>(AWS_CRYPTO_SDK_KMS_CLASS_TAG, cache);
+    published_caches.push_back(copy);
+    published_cache.store(copy.get(), std::memory_order_release);
+}
+
 static std::shared_ptr<KmsKeyring::ClientSupplier> BuildClientSupplier(
     const Aws::Vector<Aws::String> &key_ids,
     const std::shared_ptr<Aws::KMS::KMSClient> kms_client,
@@ -419,20 +1107,20 @@ aws_cryptosdk_keyring *KmsKeyring::Builder::Build(
         my_key_ids.push_back(key);
     }
 
-    return Aws::New<Private::KmsKeyringImpl>(
+    return Configure(Aws::New<Private::KmsKeyringImpl>(
         AWS_CRYPTO_SDK_KMS_CLASS_TAG,
         my_key_ids,
         grant_tokens,
-        BuildClientSupplier(my_key_ids, kms_client, client_supplier));
+        BuildClientSupplier(my_key_ids, kms_client, client_supplier)));
 }
 
 aws_cryptosdk_keyring *KmsKeyring::Builder::BuildDiscovery() const {
     Aws::Vector<Aws::String> empty_key_ids_list;
-    return Aws::New<Private::KmsKeyringImpl>(
+    return Configure(Aws::New<Private::KmsKeyringImpl>(
         AWS_CRYPTO_SDK_KMS_CLASS_TAG,
         empty_key_ids_list,
         grant_tokens,
-        BuildClientSupplier(empty_key_ids_list, kms_client, client_supplier));
+        BuildClientSupplier(empty_key_ids_list, kms_client, client_supplier)));
 }
 
 aws_cryptosdk_keyring *KmsKeyring::Builder::BuildDiscovery(std::shared_ptr<DiscoveryFilter> discovery_filter) const {
@@ -441,12 +1129,31 @@ aws_cryptosdk_keyring *KmsKeyring::Builder::BuildDiscovery(std::shared_ptr<Disco
     }
 
     Aws::Vector<Aws::String> empty_key_ids_list;
-    return Aws::New<Private::KmsKeyringImpl>(
+    return Configure(Aws::New<Private::KmsKeyringImpl>(
         AWS_CRYPTO_SDK_KMS_CLASS_TAG,
         empty_key_ids_list,
         grant_tokens,
         BuildClientSupplier(empty_key_ids_list, kms_client, client_supplier),
-        discovery_filter);
+        discovery_filter));
+}
+
+aws_cryptosdk_keyring *KmsKeyring::Builder::Configure(Private::KmsKeyringImpl *keyring) const {
+    keyring->concurrent_kms_calls = concurrent_kms_calls;
+    if (hedge_percentile > 0) {
+        keyring->hedge_percentile    = hedge_percentile;
+        keyring->hedge_initial_delay = hedge_initial_delay;
+        keyring->hedge_counters =
+            hedge_counters ? hedge_counters : Aws::MakeShared<HedgeCounters>(AWS_CRYPTO_SDK_KMS_CLASS_TAG);
+    }
+    if (prefetch_depth && prefetch_max_age.count() > 0 && keyring->key_ids.size()) {
+        keyring->data_key_pool = Aws::MakeShared<Private::DataKeyPrefetchPool>(
+            AWS_CRYPTO_SDK_KMS_CLASS_TAG,
+            keyring->kms_client_supplier,
+            keyring->grant_tokens,
+            prefetch_depth,
+            prefetch_max_age);
+    }
+    return keyring;
 }
 
 KmsKeyring::Builder &KmsKeyring::Builder::WithGrantTokens(const Aws::Vector<Aws::String> &grant_tokens) {
@@ -470,6 +1177,25 @@ KmsKeyring::Builder &KmsKeyring::Builder::WithKmsClient(const std::shared_ptr<KM
     return *this;
 }
 
+KmsKeyring::Builder &KmsKeyring::Builder::WithConcurrentKmsCalls(bool concurrent) {
+    this->concurrent_kms_calls = concurrent;
+    return *this;
+}
+
+KmsKeyring::Builder &KmsKeyring::Builder::WithDataKeyPrefetch(size_t depth, std::chrono::milliseconds max_age) {
+    this->prefetch_depth   = depth;
+    this->prefetch_max_age = max_age;
+    return *this;
+}
+
+KmsKeyring::Builder &KmsKeyring::Builder::WithHedgedDecrypt(
+    double percentile, std::chrono::milliseconds initial_delay, const std::shared_ptr<HedgeCounters> &counters) {
+    this->hedge_percentile    = percentile;
+    this->hedge_initial_delay = initial_delay;
+    this->hedge_counters      = counters;
+    return *this;
+}
+
 bool KmsKeyring::DiscoveryFilter::IsAuthorized(const Aws::String &key_arn) const {
     Utils::ARN arn(key_arn);
     if (!arn) {
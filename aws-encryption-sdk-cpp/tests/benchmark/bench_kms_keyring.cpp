@@ -0,0 +1,344 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Benchmarks the KMS keyring, the multi-keyring and the caching CMM against LocalKms, with a latency profile
+ * per region, so that the effect of the keyrings' concurrency, region ordering and hedging options can be
+ * measured without calling KMS.
+ *
+ * Usage: bench_kms_keyring [messages per thread] [threads]
+ *
+ * For each scenario, every thread encrypts its messages one after another, and then decrypts them. The
+ * throughput, the median and 99th percentile latency of each message, and the number of KMS calls made are
+ * reported for each phase.
+ */
+
+#include <aws/common/error.h>
+#include <aws/core/Aws.h>
+#include <aws/core/utils/threading/Executor.h>
+#include <aws/cryptosdk/cache.h>
+#include <aws/cryptosdk/cpp/kms_keyring.h>
+#include <aws/cryptosdk/default_cmm.h>
+#include <aws/cryptosdk/multi_keyring.h>
+#include <aws/cryptosdk/session.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "local_kms.h"
+
+using namespace Aws::Cryptosdk;
+using namespace Aws::Cryptosdk::Testing;
+
+namespace {
+
+const size_t MESSAGE_SIZE = 1024;
+
+/* Runs the multi-keyring's child calls on a shared, bounded pool of threads */
+int PoolExecutor(void *executor_data, void (*task)(void *task_data), void *task_data) {
+    auto pool = static_cast<Aws::Utils::Threading::Executor *>(executor_data);
+    return pool->Submit([task, task_data] { task(task_data); }) ? AWS_OP_SUCCESS : AWS_OP_ERR;
+}
+
+void error(const char *description) {
+    std::cerr << "Unexpected error in " << description << ": " << aws_error_str(aws_last_error()) << std::endl;
+    abort();
+}
+
+std::vector<uint8_t> process(struct aws_cryptosdk_session *session, const std::vector<uint8_t> &input) {
+    size_t out_needed = 1;
+    size_t out_offset = 0, in_offset = 0;
+    std::vector<uint8_t> buffer;
+
+    while (!aws_cryptosdk_session_is_done(session)) {
+        if (buffer.size() < out_offset + out_needed) {
+            buffer.resize(out_needed + out_offset);
+        }
+
+        size_t bytes_written, bytes_read;
+        if (aws_cryptosdk_session_process(
+                session,
+                buffer.data() + out_offset,
+                buffer.size() - out_offset,
+                &bytes_written,
+                input.data() + in_offset,
+                input.size() - in_offset,
+                &bytes_read)) {
+            error("session_process");
+        }
+
+        out_offset += bytes_written;
+        in_offset += bytes_read;
+
+        aws_cryptosdk_session_estimate_buf(session, &out_needed, NULL);
+    }
+
+    buffer.resize(out_offset);
+    return buffer;
+}
+
+/**
+ * One configuration to measure. The CMMs are released by the scenario.
+ */
+struct Scenario {
+    const char *name;
+    struct aws_cryptosdk_cmm *encrypt_cmm;
+    struct aws_cryptosdk_cmm *decrypt_cmm;
+};
+
+/**
+ * Wraps kr in a default CMM that uses a committing algorithm without signatures, so that the measurements
+ * are not dominated by ECDSA. Releases kr.
+ */
+struct aws_cryptosdk_cmm *UnsignedCmm(struct aws_allocator *alloc, struct aws_cryptosdk_keyring *kr) {
+    if (!kr) error("keyring constructor");
+    struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_default_cmm_new(alloc, kr);
+    if (!cmm) error("default CMM constructor");
+    if (aws_cryptosdk_default_cmm_set_alg_id(cmm, ALG_AES256_GCM_HKDF_SHA512_COMMIT_KEY)) {
+        error("default CMM set alg ID");
+    }
+    aws_cryptosdk_keyring_release(kr);
+    return cmm;
+}
+
+/**
+ * A scenario which encrypts and decrypts with cmm. Takes over the caller's reference to cmm.
+ */
+Scenario Symmetric(const char *name, struct aws_cryptosdk_cmm *cmm) {
+    aws_cryptosdk_cmm_retain(cmm);
+    Scenario scenario = { name, cmm, cmm };
+    return scenario;
+}
+
+double Percentile(std::vector<double> &latencies, double percentile) {
+    if (latencies.empty()) return 0;
+    size_t rank = (size_t)(percentile / 100 * (latencies.size() - 1));
+    std::nth_element(latencies.begin(), latencies.begin() + rank, latencies.end());
+    return latencies[rank];
+}
+
+struct KmsCallCounts {
+    uint64_t generate_data_key, encrypt, decrypt, throttled, failed;
+
+    explicit KmsCallCounts(const LocalKms::Counters &counters)
+        : generate_data_key(counters.generate_data_key),
+          encrypt(counters.encrypt),
+          decrypt(counters.decrypt),
+          throttled(counters.throttled),
+          failed(counters.failed) {}
+};
+
+/**
+ * Runs fn(thread, message) for every message of every thread, and prints a line of results for the phase.
+ */
+void RunPhase(
+    const char *phase,
+    const LocalKms &kms,
+    size_t threads,
+    size_t messages,
+    const std::function<void(size_t, size_t)> &fn) {
+    std::vector<std::vector<double>> thread_latencies(threads);
+    KmsCallCounts before(kms.counters);
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            for (size_t i = 0; i < messages; i++) {
+                auto message_start = std::chrono::steady_clock::now();
+                fn(t, i);
+                thread_latencies[t].push_back(
+                    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - message_start)
+                        .count());
+            }
+        });
+    }
+    for (auto &worker : workers) worker.join();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    KmsCallCounts after(kms.counters);
+    std::vector<double> latencies;
+    for (auto &l : thread_latencies) latencies.insert(latencies.end(), l.begin(), l.end());
+
+    printf(
+        "  %-8s %9.1f msg/s  p50 %7.2f ms  p99 %7.2f ms  GenerateDataKey %5llu  Encrypt %5llu  Decrypt %5llu"
+        "  throttled %4llu  failed %4llu\n",
+        phase,
+        latencies.size() / seconds,
+        Percentile(latencies, 50),
+        Percentile(latencies, 99),
+        (unsigned long long)(after.generate_data_key - before.generate_data_key),
+        (unsigned long long)(after.encrypt - before.encrypt),
+        (unsigned long long)(after.decrypt - before.decrypt),
+        (unsigned long long)(after.throttled - before.throttled),
+        (unsigned long long)(after.failed - before.failed));
+}
+
+void Run(struct aws_allocator *alloc, const LocalKms &kms, const Scenario &scenario, size_t threads, size_t messages) {
+    printf("%s\n", scenario.name);
+
+    std::vector<uint8_t> plaintext(MESSAGE_SIZE, 'x');
+    std::vector<std::vector<std::vector<uint8_t>>> ciphertexts(threads, std::vector<std::vector<uint8_t>>(messages));
+
+    RunPhase("encrypt", kms, threads, messages, [&](size_t t, size_t i) {
+        struct aws_cryptosdk_session *session =
+            aws_cryptosdk_session_new_from_cmm_2(alloc, AWS_CRYPTOSDK_ENCRYPT, scenario.encrypt_cmm);
+        if (!session) error("session constructor");
+        if (aws_cryptosdk_session_set_message_size(session, plaintext.size())) error("set_message_size");
+        ciphertexts[t][i] = process(session, plaintext);
+        aws_cryptosdk_session_destroy(session);
+    });
+
+    RunPhase("decrypt", kms, threads, messages, [&](size_t t, size_t i) {
+        struct aws_cryptosdk_session *session =
+            aws_cryptosdk_session_new_from_cmm_2(alloc, AWS_CRYPTOSDK_DECRYPT, scenario.decrypt_cmm);
+        if (!session) error("session constructor");
+        if (process(session, ciphertexts[t][i]) != plaintext) {
+            std::cerr << "Decrypted message does not match" << std::endl;
+            abort();
+        }
+        aws_cryptosdk_session_destroy(session);
+    });
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    size_t messages = argc > 1 ? strtoul(argv[1], NULL, 10) : 200;
+    size_t threads  = argc > 2 ? strtoul(argv[2], NULL, 10) : 8;
+    if (!messages || !threads) {
+        std::cerr << "Usage: " << argv[0] << " [messages per thread] [threads]" << std::endl;
+        return 1;
+    }
+
+    aws_cryptosdk_load_error_strings();
+    Aws::SDKOptions options;
+    Aws::InitAPI(options);
+    {
+        struct aws_allocator *alloc = aws_default_allocator();
+        std::shared_ptr<LocalKms> kms = LocalKms::Create();
+
+        // A nearby region, two distant ones, and one whose latency has a long tail
+        LocalKmsRegionProfile near_region, far_region, tail_region;
+        near_region.median_latency = std::chrono::milliseconds(5);
+        near_region.latency_sigma  = 0.3;
+        far_region.median_latency  = std::chrono::milliseconds(70);
+        far_region.latency_sigma   = 0.3;
+        tail_region.median_latency = std::chrono::milliseconds(5);
+        tail_region.latency_sigma  = 1.2;
+        kms->SetRegionProfile("us-west-2", near_region);
+        kms->SetRegionProfile("eu-west-1", far_region);
+        kms->SetRegionProfile("ap-southeast-2", far_region);
+        kms->SetRegionProfile("us-east-1", tail_region);
+
+        Aws::String near_key = kms->CreateKey("us-west-2");
+        Aws::String far_key  = kms->CreateKey("eu-west-1");
+        Aws::String far_key2 = kms->CreateKey("ap-southeast-2");
+        Aws::String tail_key = kms->CreateKey("us-east-1");
+
+        std::shared_ptr<KmsKeyring::ClientSupplier> supplier = kms->GetClientSupplier();
+        Aws::Utils::Threading::PooledThreadExecutor pool(8);
+        std::vector<Scenario> scenarios;
+
+        struct aws_cryptosdk_cmm *single =
+            UnsignedCmm(alloc, KmsKeyring::Builder().WithClientSupplier(supplier).Build(near_key));
+        aws_cryptosdk_cmm_retain(single);  // for the caching CMM scenario below
+        scenarios.push_back(Symmetric("KMS keyring, one key", single));
+
+        scenarios.push_back(Symmetric(
+            "KMS keyring, three keys in three regions",
+            UnsignedCmm(
+                alloc, KmsKeyring::Builder().WithClientSupplier(supplier).Build(near_key, { far_key, far_key2 }))));
+
+        scenarios.push_back(Symmetric(
+            "KMS keyring, three keys in three regions, concurrent KMS calls",
+            UnsignedCmm(
+                alloc,
+                KmsKeyring::Builder()
+                    .WithClientSupplier(supplier)
+                    .WithConcurrentKmsCalls()
+                    .Build(near_key, { far_key, far_key2 }))));
+
+        struct aws_cryptosdk_keyring *generator = KmsKeyring::Builder().WithClientSupplier(supplier).Build(near_key);
+        struct aws_cryptosdk_keyring *multi     = aws_cryptosdk_multi_keyring_new(alloc, generator);
+        if (!generator || !multi) error("multi-keyring constructor");
+        aws_cryptosdk_keyring_release(generator);
+        for (const Aws::String &key : { far_key, far_key2 }) {
+            struct aws_cryptosdk_keyring *child = KmsKeyring::Builder().WithClientSupplier(supplier).Build(key);
+            if (!child || aws_cryptosdk_multi_keyring_add_child(multi, child)) error("multi-keyring add child");
+            aws_cryptosdk_keyring_release(child);
+        }
+        if (aws_cryptosdk_multi_keyring_set_executor(multi, PoolExecutor, &pool) ||
+            aws_cryptosdk_multi_keyring_set_concurrent_encrypt(multi, true)) {
+            error("multi-keyring set concurrent");
+        }
+        scenarios.push_back(
+            Symmetric("Multi-keyring of three KMS keyrings, concurrent encrypt", UnsignedCmm(alloc, multi)));
+
+        // EDKs under the distant key come first, so discovery has to learn to try the nearby region first
+        Scenario discovery = {
+            "Discovery KMS keyring, distant EDK first",
+            UnsignedCmm(alloc, KmsKeyring::Builder().WithClientSupplier(supplier).Build(far_key, { near_key })),
+            UnsignedCmm(alloc, KmsKeyring::Builder().WithClientSupplier(supplier).BuildDiscovery())
+        };
+        scenarios.push_back(discovery);
+
+        struct aws_cryptosdk_cmm *tail_first =
+            UnsignedCmm(alloc, KmsKeyring::Builder().WithClientSupplier(supplier).Build(tail_key, { near_key }));
+        Scenario unhedged = {
+            "KMS keyring, long-tailed region first",
+            tail_first,
+            UnsignedCmm(alloc, KmsKeyring::Builder().WithClientSupplier(supplier).Build(tail_key, { near_key }))
+        };
+        scenarios.push_back(unhedged);
+        aws_cryptosdk_cmm_retain(tail_first);
+        Scenario hedged = {
+            "KMS keyring, long-tailed region first, hedged decrypt",
+            tail_first,
+            UnsignedCmm(
+                alloc,
+                KmsKeyring::Builder()
+                    .WithClientSupplier(supplier)
+                    .WithHedgedDecrypt(95, std::chrono::milliseconds(20))
+                    .Build(tail_key, { near_key }))
+        };
+        scenarios.push_back(hedged);
+
+        struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 100);
+        if (!cache) error("local cache constructor");
+        struct aws_cryptosdk_cmm *caching =
+            aws_cryptosdk_caching_cmm_new_from_cmm(alloc, cache, single, NULL, 60, AWS_TIMESTAMP_SECS);
+        if (!caching || aws_cryptosdk_caching_cmm_set_limit_messages(caching, 100)) error("caching CMM constructor");
+        aws_cryptosdk_materials_cache_release(cache);
+        aws_cryptosdk_cmm_release(single);
+        scenarios.push_back(Symmetric("Caching CMM over KMS keyring, one key, 100 messages per data key", caching));
+
+        printf("%zu threads, %zu messages of %zu bytes per thread\n\n", threads, messages, MESSAGE_SIZE);
+        for (const Scenario &scenario : scenarios) {
+            Run(alloc, *kms, scenario, threads, messages);
+            aws_cryptosdk_cmm_release(scenario.encrypt_cmm);
+            aws_cryptosdk_cmm_release(scenario.decrypt_cmm);
+        }
+    }
+    Aws::ShutdownAPI(options);
+
+    return 0;
+}
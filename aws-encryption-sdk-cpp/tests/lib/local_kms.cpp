@@ -0,0 +1,415 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "local_kms.h"
+
+#include <openssl/evp.h>
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+namespace Aws {
+namespace Cryptosdk {
+namespace Testing {
+using Aws::KMS::KMSErrors;
+using Aws::Utils::ByteBuffer;
+
+static const char *LOCAL_KMS_CLASS_TAG = "LocalKms";
+
+/*
+ * Ciphertext blob: version (1 byte), key ARN length (2 bytes, big-endian), key ARN, IV, tag, ciphertext.
+ * The AAD is everything before the IV followed by the serialized encryption context.
+ */
+static const uint8_t BLOB_VERSION   = 0x01;
+static const size_t MASTER_KEY_LEN  = 32;
+static const size_t IV_LEN          = 12;
+static const size_t TAG_LEN         = 16;
+static const int MAX_DATA_KEY_BYTES = 1024;
+
+static Aws::KMS::KMSError KmsError(KMSErrors type, const char *name, const char *message, bool retryable = false) {
+    return Aws::KMS::KMSError(Aws::Client::AWSError<KMSErrors>(type, name, message, retryable));
+}
+
+static void AppendLengthPrefixed(Aws::String &out, const Aws::String &value) {
+    out.push_back((char)((value.size() >> 8) & 0xFF));
+    out.push_back((char)(value.size() & 0xFF));
+    out.append(value);
+}
+
+static Aws::String BlobHeader(const Aws::String &key_arn) {
+    Aws::String header(1, (char)BLOB_VERSION);
+    AppendLengthPrefixed(header, key_arn);
+    return header;
+}
+
+static Aws::String Aad(const Aws::String &blob_header, const Aws::Map<Aws::String, Aws::String> &enc_ctx) {
+    // Aws::Map is ordered, so equal encryption contexts always serialize the same way
+    Aws::String aad = blob_header;
+    for (auto &entry : enc_ctx) {
+        AppendLengthPrefixed(aad, entry.first);
+        AppendLengthPrefixed(aad, entry.second);
+    }
+    return aad;
+}
+
+/**
+ * Extracts the region from a key ARN of the form arn:aws:kms:<region>:<account>:key/<id>, or returns an empty
+ * string.
+ */
+static Aws::String RegionOfArn(const Aws::String &key_arn) {
+    size_t start = 0;
+    for (int i = 0; i < 3; i++) {
+        start = key_arn.find(':', start);
+        if (start == Aws::String::npos) return "";
+        start++;
+    }
+    size_t end = key_arn.find(':', start);
+    if (end == Aws::String::npos) return "";
+    return key_arn.substr(start, end - start);
+}
+
+static bool SealAesGcm(
+    const ByteBuffer &key,
+    const ByteBuffer &iv,
+    const Aws::String &aad,
+    const ByteBuffer &plaintext,
+    ByteBuffer &ciphertext,
+    uint8_t *tag) {
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) return false;
+
+    int len = 0;
+    bool ok = EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, key.GetUnderlyingData(), iv.GetUnderlyingData()) &&
+              (aad.empty() ||
+               EVP_EncryptUpdate(ctx, NULL, &len, (const uint8_t *)aad.data(), (int)aad.size())) &&
+              (plaintext.GetLength() == 0 ||
+               EVP_EncryptUpdate(
+                   ctx, ciphertext.GetUnderlyingData(), &len, plaintext.GetUnderlyingData(),
+                   (int)plaintext.GetLength())) &&
+              EVP_EncryptFinal_ex(ctx, ciphertext.GetUnderlyingData() + plaintext.GetLength(), &len) &&
+              EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, (int)TAG_LEN, tag);
+
+    EVP_CIPHER_CTX_free(ctx);
+    return ok;
+}
+
+static bool OpenAesGcm(
+    const ByteBuffer &key,
+    const uint8_t *iv,
+    const Aws::String &aad,
+    const uint8_t *tag,
+    const uint8_t *ciphertext,
+    size_t ciphertext_len,
+    ByteBuffer &plaintext) {
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) return false;
+
+    int len = 0;
+    bool ok = EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, key.GetUnderlyingData(), iv) &&
+              (aad.empty() ||
+               EVP_DecryptUpdate(ctx, NULL, &len, (const uint8_t *)aad.data(), (int)aad.size())) &&
+              (ciphertext_len == 0 ||
+               EVP_DecryptUpdate(ctx, plaintext.GetUnderlyingData(), &len, ciphertext, (int)ciphertext_len)) &&
+              EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, (int)TAG_LEN, const_cast<uint8_t *>(tag)) &&
+              EVP_DecryptFinal_ex(ctx, plaintext.GetUnderlyingData() + ciphertext_len, &len) > 0;
+
+    EVP_CIPHER_CTX_free(ctx);
+    return ok;
+}
+
+/**
+ * Serves one client per region, all of them sending their calls to the same LocalKms.
+ */
+class LocalKmsClientSupplier : public KmsKeyring::ClientSupplier {
+   public:
+    explicit LocalKmsClientSupplier(const std::shared_ptr<LocalKms> &kms) : kms(kms) {}
+
+    std::shared_ptr<KMS::KMSClient> GetClient(const Aws::String &region, std::function<void()> &report_success) {
+        report_success = [] {};  // no-op lambda
+        std::lock_guard<std::mutex> guard(lock);
+        std::shared_ptr<KMS::KMSClient> &client = clients[region];
+        if (!client) client = kms->GetClient(region);
+        return client;
+    }
+
+   private:
+    std::shared_ptr<LocalKms> kms;
+    std::mutex lock;
+    Aws::Map<Aws::String, std::shared_ptr<KMS::KMSClient>> clients;
+};
+
+std::shared_ptr<LocalKms> LocalKms::Create(uint64_t seed) {
+    return Aws::MakeShared<LocalKms>(LOCAL_KMS_CLASS_TAG, seed);
+}
+
+ByteBuffer LocalKms::RandomBytes(size_t len) {
+    ByteBuffer bytes(len);
+    for (size_t i = 0; i < len; i += sizeof(uint64_t)) {
+        uint64_t word = rng();
+        for (size_t j = i; j < len && j < i + sizeof(uint64_t); j++) {
+            bytes[j] = (unsigned char)(word & 0xFF);
+            word >>= 8;
+        }
+    }
+    return bytes;
+}
+
+Aws::String LocalKms::CreateKey(const Aws::String &region, const Aws::String &account_id) {
+    std::lock_guard<std::mutex> guard(lock);
+
+    // A key ID shaped like a UUID, e.g. 1234abcd-12ab-34cd-56ef-1234567890ab
+    static const char *hex = "0123456789abcdef";
+    ByteBuffer id_bytes    = RandomBytes(16);
+    Aws::String key_id;
+    for (size_t i = 0; i < id_bytes.GetLength(); i++) {
+        if (i == 4 || i == 6 || i == 8 || i == 10) key_id.push_back('-');
+        key_id.push_back(hex[id_bytes[i] >> 4]);
+        key_id.push_back(hex[id_bytes[i] & 0xF]);
+    }
+
+    Aws::String key_arn = "arn:aws:kms:" + region + ":" + account_id + ":key/" + key_id;
+    MasterKey &master_key = keys[key_arn];
+    master_key.region     = region;
+    master_key.key        = RandomBytes(MASTER_KEY_LEN);
+    return key_arn;
+}
+
+void LocalKms::SetRegionProfile(const Aws::String &region, const LocalKmsRegionProfile &profile) {
+    std::lock_guard<std::mutex> guard(lock);
+    RegionState &state = regions[region];
+    state.profile      = profile;
+    state.tokens       = profile.max_calls_per_second;
+    state.refilled     = std::chrono::steady_clock::now();
+}
+
+std::shared_ptr<Aws::KMS::KMSClient> LocalKms::GetClient(const Aws::String &region) {
+    return Aws::MakeShared<LocalKmsClient>(LOCAL_KMS_CLASS_TAG, shared_from_this(), region);
+}
+
+std::shared_ptr<KmsKeyring::ClientSupplier> LocalKms::GetClientSupplier() {
+    return Aws::MakeShared<LocalKmsClientSupplier>(LOCAL_KMS_CLASS_TAG, shared_from_this());
+}
+
+bool LocalKms::Admit(const Aws::String &region, Aws::KMS::KMSError &error) {
+    std::chrono::microseconds latency(0);
+    bool throttled = false;
+    bool failed    = false;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = regions.find(region);
+        if (it == regions.end()) return true;
+        RegionState &state                   = it->second;
+        const LocalKmsRegionProfile &profile = state.profile;
+
+        if (profile.max_calls_per_second > 0) {
+            auto now = std::chrono::steady_clock::now();
+            double elapsed = std::chrono::duration<double>(now - state.refilled).count();
+            state.tokens =
+                std::min(profile.max_calls_per_second, state.tokens + elapsed * profile.max_calls_per_second);
+            state.refilled = now;
+            if (state.tokens < 1) {
+                throttled = true;
+            } else {
+                state.tokens -= 1;
+            }
+        }
+
+        double factor = 1;
+        if (profile.latency_sigma > 0) {
+            std::normal_distribution<double> normal(0, profile.latency_sigma);
+            factor = std::exp(normal(rng));
+        }
+        latency = std::chrono::microseconds((int64_t)(profile.median_latency.count() * factor));
+
+        if (!throttled && profile.error_rate > 0) {
+            std::uniform_real_distribution<double> uniform(0, 1);
+            failed = uniform(rng) < profile.error_rate;
+        }
+    }
+
+    // Sleep outside the lock, so that calls in flight overlap as they would against the service
+    if (latency.count() > 0) std::this_thread::sleep_for(latency);
+
+    if (throttled) {
+        counters.throttled++;
+        error = KmsError(KMSErrors::THROTTLING, "ThrottlingException", "Rate exceeded", true);
+        return false;
+    }
+    if (failed) {
+        counters.failed++;
+        error = KmsError(KMSErrors::K_M_S_INTERNAL, "KMSInternalException", "Injected failure", true);
+        return false;
+    }
+    return true;
+}
+
+bool LocalKms::Wrap(
+    const Aws::String &region,
+    const Aws::String &key_arn,
+    const ByteBuffer &plaintext,
+    const Aws::Map<Aws::String, Aws::String> &enc_ctx,
+    ByteBuffer &ciphertext,
+    Aws::KMS::KMSError &error) {
+    ByteBuffer key;
+    ByteBuffer iv;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = keys.find(key_arn);
+        if (it == keys.end() || it->second.region != region) {
+            error = KmsError(KMSErrors::NOT_FOUND, "NotFoundException", "Key does not exist in this region");
+            return false;
+        }
+        key = it->second.key;
+        iv  = RandomBytes(IV_LEN);
+    }
+
+    Aws::String header = BlobHeader(key_arn);
+    ByteBuffer sealed(plaintext.GetLength() + 1);  // room for EVP_EncryptFinal_ex even with empty plaintext
+    uint8_t tag[TAG_LEN];
+    if (!SealAesGcm(key, iv, Aad(header, enc_ctx), plaintext, sealed, tag)) {
+        error = KmsError(KMSErrors::K_M_S_INTERNAL, "KMSInternalException", "AES-GCM encryption failed");
+        return false;
+    }
+
+    ciphertext = ByteBuffer(header.size() + IV_LEN + TAG_LEN + plaintext.GetLength());
+    uint8_t *out = ciphertext.GetUnderlyingData();
+    std::copy(header.begin(), header.end(), out);
+    out += header.size();
+    out = std::copy(iv.GetUnderlyingData(), iv.GetUnderlyingData() + IV_LEN, out);
+    out = std::copy(tag, tag + TAG_LEN, out);
+    std::copy(sealed.GetUnderlyingData(), sealed.GetUnderlyingData() + plaintext.GetLength(), out);
+    return true;
+}
+
+Aws::KMS::Model::GenerateDataKeyOutcome LocalKms::GenerateDataKey(
+    const Aws::String &region, const Aws::KMS::Model::GenerateDataKeyRequest &request) {
+    counters.generate_data_key++;
+    Aws::KMS::KMSError error;
+    if (!Admit(region, error)) return Aws::KMS::Model::GenerateDataKeyOutcome(error);
+
+    int len = 32;
+    if (request.NumberOfBytesHasBeenSet()) {
+        len = request.GetNumberOfBytes();
+    } else if (request.KeySpecHasBeenSet() && request.GetKeySpec() == Aws::KMS::Model::DataKeySpec::AES_128) {
+        len = 16;
+    }
+    if (len < 1 || len > MAX_DATA_KEY_BYTES) {
+        return Aws::KMS::Model::GenerateDataKeyOutcome(
+            KmsError(KMSErrors::VALIDATION, "ValidationException", "NumberOfBytes is out of range"));
+    }
+
+    ByteBuffer plaintext;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        plaintext = RandomBytes(len);
+    }
+    ByteBuffer ciphertext;
+    if (!Wrap(region, request.GetKeyId(), plaintext, request.GetEncryptionContext(), ciphertext, error)) {
+        return Aws::KMS::Model::GenerateDataKeyOutcome(error);
+    }
+
+    Aws::KMS::Model::GenerateDataKeyResult result;
+    result.SetKeyId(request.GetKeyId());
+    result.SetPlaintext(plaintext);
+    result.SetCiphertextBlob(ciphertext);
+    return Aws::KMS::Model::GenerateDataKeyOutcome(result);
+}
+
+Aws::KMS::Model::EncryptOutcome LocalKms::Encrypt(
+    const Aws::String &region, const Aws::KMS::Model::EncryptRequest &request) {
+    counters.encrypt++;
+    Aws::KMS::KMSError error;
+    if (!Admit(region, error)) return Aws::KMS::Model::EncryptOutcome(error);
+
+    ByteBuffer ciphertext;
+    if (!Wrap(region, request.GetKeyId(), request.GetPlaintext(), request.GetEncryptionContext(), ciphertext, error)) {
+        return Aws::KMS::Model::EncryptOutcome(error);
+    }
+
+    Aws::KMS::Model::EncryptResult result;
+    result.SetKeyId(request.GetKeyId());
+    result.SetCiphertextBlob(ciphertext);
+    return Aws::KMS::Model::EncryptOutcome(result);
+}
+
+Aws::KMS::Model::DecryptOutcome LocalKms::Decrypt(
+    const Aws::String &region, const Aws::KMS::Model::DecryptRequest &request) {
+    counters.decrypt++;
+    Aws::KMS::KMSError error;
+    if (!Admit(region, error)) return Aws::KMS::Model::DecryptOutcome(error);
+
+    const ByteBuffer &blob = request.GetCiphertextBlob();
+    const uint8_t *data    = blob.GetUnderlyingData();
+    size_t blob_len        = blob.GetLength();
+    size_t arn_len         = blob_len >= 3 ? ((size_t)data[1] << 8) | data[2] : 0;
+    if (blob_len < 3 || data[0] != BLOB_VERSION || blob_len < 3 + arn_len + IV_LEN + TAG_LEN) {
+        return Aws::KMS::Model::DecryptOutcome(
+            KmsError(KMSErrors::INVALID_CIPHERTEXT, "InvalidCiphertextException", "Malformed ciphertext"));
+    }
+    Aws::String key_arn((const char *)data + 3, arn_len);
+
+    if (request.KeyIdHasBeenSet() && request.GetKeyId() != key_arn) {
+        if (RegionOfArn(request.GetKeyId()) != region) {
+            return Aws::KMS::Model::DecryptOutcome(
+                KmsError(KMSErrors::NOT_FOUND, "NotFoundException", "Key does not exist in this region"));
+        }
+        return Aws::KMS::Model::DecryptOutcome(KmsError(
+            KMSErrors::INCORRECT_KEY, "IncorrectKeyException", "Ciphertext was not encrypted under this key"));
+    }
+
+    ByteBuffer key;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = keys.find(key_arn);
+        if (it == keys.end() || it->second.region != region) {
+            return Aws::KMS::Model::DecryptOutcome(
+                KmsError(KMSErrors::NOT_FOUND, "NotFoundException", "Key does not exist in this region"));
+        }
+        key = it->second.key;
+    }
+
+    const uint8_t *iv     = data + 3 + arn_len;
+    const uint8_t *tag    = iv + IV_LEN;
+    const uint8_t *sealed = tag + TAG_LEN;
+    size_t sealed_len     = blob_len - (sealed - data);
+    Aws::String aad       = Aad(BlobHeader(key_arn), request.GetEncryptionContext());
+    ByteBuffer plaintext(sealed_len + 1);  // room for EVP_DecryptFinal_ex even with empty plaintext
+    if (!OpenAesGcm(key, iv, aad, tag, sealed, sealed_len, plaintext)) {
+        return Aws::KMS::Model::DecryptOutcome(KmsError(
+            KMSErrors::INVALID_CIPHERTEXT, "InvalidCiphertextException", "Ciphertext or encryption context is wrong"));
+    }
+
+    Aws::KMS::Model::DecryptResult result;
+    result.SetKeyId(key_arn);
+    result.SetPlaintext(ByteBuffer(plaintext.GetUnderlyingData(), sealed_len));
+    return Aws::KMS::Model::DecryptOutcome(result);
+}
+
+Aws::KMS::Model::GenerateDataKeyOutcome LocalKmsClient::GenerateDataKey(
+    const Aws::KMS::Model::GenerateDataKeyRequest &request) const {
+    return kms->GenerateDataKey(region, request);
+}
+
+Aws::KMS::Model::EncryptOutcome LocalKmsClient::Encrypt(const Aws::KMS::Model::EncryptRequest &request) const {
+    return kms->Encrypt(region, request);
+}
+
+Aws::KMS::Model::DecryptOutcome LocalKmsClient::Decrypt(const Aws::KMS::Model::DecryptRequest &request) const {
+    return kms->Decrypt(region, request);
+}
+
+}  // namespace Testing
+}  // namespace Cryptosdk
+}  // namespace Aws
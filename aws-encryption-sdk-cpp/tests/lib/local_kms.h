@@ -0,0 +1,188 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AWS_ENCRYPTION_SDK_LOCAL_KMS_H
+#define AWS_ENCRYPTION_SDK_LOCAL_KMS_H
+
+#include <aws/core/utils/Array.h>
+#include <aws/core/utils/memory/stl/AWSMap.h>
+#include <aws/core/utils/memory/stl/AWSString.h>
+#include <aws/cryptosdk/cpp/kms_keyring.h>
+#include <aws/kms/KMSClient.h>
+#include <aws/kms/model/DecryptRequest.h>
+#include <aws/kms/model/DecryptResult.h>
+#include <aws/kms/model/EncryptRequest.h>
+#include <aws/kms/model/EncryptResult.h>
+#include <aws/kms/model/GenerateDataKeyRequest.h>
+#include <aws/kms/model/GenerateDataKeyResult.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+
+#include "exports.h"
+
+namespace Aws {
+namespace Cryptosdk {
+namespace Testing {
+
+/**
+ * How LocalKms behaves in one region.
+ */
+struct TESTLIB_CPP_API LocalKmsRegionProfile {
+    /**
+     * Every call takes a latency drawn from a log-normal distribution with this median.
+     */
+    std::chrono::microseconds median_latency = std::chrono::microseconds(0);
+
+    /**
+     * Standard deviation of the logarithm of the latency. With 0 every call takes exactly median_latency;
+     * with 0.5 the 99th percentile is about 3.2 times the median.
+     */
+    double latency_sigma = 0;
+
+    /**
+     * Probability that a call fails with a (retryable) KMSInternalException.
+     */
+    double error_rate = 0;
+
+    /**
+     * Calls per second beyond which calls fail with a ThrottlingException, or 0 for no limit. Up to one
+     * second's worth of calls may arrive at once.
+     */
+    double max_calls_per_second = 0;
+};
+
+/**
+ * An in-process stand-in for the KMS service, for benchmarks and tests that need KMS to behave like KMS,
+ * rather than to return the canned answers of KmsClientMock.
+ *
+ * Master keys are AES-256 keys held in memory. GenerateDataKey, Encrypt and Decrypt wrap and unwrap data
+ * keys with AES-GCM under them, binding the encryption context as AAD, and fail as KMS does on a wrong key,
+ * region or encryption context. Each region can be given a latency distribution, an error rate and a
+ * throttling limit; the latency is spent sleeping in the calling thread, like a blocking HTTP request.
+ *
+ * This is not secure: master keys, data keys and IVs all come from a seeded pseudo-random generator, so
+ * that runs are repeatable.
+ */
+class TESTLIB_CPP_API LocalKms : public std::enable_shared_from_this<LocalKms> {
+   public:
+    /**
+     * Numbers of calls made to this stand-in, including the failed ones.
+     */
+    struct Counters {
+        std::atomic<uint64_t> generate_data_key{ 0 };
+        std::atomic<uint64_t> encrypt{ 0 };
+        std::atomic<uint64_t> decrypt{ 0 };
+        /** Calls that failed with a ThrottlingException */
+        std::atomic<uint64_t> throttled{ 0 };
+        /** Calls that failed with an injected KMSInternalException */
+        std::atomic<uint64_t> failed{ 0 };
+    };
+
+    static std::shared_ptr<LocalKms> Create(uint64_t seed = 0);
+
+    /**
+     * Creates a new master key in region, owned by account_id, and returns its key ARN.
+     */
+    Aws::String CreateKey(const Aws::String &region, const Aws::String &account_id = "111122223333");
+
+    /**
+     * Sets the behavior of region. Regions without a profile answer at once and never fail.
+     */
+    void SetRegionProfile(const Aws::String &region, const LocalKmsRegionProfile &profile);
+
+    /**
+     * Returns a new KMS client which sends its calls to this stand-in, as a client configured for region.
+     * Failed calls are not retried.
+     */
+    std::shared_ptr<Aws::KMS::KMSClient> GetClient(const Aws::String &region);
+
+    /**
+     * Returns a new client supplier which serves clients of this stand-in for every region, creating one
+     * client per region on first use.
+     */
+    std::shared_ptr<KmsKeyring::ClientSupplier> GetClientSupplier();
+
+    Aws::KMS::Model::GenerateDataKeyOutcome GenerateDataKey(
+        const Aws::String &region, const Aws::KMS::Model::GenerateDataKeyRequest &request);
+    Aws::KMS::Model::EncryptOutcome Encrypt(const Aws::String &region, const Aws::KMS::Model::EncryptRequest &request);
+    Aws::KMS::Model::DecryptOutcome Decrypt(const Aws::String &region, const Aws::KMS::Model::DecryptRequest &request);
+
+    Counters counters;
+
+    explicit LocalKms(uint64_t seed) : rng(seed) {}
+
+   private:
+    struct MasterKey {
+        Aws::String region;
+        Aws::Utils::ByteBuffer key;
+    };
+
+    struct RegionState {
+        LocalKmsRegionProfile profile;
+        /* Token bucket for max_calls_per_second */
+        double tokens;
+        std::chrono::steady_clock::time_point refilled;
+    };
+
+    /**
+     * Spends the latency of a call to region, and returns false and sets error if the call is throttled
+     * or fails.
+     */
+    bool Admit(const Aws::String &region, Aws::KMS::KMSError &error);
+
+    /* Must be called with lock held */
+    Aws::Utils::ByteBuffer RandomBytes(size_t len);
+
+    /**
+     * Wraps plaintext under the master key key_arn, or returns false and sets error.
+     */
+    bool Wrap(
+        const Aws::String &region,
+        const Aws::String &key_arn,
+        const Aws::Utils::ByteBuffer &plaintext,
+        const Aws::Map<Aws::String, Aws::String> &enc_ctx,
+        Aws::Utils::ByteBuffer &ciphertext,
+        Aws::KMS::KMSError &error);
+
+    std::mutex lock;
+    std::mt19937_64 rng;
+    Aws::Map<Aws::String, MasterKey> keys;
+    Aws::Map<Aws::String, RegionState> regions;
+};
+
+/**
+ * A KMS client that sends its calls to a LocalKms.
+ */
+class TESTLIB_CPP_API LocalKmsClient : public Aws::KMS::KMSClient {
+   public:
+    LocalKmsClient(const std::shared_ptr<LocalKms> &kms, const Aws::String &region) : kms(kms), region(region) {}
+
+    Aws::KMS::Model::GenerateDataKeyOutcome GenerateDataKey(
+        const Aws::KMS::Model::GenerateDataKeyRequest &request) const;
+    Aws::KMS::Model::EncryptOutcome Encrypt(const Aws::KMS::Model::EncryptRequest &request) const;
+    Aws::KMS::Model::DecryptOutcome Decrypt(const Aws::KMS::Model::DecryptRequest &request) const;
+
+   private:
+    std::shared_ptr<LocalKms> kms;
+    Aws::String region;
+};
+
+}  // namespace Testing
+}  // namespace Cryptosdk
+}  // namespace Aws
+
+#endif  // AWS_ENCRYPTION_SDK_LOCAL_KMS_H
@@ -14,12 +14,20 @@
  */
 
 #include <aws/common/byte_buf.h>
+#include <aws/core/utils/StringUtils.h>
 #include <aws/cryptosdk/enc_ctx.h>
 #include <aws/cryptosdk/private/cpputils.h>
 #include <aws/cryptosdk/private/kms_keyring.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+#include <thread>
 
 #include "edks_utils.h"
 #include "kms_client_mock.h"
+#include "local_kms.h"
 #include "testutil.h"
 
 using namespace Aws::Cryptosdk;
@@ -1853,6 +1861,915 @@ int decryptMultiAccountDiscoveryFilter_someAuthorizedEdks_decryptsSecondIfFirstC
     return 0;
 }
 
+/**
+ * With concurrent KMS calls, the Encrypt calls go through EncryptCallable. Only one call is made here,
+ * as the mock expects its calls in a fixed order.
+ */
+int concurrentKmsCalls_encrypt_returnSuccess() {
+    EncryptTestValues ev;
+    auto keyring = static_cast<KmsKeyringImpl *>(ev.kms_keyring);
+    TEST_ASSERT(!keyring->concurrent_kms_calls);
+    keyring->concurrent_kms_calls = true;
+
+    ev.kms_client_mock->ExpectEncryptAccumulator(ev.GetRequest(), ev.GetResult());
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_encrypt(
+        ev.kms_keyring,
+        ev.allocator,
+        &ev.unencrypted_data_key,
+        &ev.keyring_trace,
+        &ev.edks,
+        &ev.encryption_context,
+        ev.alg));
+
+    TEST_ASSERT_SUCCESS(t_encrypt_with_single_key_success(ev, false));
+    TEST_ASSERT(!ev.kms_client_mock->ExpectingOtherCalls());
+    return 0;
+}
+
+int concurrentKmsCalls_decrypt_returnSuccess() {
+    DecryptValues dv;
+    static_cast<KmsKeyringImpl *>(dv.kms_keyring)->concurrent_kms_calls = true;
+
+    dv.kms_client_mock->ExpectDecryptAccumulator(dv.GetRequest(), dv.GetResult());
+    TEST_ASSERT_SUCCESS(dv.AppendKeyToEdks(dv.key_id));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_decrypt(
+        dv.kms_keyring,
+        dv.allocator,
+        &dv.unencrypted_data_key,
+        &dv.keyring_trace,
+        &dv.edks.encrypted_data_keys,
+        &dv.encryption_context,
+        dv.alg));
+    TEST_ASSERT_SUCCESS(t_decrypt_success(dv));
+    TEST_ASSERT(!dv.kms_client_mock->ExpectingOtherCalls());
+    return 0;
+}
+
+int concurrentKmsCalls_decryptFails_returnSuccessWithoutKey() {
+    DecryptValues dv;
+    static_cast<KmsKeyringImpl *>(dv.kms_keyring)->concurrent_kms_calls = true;
+
+    dv.kms_client_mock->ExpectDecryptAccumulator(dv.GetRequest(), dv.GetErrorOutcome("injected failure"));
+    TEST_ASSERT_SUCCESS(dv.AppendKeyToEdks(dv.key_id));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_decrypt(
+        dv.kms_keyring,
+        dv.allocator,
+        &dv.unencrypted_data_key,
+        &dv.keyring_trace,
+        &dv.edks.encrypted_data_keys,
+        &dv.encryption_context,
+        dv.alg));
+    TEST_ASSERT_ADDR_NULL(dv.unencrypted_data_key.buffer);
+    TEST_ASSERT_INT_EQ(0, aws_array_list_length(&dv.keyring_trace));
+    TEST_ASSERT(!dv.kms_client_mock->ExpectingOtherCalls());
+    return 0;
+}
+
+static void t_set_region_profile(
+    LocalKms &kms, const Aws::String &region, std::chrono::milliseconds latency, double error_rate = 0) {
+    LocalKmsRegionProfile profile;
+    profile.median_latency = latency;
+    profile.error_rate     = error_rate;
+    kms.SetRegionProfile(region, profile);
+}
+
+/**
+ * The regions whose calls have finished, in the order they finished.
+ */
+struct CompletionLog {
+    std::mutex lock;
+    std::condition_variable changed;
+    Aws::Vector<Aws::String> regions;
+    /* Calls to the held region only go to LocalKms once this many calls have finished */
+    size_t release_after = 0;
+
+    void Release(size_t after) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            release_after = after;
+        }
+        changed.notify_all();
+    }
+
+    void WaitForSize(size_t size) {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [this, size] { return regions.size() >= size; });
+    }
+
+    Aws::Vector<Aws::String> Snapshot() {
+        std::lock_guard<std::mutex> guard(lock);
+        return regions;
+    }
+};
+
+/**
+ * A LocalKms client which logs each call as it finishes, and holds back the calls to one region until
+ * CompletionLog::release_after other calls have finished. This orders calls without relying on latencies.
+ */
+class HoldingBackKmsClient : public LocalKmsClient {
+   public:
+    HoldingBackKmsClient(
+        const std::shared_ptr<LocalKms> &kms,
+        const Aws::String &region,
+        bool held,
+        const std::shared_ptr<CompletionLog> &log)
+        : LocalKmsClient(kms, region), region(region), held(held), log(log) {}
+
+    Model::EncryptOutcome Encrypt(const Model::EncryptRequest &request) const {
+        Hold();
+        auto outcome = LocalKmsClient::Encrypt(request);
+        Finish();
+        return outcome;
+    }
+
+    Model::DecryptOutcome Decrypt(const Model::DecryptRequest &request) const {
+        Hold();
+        auto outcome = LocalKmsClient::Decrypt(request);
+        Finish();
+        return outcome;
+    }
+
+   private:
+    void Hold() const {
+        if (!held) return;
+        std::unique_lock<std::mutex> guard(log->lock);
+        // Bounded, so that a keyring which calls KMS one key at a time fails the test instead of hanging it
+        log->changed.wait_for(
+            guard, std::chrono::seconds(10), [this] { return log->regions.size() >= log->release_after; });
+    }
+
+    void Finish() const {
+        {
+            std::lock_guard<std::mutex> guard(log->lock);
+            log->regions.push_back(region);
+        }
+        log->changed.notify_all();
+    }
+
+    Aws::String region;
+    bool held;
+    std::shared_ptr<CompletionLog> log;
+};
+
+class HoldingBackClientSupplier : public KmsKeyring::ClientSupplier {
+   public:
+    HoldingBackClientSupplier(
+        const std::shared_ptr<LocalKms> &kms, const Aws::String &held_region, const std::shared_ptr<CompletionLog> &log)
+        : kms(kms), held_region(held_region), log(log) {}
+
+    std::shared_ptr<Aws::KMS::KMSClient> GetClient(const Aws::String &region, std::function<void()> &report_success) {
+        report_success = [] {};  // no-op lambda
+        std::lock_guard<std::mutex> guard(lock);
+        std::shared_ptr<Aws::KMS::KMSClient> &client = clients[region];
+        if (!client) {
+            client = Aws::MakeShared<HoldingBackKmsClient>(CLASS_TAG, kms, region, region == held_region, log);
+        }
+        return client;
+    }
+
+   private:
+    std::shared_ptr<LocalKms> kms;
+    Aws::String held_region;
+    std::shared_ptr<CompletionLog> log;
+    std::mutex lock;
+    Aws::Map<Aws::String, std::shared_ptr<Aws::KMS::KMSClient>> clients;
+};
+
+static struct aws_cryptosdk_keyring *t_create_holding_back_keyring(
+    const std::shared_ptr<LocalKms> &kms,
+    const Aws::Vector<Aws::String> &key_ids,
+    const Aws::String &held_region,
+    const std::shared_ptr<CompletionLog> &log) {
+    Aws::Cryptosdk::KmsKeyring::Builder builder;
+    return builder.WithClientSupplier(Aws::MakeShared<HoldingBackClientSupplier>(CLASS_TAG, kms, held_region, log))
+        .WithConcurrentKmsCalls()
+        .Build(key_ids[0], Aws::Vector<Aws::String>(key_ids.begin() + 1, key_ids.end()));
+}
+
+/**
+ * The Encrypt call for the first key is held back until the calls for the other two have finished, which can
+ * only happen if they were sent without waiting for it. The EDKs and trace records must still come out in key
+ * order.
+ */
+int concurrentKmsCalls_encryptCallsFinishOutOfOrder_edksInKeyOrder() {
+    auto kms = LocalKms::Create();
+    auto log = Aws::MakeShared<CompletionLog>(CLASS_TAG);
+    Aws::Vector<Aws::String> regions{ "eu-west-1", "ap-southeast-2", "us-east-1" };
+    Aws::Vector<Aws::String> key_ids;
+    for (auto &region : regions) key_ids.push_back(kms->CreateKey(region));
+    log->release_after = 2;
+
+    EncryptTestValues ev;
+    TEST_ASSERT_SUCCESS(ev.SetEncryptionContext({ { "purpose", "test" } }));
+    struct aws_cryptosdk_keyring *keyring = t_create_holding_back_keyring(kms, key_ids, regions[0], log);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_encrypt(
+        keyring, ev.allocator, &ev.unencrypted_data_key, &ev.keyring_trace, &ev.edks, &ev.encryption_context, ev.alg));
+    TEST_ASSERT_INT_EQ(kms->counters.encrypt.load(), key_ids.size());
+    auto finished = log->Snapshot();
+    TEST_ASSERT_INT_EQ(finished.size(), key_ids.size());
+    TEST_ASSERT(finished.back() == regions[0]);
+
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&ev.edks), key_ids.size());
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&ev.keyring_trace), key_ids.size());
+    for (size_t idx = 0; idx < key_ids.size(); idx++) {
+        struct aws_cryptosdk_edk *edk;
+        TEST_ASSERT_SUCCESS(aws_array_list_get_at_ptr(&ev.edks, (void **)&edk, idx));
+        TEST_ASSERT(aws_byte_buf_eq_c_str(&edk->provider_info, key_ids[idx].c_str()));
+        TEST_ASSERT_SUCCESS(assert_keyring_trace_record(
+            &ev.keyring_trace,
+            idx,
+            "aws-kms",
+            key_ids[idx].c_str(),
+            AWS_CRYPTOSDK_WRAPPING_KEY_ENCRYPTED_DATA_KEY | AWS_CRYPTOSDK_WRAPPING_KEY_SIGNED_ENC_CTX));
+
+        // Each EDK holds the data key under its own key
+        auto outcome = kms->Decrypt(
+            regions[idx],
+            Model::DecryptRequest()
+                .WithKeyId(key_ids[idx])
+                .WithCiphertextBlob(aws_utils_byte_buffer_from_c_aws_byte_buf(&edk->ciphertext))
+                .WithEncryptionContext(ev.GetEncryptionContext()));
+        TEST_ASSERT(outcome.IsSuccess());
+        TEST_ASSERT(outcome.GetResult().GetPlaintext() == ev.pt_bb);
+    }
+
+    aws_cryptosdk_keyring_release(keyring);
+    return 0;
+}
+
+/**
+ * The Encrypt call for the second key fails, while the call for the first key is held back until the other two
+ * have finished. The keyring fails without adding any EDK, but only once every call it sent has finished.
+ */
+int concurrentKmsCalls_encryptOneOfSeveralKeysFails_returnFailAfterAllCallsFinish() {
+    auto kms = LocalKms::Create();
+    auto log = Aws::MakeShared<CompletionLog>(CLASS_TAG);
+    Aws::Vector<Aws::String> regions{ "eu-west-1", "us-east-1", "ap-southeast-2" };
+    Aws::Vector<Aws::String> key_ids;
+    for (auto &region : regions) key_ids.push_back(kms->CreateKey(region));
+    t_set_region_profile(*kms, regions[1], std::chrono::milliseconds(0), 1);
+    log->release_after = 2;
+
+    EncryptTestValues ev;
+    struct aws_cryptosdk_keyring *keyring = t_create_holding_back_keyring(kms, key_ids, regions[0], log);
+
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_KMS_FAILURE,
+        aws_cryptosdk_keyring_on_encrypt(
+            keyring,
+            ev.allocator,
+            &ev.unencrypted_data_key,
+            &ev.keyring_trace,
+            &ev.edks,
+            &ev.encryption_context,
+            ev.alg));
+    // The held call finished last, and before OnEncrypt returned
+    auto finished = log->Snapshot();
+    TEST_ASSERT_INT_EQ(finished.size(), key_ids.size());
+    TEST_ASSERT(finished.back() == regions[0]);
+    TEST_ASSERT_INT_EQ(kms->counters.encrypt.load(), key_ids.size());
+    TEST_ASSERT_INT_EQ(kms->counters.failed.load(), 1);
+
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&ev.edks), 0);
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&ev.keyring_trace), 0);
+    TEST_ASSERT(aws_byte_buf_eq_c_str(&ev.unencrypted_data_key, ev.pt));
+
+    aws_cryptosdk_keyring_release(keyring);
+    return 0;
+}
+
+/**
+ * Of three EDKs, the first is in a region whose calls are held back until the test releases them, the second in
+ * a region that always fails and the third in a healthy region. The third one wins without waiting for the first,
+ * whose outcome is then ignored.
+ */
+int concurrentKmsCalls_decryptSeveralEdksOneFails_firstSuccessWins() {
+    auto kms = LocalKms::Create();
+    auto log = Aws::MakeShared<CompletionLog>(CLASS_TAG);
+    Aws::Vector<Aws::String> regions{ "eu-west-1", "us-east-1", "ap-southeast-2" };
+    Aws::Vector<Aws::String> key_ids;
+
+    DecryptValues dv;
+    for (auto &region : regions) {
+        Aws::String key_id = kms->CreateKey(region);
+        auto outcome       = kms->Encrypt(region, Model::EncryptRequest().WithKeyId(key_id).WithPlaintext(dv.pt_bb));
+        TEST_ASSERT(outcome.IsSuccess());
+        TEST_ASSERT_SUCCESS(t_append_c_str_key_to_edks(
+            dv.allocator,
+            &dv.edks.encrypted_data_keys,
+            &outcome.GetResult().GetCiphertextBlob(),
+            key_id.c_str(),
+            dv.provider_id));
+        key_ids.push_back(key_id);
+    }
+    t_set_region_profile(*kms, regions[1], std::chrono::milliseconds(0), 1);
+    log->release_after = std::numeric_limits<size_t>::max();
+
+    struct aws_cryptosdk_keyring *keyring = t_create_holding_back_keyring(kms, key_ids, regions[0], log);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_decrypt(
+        keyring,
+        dv.allocator,
+        &dv.unencrypted_data_key,
+        &dv.keyring_trace,
+        &dv.edks.encrypted_data_keys,
+        &dv.encryption_context,
+        dv.alg));
+    auto finished = log->Snapshot();
+    TEST_ASSERT(std::find(finished.begin(), finished.end(), regions[0]) == finished.end());
+    TEST_ASSERT(aws_byte_buf_eq(&dv.unencrypted_data_key, &dv.pt_aws_byte));
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&dv.keyring_trace), 1);
+    TEST_ASSERT_SUCCESS(assert_keyring_trace_record(
+        &dv.keyring_trace,
+        0,
+        "aws-kms",
+        key_ids[2].c_str(),
+        AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY | AWS_CRYPTOSDK_WRAPPING_KEY_VERIFIED_ENC_CTX));
+
+    // The held call still finishes, but changes nothing. Releasing the keyring waits for it.
+    log->Release(0);
+    log->WaitForSize(key_ids.size());
+    aws_cryptosdk_keyring_release(keyring);
+    TEST_ASSERT_INT_EQ(kms->counters.decrypt.load(), key_ids.size());
+    TEST_ASSERT_INT_EQ(kms->counters.failed.load(), 1);
+    TEST_ASSERT(aws_byte_buf_eq(&dv.unencrypted_data_key, &dv.pt_aws_byte));
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&dv.keyring_trace), 1);
+    return 0;
+}
+
+int testBuilder_withConcurrentKmsCalls_setsOption() {
+    auto kms_client_mock = Aws::MakeShared<KmsClientMock>(CLASS_TAG);
+    Aws::Cryptosdk::KmsKeyring::Builder builder;
+    aws_cryptosdk_keyring *kr =
+        builder.WithKmsClient(kms_client_mock).WithConcurrentKmsCalls().Build(TestValues::key_id);
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    TEST_ASSERT(static_cast<KmsKeyringImpl *>(kr)->concurrent_kms_calls);
+    aws_cryptosdk_keyring_release(kr);
+    return 0;
+}
+
+int regionLatencyTracker_ranksByMovingAverageAndHealth() {
+    RegionLatencyTracker tracker;
+    TEST_ASSERT(tracker.Rank("us-fake-1") == std::numeric_limits<double>::max());
+
+    tracker.RecordSuccess("us-fake-1", std::chrono::milliseconds(100));
+    TEST_ASSERT(tracker.Rank("us-fake-1") == 100);
+    tracker.RecordSuccess("us-fake-1", std::chrono::milliseconds(200));
+    TEST_ASSERT(tracker.Rank("us-fake-1") == 120);
+    // Regions never called rank after measured healthy ones
+    TEST_ASSERT(tracker.Rank("us-fake-2") > tracker.Rank("us-fake-1"));
+
+    // Failed calls count towards the latency too
+    tracker.RecordFailure("us-fake-3", std::chrono::milliseconds(50));
+    TEST_ASSERT(tracker.Rank("us-fake-3") == 50);
+
+    // Errors only matter once the region is unhealthy
+    tracker.RecordFailure("us-fake-1", std::chrono::milliseconds(120));
+    TEST_ASSERT(tracker.Rank("us-fake-1") == 120);
+    for (int i = 0; i < 3; i++) tracker.RecordFailure("us-fake-1", std::chrono::milliseconds(120));
+    TEST_ASSERT(tracker.Rank("us-fake-1") == std::numeric_limits<double>::infinity());
+    TEST_ASSERT(tracker.Rank("us-fake-1") > tracker.Rank("us-fake-2"));
+
+    // and successes bring it back
+    for (int i = 0; i < 3; i++) tracker.RecordSuccess("us-fake-1", std::chrono::milliseconds(120));
+    TEST_ASSERT(tracker.Rank("us-fake-1") < std::numeric_limits<double>::infinity());
+
+    // AccessDenied is not an error, but a mostly denied region ranks with the unmeasured ones
+    for (int i = 0; i < 4; i++) tracker.RecordAccessDenied("us-fake-4", std::chrono::milliseconds(1));
+    TEST_ASSERT(tracker.Rank("us-fake-4") == std::numeric_limits<double>::max());
+    for (int i = 0; i < 3; i++) tracker.RecordSuccess("us-fake-4", std::chrono::milliseconds(1));
+    TEST_ASSERT(tracker.Rank("us-fake-4") == 1);
+    return 0;
+}
+
+/**
+ * A region demoted by failures gets no more calls, so only the passing of time can bring it back. Its error
+ * rate halves every half life; after four half lives of silence 0.59 has decayed below the 0.5 threshold.
+ */
+int regionLatencyTracker_demotedRegionWithoutCalls_recoversOverTime() {
+    const auto half_life = std::chrono::milliseconds(20);
+    RegionLatencyTracker tracker(half_life);
+    for (int i = 0; i < 4; i++) tracker.RecordFailure("us-fake-1", std::chrono::milliseconds(10));
+    for (int i = 0; i < 4; i++) tracker.RecordAccessDenied("us-fake-2", std::chrono::milliseconds(10));
+    tracker.RecordSuccess("us-fake-3", std::chrono::milliseconds(100));
+    TEST_ASSERT(tracker.Rank("us-fake-1") == std::numeric_limits<double>::infinity());
+    TEST_ASSERT(tracker.Rank("us-fake-2") == std::numeric_limits<double>::max());
+
+    // sleep_for waits at least this long, so the rates have decayed at least this much
+    std::this_thread::sleep_for(half_life * 4);
+    TEST_ASSERT(tracker.Rank("us-fake-1") == 10);
+    TEST_ASSERT(tracker.Rank("us-fake-2") == 10);
+    TEST_ASSERT(tracker.Rank("us-fake-1") < tracker.Rank("us-fake-3"));
+
+    // The decay carries over into the next call, which starts from the decayed rate
+    tracker.RecordFailure("us-fake-1", std::chrono::milliseconds(10));
+    TEST_ASSERT(tracker.Rank("us-fake-1") == 10);
+    return 0;
+}
+
+/**
+ * A discovery keyring tries the EDK in the region with the lowest moving average latency first,
+ * regardless of the EDK order in the message.
+ */
+int decryptDiscovery_edksInSeveralRegions_triesFastestRegionFirst() {
+    DecryptValues dv;
+    struct aws_cryptosdk_keyring *keyring = t_create_discovery_keyring(dv.kms_client_mock, { TEST_ACCOUNT_ID_0 });
+    auto tracker                          = static_cast<KmsKeyringImpl *>(keyring)->region_latency;
+    tracker->RecordSuccess("us-fake-1", std::chrono::milliseconds(300));
+    tracker->RecordSuccess("us-fake-2", std::chrono::milliseconds(10));
+
+    Aws::String far_key_arn  = TEST_ACCOUNT0_KEY_ARNS[0];
+    Aws::String near_key_arn = "arn:aws:kms:us-fake-2:000011110000:key/a";
+    TEST_ASSERT_SUCCESS(dv.AppendKeyToEdks(far_key_arn));
+    TEST_ASSERT_SUCCESS(dv.AppendKeyToEdks(near_key_arn));
+
+    dv.kms_client_mock->ExpectDecryptAccumulator(
+        dv.GetRequest().WithKeyId(near_key_arn), dv.GetResult().WithKeyId(near_key_arn));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_decrypt(
+        keyring,
+        dv.allocator,
+        &dv.unencrypted_data_key,
+        &dv.keyring_trace,
+        &dv.edks.encrypted_data_keys,
+        &dv.encryption_context,
+        dv.alg));
+    TEST_ASSERT(aws_byte_buf_eq(&dv.unencrypted_data_key, &dv.pt_aws_byte));
+    TEST_ASSERT_SUCCESS(assert_keyring_trace_record(
+        &dv.keyring_trace,
+        0,
+        "aws-kms",
+        near_key_arn.c_str(),
+        AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY | AWS_CRYPTOSDK_WRAPPING_KEY_VERIFIED_ENC_CTX));
+    TEST_ASSERT(!dv.kms_client_mock->ExpectingOtherCalls());
+
+    aws_cryptosdk_keyring_release(keyring);
+    return 0;
+}
+
+/**
+ * Denies every Decrypt call for a key in denied_region at once, and answers the others correctly after 20ms.
+ * Records the key ID of every call.
+ */
+class AccessDeniedRegionKmsClient : public Aws::KMS::KMSClient {
+   public:
+    AccessDeniedRegionKmsClient(const Aws::String &denied_region, const Aws::Utils::ByteBuffer &plaintext)
+        : denied_region(denied_region), plaintext(plaintext) {}
+
+    Model::DecryptOutcome Decrypt(const Model::DecryptRequest &request) const {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            key_ids.push_back(request.GetKeyId());
+        }
+        if (parse_region_from_kms_key_arn(request.GetKeyId()) == denied_region) {
+            return Model::DecryptOutcome(Aws::KMS::KMSError(Aws::Client::AWSError<Aws::KMS::KMSErrors>(
+                Aws::KMS::KMSErrors::ACCESS_DENIED, "AccessDeniedException", "Access denied", false)));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        return Model::DecryptOutcome(DecryptValues::GetResult(request.GetKeyId(), plaintext));
+    }
+
+    mutable std::mutex lock;
+    mutable Aws::Vector<Aws::String> key_ids;
+
+   private:
+    Aws::String denied_region;
+    Aws::Utils::ByteBuffer plaintext;
+};
+
+/**
+ * A region that answers every call at once with AccessDenied is the fastest one measured, but must not stay
+ * first. Its denials do not make it unhealthy, but once they are most of its answers it ranks as if it had
+ * never been called, after which the region that can decrypt is tried first.
+ */
+int decryptDiscovery_regionAlwaysDeniesAccess_doesNotStayFirst() {
+    Aws::String denied_key_arn  = "arn:aws:kms:us-fake-1:000011110000:key/denied";
+    Aws::String allowed_key_arn = "arn:aws:kms:us-fake-2:000011110000:key/allowed";
+    Aws::Utils::ByteBuffer plaintext((unsigned char *)"Random plain txt", 16);
+    auto kms = Aws::MakeShared<AccessDeniedRegionKmsClient>(CLASS_TAG, "us-fake-1", plaintext);
+    struct aws_cryptosdk_keyring *keyring = t_create_discovery_keyring(kms, { TEST_ACCOUNT_ID_0 });
+
+    size_t calls_before = 0;
+    for (int i = 0; i < 10; i++) {
+        DecryptValues dv;
+        TEST_ASSERT_SUCCESS(dv.AppendKeyToEdks(denied_key_arn));
+        TEST_ASSERT_SUCCESS(dv.AppendKeyToEdks(allowed_key_arn));
+        calls_before = kms->key_ids.size();
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_decrypt(
+            keyring,
+            dv.allocator,
+            &dv.unencrypted_data_key,
+            &dv.keyring_trace,
+            &dv.edks.encrypted_data_keys,
+            &dv.encryption_context,
+            dv.alg));
+        TEST_ASSERT(aws_byte_buf_eq(&dv.unencrypted_data_key, &dv.pt_aws_byte));
+    }
+
+    // At first neither region is measured, so the EDKs are tried in message order
+    TEST_ASSERT(kms->key_ids[0] == denied_key_arn);
+    TEST_ASSERT(kms->key_ids[1] == allowed_key_arn);
+    // By the end the denied region is no longer tried at all
+    TEST_ASSERT_INT_EQ(kms->key_ids.size(), calls_before + 1);
+    TEST_ASSERT(kms->key_ids.back() == allowed_key_arn);
+    auto tracker = static_cast<KmsKeyringImpl *>(keyring)->region_latency;
+    TEST_ASSERT(tracker->Rank("us-fake-1") > tracker->Rank("us-fake-2"));
+    TEST_ASSERT(tracker->Rank("us-fake-1") < std::numeric_limits<double>::infinity());
+
+    aws_cryptosdk_keyring_release(keyring);
+    return 0;
+}
+
+/**
+ * Creates a prefetch pool without a background thread for the keyring of tv, so that tests decide when
+ * the pool makes its (mocked) GenerateDataKey calls.
+ */
+static std::shared_ptr<DataKeyPrefetchPool> t_attach_prefetch_pool(
+    TestValues &tv, size_t depth, std::chrono::milliseconds max_age) {
+    auto keyring           = static_cast<KmsKeyringImpl *>(tv.kms_keyring);
+    keyring->data_key_pool = Aws::MakeShared<DataKeyPrefetchPool>(
+        CLASS_TAG, keyring->kms_client_supplier, keyring->grant_tokens, depth, max_age, false);
+    return keyring->data_key_pool;
+}
+
+/**
+ * Takes from the pool until it starts filling the group of gv, checking that each Take finds no key.
+ */
+static int t_miss_until_admitted(DataKeyPrefetchPool &pool, GenerateDataKeyValues &gv) {
+    Model::GenerateDataKeyResult result;
+    for (unsigned i = 0; i < DataKeyPrefetchPool::ADMIT_AFTER_MISSES; i++) {
+        // Not admitted yet, so nothing is prefetched
+        TEST_ASSERT(!pool.FillOne());
+        TEST_ASSERT(!pool.Take(gv.key_id, gv.generate_expected_value, gv.GetEncryptionContext(), result));
+    }
+    return 0;
+}
+
+int dataKeyPrefetchPool_fillThenTake_eachKeyUsedOnce() {
+    GenerateDataKeyValues gv;
+    auto pool = t_attach_prefetch_pool(gv, 2, std::chrono::hours(1));
+    Model::GenerateDataKeyResult result;
+
+    // Nothing is prefetched before a group has been found empty often enough
+    TEST_ASSERT(!pool->FillOne());
+    TEST_ASSERT_SUCCESS(t_miss_until_admitted(*pool, gv));
+
+    gv.kms_client_mock->ExpectGenerateDataKey(gv.GetRequest(), Model::GenerateDataKeyOutcome(gv.generate_result));
+    TEST_ASSERT(pool->FillOne());
+    TEST_ASSERT(!gv.kms_client_mock->ExpectingOtherCalls());
+
+    // Other parameters have a group of their own
+    TEST_ASSERT(!pool->Take(gv.key_id, gv.generate_expected_value * 2, gv.GetEncryptionContext(), result));
+    TEST_ASSERT(!pool->Take(gv.key_id, gv.generate_expected_value, { { "k1", "v1" } }, result));
+
+    TEST_ASSERT(pool->Take(gv.key_id, gv.generate_expected_value, gv.GetEncryptionContext(), result));
+    TEST_ASSERT(result.GetPlaintext() == gv.pt_bb);
+    TEST_ASSERT(result.GetCiphertextBlob() == gv.ct_bb);
+    TEST_ASSERT(!pool->Take(gv.key_id, gv.generate_expected_value, gv.GetEncryptionContext(), result));
+    return 0;
+}
+
+int dataKeyPrefetchPool_keyOlderThanMaxAge_isDiscarded() {
+    GenerateDataKeyValues gv;
+    auto pool = t_attach_prefetch_pool(gv, 1, std::chrono::milliseconds(1));
+    Model::GenerateDataKeyResult result;
+
+    TEST_ASSERT_SUCCESS(t_miss_until_admitted(*pool, gv));
+    gv.kms_client_mock->ExpectGenerateDataKey(gv.GetRequest(), Model::GenerateDataKeyOutcome(gv.generate_result));
+    TEST_ASSERT(pool->FillOne());
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    TEST_ASSERT(!pool->Take(gv.key_id, gv.generate_expected_value, gv.GetEncryptionContext(), result));
+    return 0;
+}
+
+int dataKeyPrefetchPool_kmsFails_addsNoKey() {
+    GenerateDataKeyValues gv;
+    auto pool = t_attach_prefetch_pool(gv, 1, std::chrono::hours(1));
+    Model::GenerateDataKeyResult result;
+
+    TEST_ASSERT_SUCCESS(t_miss_until_admitted(*pool, gv));
+    gv.kms_client_mock->ExpectGenerateDataKey(gv.GetRequest(), Model::GenerateDataKeyOutcome());
+    TEST_ASSERT(!pool->FillOne());
+    TEST_ASSERT(!pool->Take(gv.key_id, gv.generate_expected_value, gv.GetEncryptionContext(), result));
+    return 0;
+}
+
+/**
+ * Encryption contexts used once each never get a group filled, and cannot grow the pool beyond MAX_GROUPS or
+ * push out a group that is being filled.
+ */
+int dataKeyPrefetchPool_uniqueEncryptionContexts_noGenerateDataKeyCalls() {
+    GenerateDataKeyValues gv;
+    auto pool = t_attach_prefetch_pool(gv, 1, std::chrono::hours(1));
+    Model::GenerateDataKeyResult result;
+    TEST_ASSERT_SUCCESS(t_miss_until_admitted(*pool, gv));
+
+    for (size_t i = 0; i < 4 * DataKeyPrefetchPool::MAX_GROUPS; i++) {
+        Aws::Map<Aws::String, Aws::String> enc_ctx{ { "request", Aws::Utils::StringUtils::to_string(i) } };
+        TEST_ASSERT(!pool->Take(gv.key_id, gv.generate_expected_value, enc_ctx, result));
+    }
+
+    // The mock throws on any call it does not expect, so the only call is for the group of gv
+    gv.kms_client_mock->ExpectGenerateDataKey(gv.GetRequest(), Model::GenerateDataKeyOutcome(gv.generate_result));
+    TEST_ASSERT(pool->FillOne());
+    TEST_ASSERT(!pool->FillOne());
+    TEST_ASSERT(!gv.kms_client_mock->ExpectingOtherCalls());
+    TEST_ASSERT(pool->Take(gv.key_id, gv.generate_expected_value, gv.GetEncryptionContext(), result));
+    return 0;
+}
+
+/**
+ * With a prefetched data key ready, OnEncrypt uses it without calling KMS.
+ */
+int generateDataKey_prefetchedKeyReady_noKmsCall() {
+    GenerateDataKeyValues gv;
+    auto pool = t_attach_prefetch_pool(gv, 1, std::chrono::hours(1));
+    Model::GenerateDataKeyResult result;
+
+    TEST_ASSERT_SUCCESS(t_miss_until_admitted(*pool, gv));
+    gv.kms_client_mock->ExpectGenerateDataKey(gv.GetRequest(), Model::GenerateDataKeyOutcome(gv.generate_result));
+    TEST_ASSERT(pool->FillOne());
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_encrypt(
+        gv.kms_keyring,
+        gv.allocator,
+        &gv.unencrypted_data_key,
+        &gv.keyring_trace,
+        &gv.edks,
+        &gv.encryption_context,
+        gv.alg));
+
+    TEST_ASSERT_SUCCESS(t_encrypt_with_single_key_success(gv, true));
+    TEST_ASSERT(aws_byte_buf_eq(&gv.unencrypted_data_key, &gv.pt_aws_byte));
+    TEST_ASSERT(!gv.kms_client_mock->ExpectingOtherCalls());
+    return 0;
+}
+
+/**
+ * Without a prefetched data key, OnEncrypt generates one itself.
+ */
+int generateDataKey_prefetchPoolEmpty_callsKms() {
+    GenerateDataKeyValues gv;
+    t_attach_prefetch_pool(gv, 1, std::chrono::hours(1));
+
+    gv.kms_client_mock->ExpectGenerateDataKey(gv.GetRequest(), Model::GenerateDataKeyOutcome(gv.generate_result));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_encrypt(
+        gv.kms_keyring,
+        gv.allocator,
+        &gv.unencrypted_data_key,
+        &gv.keyring_trace,
+        &gv.edks,
+        &gv.encryption_context,
+        gv.alg));
+
+    TEST_ASSERT_SUCCESS(t_encrypt_with_single_key_success(gv, true));
+    TEST_ASSERT(aws_byte_buf_eq(&gv.unencrypted_data_key, &gv.pt_aws_byte));
+    TEST_ASSERT(!gv.kms_client_mock->ExpectingOtherCalls());
+    return 0;
+}
+
+int testBuilder_withDataKeyPrefetch_createsPoolUnlessDiscovery() {
+    auto kms_client_mock = Aws::MakeShared<KmsClientMock>(CLASS_TAG);
+    Aws::Cryptosdk::KmsKeyring::Builder builder;
+    builder.WithKmsClient(kms_client_mock);
+
+    aws_cryptosdk_keyring *kr = builder.Build(TestValues::key_id);
+    TEST_ASSERT_ADDR_NULL(static_cast<KmsKeyringImpl *>(kr)->data_key_pool.get());
+    aws_cryptosdk_keyring_release(kr);
+
+    builder.WithDataKeyPrefetch(4, std::chrono::minutes(1));
+    kr = builder.Build(TestValues::key_id);
+    TEST_ASSERT_ADDR_NOT_NULL(static_cast<KmsKeyringImpl *>(kr)->data_key_pool.get());
+    aws_cryptosdk_keyring_release(kr);
+
+    kr = builder.BuildDiscovery();
+    TEST_ASSERT_ADDR_NULL(static_cast<KmsKeyringImpl *>(kr)->data_key_pool.get());
+    aws_cryptosdk_keyring_release(kr);
+    return 0;
+}
+
+int cachingClientSupplier_prewarmedOrReportedClients_areReused() {
+    auto supplier = KmsKeyring::CachingClientSupplier::Create();
+    supplier->PrewarmClients({ "us-fake-1", "us-fake-2" }, false);
+
+    std::function<void()> report_success;
+    auto client1 = supplier->GetClient("us-fake-1", report_success);
+    TEST_ASSERT_ADDR_NOT_NULL(client1.get());
+    TEST_ASSERT(client1 == supplier->GetClient("us-fake-1", report_success));
+    TEST_ASSERT(client1 != supplier->GetClient("us-fake-2", report_success));
+
+    // Clients for other regions are only cached once they have been used successfully
+    std::function<void()> report_success3, report_success3_again;
+    auto client3       = supplier->GetClient("us-fake-3", report_success3);
+    auto client3_again = supplier->GetClient("us-fake-3", report_success3_again);
+    TEST_ASSERT(client3 != client3_again);
+    report_success3();
+    report_success3_again();
+    TEST_ASSERT(client3 == supplier->GetClient("us-fake-3", report_success));
+
+    // Prewarming a cached region keeps its client
+    supplier->PrewarmClients({ "us-fake-3" }, false);
+    TEST_ASSERT(client3 == supplier->GetClient("us-fake-3", report_success));
+    return 0;
+}
+
+int regionLatencyTracker_latencyPercentile() {
+    RegionLatencyTracker tracker;
+    std::chrono::steady_clock::duration fallback = std::chrono::milliseconds(7);
+
+    for (int i = 1; i < (int)RegionLatencyTracker::MIN_LATENCY_SAMPLES; i++) {
+        tracker.RecordSuccess("us-fake-1", std::chrono::milliseconds(1000));
+    }
+    TEST_ASSERT(tracker.LatencyPercentile(50, fallback) == fallback);
+
+    // The window drops the oldest latencies first
+    for (int i = 1; i <= (int)RegionLatencyTracker::LATENCY_WINDOW; i++) {
+        tracker.RecordSuccess(i % 2 ? "us-fake-1" : "us-fake-2", std::chrono::milliseconds(i));
+    }
+    TEST_ASSERT(tracker.LatencyPercentile(50, fallback) == std::chrono::milliseconds(128));
+    TEST_ASSERT(tracker.LatencyPercentile(95, fallback) == std::chrono::milliseconds(244));
+    TEST_ASSERT(tracker.LatencyPercentile(100, fallback) == std::chrono::milliseconds(256));
+    TEST_ASSERT(tracker.LatencyPercentile(0, fallback) == std::chrono::milliseconds(1));
+    return 0;
+}
+
+static void t_enable_hedging(
+    aws_cryptosdk_keyring *keyring,
+    std::chrono::milliseconds initial_delay,
+    std::shared_ptr<KmsKeyring::HedgeCounters> counters) {
+    auto self                 = static_cast<KmsKeyringImpl *>(keyring);
+    self->hedge_percentile    = 95;
+    self->hedge_initial_delay = initial_delay;
+    self->hedge_counters      = counters;
+}
+
+/**
+ * If a Decrypt call fails, the next EDK is tried at once, which does not count as a hedge.
+ */
+int hedgedDecrypt_firstCallFails_decryptsSecondWithoutHedge() {
+    Aws::String key_arn_a = TestValues::key_id;
+    Aws::String key_arn_b = fake_arns[1];
+    DecryptValues dv({ key_arn_a, key_arn_b });
+    auto counters = Aws::MakeShared<KmsKeyring::HedgeCounters>(CLASS_TAG);
+    t_enable_hedging(dv.kms_keyring, std::chrono::seconds(10), counters);
+
+    TEST_ASSERT_SUCCESS(dv.AppendKeyToEdks(key_arn_a));
+    TEST_ASSERT_SUCCESS(dv.AppendKeyToEdks(key_arn_b));
+
+    dv.kms_client_mock->ExpectDecryptAccumulator(
+        dv.GetRequest().WithKeyId(key_arn_a), dv.GetErrorOutcome("injected failure"));
+    dv.kms_client_mock->ExpectDecryptAccumulator(
+        dv.GetRequest().WithKeyId(key_arn_b), dv.GetResult().WithKeyId(key_arn_b));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_decrypt(
+        dv.kms_keyring,
+        dv.allocator,
+        &dv.unencrypted_data_key,
+        &dv.keyring_trace,
+        &dv.edks.encrypted_data_keys,
+        &dv.encryption_context,
+        dv.alg));
+    TEST_ASSERT(aws_byte_buf_eq(&dv.unencrypted_data_key, &dv.pt_aws_byte));
+    TEST_ASSERT(!dv.kms_client_mock->ExpectingOtherCalls());
+    TEST_ASSERT_INT_EQ(0, counters->fired.load());
+    TEST_ASSERT_INT_EQ(0, counters->won.load());
+    return 0;
+}
+
+/**
+ * Delays its first Decrypt call, so that the keyring hedges it.
+ */
+class SlowFirstDecryptKmsClientMock : public KmsClientMock {
+   public:
+    Model::DecryptOutcome Decrypt(const Model::DecryptRequest &request) const {
+        if (!started.exchange(true)) std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        std::lock_guard<std::mutex> guard(lock);
+        Model::DecryptOutcome outcome = KmsClientMock::Decrypt(request);
+        finished++;
+        return outcome;
+    }
+
+    mutable std::atomic<bool> started{ false };
+    mutable std::atomic<int> finished{ 0 };
+
+   private:
+    mutable std::mutex lock;
+};
+
+/**
+ * If a Decrypt call is slower than the hedging delay, the next EDK is sent too, and whichever call
+ * succeeds first provides the data key.
+ */
+int hedgedDecrypt_slowFirstCall_hedgeFiresAndWins() {
+    DecryptValues dv;
+    auto slow_kms = Aws::MakeShared<SlowFirstDecryptKmsClientMock>(CLASS_TAG);
+    struct aws_cryptosdk_keyring *keyring = t_create_discovery_keyring(slow_kms, { TEST_ACCOUNT_ID_0 });
+    auto counters                         = Aws::MakeShared<KmsKeyring::HedgeCounters>(CLASS_TAG);
+    t_enable_hedging(keyring, std::chrono::milliseconds(20), counters);
+
+    Aws::String slow_key_arn = TEST_ACCOUNT0_KEY_ARNS[0];
+    Aws::String fast_key_arn = TEST_ACCOUNT0_KEY_ARNS[1];
+    TEST_ASSERT_SUCCESS(dv.AppendKeyToEdks(slow_key_arn));
+    TEST_ASSERT_SUCCESS(dv.AppendKeyToEdks(fast_key_arn));
+
+    // The hedge reaches the mock first
+    slow_kms->ExpectDecryptAccumulator(
+        dv.GetRequest().WithKeyId(fast_key_arn), dv.GetResult().WithKeyId(fast_key_arn));
+    slow_kms->ExpectDecryptAccumulator(
+        dv.GetRequest().WithKeyId(slow_key_arn), dv.GetResult().WithKeyId(slow_key_arn));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_decrypt(
+        keyring,
+        dv.allocator,
+        &dv.unencrypted_data_key,
+        &dv.keyring_trace,
+        &dv.edks.encrypted_data_keys,
+        &dv.encryption_context,
+        dv.alg));
+    TEST_ASSERT(aws_byte_buf_eq(&dv.unencrypted_data_key, &dv.pt_aws_byte));
+    TEST_ASSERT_SUCCESS(assert_keyring_trace_record(
+        &dv.keyring_trace,
+        0,
+        "aws-kms",
+        fast_key_arn.c_str(),
+        AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY | AWS_CRYPTOSDK_WRAPPING_KEY_VERIFIED_ENC_CTX));
+    TEST_ASSERT_INT_EQ(1, counters->fired.load());
+    TEST_ASSERT_INT_EQ(1, counters->won.load());
+
+    // Let the slow call finish, and the keyring release its client, before the mock is checked
+    aws_cryptosdk_keyring_release(keyring);
+    while (slow_kms->finished < 2 || slow_kms.use_count() > 1) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    TEST_ASSERT(!slow_kms->ExpectingOtherCalls());
+    return 0;
+}
+
+int testBuilder_withHedgedDecrypt_setsPolicy() {
+    auto kms_client_mock = Aws::MakeShared<KmsClientMock>(CLASS_TAG);
+    auto counters        = Aws::MakeShared<KmsKeyring::HedgeCounters>(CLASS_TAG);
+    Aws::Cryptosdk::KmsKeyring::Builder builder;
+    builder.WithKmsClient(kms_client_mock);
+
+    aws_cryptosdk_keyring *kr = builder.Build(TestValues::key_id);
+    TEST_ASSERT_ADDR_NULL(static_cast<KmsKeyringImpl *>(kr)->hedge_counters.get());
+    aws_cryptosdk_keyring_release(kr);
+
+    kr         = builder.WithHedgedDecrypt(95, std::chrono::milliseconds(50), counters).Build(TestValues::key_id);
+    auto *self = static_cast<KmsKeyringImpl *>(kr);
+    TEST_ASSERT(self->hedge_counters == counters);
+    TEST_ASSERT(self->hedge_percentile == 95);
+    TEST_ASSERT(self->hedge_initial_delay == std::chrono::milliseconds(50));
+    aws_cryptosdk_keyring_release(kr);
+
+    // Without counters of its own, the keyring still counts
+    kr = builder.WithHedgedDecrypt(95, std::chrono::milliseconds(50)).BuildDiscovery();
+    TEST_ASSERT_ADDR_NOT_NULL(static_cast<KmsKeyringImpl *>(kr)->hedge_counters.get());
+    aws_cryptosdk_keyring_release(kr);
+    return 0;
+}
+
+int localKms_roundTrip_failsOnWrongKeyRegionOrContext() {
+    auto kms            = LocalKms::Create();
+    Aws::String key_arn = kms->CreateKey("us-west-2");
+    Aws::String other   = kms->CreateKey("us-west-2");
+    Aws::Map<Aws::String, Aws::String> enc_ctx{ { "purpose", "test" } };
+    auto client = kms->GetClient("us-west-2");
+
+    auto generated = client->GenerateDataKey(Aws::KMS::Model::GenerateDataKeyRequest()
+                                                 .WithKeyId(key_arn)
+                                                 .WithNumberOfBytes(32)
+                                                 .WithEncryptionContext(enc_ctx));
+    TEST_ASSERT(generated.IsSuccess());
+    TEST_ASSERT(generated.GetResult().GetKeyId() == key_arn);
+    TEST_ASSERT_INT_EQ(generated.GetResult().GetPlaintext().GetLength(), 32);
+
+    Aws::KMS::Model::DecryptRequest request;
+    request.WithKeyId(key_arn)
+        .WithCiphertextBlob(generated.GetResult().GetCiphertextBlob())
+        .WithEncryptionContext(enc_ctx);
+    auto decrypted = client->Decrypt(request);
+    TEST_ASSERT(decrypted.IsSuccess());
+    TEST_ASSERT(decrypted.GetResult().GetKeyId() == key_arn);
+    TEST_ASSERT(decrypted.GetResult().GetPlaintext() == generated.GetResult().GetPlaintext());
+
+    // The same call, but in another region
+    auto outcome = kms->GetClient("eu-west-1")->Decrypt(request);
+    TEST_ASSERT(!outcome.IsSuccess());
+    TEST_ASSERT(outcome.GetError().GetErrorType() == Aws::KMS::KMSErrors::NOT_FOUND);
+
+    outcome = client->Decrypt(Aws::KMS::Model::DecryptRequest(request).WithKeyId(other));
+    TEST_ASSERT(!outcome.IsSuccess());
+    TEST_ASSERT(outcome.GetError().GetErrorType() == Aws::KMS::KMSErrors::INCORRECT_KEY);
+
+    enc_ctx["purpose"] = "other";
+    outcome            = client->Decrypt(Aws::KMS::Model::DecryptRequest(request).WithEncryptionContext(enc_ctx));
+    TEST_ASSERT(!outcome.IsSuccess());
+    TEST_ASSERT(outcome.GetError().GetErrorType() == Aws::KMS::KMSErrors::INVALID_CIPHERTEXT);
+
+    TEST_ASSERT_INT_EQ(kms->counters.generate_data_key.load(), 1);
+    TEST_ASSERT_INT_EQ(kms->counters.decrypt.load(), 4);
+    return 0;
+}
+
 int main() {
     Aws::SDKOptions *options = Aws::New<Aws::SDKOptions>(CLASS_TAG);
     Aws::InitAPI(*options);
@@ -1931,6 +2848,42 @@ int main() {
     RUN_TEST(decryptMultiAccountDiscoveryFilter_someAuthorizedEdks_onlyCallsKmsForAuthorizedEdks());
     RUN_TEST(decryptMultiAccountDiscoveryFilter_someAuthorizedEdks_decryptsSecondIfFirstCallFails());
 
+    // Concurrent KMS calls
+    RUN_TEST(concurrentKmsCalls_encrypt_returnSuccess());
+    RUN_TEST(concurrentKmsCalls_decrypt_returnSuccess());
+    RUN_TEST(concurrentKmsCalls_decryptFails_returnSuccessWithoutKey());
+    RUN_TEST(concurrentKmsCalls_encryptCallsFinishOutOfOrder_edksInKeyOrder());
+    RUN_TEST(concurrentKmsCalls_encryptOneOfSeveralKeysFails_returnFailAfterAllCallsFinish());
+    RUN_TEST(concurrentKmsCalls_decryptSeveralEdksOneFails_firstSuccessWins());
+    RUN_TEST(testBuilder_withConcurrentKmsCalls_setsOption());
+
+    // Region latency ordering
+    RUN_TEST(regionLatencyTracker_ranksByMovingAverageAndHealth());
+    RUN_TEST(regionLatencyTracker_demotedRegionWithoutCalls_recoversOverTime());
+    RUN_TEST(decryptDiscovery_edksInSeveralRegions_triesFastestRegionFirst());
+    RUN_TEST(decryptDiscovery_regionAlwaysDeniesAccess_doesNotStayFirst());
+
+    // Data key prefetching
+    RUN_TEST(dataKeyPrefetchPool_fillThenTake_eachKeyUsedOnce());
+    RUN_TEST(dataKeyPrefetchPool_keyOlderThanMaxAge_isDiscarded());
+    RUN_TEST(dataKeyPrefetchPool_kmsFails_addsNoKey());
+    RUN_TEST(dataKeyPrefetchPool_uniqueEncryptionContexts_noGenerateDataKeyCalls());
+    RUN_TEST(generateDataKey_prefetchedKeyReady_noKmsCall());
+    RUN_TEST(generateDataKey_prefetchPoolEmpty_callsKms());
+    RUN_TEST(testBuilder_withDataKeyPrefetch_createsPoolUnlessDiscovery());
+
+    // Client suppliers
+    RUN_TEST(cachingClientSupplier_prewarmedOrReportedClients_areReused());
+
+    // Hedged decryption
+    RUN_TEST(regionLatencyTracker_latencyPercentile());
+    RUN_TEST(hedgedDecrypt_firstCallFails_decryptsSecondWithoutHedge());
+    RUN_TEST(hedgedDecrypt_slowFirstCall_hedgeFiresAndWins());
+    RUN_TEST(testBuilder_withHedgedDecrypt_setsPolicy());
+
+    // Local KMS stand-in
+    RUN_TEST(localKms_roundTrip_failsOnWrongKeyRegionOrContext());
+
     Aws::ShutdownAPI(*options);
     Aws::Delete(options);
     return 0;
@@ -69,6 +69,26 @@ struct aws_cryptosdk_materials_cache {
 };
 #endif
 
+/**
+ * A snapshot of a materials cache's counters, as returned by @ref aws_cryptosdk_materials_cache_get_stats.
+ * All counters are cumulative since the cache was created.
+ */
+struct aws_cryptosdk_materials_cache_stats {
+    /** Lookups which found a live entry */
+    uint64_t hits;
+    /** Lookups which found no entry, or only an expired one */
+    uint64_t misses;
+    /** Entries evicted to make room for new entries */
+    uint64_t evictions_capacity;
+    /** Entries removed because their TTL had passed */
+    uint64_t evictions_ttl;
+    /**
+     * Entries removed at the request of the cache's user (e.g. because the caching CMM found them to be over
+     * their usage limits), replaced by a newer entry with the same cache ID, or removed by a clear.
+     */
+    uint64_t evictions_invalidated;
+};
+
 #ifndef AWS_CRYPTOSDK_DOXYGEN
 /**
  * NOTE: The extension API for defining new materials cache is currently considered unstable and
@@ -162,6 +182,11 @@ struct aws_cryptosdk_materials_cache_vt {
      * materials object, and (2) `enc_ctx` is updated to match the cached encryption
      * context (adding and removing entries to make it match the cached value).
      *
+     * The EDKs of the returned materials may be borrowed from the cache entry instead of copied, in
+     * which case (*materials)->owner holds a reference which keeps them alive. They must not be used
+     * after the materials are destroyed unless that reference is moved along with them; see
+     * struct aws_cryptosdk_enc_materials.
+     *
      * On failure (e.g., out of memory), `*materials` will be set to NULL; `enc_ctx`
      * remains an allocated encryption context hash table, but the contents of the hash
      * table are unspecified, as we may have been forced to abort partway through updating
@@ -283,6 +308,13 @@ struct aws_cryptosdk_materials_cache_vt {
      * may be used by referenced entries until released.
      */
     void (*clear)(struct aws_cryptosdk_materials_cache *cache);
+
+    /**
+     * Fills *stats with a snapshot of the cache's counters. Caches which don't keep statistics may leave this
+     * NULL, in which case @ref aws_cryptosdk_materials_cache_get_stats raises AWS_ERROR_UNSUPPORTED_OPERATION.
+     */
+    int (*get_stats)(
+        const struct aws_cryptosdk_materials_cache *cache, struct aws_cryptosdk_materials_cache_stats *stats);
 };
 
 AWS_CRYPTOSDK_STATIC_INLINE
@@ -457,6 +489,158 @@ AWS_CRYPTOSDK_API
 struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_local_new(
     struct aws_allocator *alloc, size_t capacity);
 
+/**
+ * Selects how the local materials cache removes entries whose TTL has passed.
+ */
+enum aws_cryptosdk_local_cache_expiry_mode {
+    /**
+     * Request threads expire a small batch of entries on each lookup and insert. This is the behavior of
+     * @ref aws_cryptosdk_materials_cache_local_new.
+     */
+    AWS_CRYPTOSDK_LOCAL_CACHE_EXPIRE_INLINE = 0,
+    /**
+     * A background thread owned by the cache periodically expires entries and destroys evicted materials.
+     */
+    AWS_CRYPTOSDK_LOCAL_CACHE_EXPIRE_BACKGROUND,
+    /**
+     * The application expires entries and destroys evicted materials by calling
+     * @ref aws_cryptosdk_local_cache_process_expirations, e.g. from a timer on its own event loop. At most
+     * capacity evicted entries await destruction at once; beyond that, the thread dropping the last reference
+     * to an evicted entry destroys it, so an application which sweeps rarely (or never) can't leak memory.
+     */
+    AWS_CRYPTOSDK_LOCAL_CACHE_EXPIRE_EXTERNAL
+};
+
+/**
+ * Creates a new instance of the built-in local materials cache, as with @ref aws_cryptosdk_materials_cache_local_new,
+ * but with control over how expired entries are removed.
+ *
+ * In the BACKGROUND and EXTERNAL modes, lookups and inserts do only constant work on behalf of the TTL heap (an
+ * expired entry is never returned, but other expired entries are left alone), and evicted materials are destroyed
+ * later by the expiry sweep rather than by the thread which drops the last reference to them. In BACKGROUND
+ * mode, sweep_interval (in sweep_interval_units) sets how often the background thread runs, and must be nonzero;
+ * it is ignored in the other modes.
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_local_new_with_expiry(
+    struct aws_allocator *alloc,
+    size_t capacity,
+    enum aws_cryptosdk_local_cache_expiry_mode expiry_mode,
+    uint64_t sweep_interval,
+    enum aws_timestamp_unit sweep_interval_units);
+
+/**
+ * Removes all expired entries from a local materials cache and destroys any evicted materials awaiting destruction.
+ * The cache lock is only held for a bounded number of entries at a time. This may be called in any expiry mode,
+ * but is intended for caches created in AWS_CRYPTOSDK_LOCAL_CACHE_EXPIRE_EXTERNAL mode.
+ *
+ * Raises AWS_ERROR_INVALID_ARGUMENT if the cache is not a local materials cache.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_local_cache_process_expirations(struct aws_cryptosdk_materials_cache *cache);
+
+/**
+ * Sets a memory budget for a local materials cache, in addition to its entry count capacity. The cache keeps an
+ * approximate count of the memory used by each entry (its data key, EDKs, encryption context, keyring trace and
+ * parsed signing key, plus bookkeeping overhead); whenever the total exceeds max_bytes, expired entries and then
+ * the least recently used entries are evicted until it no longer does. Materials which would by themselves exceed
+ * the budget are not cached. Lowering the budget evicts entries immediately; a max_bytes of zero (the default)
+ * removes the budget.
+ *
+ * Memory held by entries which have been evicted, but are still referenced by in-flight requests, is not counted.
+ *
+ * Raises AWS_ERROR_INVALID_ARGUMENT if the cache is not a local materials cache.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_local_cache_set_max_bytes(struct aws_cryptosdk_materials_cache *cache, size_t max_bytes);
+
+/**
+ * Selects how the local materials cache chooses entries to evict when it is full.
+ */
+enum aws_cryptosdk_local_cache_eviction_policy {
+    /**
+     * Evict the least recently used entry. This is the default.
+     */
+    AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_LRU = 0,
+    /**
+     * W-TinyLFU: new entries enter a small LRU admission window (1% of the capacity). An entry leaving the window
+     * only displaces the least recently used entry of the rest of the cache if it has been looked up more often
+     * recently, as estimated by a count-min sketch of lookups. This keeps frequently used entries in the cache
+     * through scans of entries which are each used once, such as a bulk decrypt of old data.
+     */
+    AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_TINYLFU
+};
+
+/**
+ * Sets the eviction policy of a local materials cache. This may be called at any time; existing entries are kept.
+ * The TinyLFU policy allocates a frequency sketch of about 16 bytes per unit of cache capacity.
+ *
+ * Raises AWS_ERROR_INVALID_ARGUMENT if the cache is not a local materials cache, or the policy is unknown.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_local_cache_set_eviction_policy(
+    struct aws_cryptosdk_materials_cache *cache, enum aws_cryptosdk_local_cache_eviction_policy policy);
+
+/**
+ * Returns the approximate memory used by the live entries of a local materials cache, as counted against the
+ * budget set by @ref aws_cryptosdk_local_cache_set_max_bytes (this is tracked even if no budget is set).
+ * Returns SIZE_MAX if the cache is not a local materials cache.
+ */
+AWS_CRYPTOSDK_API
+size_t aws_cryptosdk_local_cache_get_approx_bytes(const struct aws_cryptosdk_materials_cache *cache);
+
+/**
+ * Creates a new materials cache whose entries are kept in an anonymous shared memory segment, so that all
+ * processes forked from the creating process after this call share the same entries (e.g. the workers of a
+ * pre-forking server). Each process holds its own reference to the cache object, and must release it as usual.
+ *
+ * The segment holds slot_count entries, each with room for slot_size bytes of serialized materials (data key,
+ * EDKs, encryption context, keyring trace and signing key); materials which don't fit are simply not cached.
+ * When an entry's hash bucket is full, the least recently used entry in that bucket is evicted. The segment is
+ * locked into memory and, where supported, excluded from core dumps, on a best effort basis; use
+ * @ref aws_cryptosdk_materials_cache_shm_new_with_mlock to make creation fail if this is not possible.
+ *
+ * Each process parses an entry at most once (or not at all, if it inserted the entry). The materials it returns
+ * for that entry share the parsed signing key and borrow the EDKs (see the owner field of
+ * aws_cryptosdk_enc_materials) rather than copying them; the data key is copied out of the segment on each hit.
+ * The cache may be used from a process forked while other threads were using it.
+ *
+ * Entries are protected by a robust process-shared mutex; if a process dies while holding it, the next process
+ * to acquire it discards all entries. This cache is currently only available on Linux; on other platforms this
+ * function raises AWS_ERROR_UNSUPPORTED_OPERATION.
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_shm_new(
+    struct aws_allocator *alloc, size_t slot_count, size_t slot_size);
+
+/**
+ * Controls whether a shared memory materials cache must keep its segment out of swap and core dumps.
+ */
+enum aws_cryptosdk_shm_cache_mlock_policy {
+    /**
+     * Try to lock the segment into memory and exclude it from core dumps, but create the cache anyway if this
+     * fails (e.g. because of RLIMIT_MEMLOCK). This is the policy used by
+     * @ref aws_cryptosdk_materials_cache_shm_new.
+     */
+    AWS_CRYPTOSDK_SHM_CACHE_MLOCK_BEST_EFFORT = 0,
+    /**
+     * Fail with AWS_ERROR_SYS_CALL_FAILURE if the segment cannot be locked into memory, or (where supported)
+     * excluded from core dumps.
+     */
+    AWS_CRYPTOSDK_SHM_CACHE_MLOCK_REQUIRED
+};
+
+/**
+ * Creates a new shared memory materials cache, as with @ref aws_cryptosdk_materials_cache_shm_new, but with
+ * control over whether the segment must be locked into memory.
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_shm_new_with_mlock(
+    struct aws_allocator *alloc,
+    size_t slot_count,
+    size_t slot_size,
+    enum aws_cryptosdk_shm_cache_mlock_policy mlock_policy);
+
 /**
  * Returns an estimate of the number of entries in the cache. If a size estimate is not available,
  * returns SIZE_MAX.
@@ -473,6 +657,24 @@ size_t aws_cryptosdk_materials_cache_entry_count(const struct aws_cryptosdk_mate
     return entry_count(cache);
 }
 
+/**
+ * Fills *stats with a snapshot of the hit, miss and eviction counters of the cache. The counters are read
+ * consistently with each other. Raises AWS_ERROR_UNSUPPORTED_OPERATION if the cache doesn't keep statistics.
+ */
+AWS_CRYPTOSDK_STATIC_INLINE
+int aws_cryptosdk_materials_cache_get_stats(
+    const struct aws_cryptosdk_materials_cache *cache, struct aws_cryptosdk_materials_cache_stats *stats) {
+    int (*get_stats)(
+        const struct aws_cryptosdk_materials_cache *cache, struct aws_cryptosdk_materials_cache_stats *stats) =
+        AWS_CRYPTOSDK_PRIVATE_VT_GET_NULL(cache->vt, get_stats);
+
+    if (!get_stats) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    return get_stats(cache, stats);
+}
+
 /**
  * Attempts to clear all entries in the cache. This method is threadsafe, though any entries
  * being inserted in parallel with the clear operation may not end up being cleared.
@@ -591,6 +793,83 @@ int aws_cryptosdk_caching_cmm_set_limit_bytes(struct aws_cryptosdk_cmm *cmm, uin
 AWS_CRYPTOSDK_API
 int aws_cryptosdk_caching_cmm_set_limit_messages(struct aws_cryptosdk_cmm *cmm, uint64_t limit_messages);
 
+/**
+ * Enables refresh-ahead. Once a cached data key has been alive for refresh_percent percent of the TTL, or has
+ * used up refresh_percent percent of the message or byte limits, the next request served from it also schedules
+ * a call to the delegate CMM on a background thread. When that call completes, its materials replace the cache
+ * entry; until then, requests continue to be served from the existing entry, so that only requests arriving
+ * after the entry has actually expired need to wait for the delegate CMM.
+ *
+ * refresh_percent must be between 1 and 99, or 0 to disable refresh-ahead (the default). The background thread
+ * is started the first time refresh-ahead is enabled, and at most one refresh per cache entry is outstanding at
+ * any time. Failed refreshes are not retried until the entry is next used. This may be called while other
+ * threads are using the CMM.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_caching_cmm_set_refresh_ahead(struct aws_cryptosdk_cmm *cmm, uint32_t refresh_percent);
+
+/**
+ * Enables or disables per-EDK decryption caching (disabled by default).
+ *
+ * Normally, decryption materials are cached under the full list of EDKs in the message, so two messages only share
+ * an entry if they carry exactly the same EDKs. In per-EDK mode, each EDK is instead cached on its own, keyed by its
+ * provider ID, provider info and ciphertext together with the encryption context and algorithm suite. A message then
+ * hits the cache if any of its EDKs has been decrypted before, so that a single call to the delegate CMM (e.g. one
+ * KMS Decrypt) serves every message containing that EDK, even if their other EDKs differ.
+ *
+ * On a miss (no EDK of the message is cached), the delegate CMM is called once with the full EDK list, and its result
+ * is cached under each EDK whose wrapping key the keyring trace records as having decrypted the data key. Entries for
+ * single-EDK messages are the same in both modes.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_caching_cmm_set_per_edk_decrypt(struct aws_cryptosdk_cmm *cmm, bool per_edk);
+
+/**
+ * Number of buckets in a @ref aws_cryptosdk_latency_histogram.
+ */
+#define AWS_CRYPTOSDK_LATENCY_HISTOGRAM_BUCKETS 24
+
+/**
+ * A histogram of call latencies with power-of-two bucket boundaries: buckets[0] counts calls which took less than
+ * one microsecond, buckets[i] counts calls which took at least 2^(i-1) and less than 2^i microseconds, and the last
+ * bucket also counts all slower calls.
+ */
+struct aws_cryptosdk_latency_histogram {
+    uint64_t count;
+    uint64_t total_nanos;
+    uint64_t buckets[AWS_CRYPTOSDK_LATENCY_HISTOGRAM_BUCKETS];
+};
+
+/**
+ * A snapshot of a caching CMM's counters, as returned by @ref aws_cryptosdk_caching_cmm_get_stats.
+ * All counters are cumulative since the CMM was created.
+ */
+struct aws_cryptosdk_caching_cmm_stats {
+    /** Requests served from the cache */
+    uint64_t hits;
+    /** Requests which were eligible for caching, but were served by the delegate CMM */
+    uint64_t misses;
+    /** Requests which could not be cached (e.g. a non-KDF algorithm suite or an oversize message) */
+    uint64_t bypasses;
+    /** Cache entries this CMM invalidated because their TTL had passed */
+    uint64_t invalidations_ttl;
+    /** Cache entries this CMM invalidated because they reached the message or byte limit */
+    uint64_t invalidations_usage_limit;
+    /** Latencies of calls to the delegate CMM, including refresh-ahead calls */
+    struct aws_cryptosdk_latency_histogram upstream_encrypt_latency;
+    struct aws_cryptosdk_latency_histogram upstream_decrypt_latency;
+};
+
+/**
+ * Fills *stats with a snapshot of the caching CMM's counters. The counters are maintained with relaxed atomic
+ * operations, so a snapshot taken while requests are in flight may not be consistent between counters. For
+ * counters kept by the cache itself (e.g. capacity evictions), see @ref aws_cryptosdk_materials_cache_get_stats.
+ *
+ * Raises AWS_ERROR_UNSUPPORTED_OPERATION if cmm is not a caching CMM.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_caching_cmm_get_stats(struct aws_cryptosdk_cmm *cmm, struct aws_cryptosdk_caching_cmm_stats *stats);
+
 AWS_EXTERN_C_END
 
 /** @} */  // doxygen group caching
@@ -210,6 +210,20 @@ int aws_cryptosdk_sig_verify_start(
     const struct aws_string *pub_key,
     const struct aws_cryptosdk_alg_properties *props);
 
+/**
+ * Initializes a new sign or verify context, in the same mode as src, which shares the already-parsed
+ * key held by src. This avoids re-parsing (and, for public keys, re-decompressing) the key when the same
+ * key is used for many messages. If no data has been fed to src yet, the new context is a copy of its
+ * already-initialized digest state, which avoids setting up a new digest as well. The new context starts
+ * with no data; src itself is not modified and may continue to be used, but must not be destroyed
+ * concurrently with this call.
+ *
+ * This method is intended to be used with caching mechanisms to clone the signing context.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_sig_start_from_ctx(
+    struct aws_cryptosdk_sig_ctx **ctx, struct aws_allocator *alloc, const struct aws_cryptosdk_sig_ctx *src);
+
 /**
  * Supplies some data to an ongoing sign or verify operation.
  */
@@ -42,6 +42,16 @@ struct aws_cryptosdk_edk {
     struct aws_byte_buf ciphertext;
 };
 
+/**
+ * An opaque index over a list of EDKs by provider ID, and by provider ID together with provider info.
+ * A CMM creates one per decrypt request and shares it between all of the keyrings it calls. The index
+ * refers to the bytes of the EDKs in the list, so the list must not be modified while the index is in use.
+ *
+ * Creating an index is cheap: it is only built, in a single allocation, by the first lookup. Lookups may
+ * be made from several threads at once; only those racing with the first one wait for the build.
+ */
+struct aws_cryptosdk_edk_index;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -106,6 +116,36 @@ AWS_CRYPTOSDK_API
 int aws_cryptosdk_edk_init_clone(
     struct aws_allocator *alloc, struct aws_cryptosdk_edk *dest, const struct aws_cryptosdk_edk *src);
 
+/**
+ * Creates an index over edks, which is built on the first lookup. Returns NULL on failure, with the
+ * error code set.
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_edk_index *aws_cryptosdk_edk_index_new(
+    struct aws_allocator *alloc, const struct aws_array_list *edks);
+
+/**
+ * Deallocates all memory associated with the index. The EDK list is not affected. Does nothing if
+ * index is NULL.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_edk_index_destroy(struct aws_cryptosdk_edk_index *index);
+
+/**
+ * Looks up the EDKs with the given provider ID and, if provider_info is not NULL, the given provider
+ * info. On success, *positions is set to an array of the positions of those EDKs in the indexed list,
+ * in list order, and *num_positions to its length, which is zero when nothing matches. The array
+ * remains valid until the index is destroyed. Fails only if building the index on the first lookup
+ * fails.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_edk_index_find(
+    const struct aws_cryptosdk_edk_index *index,
+    struct aws_byte_cursor provider_id,
+    const struct aws_byte_cursor *provider_info,
+    const size_t **positions,
+    size_t *num_positions);
+
 /**
  * Returns true if the contents of all EDK byte buffers are identical, false otherwise.
  */
@@ -40,6 +40,16 @@ AWS_CRYPTOSDK_API
 int aws_cryptosdk_edk_list_copy_all(
     struct aws_allocator *alloc, struct aws_array_list *dest, const struct aws_array_list *src);
 
+/**
+ * Appends _borrowed_ shallow copies of all EDKs in the list at src to dest. dest must already be initialized.
+ * The borrowed EDKs share their buffers with src, but have NULL allocators, so cleaning up dest will not free
+ * them; the caller must ensure that the buffers in src outlive any use of dest.
+ *
+ * On failure, the destination list is unchanged.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_edk_list_borrow_all(struct aws_array_list *dest, const struct aws_array_list *src);
+
 /**
  * _Copies_ all aws_cryptosdk_keyring_trace_records in the list at src, appending the copies to dest.
  * dest must already be initialized.
@@ -167,8 +167,31 @@ AWS_CRYPTOSDK_STATIC_INLINE bool aws_cryptosdk_enc_request_is_valid(const struct
     return request && aws_allocator_is_valid(request->alloc) && aws_hash_table_is_valid(request->enc_ctx);
 }
 
+/**
+ * A reference to an immutable, reference-counted object which owns buffers that a set of materials
+ * borrows instead of copying; for example, a materials cache entry. Each holder of a reference
+ * must invoke release exactly once.
+ */
+struct aws_cryptosdk_materials_owner {
+    void (*release)(struct aws_cryptosdk_materials_owner *owner);
+};
+
+/**
+ * Releases a reference to a materials owner. If owner is NULL, this is a no-op.
+ */
+AWS_CRYPTOSDK_STATIC_INLINE void aws_cryptosdk_materials_owner_release(struct aws_cryptosdk_materials_owner *owner) {
+    if (owner) {
+        owner->release(owner);
+    }
+}
+
 /**
  * Materials returned from a CMM generate_enc_materials operation
+ *
+ * The EDKs in encrypted_data_keys may be borrowed rather than owned by the materials; see owner below.
+ * Code which takes EDKs out of the materials (by moving or swapping the list, or by copying the
+ * aws_cryptosdk_edk structs) must either take the owner reference along with them, or deep-copy them
+ * with aws_cryptosdk_edk_list_copy_all before the materials are destroyed.
  */
 struct aws_cryptosdk_enc_materials {
     struct aws_allocator *alloc;
@@ -180,6 +203,17 @@ struct aws_cryptosdk_enc_materials {
     /** Trailing signature context, or NULL if no trailing signature is needed for this algorithm */
     struct aws_cryptosdk_sig_ctx *signctx;
     enum aws_cryptosdk_alg_id alg;
+    /**
+     * If non-NULL, some EDKs in encrypted_data_keys are borrowed (their buffers have a NULL allocator)
+     * from this owner, and remain valid only while this reference is held. The reference is released
+     * by aws_cryptosdk_enc_materials_destroy, after which the borrowed buffers may be freed at any time.
+     *
+     * Code which keeps borrowed EDKs beyond the lifetime of the materials (for example a CMM which
+     * wraps another one and moves the EDK list into materials of its own) must move this reference
+     * along with them, setting this field to NULL, and release it once it no longer uses them. Moving
+     * the EDKs without the reference leaves them dangling as soon as these materials are destroyed.
+     */
+    struct aws_cryptosdk_materials_owner *owner;
 };
 
 /**
@@ -463,7 +497,9 @@ AWS_CRYPTOSDK_STATIC_INLINE struct aws_cryptosdk_cmm *aws_cryptosdk_cmm_retain(s
  * including an encrypted data key and a list of EDKs for doing encryption.
  *
  * On success returns AWS_OP_SUCCESS and allocates encryption materials object at address
- * pointed to by output.
+ * pointed to by output. The EDKs of the materials may be borrowed from (*output)->owner, for
+ * example from a cache entry; they are then valid only until the materials are destroyed, unless
+ * the caller takes over that reference. See struct aws_cryptosdk_enc_materials.
  *
  * On failure returns AWS_OP_ERR, sets address pointed to by output to NULL, and sets
  * internal AWS error code.
@@ -555,6 +591,22 @@ struct aws_cryptosdk_keyring_vt {
         const struct aws_array_list *edks,
         const struct aws_hash_table *enc_ctx,
         enum aws_cryptosdk_alg_id alg);
+
+    /**
+     * VIRTUAL FUNCTION: optional. Same as on_decrypt, but also receives an index over edks,
+     * which the caller builds once and shares between keyrings, so that implementations can
+     * look up the EDKs they are able to decrypt rather than scanning the whole list. When
+     * this is not implemented, on_decrypt is called instead.
+     */
+    int (*on_decrypt_indexed)(
+        struct aws_cryptosdk_keyring *keyring,
+        struct aws_allocator *request_alloc,
+        struct aws_byte_buf *unencrypted_data_key,
+        struct aws_array_list *keyring_trace,
+        const struct aws_array_list *edks,
+        const struct aws_cryptosdk_edk_index *edk_index,
+        const struct aws_hash_table *enc_ctx,
+        enum aws_cryptosdk_alg_id alg);
 };
 
 /**
@@ -659,6 +711,21 @@ int aws_cryptosdk_keyring_on_decrypt(
     const struct aws_hash_table *enc_ctx,
     enum aws_cryptosdk_alg_id alg);
 
+/**
+ * As aws_cryptosdk_keyring_on_decrypt, but passes edk_index, an index over edks, to keyrings
+ * which can use it. edk_index may be NULL, and is ignored if it was not built over edks.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_keyring_on_decrypt_indexed(
+    struct aws_cryptosdk_keyring *keyring,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_cryptosdk_edk_index *edk_index,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg);
+
 /**
  * Allocates a new encryption materials object, including allocating memory to the list
  * of EDKs. The list of EDKs will be empty and no memory will be allocated to any byte
@@ -15,6 +15,7 @@
 #ifndef AWS_CRYPTOSDK_MULTI_KEYRING_H
 #define AWS_CRYPTOSDK_MULTI_KEYRING_H
 
+#include <aws/common/clock.h>
 #include <aws/cryptosdk/exports.h>
 #include <aws/cryptosdk/materials.h>
 
@@ -88,6 +89,69 @@ struct aws_cryptosdk_keyring *aws_cryptosdk_multi_keyring_new(
 AWS_CRYPTOSDK_API
 int aws_cryptosdk_multi_keyring_add_child(struct aws_cryptosdk_keyring *multi, struct aws_cryptosdk_keyring *child);
 
+/**
+ * An executor used by the multi-keyring's concurrent modes. It must arrange for task(task_data) to be
+ * called exactly once, typically on another thread, and return AWS_OP_SUCCESS. If it cannot accept the
+ * task, it must return AWS_OP_ERR without calling task, and the multi-keyring will run the task itself.
+ *
+ * Concurrent On Encrypt waits for all the tasks it submits before returning, so a task must never be queued
+ * behind the request that submitted it (e.g. on a single-threaded executor which is running that request).
+ * Hedged On Decrypt returns as soon as one of its tasks produces a data key; the others then finish on the
+ * executor after the request has returned.
+ */
+typedef int (*aws_cryptosdk_keyring_executor_fn)(void *executor_data, void (*task)(void *task_data), void *task_data);
+
+/**
+ * Sets the executor used to run child keyrings in the multi-keyring's concurrent modes. The concurrent modes
+ * need an executor: while executor is NULL (the default), they have no effect, and child keyrings are called
+ * one at a time on the requesting thread as in sequential mode. Typically the executor is a bounded thread
+ * pool shared by all the keyrings of an application, which avoids starting threads for each request.
+ *
+ * This operation is not threadsafe, in the same way as aws_cryptosdk_multi_keyring_add_child.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_multi_keyring_set_executor(
+    struct aws_cryptosdk_keyring *multi, aws_cryptosdk_keyring_executor_fn executor, void *executor_data);
+
+/**
+ * Enables or disables concurrent On Encrypt (disabled by default). Once the generator has produced the
+ * data key, all child keyrings are called at the same time on the multi-keyring's executor (which this
+ * mode needs; see aws_cryptosdk_multi_keyring_set_executor), rather than one after another, so the latency
+ * of On Encrypt is that of the slowest child rather than the sum of all of them. The EDKs and keyring trace
+ * records the children produce are appended in child order, as in sequential mode.
+ *
+ * In this mode every child is called even if another one fails. If any child fails, On Encrypt fails
+ * with the error raised by the first failing child (in child order), and appends nothing.
+ *
+ * Child keyrings, and the request allocator, must be safe to use from several threads at once.
+ * This operation is not threadsafe, in the same way as aws_cryptosdk_multi_keyring_add_child.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_multi_keyring_set_concurrent_encrypt(struct aws_cryptosdk_keyring *multi, bool concurrent);
+
+/**
+ * Enables or disables hedged On Decrypt (disabled by default). Rather than trying the generator and each
+ * child keyring in turn, the multi-keyring starts them on its executor in the same order, each one either
+ * delay after the previous one started or as soon as all of those started so far have failed, whichever
+ * comes first. A delay of zero starts them all at once. The first of them to produce a data key wins, and
+ * the keyring trace holds only the records of that keyring.
+ *
+ * Once there is a winner, On Decrypt returns at once, and keyrings which have not started yet are not called
+ * at all. Keyrings which are still running are not interrupted; they finish on the executor after On Decrypt
+ * has returned, and their results are discarded. Until then they hold references to themselves and to copies
+ * of the EDKs and encryption context, and allocate with the multi-keyring's allocator rather than the request
+ * allocator, so the data key and keyring trace records of the winner come from the multi-keyring's allocator
+ * too. If no keyring produces a data key, the result is the same as in sequential mode, with the error raised
+ * by the first failing keyring.
+ *
+ * This mode needs an executor (see aws_cryptosdk_multi_keyring_set_executor). Keyrings, and the multi-keyring's
+ * allocator, must be safe to use from several threads at once. This operation is not threadsafe, in the same
+ * way as aws_cryptosdk_multi_keyring_add_child.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_multi_keyring_set_hedged_decrypt(
+    struct aws_cryptosdk_keyring *multi, bool hedged, uint64_t delay, enum aws_timestamp_unit delay_units);
+
 /**
  * Constant time check of data-structure invariants for struct multi_keyring.
  */
@@ -200,6 +200,47 @@ int aws_cryptosdk_aes_gcm_decrypt(
     const struct aws_byte_cursor aad,
     const struct aws_string *key);
 
+/**
+ * An AES-GCM key whose key schedule has already been computed, held in OpenSSL contexts which have
+ * been set up for encryption and decryption with no IV. Each operation copies one of those contexts,
+ * so one key may be used from several threads at once.
+ */
+struct aws_cryptosdk_aes_gcm_key;
+
+/**
+ * Prepares an AES-256/192/128 key, chosen by key_len, for AES-GCM encryption and decryption.
+ * Returns NULL on failure and sets one of the following error codes:
+ *
+ * AWS_INVALID_BUFFER_SIZE : bad key length
+ * AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN : OpenSSL error
+ */
+struct aws_cryptosdk_aes_gcm_key *aws_cryptosdk_aes_gcm_key_new(
+    struct aws_allocator *alloc, const uint8_t *key_bytes, size_t key_len);
+
+void aws_cryptosdk_aes_gcm_key_destroy(struct aws_cryptosdk_aes_gcm_key *key);
+
+/**
+ * As aws_cryptosdk_aes_gcm_encrypt, but with a key prepared by aws_cryptosdk_aes_gcm_key_new.
+ */
+int aws_cryptosdk_aes_gcm_encrypt_with_key(
+    struct aws_byte_buf *cipher,
+    struct aws_byte_buf *tag,
+    const struct aws_byte_cursor plain,
+    const struct aws_byte_cursor iv,
+    const struct aws_byte_cursor aad,
+    const struct aws_cryptosdk_aes_gcm_key *key);
+
+/**
+ * As aws_cryptosdk_aes_gcm_decrypt, but with a key prepared by aws_cryptosdk_aes_gcm_key_new.
+ */
+int aws_cryptosdk_aes_gcm_decrypt_with_key(
+    struct aws_byte_buf *plain,
+    const struct aws_byte_cursor cipher,
+    const struct aws_byte_cursor tag,
+    const struct aws_byte_cursor iv,
+    const struct aws_byte_cursor aad,
+    const struct aws_cryptosdk_aes_gcm_key *key);
+
 /**
  * Does RSA decryption of an encrypted data key to an unecrypted data key.
  * RSA with PKCS1, OAEP_SHA1_MGF1 and OAEP_SHA256_MGF1 padding modes is supported.
@@ -251,4 +292,45 @@ int aws_cryptosdk_rsa_encrypt(
     const struct aws_string *rsa_public_key_pem,
     enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode);
 
+/**
+ * A parsed RSA key, together with an OpenSSL context which has already been set up for encryption (public
+ * keys) or decryption (private keys) with the given padding mode. Each operation duplicates that context,
+ * so one key may be used from several threads at once.
+ */
+struct aws_cryptosdk_rsa_key;
+
+/**
+ * Parses an RSA public or private key in PEM format for use with the given padding mode.
+ *
+ * Returns NULL on failure, and sets one of the following error codes:
+ *
+ * AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT: unsupported padding mode for RSA wrapping algorithm
+ * AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN : the key could not be parsed, or another OpenSSL error
+ */
+struct aws_cryptosdk_rsa_key *aws_cryptosdk_rsa_key_new(
+    struct aws_allocator *alloc,
+    const struct aws_string *rsa_key_pem,
+    bool is_private,
+    enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode);
+
+void aws_cryptosdk_rsa_key_destroy(struct aws_cryptosdk_rsa_key *key);
+
+/**
+ * As aws_cryptosdk_rsa_encrypt, but with a public key parsed by aws_cryptosdk_rsa_key_new.
+ */
+int aws_cryptosdk_rsa_encrypt_with_key(
+    struct aws_byte_buf *cipher,
+    struct aws_allocator *alloc,
+    const struct aws_byte_cursor plain,
+    const struct aws_cryptosdk_rsa_key *key);
+
+/**
+ * As aws_cryptosdk_rsa_decrypt, but with a private key parsed by aws_cryptosdk_rsa_key_new.
+ */
+int aws_cryptosdk_rsa_decrypt_with_key(
+    struct aws_byte_buf *plain,
+    struct aws_allocator *alloc,
+    const struct aws_byte_cursor cipher,
+    const struct aws_cryptosdk_rsa_key *key);
+
 #endif  // AWS_CRYPTOSDK_PRIVATE_CIPHER_H
@@ -0,0 +1,36 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AWS_CRYPTOSDK_PRIVATE_EDK_H
+#define AWS_CRYPTOSDK_PRIVATE_EDK_H
+
+#include <aws/common/atomics.h>
+#include <aws/common/mutex.h>
+#include <aws/cryptosdk/edk.h>
+
+struct aws_cryptosdk_edk_index {
+    struct aws_allocator *alloc;
+    /* The indexed list */
+    const struct aws_array_list *edks;
+    /* Held while the first lookup builds the index */
+    struct aws_mutex build_lock;
+    /*
+     * NULL until the first lookup. Then a single allocation of size_t positions in the indexed list: first
+     * sorted by provider ID, then sorted by provider ID and provider info, positions of equal EDKs in list
+     * order within both. Read-only once published.
+     */
+    struct aws_atomic_var sorted;
+};
+
+#endif  // AWS_CRYPTOSDK_PRIVATE_EDK_H
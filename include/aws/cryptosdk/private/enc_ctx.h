@@ -15,6 +15,7 @@
 #ifndef AWS_CRYPTOSDK_PRIVATE_ENC_CTX_H
 #define AWS_CRYPTOSDK_PRIVATE_ENC_CTX_H
 
+#include <aws/common/array_list.h>
 #include <aws/common/byte_buf.h>
 #include <aws/cryptosdk/enc_ctx.h>
 
@@ -25,6 +26,124 @@
  */
 int aws_cryptosdk_enc_ctx_size(size_t *size, const struct aws_hash_table *enc_ctx);
 
+/**
+ * Encryption contexts with no more than this many elements can be sorted or serialized without
+ * allocating any temporary working memory.
+ */
+#define AWS_CRYPTOSDK_ENC_CTX_SMALL_SIZE 16
+
+/**
+ * Length of the digest computed by aws_cryptosdk_enc_ctx_flat_digest (SHA-512).
+ */
+#define AWS_CRYPTOSDK_ENC_CTX_DIGEST_LEN 64
+
+/**
+ * One key-value pair of an encryption context. The bytes are not owned by the entry.
+ */
+struct aws_cryptosdk_enc_ctx_entry {
+    struct aws_byte_cursor key;
+    struct aws_byte_cursor value;
+};
+
+/**
+ * A flat representation of an encryption context: its entries in an array sorted by key (i.e. in the
+ * order used by the serialized form), along with the serialized form and its SHA-512 digest. These are
+ * computed on first use and kept until the context is next changed through the functions below.
+ *
+ * The entries are views of keys and values which are owned elsewhere (e.g. by the hash table the flat
+ * context was built from, or by the buffer it was deserialized from); they must stay valid and unchanged
+ * for as long as the flat context is used.
+ */
+struct aws_cryptosdk_enc_ctx_flat {
+    struct aws_allocator *alloc;
+    /* struct aws_cryptosdk_enc_ctx_entry, sorted by key, with no duplicate keys */
+    struct aws_array_list entries;
+    /*
+     * Valid iff has_serialized. Not owned (allocator is NULL) while it is a view of the input to
+     * aws_cryptosdk_enc_ctx_flat_deserialize; serializing again after a change allocates a buffer of its own.
+     */
+    struct aws_byte_buf serialized;
+    /* Valid iff has_digest */
+    uint8_t digest[AWS_CRYPTOSDK_ENC_CTX_DIGEST_LEN];
+    bool has_serialized;
+    bool has_digest;
+};
+
+/**
+ * Initializes an empty flat encryption context. If storage is not NULL, up to storage_len entries are
+ * kept in it, and the entries are only allocated (with alloc) when there are more than that. The flat
+ * context must be released with aws_cryptosdk_enc_ctx_flat_clean_up.
+ */
+void aws_cryptosdk_enc_ctx_flat_init(
+    struct aws_cryptosdk_enc_ctx_flat *flat,
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_enc_ctx_entry *storage,
+    size_t storage_len);
+
+void aws_cryptosdk_enc_ctx_flat_clean_up(struct aws_cryptosdk_enc_ctx_flat *flat);
+
+/**
+ * Removes all entries of the flat encryption context, keeping any memory allocated for them.
+ */
+void aws_cryptosdk_enc_ctx_flat_clear(struct aws_cryptosdk_enc_ctx_flat *flat);
+
+/**
+ * Replaces the contents of the flat encryption context with views of the keys and values of enc_ctx.
+ * enc_ctx must not be modified while the flat context is in use.
+ */
+int aws_cryptosdk_enc_ctx_flat_set(struct aws_cryptosdk_enc_ctx_flat *flat, const struct aws_hash_table *enc_ctx);
+
+/**
+ * Sets the value of key, adding an entry if there is none for it yet. Only the views are stored: the
+ * bytes of key and value must outlive the flat context.
+ */
+int aws_cryptosdk_enc_ctx_flat_put(
+    struct aws_cryptosdk_enc_ctx_flat *flat, struct aws_byte_cursor key, struct aws_byte_cursor value);
+
+/**
+ * Returns the value of key, or NULL if the flat encryption context has no entry for it.
+ */
+const struct aws_byte_cursor *aws_cryptosdk_enc_ctx_flat_get(
+    const struct aws_cryptosdk_enc_ctx_flat *flat, struct aws_byte_cursor key);
+
+/**
+ * Replaces the contents of the flat encryption context with views of the serialized encryption context
+ * at cursor, which is advanced past it. Nothing is copied: the serialized bytes must outlive the flat
+ * context, or be moved along with aws_cryptosdk_enc_ctx_flat_rebase. They are also kept as the serialized
+ * form, as they were read, even if their keys were not in sorted order.
+ *
+ * Raises AWS_ERROR_SHORT_BUFFER if cursor ends early, and AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT if the
+ * serialized context is malformed or has duplicate keys; the flat context is left empty on failure.
+ */
+int aws_cryptosdk_enc_ctx_flat_deserialize(struct aws_cryptosdk_enc_ctx_flat *flat, struct aws_byte_cursor *cursor);
+
+/**
+ * Updates a flat encryption context filled by aws_cryptosdk_enc_ctx_flat_deserialize after its serialized
+ * bytes have been copied from old_base to new_base, so that it refers to the copy instead.
+ */
+void aws_cryptosdk_enc_ctx_flat_rebase(
+    struct aws_cryptosdk_enc_ctx_flat *flat, const uint8_t *old_base, const uint8_t *new_base);
+
+/**
+ * Adds copies of the entries of the flat encryption context to enc_ctx, which must be empty, as aws_strings
+ * allocated with the flat context's allocator and owned by enc_ctx. enc_ctx is independent of the flat
+ * context afterwards. On failure enc_ctx is left empty.
+ */
+int aws_cryptosdk_enc_ctx_flat_export(struct aws_cryptosdk_enc_ctx_flat *flat, struct aws_hash_table *enc_ctx);
+
+/**
+ * Sets *serialized to the serialized form of the flat encryption context, which stays valid until the flat
+ * context is next changed. Raises AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED if the context is too large to serialize.
+ */
+int aws_cryptosdk_enc_ctx_flat_serialize(
+    struct aws_cryptosdk_enc_ctx_flat *flat, struct aws_byte_cursor *serialized);
+
+/**
+ * Copies the SHA-512 digest of the serialized form of the flat encryption context to digest, which must
+ * have room for AWS_CRYPTOSDK_ENC_CTX_DIGEST_LEN bytes.
+ */
+int aws_cryptosdk_enc_ctx_flat_digest(struct aws_cryptosdk_enc_ctx_flat *flat, uint8_t *digest);
+
 /**
  * Serializes an encryption context into the given buffer, which must be preallocated.
  * The serialized context will be appended to the buffer (failing if it hits the buffer's capacity).
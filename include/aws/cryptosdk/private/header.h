@@ -20,6 +20,7 @@
 #include <aws/common/hash_table.h>
 #include "aws/cryptosdk/header.h"
 #include "aws/cryptosdk/materials.h"  // struct aws_cryptosdk_edk
+#include "aws/cryptosdk/private/enc_ctx.h"
 
 struct aws_cryptosdk_hdr {
     struct aws_allocator *alloc;
@@ -34,6 +35,12 @@ struct aws_cryptosdk_hdr {
     struct aws_hash_table enc_ctx;
     struct aws_array_list edk_list;
 
+    // Once enc_ctx_frozen is set by aws_cryptosdk_hdr_freeze_enc_ctx, a sorted view of enc_ctx with its
+    // serialized form already computed, which hdr_size and hdr_write use instead of enc_ctx. After
+    // aws_cryptosdk_hdr_parse_borrowed, views of the parsed encryption context, which nothing writes.
+    struct aws_cryptosdk_enc_ctx_flat enc_ctx_flat;
+    bool enc_ctx_frozen;
+
     // number of bytes of header except for IV and auth tag,
     // i.e., exactly the bytes that get authenticated
     size_t auth_len;
@@ -68,6 +75,13 @@ void aws_cryptosdk_hdr_clean_up(struct aws_cryptosdk_hdr *hdr);
  */
 void aws_cryptosdk_hdr_clear(struct aws_cryptosdk_hdr *hdr);
 
+/**
+ * Records that hdr->enc_ctx will not change any more, so that its serialized form is computed only
+ * once rather than every time the header is sized or written. hdr->enc_ctx must not be modified
+ * afterwards until the header is cleared.
+ */
+int aws_cryptosdk_hdr_freeze_enc_ctx(struct aws_cryptosdk_hdr *hdr);
+
 /**
  * Reads raw header data from src and populates hdr with all of the information about the
  * message. hdr must have been initialized with aws_cryptosdk_hdr_init.
@@ -77,6 +91,23 @@ void aws_cryptosdk_hdr_clear(struct aws_cryptosdk_hdr *hdr);
  */
 int aws_cryptosdk_hdr_parse(struct aws_cryptosdk_hdr *hdr, struct aws_byte_cursor *cursor);
 
+/**
+ * As aws_cryptosdk_hdr_parse, but the EDKs, and the encryption context in hdr->enc_ctx_flat, are parsed
+ * as views of the bytes at cursor (with no allocator), which therefore must stay valid and unchanged until
+ * the header is cleared; use aws_cryptosdk_hdr_rebase if they are moved.
+ *
+ * hdr->enc_ctx is only filled in once the whole header has been parsed, with strings of its own, so a
+ * partial header costs no allocations for it. It is independent of the parsed bytes, may be modified
+ * like that of any other header, and is what aws_cryptosdk_hdr_size and aws_cryptosdk_hdr_write use.
+ */
+int aws_cryptosdk_hdr_parse_borrowed(struct aws_cryptosdk_hdr *hdr, struct aws_byte_cursor *cursor);
+
+/**
+ * Updates a header parsed by aws_cryptosdk_hdr_parse_borrowed after the parsed bytes have been copied
+ * from old_base to new_base, so that it refers to the copy instead.
+ */
+void aws_cryptosdk_hdr_rebase(struct aws_cryptosdk_hdr *hdr, const uint8_t *old_base, const uint8_t *new_base);
+
 /**
  * Reads information from already parsed hdr object and determines how many bytes are
  * needed to serialize.
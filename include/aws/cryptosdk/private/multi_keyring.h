@@ -22,6 +22,12 @@ struct multi_keyring {
     struct aws_allocator *alloc;
     struct aws_cryptosdk_keyring *generator;
     struct aws_array_list children;  // list of (struct aws_cryptosdk_keyring *)
+    /* Runs child keyring calls in concurrent modes, which have no effect while it is NULL */
+    aws_cryptosdk_keyring_executor_fn executor;
+    void *executor_data;
+    bool concurrent_encrypt;
+    bool hedged_decrypt;
+    uint64_t hedge_delay_nanos;
 };
 
 #endif  // AWS_CRYPTOSDK_PRIVATE_MULTI_KEYRING_H
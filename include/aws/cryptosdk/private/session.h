@@ -65,6 +65,11 @@ struct aws_cryptosdk_session {
     uint8_t *header_copy;
     size_t header_size;
     struct aws_cryptosdk_hdr header;
+    /*
+     * Reference to the owner of any EDKs in the header which were borrowed from the encryption materials
+     * (e.g. from a cache entry) rather than copied, or NULL. Released when the header is cleared.
+     */
+    struct aws_cryptosdk_materials_owner *materials_owner;
     uint64_t frame_size; /* Frame size, zero for unframed */
 
     /* List of (struct aws_cryptosdk_keyring_trace_record)s */
@@ -13,15 +13,88 @@
  * limitations under the License.
  */
 
+#include <aws/common/array_list.h>
 #include <aws/common/byte_buf.h>
+#include <aws/common/condition_variable.h>
 #include <aws/common/linked_list.h> /* AWS_CONTAINER_OF */
 #include <aws/common/math.h>
+#include <aws/common/mutex.h>
+#include <aws/common/thread.h>
 #include <aws/cryptosdk/cache.h>
 #include <aws/cryptosdk/default_cmm.h>
 #include <aws/cryptosdk/enc_ctx.h>
+#include <aws/cryptosdk/keyring_trace.h>
+#include <aws/cryptosdk/list_utils.h>
 #include <aws/cryptosdk/private/cipher.h>
 #include <aws/cryptosdk/private/enc_ctx.h>
 
+/* Number of slots in each of the digest memos below */
+#define DIGEST_MEMO_SLOTS 16
+/* Number of independently locked sets of digest memos; each thread uses the one its thread ID hashes to */
+#define DIGEST_MEMO_SHARDS 4
+/* EDK lists up to this length are hashed without allocating any temporary working memory */
+#define SMALL_EDK_COUNT 8
+/* Maximum number of refresh-ahead requests waiting for the background thread; further requests are dropped */
+#define MAX_QUEUED_REFRESHES 32
+/*
+ * How long a request waits for another request's upstream call for the same cache ID before giving up on it and
+ * calling the upstream CMM itself
+ */
+#define DEFAULT_FLIGHT_WAIT_NANOS (2ULL * 1000 * 1000 * 1000)
+
+struct digest_memo_slot {
+    bool in_use;
+    uint64_t fingerprint;
+    /* The exact bytes which were hashed, so that hits can be verified against the request */
+    struct aws_byte_buf hashed;
+    uint8_t digest[AWS_CRYPTOSDK_MD_MAX_SIZE];
+};
+
+/*
+ * A small, direct-mapped memo of recently computed SHA-512 digests of encryption contexts or EDKs.
+ * A fingerprint collision only costs us a recomputation, as each hit is checked against the bytes
+ * that were actually hashed.
+ */
+struct digest_memo {
+    struct digest_memo_slot slots[DIGEST_MEMO_SLOTS];
+};
+
+/*
+ * One shard of the CMM's digest memos. Threads are spread across the shards so that concurrent requests rarely
+ * contend for the same lock.
+ */
+struct digest_memo_shard {
+    /* Protects all three memos */
+    struct aws_mutex lock;
+    /* Encryption context digests, used for decrypt cache IDs */
+    struct digest_memo enc_ctx_memo;
+    /* Complete encrypt cache IDs; the hashed bytes are the requested algorithm followed by the context */
+    struct digest_memo enc_request_memo;
+    /* EDK digests */
+    struct digest_memo edk_memo;
+};
+
+/*
+ * A refresh-ahead request, holding private copies of everything needed to repeat the original request
+ * against the upstream CMM.
+ */
+struct refresh_job {
+    bool is_encrypt;
+    uint8_t cache_id[AWS_CRYPTOSDK_MD_MAX_SIZE];
+    size_t cache_id_len;
+
+    struct aws_hash_table enc_ctx;
+    struct aws_cryptosdk_enc_request enc_request;
+    /* encrypted_data_keys holds deep copies of the request's EDKs */
+    struct aws_cryptosdk_dec_request dec_request;
+};
+
+/* Atomic counterpart of struct aws_cryptosdk_latency_histogram */
+struct latency_histogram {
+    struct aws_atomic_var count, total_nanos;
+    struct aws_atomic_var buckets[AWS_CRYPTOSDK_LATENCY_HISTOGRAM_BUCKETS];
+};
+
 struct caching_cmm {
     struct aws_cryptosdk_cmm base;
     struct aws_allocator *alloc;
@@ -32,9 +105,54 @@ struct caching_cmm {
     int (*clock_get_ticks)(uint64_t *now);
 
     uint64_t limit_messages, limit_bytes, ttl_nanos;
+
+    struct digest_memo_shard memo_shards[DIGEST_MEMO_SHARDS];
+
+    /*
+     * Cache IDs (struct aws_byte_buf *, owned by the requests in question) for which a request is currently
+     * calling the upstream CMM. Protected by flight_lock; flight_done is signalled whenever an entry is removed.
+     */
+    struct aws_mutex flight_lock;
+    struct aws_condition_variable flight_done;
+    struct aws_array_list flights;
+    uint64_t flight_wait_nanos;
+
+    /*
+     * Refresh-ahead threshold, as a percentage of the TTL and usage limits; zero if disabled. Requests load it
+     * with acquire ordering, and it only becomes non-zero once the refresher has been started, so a request
+     * which sees a non-zero value also sees the refresher's state.
+     */
+    struct aws_atomic_var refresh_percent;
+
+    /* If set, decrypt entries are cached per EDK rather than per EDK list */
+    bool per_edk_decrypt;
+
+    /*
+     * Refresh-ahead state. refresh_lock and refresh_signal are initialized with the CMM; the thread and queue
+     * are set up when refresh-ahead is first enabled. All but the thread itself is protected by refresh_lock.
+     */
+    struct aws_mutex refresh_lock;
+    struct aws_condition_variable refresh_signal;
+    bool refresher_started;
+    struct aws_thread refresher;
+    /* struct refresh_job * */
+    struct aws_array_list refresh_queue;
+    /* The job the refresher is currently running, if any */
+    struct refresh_job *refresh_in_flight;
+    bool refresher_stop;
+
+    /* Statistics (see aws_cryptosdk_caching_cmm_get_stats), updated with relaxed atomic operations */
+    struct aws_atomic_var stat_hits, stat_misses, stat_bypasses;
+    struct aws_atomic_var stat_invalidations_ttl, stat_invalidations_usage_limit;
+    struct latency_histogram upstream_enc_latency, upstream_dec_latency;
 };
 
 static void destroy_caching_cmm(struct aws_cryptosdk_cmm *generic_cmm);
+static int digest_memo_shards_init(struct caching_cmm *cmm);
+static void digest_memo_shards_clean_up(struct caching_cmm *cmm, size_t n_shards);
+static void refresh_job_destroy(struct caching_cmm *cmm, struct refresh_job *job);
+static void stop_refresher(struct caching_cmm *cmm);
+static void refresher_thread_fn(void *vp_cmm);
 static int generate_enc_materials(
     struct aws_cryptosdk_cmm *cmm,
     struct aws_cryptosdk_enc_materials **output,
@@ -52,7 +170,16 @@ static const struct aws_cryptosdk_cmm_vt caching_cmm_vt = { .vt_size
 static void destroy_caching_cmm(struct aws_cryptosdk_cmm *generic_cmm) {
     struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
 
+    /* This must come first, as a refresh in progress uses the upstream CMM and materials cache */
+    stop_refresher(cmm);
+
+    aws_condition_variable_clean_up(&cmm->refresh_signal);
+    aws_mutex_clean_up(&cmm->refresh_lock);
     aws_string_destroy(cmm->partition_id);
+    digest_memo_shards_clean_up(cmm, DIGEST_MEMO_SHARDS);
+    aws_array_list_clean_up(&cmm->flights);
+    aws_condition_variable_clean_up(&cmm->flight_done);
+    aws_mutex_clean_up(&cmm->flight_lock);
     aws_cryptosdk_materials_cache_release(cmm->materials_cache);
     aws_cryptosdk_cmm_release(cmm->upstream);
     aws_mem_release(cmm->alloc, cmm);
@@ -133,9 +260,81 @@ int aws_cryptosdk_caching_cmm_set_limit_messages(struct aws_cryptosdk_cmm *gener
     return AWS_OP_SUCCESS;
 }
 
+int aws_cryptosdk_caching_cmm_set_refresh_ahead(struct aws_cryptosdk_cmm *generic_cmm, uint32_t refresh_percent) {
+    struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
+    if (generic_cmm->vtable != &caching_cmm_vt) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    if (refresh_percent >= 100) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    /* Holding refresh_lock serializes concurrent calls; the refresher itself waits for it before doing anything */
+    if (aws_mutex_lock(&cmm->refresh_lock)) {
+        return AWS_OP_ERR;
+    }
+
+    if (refresh_percent && !cmm->refresher_started) {
+        if (aws_array_list_init_dynamic(
+                &cmm->refresh_queue, cmm->alloc, MAX_QUEUED_REFRESHES, sizeof(struct refresh_job *))) {
+            goto err_queue;
+        }
+
+        cmm->refresh_in_flight = NULL;
+        cmm->refresher_stop    = false;
+
+        if (aws_thread_init(&cmm->refresher, cmm->alloc)) {
+            goto err_thread_init;
+        }
+
+        if (aws_thread_launch(&cmm->refresher, refresher_thread_fn, cmm, aws_default_thread_options())) {
+            goto err_thread_launch;
+        }
+
+        cmm->refresher_started = true;
+    }
+
+    aws_atomic_store_int_explicit(&cmm->refresh_percent, refresh_percent, aws_memory_order_release);
+
+    if (aws_mutex_unlock(&cmm->refresh_lock)) {
+        abort();
+    }
+
+    return AWS_OP_SUCCESS;
+
+err_thread_launch:
+    aws_thread_clean_up(&cmm->refresher);
+err_thread_init:
+    aws_array_list_clean_up(&cmm->refresh_queue);
+err_queue:
+    if (aws_mutex_unlock(&cmm->refresh_lock)) {
+        abort();
+    }
+
+    return AWS_OP_ERR;
+}
+
+int aws_cryptosdk_caching_cmm_set_per_edk_decrypt(struct aws_cryptosdk_cmm *generic_cmm, bool per_edk) {
+    struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
+    if (generic_cmm->vtable != &caching_cmm_vt) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    cmm->per_edk_decrypt = per_edk;
+    return AWS_OP_SUCCESS;
+}
+
 /* Returns zero if any of the arguments have invalid values
  * and returns UINT64_MAX if there would be an overflow.
  */
+AWS_CRYPTOSDK_TEST_STATIC
+void caching_cmm_set_flight_wait(struct aws_cryptosdk_cmm *generic_cmm, uint64_t flight_wait_nanos) {
+    struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
+
+    cmm->flight_wait_nanos = flight_wait_nanos;
+}
+
 AWS_CRYPTOSDK_TEST_STATIC
 uint64_t convert_ttl_to_nanos(uint64_t ttl, enum aws_timestamp_unit ttl_units) {
     if (!ttl || (ttl_units != AWS_TIMESTAMP_SECS && ttl_units != AWS_TIMESTAMP_MILLIS &&
@@ -159,6 +358,93 @@ int aws_cryptosdk_caching_cmm_set_ttl(
     return AWS_OP_SUCCESS;
 }
 
+/********** Statistics **********/
+
+static void latency_histogram_init(struct latency_histogram *hist) {
+    aws_atomic_init_int(&hist->count, 0);
+    aws_atomic_init_int(&hist->total_nanos, 0);
+
+    for (size_t i = 0; i < AWS_CRYPTOSDK_LATENCY_HISTOGRAM_BUCKETS; i++) {
+        aws_atomic_init_int(&hist->buckets[i], 0);
+    }
+}
+
+static void stats_init(struct caching_cmm *cmm) {
+    aws_atomic_init_int(&cmm->stat_hits, 0);
+    aws_atomic_init_int(&cmm->stat_misses, 0);
+    aws_atomic_init_int(&cmm->stat_bypasses, 0);
+    aws_atomic_init_int(&cmm->stat_invalidations_ttl, 0);
+    aws_atomic_init_int(&cmm->stat_invalidations_usage_limit, 0);
+    latency_histogram_init(&cmm->upstream_enc_latency);
+    latency_histogram_init(&cmm->upstream_dec_latency);
+}
+
+static inline void stat_add(struct aws_atomic_var *counter, size_t n) {
+    /* The counters don't order any other memory accesses, so relaxed ordering suffices */
+    aws_atomic_fetch_add_explicit(counter, n, aws_memory_order_relaxed);
+}
+
+static inline uint64_t stat_read(const struct aws_atomic_var *counter) {
+    return aws_atomic_load_int_explicit(counter, aws_memory_order_relaxed);
+}
+
+/* Returns the start time of an upstream call, for use with record_upstream_latency */
+static uint64_t upstream_call_start(void) {
+    uint64_t now;
+
+    return aws_high_res_clock_get_ticks(&now) ? 0 : now;
+}
+
+static void record_upstream_latency(struct latency_histogram *hist, uint64_t start) {
+    uint64_t end;
+
+    if (!start || aws_high_res_clock_get_ticks(&end) || end < start) {
+        return;
+    }
+
+    uint64_t nanos  = end - start;
+    uint64_t micros = nanos / 1000;
+    size_t bucket   = 0;
+
+    /* Bucket 0 is [0, 1us); bucket i is [2^(i-1), 2^i) us; the last bucket is unbounded */
+    while (micros && bucket < AWS_CRYPTOSDK_LATENCY_HISTOGRAM_BUCKETS - 1) {
+        micros >>= 1;
+        bucket++;
+    }
+
+    stat_add(&hist->count, 1);
+    stat_add(&hist->total_nanos, (size_t)nanos);
+    stat_add(&hist->buckets[bucket], 1);
+}
+
+static void latency_histogram_snapshot(
+    struct aws_cryptosdk_latency_histogram *out, const struct latency_histogram *hist) {
+    out->count       = stat_read(&hist->count);
+    out->total_nanos = stat_read(&hist->total_nanos);
+
+    for (size_t i = 0; i < AWS_CRYPTOSDK_LATENCY_HISTOGRAM_BUCKETS; i++) {
+        out->buckets[i] = stat_read(&hist->buckets[i]);
+    }
+}
+
+int aws_cryptosdk_caching_cmm_get_stats(
+    struct aws_cryptosdk_cmm *generic_cmm, struct aws_cryptosdk_caching_cmm_stats *stats) {
+    struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
+    if (generic_cmm->vtable != &caching_cmm_vt) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    stats->hits                      = stat_read(&cmm->stat_hits);
+    stats->misses                    = stat_read(&cmm->stat_misses);
+    stats->bypasses                  = stat_read(&cmm->stat_bypasses);
+    stats->invalidations_ttl         = stat_read(&cmm->stat_invalidations_ttl);
+    stats->invalidations_usage_limit = stat_read(&cmm->stat_invalidations_usage_limit);
+    latency_histogram_snapshot(&stats->upstream_encrypt_latency, &cmm->upstream_enc_latency);
+    latency_histogram_snapshot(&stats->upstream_decrypt_latency, &cmm->upstream_dec_latency);
+
+    return AWS_OP_SUCCESS;
+}
+
 struct aws_cryptosdk_cmm *aws_cryptosdk_caching_cmm_new_from_cmm(
     struct aws_allocator *alloc,
     struct aws_cryptosdk_materials_cache *materials_cache,
@@ -180,7 +466,31 @@ struct aws_cryptosdk_cmm *aws_cryptosdk_caching_cmm_new_from_cmm(
 
     struct caching_cmm *cmm = aws_mem_acquire(alloc, sizeof(*cmm));
     if (!cmm) {
-        return NULL;
+        goto err_alloc;
+    }
+
+    if (digest_memo_shards_init(cmm)) {
+        goto err_memo_shards;
+    }
+
+    if (aws_mutex_init(&cmm->flight_lock)) {
+        goto err_flight_lock;
+    }
+
+    if (aws_condition_variable_init(&cmm->flight_done)) {
+        goto err_flight_done;
+    }
+
+    if (aws_array_list_init_dynamic(&cmm->flights, alloc, 4, sizeof(const struct aws_byte_buf *))) {
+        goto err_flights;
+    }
+
+    if (aws_mutex_init(&cmm->refresh_lock)) {
+        goto err_refresh_lock;
+    }
+
+    if (aws_condition_variable_init(&cmm->refresh_signal)) {
+        goto err_refresh_signal;
     }
 
     aws_cryptosdk_cmm_base_init(&cmm->base, &caching_cmm_vt);
@@ -192,12 +502,34 @@ struct aws_cryptosdk_cmm *aws_cryptosdk_caching_cmm_new_from_cmm(
 
     // We use the test helper here just to ensure we don't get unused static function warnings
     caching_cmm_set_clock(&cmm->base, aws_sys_clock_get_ticks);
+    caching_cmm_set_flight_wait(&cmm->base, DEFAULT_FLIGHT_WAIT_NANOS);
 
     cmm->limit_messages = AWS_CRYPTOSDK_CACHE_MAX_LIMIT_MESSAGES;
     cmm->limit_bytes    = INT64_MAX;
     cmm->ttl_nanos      = ttl_nanos;
 
+    aws_atomic_init_int(&cmm->refresh_percent, 0);
+    cmm->refresher_started = false;
+
+    stats_init(cmm);
+
     return &cmm->base;
+
+err_refresh_signal:
+    aws_mutex_clean_up(&cmm->refresh_lock);
+err_refresh_lock:
+    aws_array_list_clean_up(&cmm->flights);
+err_flights:
+    aws_condition_variable_clean_up(&cmm->flight_done);
+err_flight_done:
+    aws_mutex_clean_up(&cmm->flight_lock);
+err_flight_lock:
+    digest_memo_shards_clean_up(cmm, DIGEST_MEMO_SHARDS);
+err_memo_shards:
+    aws_mem_release(alloc, cmm);
+err_alloc:
+    aws_string_destroy(partition_id_str);
+    return NULL;
 }
 
 struct aws_cryptosdk_cmm *aws_cryptosdk_caching_cmm_new_from_keyring(
@@ -247,193 +579,568 @@ static bool check_ttl(struct caching_cmm *cmm, struct aws_cryptosdk_materials_ca
     return true;
 }
 
-AWS_CRYPTOSDK_TEST_STATIC
-int hash_enc_request(
-    struct aws_string *partition_id, struct aws_byte_buf *out, const struct aws_cryptosdk_enc_request *req) {
-    /*
-     * Here, we hash the relevant aspects of the request structure to use as a cache identifier.
-     * The hash is intended to match Java and Python, but since we've not yet committed to maintaining
-     * that parity indefinitely, we don't include this structure as part of the header API docs.
-     * The structure, internally, is:
-     *   [partition ID hash]
-     *   [0x01 if the request alg id is set, otherwise 0x00]
-     *   [request alg id, if set]
-     *   [serialized encryption context]
-     */
-    struct aws_byte_buf context_buf              = { 0 };
-    uint8_t digestbuf[AWS_CRYPTOSDK_MD_MAX_SIZE] = { 0 };
+/*
+ * Cache ID computation
+ *
+ * Cache IDs must match the other SDKs, so their structure (see hash_enc_request and hash_dec_request) can't
+ * change. However, most of the work in computing them is hashing the serialized encryption context and (on
+ * decrypt) each EDK, and in practice the same contexts and EDKs recur from one request to the next. We therefore
+ * keep small memos of recently computed digests: complete cache IDs for encrypt requests, and digests of the
+ * encryption context and of each EDK for decrypt requests.
+ */
 
-    if (out->capacity < AWS_CRYPTOSDK_MD_MAX_SIZE) {
-        return aws_raise_error(AWS_ERROR_INVALID_BUFFER_SIZE);
-    }
+static void digest_memo_init(struct digest_memo *memo) {
+    memset(memo->slots, 0, sizeof(memo->slots));
+}
 
-    struct aws_cryptosdk_md_context *md_context, *enc_ctx_md;
-    if (aws_cryptosdk_md_init(req->alloc, &md_context, AWS_CRYPTOSDK_MD_SHA512)) {
-        return AWS_OP_ERR;
+static void digest_memo_clean_up(struct digest_memo *memo) {
+    for (size_t i = 0; i < DIGEST_MEMO_SLOTS; i++) {
+        aws_byte_buf_clean_up(&memo->slots[i].hashed);
     }
+}
 
-    if (aws_cryptosdk_md_init(req->alloc, &enc_ctx_md, AWS_CRYPTOSDK_MD_SHA512)) {
-        return AWS_OP_ERR;
+static int digest_memo_shards_init(struct caching_cmm *cmm) {
+    for (size_t i = 0; i < DIGEST_MEMO_SHARDS; i++) {
+        struct digest_memo_shard *shard = &cmm->memo_shards[i];
+
+        if (aws_mutex_init(&shard->lock)) {
+            digest_memo_shards_clean_up(cmm, i);
+            return AWS_OP_ERR;
+        }
+
+        digest_memo_init(&shard->enc_ctx_memo);
+        digest_memo_init(&shard->enc_request_memo);
+        digest_memo_init(&shard->edk_memo);
     }
 
-    if (aws_cryptosdk_md_update(md_context, aws_string_bytes(partition_id), partition_id->len)) {
-        goto md_err;
+    return AWS_OP_SUCCESS;
+}
+
+/* Cleans up the first n_shards memo shards */
+static void digest_memo_shards_clean_up(struct caching_cmm *cmm, size_t n_shards) {
+    for (size_t i = 0; i < n_shards; i++) {
+        struct digest_memo_shard *shard = &cmm->memo_shards[i];
+
+        digest_memo_clean_up(&shard->enc_ctx_memo);
+        digest_memo_clean_up(&shard->enc_request_memo);
+        digest_memo_clean_up(&shard->edk_memo);
+        aws_mutex_clean_up(&shard->lock);
     }
+}
 
-    uint8_t requested_alg_present = req->requested_alg != 0;
-    if (aws_cryptosdk_md_update(md_context, &requested_alg_present, 1)) {
-        goto md_err;
+/* Returns the memo shard used by the calling thread */
+static struct digest_memo_shard *digest_memo_shard_for_thread(struct caching_cmm *cmm) {
+    uint64_t thread_id            = (uint64_t)aws_thread_current_thread_id();
+    struct aws_byte_cursor cursor = aws_byte_cursor_from_array(&thread_id, sizeof(thread_id));
+
+    return &cmm->memo_shards[aws_hash_byte_cursor_ptr(&cursor) % DIGEST_MEMO_SHARDS];
+}
+
+/*
+ * Looks up the digest for an item with the given fingerprint. match is invoked (with the memo lock held) to
+ * confirm that the bytes hashed for the slot are exactly the serialized form of item.
+ */
+static bool digest_memo_find(
+    struct aws_mutex *lock,
+    struct digest_memo *memo,
+    uint64_t fingerprint,
+    bool (*match)(const struct aws_byte_buf *hashed, const void *item),
+    const void *item,
+    uint8_t *digest) {
+    struct digest_memo_slot *slot = &memo->slots[fingerprint % DIGEST_MEMO_SLOTS];
+    bool found                    = false;
+
+    if (aws_mutex_lock(lock)) {
+        return false;
     }
 
-    if (requested_alg_present) {
-        uint16_t alg_id = aws_hton16(req->requested_alg);
-        if (aws_cryptosdk_md_update(md_context, &alg_id, sizeof(alg_id))) {
-            goto md_err;
-        }
+    if (slot->in_use && slot->fingerprint == fingerprint && match(&slot->hashed, item)) {
+        memcpy(digest, slot->digest, sizeof(slot->digest));
+        found = true;
     }
 
-    size_t context_size;
-    if (aws_cryptosdk_enc_ctx_size(&context_size, req->enc_ctx) ||
-        aws_byte_buf_init(&context_buf, req->alloc, context_size) ||
-        aws_cryptosdk_enc_ctx_serialize(req->alloc, &context_buf, req->enc_ctx) ||
-        aws_cryptosdk_md_update(enc_ctx_md, context_buf.buffer, context_buf.len)) {
-        goto md_err;
+    if (aws_mutex_unlock(lock)) {
+        abort();
     }
 
-    size_t enc_ctx_digest_len;
-    if (aws_cryptosdk_md_finish(enc_ctx_md, digestbuf, &enc_ctx_digest_len)) {
-        enc_ctx_md = NULL;
-        goto md_err;
+    return found;
+}
+
+/*
+ * Records a digest in the memo, replacing whatever previously occupied the slot. write_hashed is invoked
+ * (without the memo lock held) to write the hashed_len bytes that were hashed for item into the slot's own
+ * buffer, which is allocated from alloc. This must be the CMM's own allocator, since the slot outlives the
+ * request (and the request's allocator) that produced the digest. The memo is only an optimization, so failing
+ * to allocate the buffer just leaves the slot as it was.
+ */
+static void digest_memo_store(
+    struct aws_mutex *lock,
+    struct digest_memo *memo,
+    struct aws_allocator *alloc,
+    uint64_t fingerprint,
+    size_t hashed_len,
+    bool (*write_hashed)(struct aws_byte_buf *dest, const void *item),
+    const void *item,
+    const uint8_t *digest) {
+    struct digest_memo_slot *slot = &memo->slots[fingerprint % DIGEST_MEMO_SLOTS];
+    struct aws_byte_buf evicted;
+
+    /* Build the copy outside the lock */
+    if (aws_byte_buf_init(&evicted, alloc, hashed_len)) {
+        return;
     }
-    enc_ctx_md = NULL;
 
-    if (aws_cryptosdk_md_update(md_context, digestbuf, enc_ctx_digest_len)) {
-        goto md_err;
+    if (!write_hashed(&evicted, item) || evicted.len != hashed_len) {
+        aws_byte_buf_clean_up(&evicted);
+        return;
     }
 
-    aws_byte_buf_clean_up(&context_buf);
-    return aws_cryptosdk_md_finish(md_context, out->buffer, &out->len);
+    if (!aws_mutex_lock(lock)) {
+        struct aws_byte_buf copy = evicted;
 
-md_err:
-    aws_byte_buf_clean_up(&context_buf);
-    aws_cryptosdk_md_abort(md_context);
-    aws_cryptosdk_md_abort(enc_ctx_md);
+        evicted           = slot->hashed;
+        slot->in_use      = true;
+        slot->fingerprint = fingerprint;
+        slot->hashed      = copy;
+        memcpy(slot->digest, digest, sizeof(slot->digest));
 
-    return AWS_OP_ERR;
+        if (aws_mutex_unlock(lock)) {
+            abort();
+        }
+    }
+
+    /* Free the evicted buffer (or, if we failed to lock, the copy) outside the lock */
+    aws_byte_buf_clean_up(&evicted);
 }
 
-struct edk_hash_entry {
-    uint8_t hash_data[AWS_CRYPTOSDK_MD_MAX_SIZE];
-};
+/*
+ * Consumes a field with a 16-bit big-endian length prefix from cursor, and returns true if its contents
+ * are equal to expected.
+ */
+static bool serialized_field_matches(struct aws_byte_cursor *cursor, const uint8_t *expected, size_t expected_len) {
+    uint16_t field_len;
 
-static int edk_hash_entry_cmp(const void *vp_a, const void *vp_b) {
-    const struct edk_hash_entry *a = vp_a, *b = vp_b;
+    if (!aws_byte_cursor_read_be16(cursor, &field_len) || field_len != expected_len) {
+        return false;
+    }
 
-    return memcmp(a->hash_data, b->hash_data, sizeof(a->hash_data));
+    struct aws_byte_cursor field = aws_byte_cursor_advance(cursor, field_len);
+
+    return field.len == expected_len && (!expected_len || !memcmp(field.ptr, expected, expected_len));
 }
 
-static int hash_edk_field(struct aws_cryptosdk_md_context *md_context, const struct aws_byte_buf *field) {
-    uint16_t field_len;
+/* Fingerprints a flat encryption context; used only to select and pre-check memo slots */
+static uint64_t enc_ctx_fingerprint(const struct aws_cryptosdk_enc_ctx_flat *flat) {
+    uint64_t fingerprint = aws_array_list_length(&flat->entries);
 
-    if (field->len > UINT16_MAX) {
-        return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
-    }
+    for (size_t i = 0; i < aws_array_list_length(&flat->entries); i++) {
+        struct aws_cryptosdk_enc_ctx_entry *entry = NULL;
 
-    field_len = aws_ntoh16(field->len);
-    if (aws_cryptosdk_md_update(md_context, &field_len, sizeof(field_len)) ||
-        aws_cryptosdk_md_update(md_context, field->buffer, field->len)) {
-        return AWS_OP_ERR;
+        aws_array_list_get_at_ptr(&flat->entries, (void **)&entry, i);
+        fingerprint = fingerprint * 31 + aws_hash_byte_cursor_ptr(&entry->key);
+        fingerprint = fingerprint * 31 + aws_hash_byte_cursor_ptr(&entry->value);
     }
 
-    return AWS_OP_SUCCESS;
+    return fingerprint;
 }
 
-AWS_CRYPTOSDK_TEST_STATIC
-int hash_edk_for_decrypt(
-    struct aws_allocator *alloc, struct edk_hash_entry *entry, const struct aws_cryptosdk_edk *edk) {
-    struct aws_cryptosdk_md_context *md_context = NULL;
-    if (aws_cryptosdk_md_init(alloc, &md_context, AWS_CRYPTOSDK_MD_SHA512)) {
-        return AWS_OP_ERR;
+/* Returns true if cursor holds exactly the serialized form of the flat encryption context */
+static bool enc_ctx_cursor_matches(struct aws_byte_cursor cursor, const struct aws_cryptosdk_enc_ctx_flat *flat) {
+    size_t num_entries = aws_array_list_length(&flat->entries);
+    uint16_t serialized_count;
+
+    if (num_entries == 0) {
+        /* An empty context serializes to nothing at all */
+        return cursor.len == 0;
     }
 
-    if (hash_edk_field(md_context, &edk->provider_id) || hash_edk_field(md_context, &edk->provider_info) ||
-        hash_edk_field(md_context, &edk->ciphertext)) {
-        aws_cryptosdk_md_abort(md_context);
-        return AWS_OP_ERR;
+    if (!aws_byte_cursor_read_be16(&cursor, &serialized_count) || serialized_count != num_entries) {
+        return false;
     }
 
-    memset(entry->hash_data, 0, sizeof(entry->hash_data));
+    for (size_t i = 0; i < num_entries; i++) {
+        struct aws_cryptosdk_enc_ctx_entry *entry = NULL;
 
-    size_t ignored_length;
-    return aws_cryptosdk_md_finish(md_context, entry->hash_data, &ignored_length);
+        if (aws_array_list_get_at_ptr(&flat->entries, (void **)&entry, i)) {
+            return false;
+        }
+
+        if (!serialized_field_matches(&cursor, entry->key.ptr, entry->key.len) ||
+            !serialized_field_matches(&cursor, entry->value.ptr, entry->value.len)) {
+            return false;
+        }
+    }
+
+    return cursor.len == 0;
 }
 
-AWS_CRYPTOSDK_TEST_STATIC
-int hash_dec_request(
-    const struct aws_string *partition_id, struct aws_byte_buf *out, const struct aws_cryptosdk_dec_request *req) {
-    static const struct edk_hash_entry zero_entry = { { 0 } };
+static bool enc_ctx_matches(const struct aws_byte_buf *hashed, const void *vp_flat) {
+    return enc_ctx_cursor_matches(aws_byte_cursor_from_buf(hashed), vp_flat);
+}
 
-    int rv             = AWS_OP_ERR;
-    size_t md_length   = aws_cryptosdk_md_size(AWS_CRYPTOSDK_MD_SHA512);
-    uint16_t alg_id_be = aws_hton16(req->alg);
+static bool write_cursor(struct aws_byte_buf *dest, const void *vp_cursor) {
+    const struct aws_byte_cursor *cursor = vp_cursor;
 
-    struct aws_byte_buf context_buf                       = { 0 };
-    uint8_t context_digest_arr[AWS_CRYPTOSDK_MD_MAX_SIZE] = { 0 };
-    struct aws_byte_buf context_digest_buf = aws_byte_buf_from_array(context_digest_arr, sizeof(context_digest_arr));
-    struct aws_cryptosdk_md_context *md_context = NULL;
-    struct aws_array_list edk_hash_list;
+    return cursor->len == 0 || aws_byte_buf_write(dest, cursor->ptr, cursor->len);
+}
 
-    if (out->capacity < AWS_CRYPTOSDK_MD_MAX_SIZE) {
-        return aws_raise_error(AWS_ERROR_INVALID_BUFFER_SIZE);
+/*
+ * Computes the SHA-512 digest of the serialized encryption context. If cmm is non-NULL, a recently seen
+ * context is looked up in its memo instead of being serialized and hashed again.
+ */
+static int enc_ctx_digest(
+    struct caching_cmm *cmm, struct aws_allocator *alloc, uint8_t *digest, const struct aws_hash_table *enc_ctx) {
+    struct aws_cryptosdk_enc_ctx_entry entries_storage[AWS_CRYPTOSDK_ENC_CTX_SMALL_SIZE];
+    struct aws_cryptosdk_enc_ctx_flat flat;
+    struct digest_memo_shard *shard = NULL;
+    struct aws_byte_cursor serialized;
+    uint64_t fingerprint = 0;
+    int rv               = AWS_OP_ERR;
+
+    /* The context is sorted once, both to look it up in the memo and to serialize it on a miss */
+    aws_cryptosdk_enc_ctx_flat_init(&flat, alloc, entries_storage, AWS_CRYPTOSDK_ENC_CTX_SMALL_SIZE);
+    if (aws_cryptosdk_enc_ctx_flat_set(&flat, enc_ctx)) {
+        goto out;
     }
 
-    if (aws_array_list_init_dynamic(
-            &edk_hash_list,
-            req->alloc,
-            aws_array_list_length(&req->encrypted_data_keys),
-            sizeof(struct edk_hash_entry))) {
-        return AWS_OP_ERR;
+    if (cmm) {
+        shard       = digest_memo_shard_for_thread(cmm);
+        fingerprint = enc_ctx_fingerprint(&flat);
+        if (digest_memo_find(&shard->lock, &shard->enc_ctx_memo, fingerprint, enc_ctx_matches, &flat, digest)) {
+            rv = AWS_OP_SUCCESS;
+            goto out;
+        }
     }
 
-    size_t context_size;
-    if (aws_cryptosdk_md_init(req->alloc, &md_context, AWS_CRYPTOSDK_MD_SHA512) ||
-        aws_cryptosdk_enc_ctx_size(&context_size, req->enc_ctx) ||
-        aws_byte_buf_init(&context_buf, req->alloc, context_size) ||
-        aws_cryptosdk_enc_ctx_serialize(req->alloc, &context_buf, req->enc_ctx) ||
-        aws_cryptosdk_md_update(md_context, context_buf.buffer, context_buf.len)) {
-        goto err;
+    if (aws_cryptosdk_enc_ctx_flat_digest(&flat, digest)) {
+        goto out;
     }
 
-    if (aws_cryptosdk_md_finish(md_context, context_digest_buf.buffer, &context_digest_buf.len)) {
-        md_context = NULL;
-        goto err;
+    /* flat_digest has already serialized the context; the memo copies those bytes, as flat is cleaned up below */
+    if (cmm && !aws_cryptosdk_enc_ctx_flat_serialize(&flat, &serialized)) {
+        digest_memo_store(
+            &shard->lock,
+            &shard->enc_ctx_memo,
+            cmm->alloc,
+            fingerprint,
+            serialized.len,
+            write_cursor,
+            &serialized,
+            digest);
     }
 
-    // The decryption request cache IDs are constructed out of a hash of:
-    // [partition ID]
-    // [algorithm ID]
-    // [EDK hashes, in sorted order]
-    // [digestLength zero bytes]
-    // [encryption context hash]
+    rv = AWS_OP_SUCCESS;
+out:
+    aws_cryptosdk_enc_ctx_flat_clean_up(&flat);
+    return rv;
+}
 
-    // Before we start hashing the top level stuff, let's hash the EDKs and sort them
-    // Note that the EDK entries have no length field - if we introduce a larger hash
-    // in the future, we just treat the smaller (?) SHA-512 as the top-order bits of
-    // a larger field.
+/*
+ * An encrypt request as recorded in the encrypt cache ID memo: the requested algorithm (zero if none), as a
+ * 16-bit big-endian value, followed by the serialized encryption context. The partition ID is the CMM's own,
+ * so it needn't be recorded.
+ */
+struct enc_request_key {
+    uint16_t requested_alg;
+    const struct aws_cryptosdk_enc_ctx_flat *flat;
+    /* Set only once the context has been serialized, on a miss */
+    struct aws_byte_cursor serialized;
+};
 
-    size_t n_edks = aws_array_list_length(&req->encrypted_data_keys);
-    for (size_t i = 0; i < n_edks; i++) {
-        struct edk_hash_entry entry;
-        const struct aws_cryptosdk_edk *edk = NULL;
-        void *vp_edk                        = NULL;
+static uint64_t enc_request_fingerprint(const struct enc_request_key *key) {
+    return enc_ctx_fingerprint(key->flat) * 31 + key->requested_alg;
+}
 
-        if (aws_array_list_get_at_ptr(&req->encrypted_data_keys, &vp_edk, i)) {
-            goto err;
-        }
+static bool enc_request_matches(const struct aws_byte_buf *hashed, const void *vp_key) {
+    const struct enc_request_key *key = vp_key;
+    struct aws_byte_cursor cursor     = aws_byte_cursor_from_buf(hashed);
+    uint16_t requested_alg;
+
+    return aws_byte_cursor_read_be16(&cursor, &requested_alg) && requested_alg == key->requested_alg &&
+           enc_ctx_cursor_matches(cursor, key->flat);
+}
+
+static bool write_enc_request(struct aws_byte_buf *dest, const void *vp_key) {
+    const struct enc_request_key *key = vp_key;
+
+    return aws_byte_buf_write_be16(dest, key->requested_alg) && write_cursor(dest, &key->serialized);
+}
+
+/*
+ * Computes the encrypt cache ID for req. If cmm is non-NULL, partition_id must be the CMM's own, and a recently
+ * seen request is looked up in the CMM's memo of complete cache IDs, so that neither the encryption context nor
+ * the cache ID itself is hashed again.
+ */
+static int hash_enc_request_memoized(
+    struct caching_cmm *cmm,
+    const struct aws_string *partition_id,
+    struct aws_byte_buf *out,
+    const struct aws_cryptosdk_enc_request *req) {
+    /*
+     * Here, we hash the relevant aspects of the request structure to use as a cache identifier.
+     * The hash is intended to match Java and Python, but since we've not yet committed to maintaining
+     * that parity indefinitely, we don't include this structure as part of the header API docs.
+     * The structure, internally, is:
+     *   [partition ID hash]
+     *   [0x01 if the request alg id is set, otherwise 0x00]
+     *   [request alg id, if set]
+     *   [hash of serialized encryption context]
+     */
+    uint8_t digestbuf[AWS_CRYPTOSDK_MD_MAX_SIZE] = { 0 };
+    struct aws_cryptosdk_md_context *md_context  = NULL;
+    struct aws_cryptosdk_enc_ctx_entry entries_storage[AWS_CRYPTOSDK_ENC_CTX_SMALL_SIZE];
+    struct aws_cryptosdk_enc_ctx_flat flat;
+    struct digest_memo_shard *shard = NULL;
+    struct enc_request_key key      = { 0 };
+    uint64_t fingerprint            = 0;
+    int rv                          = AWS_OP_ERR;
+
+    if (out->capacity < AWS_CRYPTOSDK_MD_MAX_SIZE) {
+        return aws_raise_error(AWS_ERROR_INVALID_BUFFER_SIZE);
+    }
+
+    aws_cryptosdk_enc_ctx_flat_init(&flat, req->alloc, entries_storage, AWS_CRYPTOSDK_ENC_CTX_SMALL_SIZE);
+    if (aws_cryptosdk_enc_ctx_flat_set(&flat, req->enc_ctx)) {
+        goto out;
+    }
+
+    key.requested_alg = (uint16_t)req->requested_alg;
+    key.flat          = &flat;
+
+    if (cmm) {
+        shard       = digest_memo_shard_for_thread(cmm);
+        fingerprint = enc_request_fingerprint(&key);
+        if (digest_memo_find(
+                &shard->lock, &shard->enc_request_memo, fingerprint, enc_request_matches, &key, out->buffer)) {
+            out->len = aws_cryptosdk_md_size(AWS_CRYPTOSDK_MD_SHA512);
+            rv       = AWS_OP_SUCCESS;
+            goto out;
+        }
+    }
+
+    if (aws_cryptosdk_enc_ctx_flat_digest(&flat, digestbuf)) {
+        goto out;
+    }
+
+    if (aws_cryptosdk_md_init(req->alloc, &md_context, AWS_CRYPTOSDK_MD_SHA512) ||
+        aws_cryptosdk_md_update(md_context, aws_string_bytes(partition_id), partition_id->len)) {
+        goto out;
+    }
+
+    uint8_t requested_alg_present = req->requested_alg != 0;
+    if (aws_cryptosdk_md_update(md_context, &requested_alg_present, 1)) {
+        goto out;
+    }
+
+    if (requested_alg_present) {
+        uint16_t alg_id = aws_hton16(req->requested_alg);
+        if (aws_cryptosdk_md_update(md_context, &alg_id, sizeof(alg_id))) {
+            goto out;
+        }
+    }
+
+    if (aws_cryptosdk_md_update(md_context, digestbuf, aws_cryptosdk_md_size(AWS_CRYPTOSDK_MD_SHA512))) {
+        goto out;
+    }
+
+    rv         = aws_cryptosdk_md_finish(md_context, out->buffer, &out->len);
+    md_context = NULL;
+
+    if (rv == AWS_OP_SUCCESS && cmm && !aws_cryptosdk_enc_ctx_flat_serialize(&flat, &key.serialized)) {
+        digest_memo_store(
+            &shard->lock,
+            &shard->enc_request_memo,
+            cmm->alloc,
+            fingerprint,
+            sizeof(uint16_t) + key.serialized.len,
+            write_enc_request,
+            &key,
+            out->buffer);
+    }
+
+out:
+    aws_cryptosdk_md_abort(md_context);
+    aws_cryptosdk_enc_ctx_flat_clean_up(&flat);
+
+    return rv;
+}
+
+AWS_CRYPTOSDK_TEST_STATIC
+int hash_enc_request(
+    struct aws_string *partition_id, struct aws_byte_buf *out, const struct aws_cryptosdk_enc_request *req) {
+    return hash_enc_request_memoized(NULL, partition_id, out, req);
+}
+
+struct edk_hash_entry {
+    uint8_t hash_data[AWS_CRYPTOSDK_MD_MAX_SIZE];
+};
+
+static int edk_hash_entry_cmp(const void *vp_a, const void *vp_b) {
+    const struct edk_hash_entry *a = vp_a, *b = vp_b;
+
+    return memcmp(a->hash_data, b->hash_data, sizeof(a->hash_data));
+}
+
+/*
+ * EDKs are hashed for decrypt cache IDs in serialized form: each of the provider ID, provider info, and
+ * ciphertext, preceded by its 16-bit big-endian length. The fields are streamed into the digest directly,
+ * so only the memo's own copy of the serialized EDK is ever allocated.
+ */
+static size_t edk_serialized_len(const struct aws_cryptosdk_edk *edk) {
+    /* Can't overflow, as each field is at most UINT16_MAX bytes */
+    return 3 * sizeof(uint16_t) + edk->provider_id.len + edk->provider_info.len + edk->ciphertext.len;
+}
+
+static int md_update_edk_field(struct aws_cryptosdk_md_context *md_context, const struct aws_byte_buf *field) {
+    uint16_t field_len_be = aws_hton16((uint16_t)field->len);
+
+    if (aws_cryptosdk_md_update(md_context, &field_len_be, sizeof(field_len_be))) {
+        return AWS_OP_ERR;
+    }
+
+    return field->len ? aws_cryptosdk_md_update(md_context, field->buffer, field->len) : AWS_OP_SUCCESS;
+}
+
+static bool write_edk_field(struct aws_byte_buf *dest, const struct aws_byte_buf *field) {
+    return aws_byte_buf_write_be16(dest, (uint16_t)field->len) &&
+           (!field->len || aws_byte_buf_write(dest, field->buffer, field->len));
+}
+
+static bool write_edk(struct aws_byte_buf *dest, const void *vp_edk) {
+    const struct aws_cryptosdk_edk *edk = vp_edk;
+
+    return write_edk_field(dest, &edk->provider_id) && write_edk_field(dest, &edk->provider_info) &&
+           write_edk_field(dest, &edk->ciphertext);
+}
+
+static uint64_t edk_fingerprint(const struct aws_cryptosdk_edk *edk) {
+    /* The ciphertext alone is all but unique; the remaining fields are checked by edk_matches */
+    struct aws_byte_cursor ciphertext = aws_byte_cursor_from_buf(&edk->ciphertext);
+
+    return aws_hash_byte_cursor_ptr(&ciphertext);
+}
+
+static bool edk_matches(const struct aws_byte_buf *hashed, const void *vp_edk) {
+    const struct aws_cryptosdk_edk *edk = vp_edk;
+    struct aws_byte_cursor cursor       = aws_byte_cursor_from_buf(hashed);
+
+    return serialized_field_matches(&cursor, edk->provider_id.buffer, edk->provider_id.len) &&
+           serialized_field_matches(&cursor, edk->provider_info.buffer, edk->provider_info.len) &&
+           serialized_field_matches(&cursor, edk->ciphertext.buffer, edk->ciphertext.len) && cursor.len == 0;
+}
+
+static int hash_edk_for_decrypt_memoized(
+    struct caching_cmm *cmm,
+    struct aws_allocator *alloc,
+    struct edk_hash_entry *entry,
+    const struct aws_cryptosdk_edk *edk) {
+    struct aws_cryptosdk_md_context *md_context = NULL;
+    struct digest_memo_shard *shard             = NULL;
+    uint64_t fingerprint                        = 0;
+    size_t ignored_length;
+
+    memset(entry->hash_data, 0, sizeof(entry->hash_data));
+
+    if (cmm) {
+        shard       = digest_memo_shard_for_thread(cmm);
+        fingerprint = edk_fingerprint(edk);
+        if (digest_memo_find(&shard->lock, &shard->edk_memo, fingerprint, edk_matches, edk, entry->hash_data)) {
+            return AWS_OP_SUCCESS;
+        }
+    }
+
+    if (edk->provider_id.len > UINT16_MAX || edk->provider_info.len > UINT16_MAX ||
+        edk->ciphertext.len > UINT16_MAX) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    }
+
+    if (aws_cryptosdk_md_init(alloc, &md_context, AWS_CRYPTOSDK_MD_SHA512) ||
+        md_update_edk_field(md_context, &edk->provider_id) || md_update_edk_field(md_context, &edk->provider_info) ||
+        md_update_edk_field(md_context, &edk->ciphertext)) {
+        aws_cryptosdk_md_abort(md_context);
+        return AWS_OP_ERR;
+    }
+
+    if (aws_cryptosdk_md_finish(md_context, entry->hash_data, &ignored_length)) {
+        return AWS_OP_ERR;
+    }
+
+    if (cmm) {
+        digest_memo_store(
+            &shard->lock,
+            &shard->edk_memo,
+            cmm->alloc,
+            fingerprint,
+            edk_serialized_len(edk),
+            write_edk,
+            edk,
+            entry->hash_data);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+AWS_CRYPTOSDK_TEST_STATIC
+int hash_edk_for_decrypt(
+    struct aws_allocator *alloc, struct edk_hash_entry *entry, const struct aws_cryptosdk_edk *edk) {
+    return hash_edk_for_decrypt_memoized(NULL, alloc, entry, edk);
+}
+
+static int hash_dec_request_memoized(
+    struct caching_cmm *cmm,
+    const struct aws_string *partition_id,
+    struct aws_byte_buf *out,
+    const struct aws_cryptosdk_dec_request *req) {
+    static const struct edk_hash_entry zero_entry = { { 0 } };
+
+    int rv             = AWS_OP_ERR;
+    size_t md_length   = aws_cryptosdk_md_size(AWS_CRYPTOSDK_MD_SHA512);
+    uint16_t alg_id_be = aws_hton16(req->alg);
+    size_t n_edks      = aws_array_list_length(&req->encrypted_data_keys);
+
+    uint8_t context_digest[AWS_CRYPTOSDK_MD_MAX_SIZE] = { 0 };
+    struct aws_cryptosdk_md_context *md_context       = NULL;
+    struct edk_hash_entry edk_hash_storage[SMALL_EDK_COUNT];
+    struct aws_array_list edk_hash_list;
+
+    if (out->capacity < AWS_CRYPTOSDK_MD_MAX_SIZE) {
+        return aws_raise_error(AWS_ERROR_INVALID_BUFFER_SIZE);
+    }
+
+    if (n_edks <= SMALL_EDK_COUNT) {
+        aws_array_list_init_static(&edk_hash_list, edk_hash_storage, SMALL_EDK_COUNT, sizeof(struct edk_hash_entry));
+    } else if (aws_array_list_init_dynamic(&edk_hash_list, req->alloc, n_edks, sizeof(struct edk_hash_entry))) {
+        return AWS_OP_ERR;
+    }
+
+    if (enc_ctx_digest(cmm, req->alloc, context_digest, req->enc_ctx)) {
+        goto err;
+    }
+
+    // The decryption request cache IDs are constructed out of a hash of:
+    // [partition ID]
+    // [algorithm ID]
+    // [EDK hashes, in sorted order]
+    // [digestLength zero bytes]
+    // [encryption context hash]
+
+    // Before we start hashing the top level stuff, let's hash the EDKs and sort them
+    // Note that the EDK entries have no length field - if we introduce a larger hash
+    // in the future, we just treat the smaller (?) SHA-512 as the top-order bits of
+    // a larger field.
+
+    for (size_t i = 0; i < n_edks; i++) {
+        struct edk_hash_entry entry;
+        const struct aws_cryptosdk_edk *edk = NULL;
+        void *vp_edk                        = NULL;
+
+        if (aws_array_list_get_at_ptr(&req->encrypted_data_keys, &vp_edk, i)) {
+            goto err;
+        }
 
         edk = vp_edk;
 
-        if (hash_edk_for_decrypt(req->alloc, &entry, edk)) {
+        if (hash_edk_for_decrypt_memoized(cmm, req->alloc, &entry, edk)) {
             goto err;
         }
 
@@ -459,7 +1166,7 @@ int hash_dec_request(
     }
 
     if (aws_cryptosdk_md_update(md_context, &zero_entry, sizeof(zero_entry)) ||
-        aws_cryptosdk_md_update(md_context, context_digest_buf.buffer, context_digest_buf.len)) {
+        aws_cryptosdk_md_update(md_context, context_digest, md_length)) {
         goto err;
     }
 
@@ -468,12 +1175,17 @@ int hash_dec_request(
 
 err:
     aws_cryptosdk_md_abort(md_context);
-    aws_byte_buf_clean_up(&context_buf);
     aws_array_list_clean_up(&edk_hash_list);
 
     return rv;
 }
 
+AWS_CRYPTOSDK_TEST_STATIC
+int hash_dec_request(
+    const struct aws_string *partition_id, struct aws_byte_buf *out, const struct aws_cryptosdk_dec_request *req) {
+    return hash_dec_request_memoized(NULL, partition_id, out, req);
+}
+
 static void set_ttl_on_miss(struct caching_cmm *cmm, struct aws_cryptosdk_materials_cache_entry *entry) {
     if (entry && cmm->ttl_nanos != UINT64_MAX) {
         uint64_t creation_time = aws_cryptosdk_materials_cache_entry_get_creation_time(cmm->materials_cache, entry);
@@ -485,13 +1197,422 @@ static void set_ttl_on_miss(struct caching_cmm *cmm, struct aws_cryptosdk_materi
     }
 }
 
+/*
+ * Single-flight upstream calls
+ *
+ * When many requests miss on the same cache ID at once (e.g. when a popular entry expires), only the first one
+ * calls the upstream CMM. The others wait for it to finish, and then look the cache ID up again, which will
+ * usually find the entry it just added. So that a stuck upstream call can't hold up every other request for the
+ * same cache ID, the wait is bounded by flight_wait_nanos, after which the waiter calls the upstream CMM itself.
+ */
+
+/* Must be called with flight_lock held. Returns the index of cache_id in the flights list, or SIZE_MAX. */
+static size_t locked_find_flight(struct caching_cmm *cmm, const struct aws_byte_buf *cache_id) {
+    for (size_t i = 0; i < aws_array_list_length(&cmm->flights); i++) {
+        const struct aws_byte_buf *flight_id;
+
+        if (!aws_array_list_get_at(&cmm->flights, &flight_id, i) && aws_byte_buf_eq(flight_id, cache_id)) {
+            return i;
+        }
+    }
+
+    return SIZE_MAX;
+}
+
+/*
+ * Returns true if the caller should call the upstream CMM itself, and false once some other request's upstream
+ * call for the same cache ID has completed, in which case the caller should check the cache again. If the other
+ * call doesn't complete within flight_wait_nanos, this returns true without registering the caller, so that
+ * requests which arrive later still wait for the original call.
+ *
+ * If this returns true, the caller must pass the same cache_id (which must remain valid until then) and the value
+ * returned in *registered to end_upstream_call once it is done with the upstream CMM and materials cache.
+ */
+static bool begin_upstream_call(struct caching_cmm *cmm, const struct aws_byte_buf *cache_id, bool *registered) {
+    bool waited = false, timed_out = false;
+    uint64_t now, deadline;
+    *registered = false;
+
+    if (aws_sys_clock_get_ticks(&now) || aws_mutex_lock(&cmm->flight_lock)) {
+        /* We can't coordinate with anyone else, so just go ahead */
+        return true;
+    }
+
+    deadline = aws_add_u64_saturating(now, cmm->flight_wait_nanos);
+
+    while (locked_find_flight(cmm, cache_id) != SIZE_MAX) {
+        waited = true;
+
+        if (aws_sys_clock_get_ticks(&now) || now >= deadline) {
+            timed_out = true;
+            break;
+        }
+
+        /* Timeouts and spurious wakeups alike bring us back here to check the flights and the deadline again */
+        uint64_t remaining = deadline - now;
+        aws_condition_variable_wait_for(
+            &cmm->flight_done, &cmm->flight_lock, remaining > INT64_MAX ? INT64_MAX : (int64_t)remaining);
+    }
+
+    if (!waited) {
+        *registered = !aws_array_list_push_back(&cmm->flights, &cache_id);
+    }
+
+    if (aws_mutex_unlock(&cmm->flight_lock)) {
+        abort();
+    }
+
+    return !waited || timed_out;
+}
+
+static void end_upstream_call(struct caching_cmm *cmm, const struct aws_byte_buf *cache_id, bool registered) {
+    if (!registered) {
+        return;
+    }
+
+    /* Other requests may be waiting on us, so there's no way to back out if this fails */
+    if (aws_mutex_lock(&cmm->flight_lock)) {
+        abort();
+    }
+
+    size_t idx  = locked_find_flight(cmm, cache_id);
+    size_t last = aws_array_list_length(&cmm->flights) - 1;
+    assert(idx != SIZE_MAX);
+
+    if (idx != last) {
+        aws_array_list_swap(&cmm->flights, idx, last);
+    }
+    aws_array_list_pop_back(&cmm->flights);
+
+    aws_condition_variable_notify_all(&cmm->flight_done);
+
+    if (aws_mutex_unlock(&cmm->flight_lock)) {
+        abort();
+    }
+}
+
+/*
+ * Refresh-ahead
+ *
+ * When an entry that is served from the cache gets close to its TTL or usage limits, we queue a copy of the
+ * request for a background thread, which makes the same request to the upstream CMM and overwrites the entry
+ * with the result. Jobs are deduplicated by cache ID, so each entry has at most one refresh outstanding.
+ */
+
+/*
+ * Returns true if the entry has passed the refresh-ahead threshold. stats is the entry's usage including the
+ * current request, or NULL for decrypt entries.
+ */
+static bool refresh_due(
+    struct caching_cmm *cmm,
+    struct aws_cryptosdk_materials_cache_entry *entry,
+    const struct aws_cryptosdk_cache_usage_stats *stats) {
+    uint64_t percent = aws_atomic_load_int_explicit(&cmm->refresh_percent, aws_memory_order_acquire);
+
+    if (!percent) {
+        return false;
+    }
+
+    if (stats && (stats->messages_encrypted >= cmm->limit_messages * percent / 100 ||
+                  stats->bytes_encrypted >= cmm->limit_bytes / 100 * percent)) {
+        return true;
+    }
+
+    if (cmm->ttl_nanos == UINT64_MAX) {
+        return false;
+    }
+
+    uint64_t creation_time = aws_cryptosdk_materials_cache_entry_get_creation_time(cmm->materials_cache, entry);
+    uint64_t refresh_time  = aws_add_u64_saturating(creation_time, cmm->ttl_nanos / 100 * percent);
+    uint64_t now;
+
+    return !cmm->clock_get_ticks(&now) && now >= refresh_time;
+}
+
+static void refresh_job_destroy(struct caching_cmm *cmm, struct refresh_job *job) {
+    if (!job) {
+        return;
+    }
+
+    aws_cryptosdk_enc_ctx_clean_up(&job->enc_ctx);
+    if (!job->is_encrypt) {
+        aws_cryptosdk_edk_list_clean_up(&job->dec_request.encrypted_data_keys);
+    }
+
+    aws_mem_release(cmm->alloc, job);
+}
+
+static struct refresh_job *refresh_job_new(
+    struct caching_cmm *cmm, const struct aws_byte_buf *cache_id, bool is_encrypt) {
+    struct refresh_job *job = aws_mem_acquire(cmm->alloc, sizeof(*job));
+
+    if (!job) {
+        return NULL;
+    }
+
+    memset(job, 0, sizeof(*job));
+    assert(cache_id->len <= sizeof(job->cache_id));
+    memcpy(job->cache_id, cache_id->buffer, cache_id->len);
+    job->cache_id_len = cache_id->len;
+    job->is_encrypt   = is_encrypt;
+
+    if (aws_cryptosdk_enc_ctx_init(cmm->alloc, &job->enc_ctx)) {
+        goto err_enc_ctx;
+    }
+
+    if (!is_encrypt && aws_cryptosdk_edk_list_init(cmm->alloc, &job->dec_request.encrypted_data_keys)) {
+        goto err_edk_list;
+    }
+
+    return job;
+
+err_edk_list:
+    aws_cryptosdk_enc_ctx_clean_up(&job->enc_ctx);
+err_enc_ctx:
+    aws_mem_release(cmm->alloc, job);
+    return NULL;
+}
+
+static bool refresh_job_matches(const struct refresh_job *job, const struct aws_byte_buf *cache_id) {
+    return job->cache_id_len == cache_id->len && !memcmp(job->cache_id, cache_id->buffer, cache_id->len);
+}
+
+/* Must be called with refresh_lock held */
+static bool locked_refresh_pending(struct caching_cmm *cmm, const struct aws_byte_buf *cache_id) {
+    struct refresh_job *job = cmm->refresh_in_flight;
+
+    if (job && refresh_job_matches(job, cache_id)) {
+        return true;
+    }
+
+    for (size_t i = 0; i < aws_array_list_length(&cmm->refresh_queue); i++) {
+        if (!aws_array_list_get_at(&cmm->refresh_queue, &job, i) && refresh_job_matches(job, cache_id)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Queues the job (or destroys it, if a refresh for the same cache ID is already pending or the queue is full).
+ * Failures only cost us the refresh, so they are not reported.
+ */
+static void enqueue_refresh(struct caching_cmm *cmm, struct refresh_job *job) {
+    if (aws_mutex_lock(&cmm->refresh_lock)) {
+        refresh_job_destroy(cmm, job);
+        return;
+    }
+
+    struct aws_byte_buf cache_id = aws_byte_buf_from_array(job->cache_id, job->cache_id_len);
+    if (!cmm->refresher_started || cmm->refresher_stop ||
+        aws_array_list_length(&cmm->refresh_queue) >= MAX_QUEUED_REFRESHES ||
+        locked_refresh_pending(cmm, &cache_id) || aws_array_list_push_back(&cmm->refresh_queue, &job)) {
+        refresh_job_destroy(cmm, job);
+    } else {
+        aws_condition_variable_notify_one(&cmm->refresh_signal);
+    }
+
+    if (aws_mutex_unlock(&cmm->refresh_lock)) {
+        abort();
+    }
+}
+
+/* Cheap check, done before copying the request, for whether a refresh for this cache ID is already pending */
+static bool refresh_pending(struct caching_cmm *cmm, const struct aws_byte_buf *cache_id) {
+    bool pending = true;
+
+    if (!aws_mutex_lock(&cmm->refresh_lock)) {
+        pending = !cmm->refresher_started || locked_refresh_pending(cmm, cache_id);
+
+        if (aws_mutex_unlock(&cmm->refresh_lock)) {
+            abort();
+        }
+    }
+
+    return pending;
+}
+
+static void schedule_enc_refresh(
+    struct caching_cmm *cmm, const struct aws_byte_buf *cache_id, const struct aws_cryptosdk_enc_request *request) {
+    if (refresh_pending(cmm, cache_id)) {
+        return;
+    }
+
+    struct refresh_job *job = refresh_job_new(cmm, cache_id, true);
+    if (!job) {
+        return;
+    }
+
+    job->enc_request.alloc          = cmm->alloc;
+    job->enc_request.enc_ctx        = &job->enc_ctx;
+    job->enc_request.requested_alg  = request->requested_alg;
+    job->enc_request.plaintext_size = request->plaintext_size;
+
+    if (aws_cryptosdk_enc_ctx_clone(cmm->alloc, &job->enc_ctx, request->enc_ctx)) {
+        refresh_job_destroy(cmm, job);
+        return;
+    }
+
+    enqueue_refresh(cmm, job);
+}
+
+static void schedule_dec_refresh(
+    struct caching_cmm *cmm, const struct aws_byte_buf *cache_id, const struct aws_cryptosdk_dec_request *request) {
+    if (refresh_pending(cmm, cache_id)) {
+        return;
+    }
+
+    struct refresh_job *job = refresh_job_new(cmm, cache_id, false);
+    if (!job) {
+        return;
+    }
+
+    job->dec_request.alloc   = cmm->alloc;
+    job->dec_request.enc_ctx = &job->enc_ctx;
+    job->dec_request.alg     = request->alg;
+
+    if (aws_cryptosdk_enc_ctx_clone(cmm->alloc, &job->enc_ctx, request->enc_ctx) ||
+        aws_cryptosdk_edk_list_copy_all(
+            cmm->alloc, &job->dec_request.encrypted_data_keys, &request->encrypted_data_keys)) {
+        refresh_job_destroy(cmm, job);
+        return;
+    }
+
+    enqueue_refresh(cmm, job);
+}
+
+static void set_ttl_on_miss(struct caching_cmm *cmm, struct aws_cryptosdk_materials_cache_entry *entry);
+
+static void run_refresh_job(struct caching_cmm *cmm, struct refresh_job *job) {
+    struct aws_byte_buf cache_id                      = aws_byte_buf_from_array(job->cache_id, job->cache_id_len);
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+
+    if (job->is_encrypt) {
+        struct aws_cryptosdk_enc_materials *materials = NULL;
+        /* The refresh itself doesn't encrypt anything, so the new entry starts out unused */
+        struct aws_cryptosdk_cache_usage_stats initial_usage = { 0, 0 };
+        uint64_t start                                       = upstream_call_start();
+        int rv = aws_cryptosdk_cmm_generate_enc_materials(cmm->upstream, &materials, &job->enc_request);
+
+        record_upstream_latency(&cmm->upstream_enc_latency, start);
+        if (rv) {
+            return;
+        }
+
+        if (can_cache_algorithm(materials->alg)) {
+            aws_cryptosdk_materials_cache_put_entry_for_encrypt(
+                cmm->materials_cache, &entry, materials, initial_usage, &job->enc_ctx, &cache_id);
+        }
+
+        aws_cryptosdk_enc_materials_destroy(materials);
+    } else {
+        struct aws_cryptosdk_dec_materials *materials = NULL;
+        uint64_t start                                = upstream_call_start();
+        int rv = aws_cryptosdk_cmm_decrypt_materials(cmm->upstream, &materials, &job->dec_request);
+
+        record_upstream_latency(&cmm->upstream_dec_latency, start);
+        if (rv) {
+            return;
+        }
+
+        aws_cryptosdk_materials_cache_put_entry_for_decrypt(cmm->materials_cache, &entry, materials, &cache_id);
+
+        aws_cryptosdk_dec_materials_destroy(materials);
+    }
+
+    set_ttl_on_miss(cmm, entry);
+
+    if (entry) {
+        aws_cryptosdk_materials_cache_entry_release(cmm->materials_cache, entry, false);
+    }
+}
+
+static void refresher_thread_fn(void *vp_cmm) {
+    struct caching_cmm *cmm = vp_cmm;
+
+    if (aws_mutex_lock(&cmm->refresh_lock)) {
+        abort();
+    }
+
+    while (true) {
+        while (!cmm->refresher_stop && !aws_array_list_length(&cmm->refresh_queue)) {
+            aws_condition_variable_wait(&cmm->refresh_signal, &cmm->refresh_lock);
+        }
+
+        if (cmm->refresher_stop) {
+            break;
+        }
+
+        struct refresh_job *job;
+        if (aws_array_list_front(&cmm->refresh_queue, &job) || aws_array_list_pop_front(&cmm->refresh_queue)) {
+            abort();
+        }
+
+        /* Keep the job visible to locked_refresh_pending while we run it */
+        cmm->refresh_in_flight = job;
+
+        if (aws_mutex_unlock(&cmm->refresh_lock)) {
+            abort();
+        }
+
+        run_refresh_job(cmm, job);
+
+        if (aws_mutex_lock(&cmm->refresh_lock)) {
+            abort();
+        }
+
+        cmm->refresh_in_flight = NULL;
+        refresh_job_destroy(cmm, job);
+    }
+
+    if (aws_mutex_unlock(&cmm->refresh_lock)) {
+        abort();
+    }
+}
+
+/*
+ * Stops the refresher thread (waiting for any refresh in progress) and discards queued refreshes. Only called
+ * when the CMM is destroyed, so no other thread can be using the refresher state.
+ */
+static void stop_refresher(struct caching_cmm *cmm) {
+    if (!cmm->refresher_started) {
+        return;
+    }
+
+    if (aws_mutex_lock(&cmm->refresh_lock)) {
+        abort();
+    }
+
+    cmm->refresher_stop = true;
+    aws_condition_variable_notify_one(&cmm->refresh_signal);
+
+    if (aws_mutex_unlock(&cmm->refresh_lock)) {
+        abort();
+    }
+
+    aws_thread_join(&cmm->refresher);
+    aws_thread_clean_up(&cmm->refresher);
+
+    for (size_t i = 0; i < aws_array_list_length(&cmm->refresh_queue); i++) {
+        struct refresh_job *job;
+        if (!aws_array_list_get_at(&cmm->refresh_queue, &job, i)) {
+            refresh_job_destroy(cmm, job);
+        }
+    }
+
+    aws_array_list_clean_up(&cmm->refresh_queue);
+
+    cmm->refresher_started = false;
+}
+
 static int generate_enc_materials(
     struct aws_cryptosdk_cmm *generic_cmm,
     struct aws_cryptosdk_enc_materials **output,
     struct aws_cryptosdk_enc_request *request) {
     struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
 
-    bool is_encrypt, should_invalidate = false;
+    bool is_encrypt, should_invalidate = false, retried = false, registered;
     struct aws_cryptosdk_materials_cache_entry *entry = NULL;
     struct aws_cryptosdk_cache_usage_stats delta_usage;
 
@@ -508,21 +1629,26 @@ static int generate_enc_materials(
 
     if (delta_usage.bytes_encrypted > cmm->limit_bytes ||
         (request->requested_alg && !can_cache_algorithm(request->requested_alg))) {
+        stat_add(&cmm->stat_bypasses, 1);
         return aws_cryptosdk_cmm_generate_enc_materials(cmm->upstream, output, request);
     }
 
     uint8_t hash_arr[AWS_CRYPTOSDK_MD_MAX_SIZE];
     struct aws_byte_buf hash_buf = aws_byte_buf_from_array(hash_arr, sizeof(hash_arr));
-    if (hash_enc_request(cmm->partition_id, &hash_buf, request)) {
+    if (hash_enc_request_memoized(cmm, cmm->partition_id, &hash_buf, request)) {
         return AWS_OP_ERR;
     }
 
+lookup:
+    should_invalidate = false;
+
     if (aws_cryptosdk_materials_cache_find_entry(cmm->materials_cache, &entry, &is_encrypt, &hash_buf) || !entry ||
         !is_encrypt) {
         goto cache_miss;
     }
 
     if (!check_ttl(cmm, entry)) {
+        stat_add(&cmm->stat_invalidations_ttl, 1);
         goto cache_miss;
     }
 
@@ -532,6 +1658,7 @@ static int generate_enc_materials(
     }
 
     if (stats.bytes_encrypted > cmm->limit_bytes || stats.messages_encrypted > cmm->limit_messages) {
+        stat_add(&cmm->stat_invalidations_usage_limit, 1);
         goto cache_miss;
     }
 
@@ -542,6 +1669,9 @@ static int generate_enc_materials(
      */
     if (stats.messages_encrypted == cmm->limit_messages) {
         should_invalidate = true;
+    } else if (refresh_due(cmm, entry, &stats)) {
+        /* This must happen before get_enc_materials, which copies the cached context into the request's */
+        schedule_enc_refresh(cmm, &hash_buf, request);
     }
 
     if (aws_cryptosdk_materials_cache_get_enc_materials(
@@ -551,6 +1681,11 @@ static int generate_enc_materials(
 
     aws_cryptosdk_materials_cache_entry_release(cmm->materials_cache, entry, should_invalidate);
 
+    stat_add(&cmm->stat_hits, 1);
+    if (should_invalidate) {
+        stat_add(&cmm->stat_invalidations_usage_limit, 1);
+    }
+
     return AWS_OP_SUCCESS;
 cache_miss:
     if (entry) {
@@ -562,7 +1697,25 @@ cache_miss:
         entry = NULL;
     }
 
-    if (aws_cryptosdk_cmm_generate_enc_materials(cmm->upstream, output, request)) {
+    if (!retried && !begin_upstream_call(cmm, &hash_buf, &registered)) {
+        /* Another request just fetched materials for this cache ID; they're probably in the cache now */
+        retried = true;
+        goto lookup;
+    }
+
+    if (retried) {
+        /* We waited for another request, but still missed; don't wait again */
+        registered = false;
+    }
+
+    stat_add(&cmm->stat_misses, 1);
+
+    uint64_t start = upstream_call_start();
+    int rv         = aws_cryptosdk_cmm_generate_enc_materials(cmm->upstream, output, request);
+
+    record_upstream_latency(&cmm->upstream_enc_latency, start);
+    if (rv) {
+        end_upstream_call(cmm, &hash_buf, registered);
         return AWS_OP_ERR;
     }
 
@@ -577,31 +1730,24 @@ cache_miss:
         }
     }
 
+    end_upstream_call(cmm, &hash_buf, registered);
+
     return AWS_OP_SUCCESS;
 }
 
-static int decrypt_materials(
-    struct aws_cryptosdk_cmm *generic_cmm,
+/*
+ * Looks cache_id up as a decrypt entry. On a hit, fills *output and returns true; otherwise, invalidates any
+ * unusable entry found under cache_id and returns false.
+ */
+static bool find_cached_dec_materials(
+    struct caching_cmm *cmm,
     struct aws_cryptosdk_dec_materials **output,
-    struct aws_cryptosdk_dec_request *request) {
-    struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
-
+    const struct aws_cryptosdk_dec_request *request,
+    const struct aws_byte_buf *cache_id) {
     bool is_encrypt;
     struct aws_cryptosdk_materials_cache_entry *entry = NULL;
 
-    if (!can_cache_algorithm(request->alg)) {
-        /* The algorithm used for the ciphertext is not cachable, so bypass the cache entirely */
-        return aws_cryptosdk_cmm_decrypt_materials(cmm->upstream, output, request);
-    }
-
-    uint8_t hash_arr[AWS_CRYPTOSDK_MD_MAX_SIZE];
-    struct aws_byte_buf hash_buf = aws_byte_buf_from_array(hash_arr, sizeof(hash_arr));
-
-    if (hash_dec_request(cmm->partition_id, &hash_buf, request)) {
-        return AWS_OP_ERR;
-    }
-
-    if (aws_cryptosdk_materials_cache_find_entry(cmm->materials_cache, &entry, &is_encrypt, &hash_buf) || !entry ||
+    if (aws_cryptosdk_materials_cache_find_entry(cmm->materials_cache, &entry, &is_encrypt, cache_id) || !entry ||
         is_encrypt) {
         /*
          * If we got an encrypt entry, we'll invalidate it, since we're about to replace it anyway.
@@ -611,6 +1757,7 @@ static int decrypt_materials(
     }
 
     if (!check_ttl(cmm, entry)) {
+        stat_add(&cmm->stat_invalidations_ttl, 1);
         goto cache_miss;
     }
 
@@ -618,9 +1765,13 @@ static int decrypt_materials(
         goto cache_miss;
     }
 
+    if (refresh_due(cmm, entry, NULL)) {
+        schedule_dec_refresh(cmm, cache_id, request);
+    }
+
     aws_cryptosdk_materials_cache_entry_release(cmm->materials_cache, entry, false);
 
-    return AWS_OP_SUCCESS;
+    return true;
 
 cache_miss:
     if (entry) {
@@ -631,11 +1782,45 @@ cache_miss:
         aws_cryptosdk_materials_cache_entry_release(cmm->materials_cache, entry, true);
     }
 
-    if (aws_cryptosdk_cmm_decrypt_materials(cmm->upstream, output, request)) {
+    return false;
+}
+
+/* Serves request from the cache entry under cache_id, or from the upstream CMM on a miss */
+static int decrypt_materials_for_id(
+    struct caching_cmm *cmm,
+    struct aws_cryptosdk_dec_materials **output,
+    struct aws_cryptosdk_dec_request *request,
+    const struct aws_byte_buf *cache_id) {
+    bool retried = false, registered;
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+
+lookup:
+    if (find_cached_dec_materials(cmm, output, request, cache_id)) {
+        stat_add(&cmm->stat_hits, 1);
+        return AWS_OP_SUCCESS;
+    }
+
+    if (!retried && !begin_upstream_call(cmm, cache_id, &registered)) {
+        retried = true;
+        goto lookup;
+    }
+
+    if (retried) {
+        registered = false;
+    }
+
+    stat_add(&cmm->stat_misses, 1);
+
+    uint64_t start = upstream_call_start();
+    int rv         = aws_cryptosdk_cmm_decrypt_materials(cmm->upstream, output, request);
+
+    record_upstream_latency(&cmm->upstream_dec_latency, start);
+    if (rv) {
+        end_upstream_call(cmm, cache_id, registered);
         return AWS_OP_ERR;
     }
 
-    aws_cryptosdk_materials_cache_put_entry_for_decrypt(cmm->materials_cache, &entry, *output, &hash_buf);
+    aws_cryptosdk_materials_cache_put_entry_for_decrypt(cmm->materials_cache, &entry, *output, cache_id);
 
     set_ttl_on_miss(cmm, entry);
 
@@ -643,5 +1828,202 @@ cache_miss:
         aws_cryptosdk_materials_cache_entry_release(cmm->materials_cache, entry, false);
     }
 
+    end_upstream_call(cmm, cache_id, registered);
+
     return AWS_OP_SUCCESS;
 }
+
+/*
+ * Makes *single a shallow copy of request which carries only the EDK at index idx. edk_list must be a static
+ * list with room for one EDK, and must remain in place for as long as *single is used.
+ */
+static int single_edk_request(
+    struct aws_cryptosdk_dec_request *single,
+    struct aws_array_list *edk_list,
+    const struct aws_cryptosdk_dec_request *request,
+    size_t idx) {
+    void *vp_edk = NULL;
+
+    aws_array_list_clear(edk_list);
+    if (aws_array_list_get_at_ptr(&request->encrypted_data_keys, &vp_edk, idx) ||
+        aws_array_list_push_back(edk_list, vp_edk)) {
+        return AWS_OP_ERR;
+    }
+
+    single->alloc               = request->alloc;
+    single->enc_ctx             = request->enc_ctx;
+    single->alg                 = request->alg;
+    single->encrypted_data_keys = *edk_list;
+
+    return AWS_OP_SUCCESS;
+}
+
+/*
+ * Per-EDK decryption caching (see aws_cryptosdk_caching_cmm_set_per_edk_decrypt)
+ *
+ * Each EDK is cached under the ID that a request carrying only that EDK would have, so messages whose EDK lists
+ * overlap share entries. We look each EDK up once, and only if none of them hits do we make a single call to the
+ * upstream CMM with the full EDK list. Its result is then cached under the IDs of the EDKs which the keyring trace
+ * shows were decrypted.
+ */
+
+/*
+ * Returns true if the keyring trace records that the wrapping key of edk decrypted the data key. The wrapping key
+ * name must be a prefix of the provider info, as raw AES keyrings append their IV parameters to the key name.
+ */
+static bool edk_decrypted_per_trace(const struct aws_array_list *keyring_trace, const struct aws_cryptosdk_edk *edk) {
+    for (size_t i = 0; i < aws_array_list_length(keyring_trace); i++) {
+        struct aws_cryptosdk_keyring_trace_record *record = NULL;
+
+        if (aws_array_list_get_at_ptr(keyring_trace, (void **)&record, i) ||
+            !(record->flags & AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY) || !record->wrapping_key_namespace ||
+            !record->wrapping_key_name) {
+            continue;
+        }
+
+        const struct aws_string *name = record->wrapping_key_name;
+        if (aws_string_eq_byte_buf(record->wrapping_key_namespace, &edk->provider_id) &&
+            name->len <= edk->provider_info.len &&
+            (!name->len || !memcmp(aws_string_bytes(name), edk->provider_info.buffer, name->len))) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int decrypt_materials_per_edk(
+    struct caching_cmm *cmm,
+    struct aws_cryptosdk_dec_materials **output,
+    struct aws_cryptosdk_dec_request *request) {
+    int rv           = AWS_OP_ERR;
+    bool registered  = false;
+    size_t md_length = aws_cryptosdk_md_size(AWS_CRYPTOSDK_MD_SHA512);
+    size_t n_edks    = aws_array_list_length(&request->encrypted_data_keys);
+
+    struct aws_cryptosdk_edk edk_storage;
+    struct aws_array_list edk_list;
+    struct aws_cryptosdk_dec_request single;
+    struct edk_hash_entry id_storage[SMALL_EDK_COUNT];
+    struct aws_array_list id_list;
+    struct aws_byte_buf flight_id;
+    void *vp_id = NULL;
+
+    aws_array_list_init_static(&edk_list, &edk_storage, 1, sizeof(edk_storage));
+
+    if (n_edks <= SMALL_EDK_COUNT) {
+        aws_array_list_init_static(&id_list, id_storage, SMALL_EDK_COUNT, sizeof(struct edk_hash_entry));
+    } else if (aws_array_list_init_dynamic(&id_list, request->alloc, n_edks, sizeof(struct edk_hash_entry))) {
+        return AWS_OP_ERR;
+    }
+
+    /* Each ID is computed only if every EDK before it has missed */
+    for (size_t i = 0; i < n_edks; i++) {
+        struct edk_hash_entry id;
+        struct aws_byte_buf id_buf = aws_byte_buf_from_array(id.hash_data, sizeof(id.hash_data));
+
+        if (single_edk_request(&single, &edk_list, request, i) ||
+            hash_dec_request_memoized(cmm, cmm->partition_id, &id_buf, &single)) {
+            goto out;
+        }
+
+        if (find_cached_dec_materials(cmm, output, &single, &id_buf)) {
+            stat_add(&cmm->stat_hits, 1);
+            rv = AWS_OP_SUCCESS;
+            goto out;
+        }
+
+        if (aws_array_list_push_back(&id_list, &id)) {
+            goto out;
+        }
+    }
+
+    /* Concurrent misses on the same message coalesce on the ID of its first EDK */
+    if (aws_array_list_get_at_ptr(&id_list, &vp_id, 0)) {
+        goto out;
+    }
+    flight_id = aws_byte_buf_from_array(((struct edk_hash_entry *)vp_id)->hash_data, md_length);
+
+    if (begin_upstream_call(cmm, &flight_id, &registered)) {
+        stat_add(&cmm->stat_misses, 1);
+    } else {
+        /* Someone else just called the upstream CMM for this message, so look the EDKs up again */
+        for (size_t i = 0; i < n_edks; i++) {
+            if (aws_array_list_get_at_ptr(&id_list, &vp_id, i) || single_edk_request(&single, &edk_list, request, i)) {
+                goto out;
+            }
+
+            struct aws_byte_buf id_buf =
+                aws_byte_buf_from_array(((struct edk_hash_entry *)vp_id)->hash_data, md_length);
+            if (find_cached_dec_materials(cmm, output, &single, &id_buf)) {
+                stat_add(&cmm->stat_hits, 1);
+                rv = AWS_OP_SUCCESS;
+                goto out;
+            }
+        }
+
+        stat_add(&cmm->stat_misses, 1);
+    }
+
+    uint64_t start = upstream_call_start();
+    rv             = aws_cryptosdk_cmm_decrypt_materials(cmm->upstream, output, request);
+
+    record_upstream_latency(&cmm->upstream_dec_latency, start);
+    if (rv) {
+        end_upstream_call(cmm, &flight_id, registered);
+        goto out;
+    }
+
+    for (size_t i = 0; i < n_edks; i++) {
+        struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+        void *vp_edk                                      = NULL;
+
+        if (aws_array_list_get_at_ptr(&request->encrypted_data_keys, &vp_edk, i) ||
+            !edk_decrypted_per_trace(&(*output)->keyring_trace, vp_edk) ||
+            aws_array_list_get_at_ptr(&id_list, &vp_id, i)) {
+            continue;
+        }
+
+        struct aws_byte_buf id_buf = aws_byte_buf_from_array(((struct edk_hash_entry *)vp_id)->hash_data, md_length);
+        aws_cryptosdk_materials_cache_put_entry_for_decrypt(cmm->materials_cache, &entry, *output, &id_buf);
+
+        set_ttl_on_miss(cmm, entry);
+
+        if (entry) {
+            aws_cryptosdk_materials_cache_entry_release(cmm->materials_cache, entry, false);
+        }
+    }
+
+    end_upstream_call(cmm, &flight_id, registered);
+
+out:
+    aws_array_list_clean_up(&id_list);
+
+    return rv;
+}
+
+static int decrypt_materials(
+    struct aws_cryptosdk_cmm *generic_cmm,
+    struct aws_cryptosdk_dec_materials **output,
+    struct aws_cryptosdk_dec_request *request) {
+    struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
+
+    if (!can_cache_algorithm(request->alg)) {
+        /* The algorithm used for the ciphertext is not cachable, so bypass the cache entirely */
+        stat_add(&cmm->stat_bypasses, 1);
+        return aws_cryptosdk_cmm_decrypt_materials(cmm->upstream, output, request);
+    }
+
+    if (cmm->per_edk_decrypt && aws_array_list_length(&request->encrypted_data_keys) > 1) {
+        return decrypt_materials_per_edk(cmm, output, request);
+    }
+
+    uint8_t hash_arr[AWS_CRYPTOSDK_MD_MAX_SIZE];
+    struct aws_byte_buf hash_buf = aws_byte_buf_from_array(hash_arr, sizeof(hash_arr));
+
+    if (hash_dec_request_memoized(cmm, cmm->partition_id, &hash_buf, request)) {
+        return AWS_OP_ERR;
+    }
+
+    return decrypt_materials_for_id(cmm, output, request, &hash_buf);
+}
@@ -803,22 +803,13 @@ static const EVP_CIPHER *get_alg_from_key_size(size_t key_len) {
 static const size_t aes_gcm_tag_len = 16;
 static const size_t aes_gcm_iv_len  = 12;
 
-int aws_cryptosdk_aes_gcm_encrypt(
+/* Runs an AES-GCM encryption on a context which already has its cipher, key and IV set */
+static int aes_gcm_encrypt_ctx(
+    EVP_CIPHER_CTX *ctx,
     struct aws_byte_buf *cipher,
     struct aws_byte_buf *tag,
     const struct aws_byte_cursor plain,
-    const struct aws_byte_cursor iv,
-    const struct aws_byte_cursor aad,
-    const struct aws_string *key) {
-    const EVP_CIPHER *alg = get_alg_from_key_size(key->len);
-    if (!alg || iv.len != aes_gcm_iv_len || tag->capacity < aes_gcm_tag_len || cipher->capacity < plain.len)
-        return aws_raise_error(AWS_ERROR_INVALID_BUFFER_SIZE);
-
-    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
-    if (!ctx) goto openssl_err;
-
-    if (!EVP_EncryptInit_ex(ctx, alg, NULL, aws_string_bytes(key), iv.ptr)) goto openssl_err;
-
+    const struct aws_byte_cursor aad) {
     int out_len;
     if (aad.len) {
         if (!EVP_EncryptUpdate(ctx, NULL, &out_len, aad.ptr, aad.len)) goto openssl_err;
@@ -843,22 +834,14 @@ openssl_err:
     return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
 }
 
-int aws_cryptosdk_aes_gcm_decrypt(
+/* Runs an AES-GCM decryption on a context which already has its cipher, key and IV set */
+static int aes_gcm_decrypt_ctx(
+    EVP_CIPHER_CTX *ctx,
     struct aws_byte_buf *plain,
     const struct aws_byte_cursor cipher,
     const struct aws_byte_cursor tag,
-    const struct aws_byte_cursor iv,
-    const struct aws_byte_cursor aad,
-    const struct aws_string *key) {
-    bool openssl_err      = true;
-    const EVP_CIPHER *alg = get_alg_from_key_size(key->len);
-    if (!alg || iv.len != aes_gcm_iv_len || tag.len != aes_gcm_tag_len || plain->capacity < cipher.len)
-        return aws_raise_error(AWS_ERROR_INVALID_BUFFER_SIZE);
-
-    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
-    if (!ctx) goto decrypt_err;
-
-    if (!EVP_DecryptInit_ex(ctx, alg, NULL, aws_string_bytes(key), iv.ptr)) goto decrypt_err;
+    const struct aws_byte_cursor aad) {
+    bool openssl_err = true;
 
     if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, tag.len, tag.ptr)) goto decrypt_err;
 
@@ -895,6 +878,141 @@ decrypt_err:
     return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
 }
 
+static int aes_gcm_setup_err(EVP_CIPHER_CTX *ctx) {
+    EVP_CIPHER_CTX_free(ctx);
+    flush_openssl_errors();
+    return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+}
+
+int aws_cryptosdk_aes_gcm_encrypt(
+    struct aws_byte_buf *cipher,
+    struct aws_byte_buf *tag,
+    const struct aws_byte_cursor plain,
+    const struct aws_byte_cursor iv,
+    const struct aws_byte_cursor aad,
+    const struct aws_string *key) {
+    const EVP_CIPHER *alg = get_alg_from_key_size(key->len);
+    if (!alg || iv.len != aes_gcm_iv_len || tag->capacity < aes_gcm_tag_len || cipher->capacity < plain.len)
+        return aws_raise_error(AWS_ERROR_INVALID_BUFFER_SIZE);
+
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    if (!ctx || !EVP_EncryptInit_ex(ctx, alg, NULL, aws_string_bytes(key), iv.ptr)) {
+        aws_byte_buf_secure_zero(cipher);
+        aws_byte_buf_secure_zero(tag);
+        return aes_gcm_setup_err(ctx);
+    }
+
+    return aes_gcm_encrypt_ctx(ctx, cipher, tag, plain, aad);
+}
+
+int aws_cryptosdk_aes_gcm_decrypt(
+    struct aws_byte_buf *plain,
+    const struct aws_byte_cursor cipher,
+    const struct aws_byte_cursor tag,
+    const struct aws_byte_cursor iv,
+    const struct aws_byte_cursor aad,
+    const struct aws_string *key) {
+    const EVP_CIPHER *alg = get_alg_from_key_size(key->len);
+    if (!alg || iv.len != aes_gcm_iv_len || tag.len != aes_gcm_tag_len || plain->capacity < cipher.len)
+        return aws_raise_error(AWS_ERROR_INVALID_BUFFER_SIZE);
+
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    if (!ctx || !EVP_DecryptInit_ex(ctx, alg, NULL, aws_string_bytes(key), iv.ptr)) {
+        aws_byte_buf_secure_zero(plain);
+        return aes_gcm_setup_err(ctx);
+    }
+
+    return aes_gcm_decrypt_ctx(ctx, plain, cipher, tag, aad);
+}
+
+struct aws_cryptosdk_aes_gcm_key {
+    struct aws_allocator *alloc;
+    /* Initialized with the cipher and the expanded key but no IV, for encryption and decryption respectively */
+    EVP_CIPHER_CTX *enc_proto;
+    EVP_CIPHER_CTX *dec_proto;
+};
+
+struct aws_cryptosdk_aes_gcm_key *aws_cryptosdk_aes_gcm_key_new(
+    struct aws_allocator *alloc, const uint8_t *key_bytes, size_t key_len) {
+    const EVP_CIPHER *alg = get_alg_from_key_size(key_len);
+    if (!alg) {
+        aws_raise_error(AWS_ERROR_INVALID_BUFFER_SIZE);
+        return NULL;
+    }
+
+    struct aws_cryptosdk_aes_gcm_key *key = aws_mem_acquire(alloc, sizeof(*key));
+    if (!key) {
+        aws_raise_error(AWS_ERROR_OOM);
+        return NULL;
+    }
+
+    key->alloc     = alloc;
+    key->enc_proto = EVP_CIPHER_CTX_new();
+    key->dec_proto = EVP_CIPHER_CTX_new();
+    if (!key->enc_proto || !key->dec_proto) goto err;
+    if (!EVP_EncryptInit_ex(key->enc_proto, alg, NULL, key_bytes, NULL)) goto err;
+    if (!EVP_DecryptInit_ex(key->dec_proto, alg, NULL, key_bytes, NULL)) goto err;
+
+    return key;
+
+err:
+    flush_openssl_errors();
+    aws_cryptosdk_aes_gcm_key_destroy(key);
+    aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+    return NULL;
+}
+
+void aws_cryptosdk_aes_gcm_key_destroy(struct aws_cryptosdk_aes_gcm_key *key) {
+    if (!key) return;
+
+    /* EVP_CIPHER_CTX_free cleanses the key schedule */
+    EVP_CIPHER_CTX_free(key->enc_proto);
+    EVP_CIPHER_CTX_free(key->dec_proto);
+    aws_mem_release(key->alloc, key);
+}
+
+int aws_cryptosdk_aes_gcm_encrypt_with_key(
+    struct aws_byte_buf *cipher,
+    struct aws_byte_buf *tag,
+    const struct aws_byte_cursor plain,
+    const struct aws_byte_cursor iv,
+    const struct aws_byte_cursor aad,
+    const struct aws_cryptosdk_aes_gcm_key *key) {
+    if (iv.len != aes_gcm_iv_len || tag->capacity < aes_gcm_tag_len || cipher->capacity < plain.len)
+        return aws_raise_error(AWS_ERROR_INVALID_BUFFER_SIZE);
+
+    /* The prototype may be in use by other threads, so each call works on its own copy. Passing only
+     * the IV to the copy keeps the key schedule computed when the key was created.
+     */
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    if (!ctx || !EVP_CIPHER_CTX_copy(ctx, key->enc_proto) || !EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, iv.ptr)) {
+        aws_byte_buf_secure_zero(cipher);
+        aws_byte_buf_secure_zero(tag);
+        return aes_gcm_setup_err(ctx);
+    }
+
+    return aes_gcm_encrypt_ctx(ctx, cipher, tag, plain, aad);
+}
+
+int aws_cryptosdk_aes_gcm_decrypt_with_key(
+    struct aws_byte_buf *plain,
+    const struct aws_byte_cursor cipher,
+    const struct aws_byte_cursor tag,
+    const struct aws_byte_cursor iv,
+    const struct aws_byte_cursor aad,
+    const struct aws_cryptosdk_aes_gcm_key *key) {
+    if (iv.len != aes_gcm_iv_len || tag.len != aes_gcm_tag_len || plain->capacity < cipher.len)
+        return aws_raise_error(AWS_ERROR_INVALID_BUFFER_SIZE);
+
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    if (!ctx || !EVP_CIPHER_CTX_copy(ctx, key->dec_proto) || !EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, iv.ptr)) {
+        aws_byte_buf_secure_zero(plain);
+        return aes_gcm_setup_err(ctx);
+    }
+
+    return aes_gcm_decrypt_ctx(ctx, plain, cipher, tag, aad);
+}
+
 static int get_openssl_rsa_padding_mode(enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode) {
     switch (rsa_padding_mode) {
         case AWS_CRYPTOSDK_RSA_PKCS1: return RSA_PKCS1_PADDING;
@@ -904,33 +1022,82 @@ static int get_openssl_rsa_padding_mode(enum aws_cryptosdk_rsa_padding_mode rsa_
     }
 }
 
-int aws_cryptosdk_rsa_encrypt(
-    struct aws_byte_buf *cipher,
+struct aws_cryptosdk_rsa_key {
+    struct aws_allocator *alloc;
+    bool is_private;
+    EVP_PKEY *pkey;
+    /* Initialized for encryption (public keys) or decryption (private keys), with the padding mode set */
+    EVP_PKEY_CTX *proto;
+};
+
+struct aws_cryptosdk_rsa_key *aws_cryptosdk_rsa_key_new(
     struct aws_allocator *alloc,
-    const struct aws_byte_cursor plain,
-    const struct aws_string *rsa_public_key_pem,
+    const struct aws_string *rsa_key_pem,
+    bool is_private,
     enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode) {
-    if (cipher->buffer) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
     int padding = get_openssl_rsa_padding_mode(rsa_padding_mode);
-    if (padding < 0) return aws_raise_error(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT);
-    BIO *bio          = NULL;
-    EVP_PKEY_CTX *ctx = NULL;
-    EVP_PKEY *pkey    = NULL;
-    bool error        = true;
-    int err_code      = AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN;
-    pkey              = EVP_PKEY_new();
-    if (!pkey) goto cleanup;
-    bio = BIO_new_mem_buf(aws_string_bytes(rsa_public_key_pem), rsa_public_key_pem->len);
-    if (!bio) goto cleanup;
-    if (!PEM_read_bio_PUBKEY(bio, &pkey, NULL, NULL)) goto cleanup;
-    ctx = EVP_PKEY_CTX_new(pkey, NULL);
-    if (!ctx) goto cleanup;
-    if (EVP_PKEY_encrypt_init(ctx) <= 0) goto cleanup;
-    if (EVP_PKEY_CTX_set_rsa_padding(ctx, padding) <= 0) goto cleanup;
+    if (padding < 0) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT);
+        return NULL;
+    }
+
+    struct aws_cryptosdk_rsa_key *key = aws_mem_acquire(alloc, sizeof(*key));
+    if (!key) {
+        aws_raise_error(AWS_ERROR_OOM);
+        return NULL;
+    }
+
+    BIO *bio        = NULL;
+    key->alloc      = alloc;
+    key->is_private = is_private;
+    key->proto      = NULL;
+    key->pkey       = EVP_PKEY_new();
+    if (!key->pkey) goto err;
+    bio = BIO_new_mem_buf(aws_string_bytes(rsa_key_pem), rsa_key_pem->len);
+    if (!bio) goto err;
+    if (is_private) {
+        if (!PEM_read_bio_PrivateKey(bio, &key->pkey, NULL, NULL)) goto err;
+    } else {
+        if (!PEM_read_bio_PUBKEY(bio, &key->pkey, NULL, NULL)) goto err;
+    }
+    key->proto = EVP_PKEY_CTX_new(key->pkey, NULL);
+    if (!key->proto) goto err;
+    if ((is_private ? EVP_PKEY_decrypt_init(key->proto) : EVP_PKEY_encrypt_init(key->proto)) <= 0) goto err;
+    if (EVP_PKEY_CTX_set_rsa_padding(key->proto, padding) <= 0) goto err;
     if (rsa_padding_mode == AWS_CRYPTOSDK_RSA_OAEP_SHA256_MGF1) {
-        if (EVP_PKEY_CTX_set_rsa_oaep_md(ctx, EVP_sha256()) <= 0) goto cleanup;
-        if (EVP_PKEY_CTX_set_rsa_mgf1_md(ctx, EVP_sha256()) <= 0) goto cleanup;
+        if (EVP_PKEY_CTX_set_rsa_oaep_md(key->proto, EVP_sha256()) <= 0) goto err;
+        if (EVP_PKEY_CTX_set_rsa_mgf1_md(key->proto, EVP_sha256()) <= 0) goto err;
     }
+
+    BIO_free(bio);
+    return key;
+
+err:
+    BIO_free(bio);
+    flush_openssl_errors();
+    aws_cryptosdk_rsa_key_destroy(key);
+    aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+    return NULL;
+}
+
+void aws_cryptosdk_rsa_key_destroy(struct aws_cryptosdk_rsa_key *key) {
+    if (!key) return;
+
+    EVP_PKEY_CTX_free(key->proto);
+    EVP_PKEY_free(key->pkey);
+    aws_mem_release(key->alloc, key);
+}
+
+int aws_cryptosdk_rsa_encrypt_with_key(
+    struct aws_byte_buf *cipher,
+    struct aws_allocator *alloc,
+    const struct aws_byte_cursor plain,
+    const struct aws_cryptosdk_rsa_key *key) {
+    if (cipher->buffer || key->is_private) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    bool error = true;
+    /* The prototype may be in use by other threads, so each call works on its own copy */
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_dup(key->proto);
+    if (!ctx) goto cleanup;
     size_t outlen;
     if (EVP_PKEY_encrypt(ctx, NULL, &outlen, plain.ptr, plain.len) <= 0) goto cleanup;
     if (aws_byte_buf_init(cipher, alloc, outlen)) goto cleanup;
@@ -941,44 +1108,26 @@ int aws_cryptosdk_rsa_encrypt(
 
 cleanup:
     EVP_PKEY_CTX_free(ctx);
-    EVP_PKEY_free(pkey);
-    BIO_free(bio);
     flush_openssl_errors();
     if (error) {
         aws_byte_buf_clean_up_secure(cipher);
-        return aws_raise_error(err_code);
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
     } else {
         return AWS_OP_SUCCESS;
     }
 }
 
-int aws_cryptosdk_rsa_decrypt(
+int aws_cryptosdk_rsa_decrypt_with_key(
     struct aws_byte_buf *plain,
     struct aws_allocator *alloc,
     const struct aws_byte_cursor cipher,
-    const struct aws_string *rsa_private_key_pem,
-    enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode) {
-    if (plain->buffer) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
-    int padding = get_openssl_rsa_padding_mode(rsa_padding_mode);
-    if (padding < 0) return aws_raise_error(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT);
-    BIO *bio          = NULL;
-    EVP_PKEY_CTX *ctx = NULL;
-    EVP_PKEY *pkey    = NULL;
-    bool error        = true;
-    int err_code      = AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN;
-    pkey              = EVP_PKEY_new();
-    if (!pkey) goto cleanup;
-    bio = BIO_new_mem_buf(aws_string_bytes(rsa_private_key_pem), rsa_private_key_pem->len);
-    if (!bio) goto cleanup;
-    if (!PEM_read_bio_PrivateKey(bio, &pkey, NULL, NULL)) goto cleanup;
-    ctx = EVP_PKEY_CTX_new(pkey, NULL);
+    const struct aws_cryptosdk_rsa_key *key) {
+    if (plain->buffer || !key->is_private) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    bool error   = true;
+    int err_code = AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN;
+    /* The prototype may be in use by other threads, so each call works on its own copy */
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_dup(key->proto);
     if (!ctx) goto cleanup;
-    if (EVP_PKEY_decrypt_init(ctx) <= 0) goto cleanup;
-    if (EVP_PKEY_CTX_set_rsa_padding(ctx, padding) <= 0) goto cleanup;
-    if (rsa_padding_mode == AWS_CRYPTOSDK_RSA_OAEP_SHA256_MGF1) {
-        if (EVP_PKEY_CTX_set_rsa_oaep_md(ctx, EVP_sha256()) <= 0) goto cleanup;
-        if (EVP_PKEY_CTX_set_rsa_mgf1_md(ctx, EVP_sha256()) <= 0) goto cleanup;
-    }
     size_t outlen;
     if (EVP_PKEY_decrypt(ctx, NULL, &outlen, cipher.ptr, cipher.len) <= 0) goto cleanup;
     if (aws_byte_buf_init(plain, alloc, outlen)) goto cleanup;
@@ -991,8 +1140,6 @@ int aws_cryptosdk_rsa_decrypt(
 
 cleanup:
     EVP_PKEY_CTX_free(ctx);
-    EVP_PKEY_free(pkey);
-    BIO_free(bio);
     flush_openssl_errors();
     if (error) {
         aws_byte_buf_clean_up_secure(plain);
@@ -1001,3 +1148,33 @@ cleanup:
         return AWS_OP_SUCCESS;
     }
 }
+
+int aws_cryptosdk_rsa_encrypt(
+    struct aws_byte_buf *cipher,
+    struct aws_allocator *alloc,
+    const struct aws_byte_cursor plain,
+    const struct aws_string *rsa_public_key_pem,
+    enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode) {
+    if (cipher->buffer) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    struct aws_cryptosdk_rsa_key *key = aws_cryptosdk_rsa_key_new(alloc, rsa_public_key_pem, false, rsa_padding_mode);
+    if (!key) return AWS_OP_ERR;
+
+    int rv = aws_cryptosdk_rsa_encrypt_with_key(cipher, alloc, plain, key);
+    aws_cryptosdk_rsa_key_destroy(key);
+    return rv;
+}
+
+int aws_cryptosdk_rsa_decrypt(
+    struct aws_byte_buf *plain,
+    struct aws_allocator *alloc,
+    const struct aws_byte_cursor cipher,
+    const struct aws_string *rsa_private_key_pem,
+    enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode) {
+    if (plain->buffer) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    struct aws_cryptosdk_rsa_key *key = aws_cryptosdk_rsa_key_new(alloc, rsa_private_key_pem, true, rsa_padding_mode);
+    if (!key) return AWS_OP_ERR;
+
+    int rv = aws_cryptosdk_rsa_decrypt_with_key(plain, alloc, cipher, key);
+    aws_cryptosdk_rsa_key_destroy(key);
+    return rv;
+}
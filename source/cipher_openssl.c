@@ -55,6 +55,10 @@
 #    define EVP_MD_CTX_new EVP_MD_CTX_create
 #    define EVP_MD_CTX_free EVP_MD_CTX_destroy
 
+static int EVP_PKEY_up_ref(EVP_PKEY *pkey) {
+    return CRYPTO_add(&pkey->references, 1, CRYPTO_LOCK_EVP_PKEY) > 1;
+}
+
 static void ECDSA_SIG_get0(const ECDSA_SIG *sig, const BIGNUM **r, const BIGNUM **s) {
     *r = sig->r;
     *s = sig->s;
@@ -77,6 +81,8 @@ struct aws_cryptosdk_sig_ctx {
     EVP_PKEY *pkey;
     EVP_MD_CTX *ctx;
     bool is_sign;
+    /* True until data is first fed to ctx, i.e. while ctx can serve as a prototype for new contexts */
+    bool is_pristine;
 };
 
 bool aws_cryptosdk_sig_ctx_is_valid(const struct aws_cryptosdk_sig_ctx *sig_ctx) {
@@ -247,7 +253,8 @@ static struct aws_cryptosdk_sig_ctx *sign_start(
         goto rethrow;
     }
 
-    ctx->is_sign = true;
+    ctx->is_sign     = true;
+    ctx->is_pristine = true;
 
     return ctx;
 
@@ -722,6 +729,51 @@ out:
     return result ? aws_raise_error(result) : AWS_OP_SUCCESS;
 }
 
+/**
+ * Set up a verification context using a previously prepared EC_KEY. As with sign_start, this will take a reference on
+ * keypair, so the caller should dispose of its own reference on keypair.
+ */
+static struct aws_cryptosdk_sig_ctx *verify_start(
+    struct aws_allocator *alloc, EC_KEY *keypair, const struct aws_cryptosdk_alg_properties *props) {
+    struct aws_cryptosdk_sig_ctx *ctx = aws_mem_acquire(alloc, sizeof(*ctx));
+
+    if (!ctx) {
+        aws_raise_error(AWS_ERROR_OOM);
+        return NULL;
+    }
+
+    *ctx = (struct aws_cryptosdk_sig_ctx){
+        .alloc = alloc, .props = props, .keypair = keypair, .pkey = NULL, .is_sign = false, .is_pristine = true
+    };
+    EC_KEY_up_ref(ctx->keypair);
+
+    if (!(ctx->pkey = EVP_PKEY_new())) {
+        goto oom;
+    }
+
+    if (!EVP_PKEY_set1_EC_KEY(ctx->pkey, ctx->keypair)) {
+        goto oom;
+    }
+
+    if (!(ctx->ctx = EVP_MD_CTX_new())) {
+        goto oom;
+    }
+
+    if (!(EVP_DigestVerifyInit(ctx->ctx, NULL, props->impl->sig_md_ctor(), NULL, ctx->pkey))) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+        goto rethrow;
+    }
+
+    return ctx;
+
+oom:
+    aws_raise_error(AWS_ERROR_OOM);
+rethrow:
+    aws_cryptosdk_sig_abort(ctx);
+
+    return NULL;
+}
+
 int aws_cryptosdk_sig_verify_start(
     struct aws_cryptosdk_sig_ctx **pctx,
     struct aws_allocator *alloc,
@@ -740,54 +792,86 @@ int aws_cryptosdk_sig_verify_start(
         return AWS_OP_SUCCESS;
     }
 
-    struct aws_cryptosdk_sig_ctx *ctx = aws_mem_acquire(alloc, sizeof(*ctx));
+    EC_KEY *keypair = NULL;
 
-    if (!ctx) {
-        goto oom;
+    if (load_pubkey(&keypair, props, pub_key)) {
+        AWS_POSTCONDITION(!*pctx);
+        AWS_POSTCONDITION(aws_string_is_valid(pub_key));
+        return AWS_OP_ERR;
     }
 
-    *ctx = (struct aws_cryptosdk_sig_ctx){
-        .alloc = alloc, .props = props, .keypair = NULL, .pkey = NULL, .is_sign = false
-    };
+    *pctx = verify_start(alloc, keypair, props);
 
-    if (load_pubkey(&ctx->keypair, props, pub_key)) {
-        goto rethrow;
-    }
+    // EC_KEYs are reference counted
+    EC_KEY_free(keypair);
 
-    if (!(ctx->pkey = EVP_PKEY_new())) {
-        goto oom;
-    }
+    AWS_POSTCONDITION(!*pctx || aws_cryptosdk_sig_ctx_is_valid(*pctx));
+    AWS_POSTCONDITION(!*pctx || !(*pctx)->is_sign);
+    AWS_POSTCONDITION(aws_string_is_valid(pub_key));
+    return *pctx ? AWS_OP_SUCCESS : AWS_OP_ERR;
+}
 
-    if (!EVP_PKEY_set1_EC_KEY(ctx->pkey, ctx->keypair)) {
-        goto oom;
+/**
+ * Set up a context which shares src's EC_KEY and EVP_PKEY, with its digest state copied from src. src must not have
+ * been fed any data yet, so that the copy starts out with an empty digest.
+ */
+static struct aws_cryptosdk_sig_ctx *copy_pristine(
+    struct aws_allocator *alloc, const struct aws_cryptosdk_sig_ctx *src) {
+    struct aws_cryptosdk_sig_ctx *ctx = aws_mem_acquire(alloc, sizeof(*ctx));
+
+    if (!ctx) {
+        aws_raise_error(AWS_ERROR_OOM);
+        return NULL;
     }
 
+    *ctx = (struct aws_cryptosdk_sig_ctx){ .alloc       = alloc,
+                                           .props       = src->props,
+                                           .keypair     = src->keypair,
+                                           .pkey        = src->pkey,
+                                           .is_sign     = src->is_sign,
+                                           .is_pristine = true };
+    EC_KEY_up_ref(ctx->keypair);
+    EVP_PKEY_up_ref(ctx->pkey);
+
     if (!(ctx->ctx = EVP_MD_CTX_new())) {
-        goto oom;
+        aws_raise_error(AWS_ERROR_OOM);
+        goto err;
     }
 
-    if (!(EVP_DigestVerifyInit(ctx->ctx, NULL, props->impl->sig_md_ctor(), NULL, ctx->pkey))) {
+    if (!EVP_MD_CTX_copy_ex(ctx->ctx, src->ctx)) {
         aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
-        goto rethrow;
+        goto err;
     }
 
-    *pctx = ctx;
+    return ctx;
 
-    AWS_POSTCONDITION(aws_cryptosdk_sig_ctx_is_valid(*pctx));
-    AWS_POSTCONDITION(!(*pctx)->is_sign);
-    AWS_POSTCONDITION(aws_string_is_valid(pub_key));
-    return AWS_OP_SUCCESS;
+err:
+    aws_cryptosdk_sig_abort(ctx);
 
-oom:
-    aws_raise_error(AWS_ERROR_OOM);
-rethrow:
-    if (ctx) {
-        aws_cryptosdk_sig_abort(ctx);
+    return NULL;
+}
+
+int aws_cryptosdk_sig_start_from_ctx(
+    struct aws_cryptosdk_sig_ctx **pctx, struct aws_allocator *alloc, const struct aws_cryptosdk_sig_ctx *src) {
+    AWS_PRECONDITION(AWS_OBJECT_PTR_IS_WRITABLE(pctx));
+    AWS_PRECONDITION(AWS_OBJECT_PTR_IS_READABLE(alloc));
+    AWS_PRECONDITION(aws_cryptosdk_sig_ctx_is_valid(src));
+
+    /*
+     * Neither the EC_KEY nor the EVP_PKEY is modified once a context has been set up, so it's safe to share
+     * them between contexts (and threads). If src hasn't digested anything yet, its digest state is a ready-made
+     * prototype, and copying it is much cheaper than initializing a new one; otherwise we start from scratch.
+     */
+    if (src->is_pristine) {
+        *pctx = copy_pristine(alloc, src);
+    } else if (src->is_sign) {
+        *pctx = sign_start(alloc, src->keypair, src->props);
+    } else {
+        *pctx = verify_start(alloc, src->keypair, src->props);
     }
 
-    AWS_POSTCONDITION(!*pctx);
-    AWS_POSTCONDITION(aws_string_is_valid(pub_key));
-    return AWS_OP_ERR;
+    AWS_POSTCONDITION(!*pctx || (aws_cryptosdk_sig_ctx_is_valid(*pctx) && (*pctx)->is_sign == src->is_sign));
+    return *pctx ? AWS_OP_SUCCESS : AWS_OP_ERR;
 }
 
 int aws_cryptosdk_sig_update(struct aws_cryptosdk_sig_ctx *ctx, const struct aws_byte_cursor cursor) {
@@ -801,6 +885,7 @@ int aws_cryptosdk_sig_update(struct aws_cryptosdk_sig_ctx *ctx, const struct aws
         return AWS_OP_SUCCESS;
     }
 
+    ctx->is_pristine = false;
     if (EVP_DigestUpdate(ctx->ctx, cursor.ptr, cursor.len) != 1) {
         return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
     }
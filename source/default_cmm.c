@@ -103,15 +103,26 @@ static int default_cmm_decrypt_materials(
     dec_mat = aws_cryptosdk_dec_materials_new(request->alloc, request->alg);
     if (!dec_mat) goto err;
 
-    if (aws_cryptosdk_keyring_on_decrypt(
-            self->kr,
-            request->alloc,
-            &dec_mat->unencrypted_data_key,
-            &dec_mat->keyring_trace,
-            &request->encrypted_data_keys,
-            request->enc_ctx,
-            request->alg))
+    /*
+     * Only built by the first keyring under self->kr that looks something up in it, so requests whose keyrings
+     * never do cost just this allocation. A single EDK is just as quick to scan, so it isn't indexed.
+     */
+    struct aws_cryptosdk_edk_index *edk_index = NULL;
+    if (aws_array_list_length(&request->encrypted_data_keys) > 1 &&
+        !(edk_index = aws_cryptosdk_edk_index_new(request->alloc, &request->encrypted_data_keys))) {
         goto err;
+    }
+    int rv = aws_cryptosdk_keyring_on_decrypt_indexed(
+        self->kr,
+        request->alloc,
+        &dec_mat->unencrypted_data_key,
+        &dec_mat->keyring_trace,
+        &request->encrypted_data_keys,
+        edk_index,
+        request->enc_ctx,
+        request->alg);
+    aws_cryptosdk_edk_index_destroy(edk_index);
+    if (rv) goto err;
 
     if (!dec_mat->unencrypted_data_key.buffer) {
         aws_raise_error(AWS_CRYPTOSDK_ERR_CANNOT_DECRYPT);
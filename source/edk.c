@@ -13,6 +13,10 @@
  * limitations under the License.
  */
 #include <aws/cryptosdk/edk.h>
+#include <aws/cryptosdk/private/edk.h>
+
+#include <aws/common/math.h>
+#include <string.h>
 
 int aws_cryptosdk_edk_list_init(struct aws_allocator *alloc, struct aws_array_list *edk_list) {
     const int initial_size = 4;  // arbitrary starting point, list will resize as necessary
@@ -107,3 +111,171 @@ bool aws_cryptosdk_empty_edk_list_is_valid(const struct aws_array_list *edk_list
     AWS_PRECONDITION(edk_list->length == 0);
     return aws_array_list_is_valid(edk_list) && (edk_list->item_size == sizeof(struct aws_cryptosdk_edk));
 }
+
+/* Orders byte cursors by length, then by contents; any total order will do for lookups */
+static int edk_index_cursor_cmp(struct aws_byte_cursor a, struct aws_byte_cursor b) {
+    if (a.len != b.len) return a.len < b.len ? -1 : 1;
+    return a.len ? memcmp(a.ptr, b.ptr, a.len) : 0;
+}
+
+/*
+ * Compares the EDK at position with the lookup key (provider_id, provider_info), ignoring provider info
+ * when provider_info is NULL.
+ */
+static int edk_index_cmp(
+    const struct aws_array_list *edks,
+    size_t position,
+    struct aws_byte_cursor provider_id,
+    const struct aws_byte_cursor *provider_info) {
+    const struct aws_cryptosdk_edk *edk = (const struct aws_cryptosdk_edk *)edks->data + position;
+    int cmp = edk_index_cursor_cmp(aws_byte_cursor_from_buf(&edk->provider_id), provider_id);
+    if (cmp || !provider_info) return cmp;
+    return edk_index_cursor_cmp(aws_byte_cursor_from_buf(&edk->provider_info), *provider_info);
+}
+
+static int edk_index_position_cmp(const struct aws_array_list *edks, size_t a, size_t b, bool by_info) {
+    const struct aws_cryptosdk_edk *edk_b = (const struct aws_cryptosdk_edk *)edks->data + b;
+    struct aws_byte_cursor info_b         = aws_byte_cursor_from_buf(&edk_b->provider_info);
+    return edk_index_cmp(edks, a, aws_byte_cursor_from_buf(&edk_b->provider_id), by_info ? &info_b : NULL);
+}
+
+/*
+ * Sorts positions, which are in increasing order, by provider ID and (if by_info) provider info. This is a
+ * bottom-up merge sort, which is stable, so the positions of equal EDKs stay in list order. scratch must have
+ * room for num positions.
+ */
+static void edk_index_sort(
+    const struct aws_array_list *edks, size_t *positions, size_t *scratch, size_t num, bool by_info) {
+    size_t *from = positions;
+    size_t *to   = scratch;
+
+    for (size_t width = 1; width < num; width *= 2) {
+        for (size_t lo = 0; lo < num; lo += 2 * width) {
+            size_t mid = aws_min_size(lo + width, num);
+            size_t hi  = aws_min_size(lo + 2 * width, num);
+            size_t a = lo, b = mid, out = lo;
+            while (a < mid && b < hi) {
+                to[out++] = edk_index_position_cmp(edks, from[b], from[a], by_info) < 0 ? from[b++] : from[a++];
+            }
+            while (a < mid) to[out++] = from[a++];
+            while (b < hi) to[out++] = from[b++];
+        }
+        size_t *tmp = from;
+        from        = to;
+        to          = tmp;
+    }
+    if (from != positions) memcpy(positions, from, num * sizeof(*positions));
+}
+
+/*
+ * Builds the sorted positions of index, unless another thread got there first, and returns them, or NULL
+ * on failure with the error code set.
+ */
+static size_t *edk_index_build(struct aws_cryptosdk_edk_index *index) {
+    size_t num_edks = aws_array_list_length(index->edks);
+    size_t *sorted  = NULL;
+
+    if (aws_mutex_lock(&index->build_lock)) {
+        return NULL;
+    }
+
+    sorted = aws_atomic_load_ptr(&index->sorted);
+    if (!sorted) {
+        /* By provider ID, then by provider ID and info, then scratch space for the sort */
+        size_t size;
+        if (aws_mul_size_checked(num_edks, 3 * sizeof(size_t), &size)) goto out;
+        if (!(sorted = aws_mem_acquire(index->alloc, size))) {
+            aws_raise_error(AWS_ERROR_OOM);
+            goto out;
+        }
+        for (size_t idx = 0; idx < num_edks; ++idx) sorted[idx] = sorted[num_edks + idx] = idx;
+        edk_index_sort(index->edks, sorted, sorted + 2 * num_edks, num_edks, false);
+        edk_index_sort(index->edks, sorted + num_edks, sorted + 2 * num_edks, num_edks, true);
+        aws_atomic_store_ptr(&index->sorted, sorted);
+    }
+
+out:
+    if (aws_mutex_unlock(&index->build_lock)) {
+        abort();
+    }
+    return sorted;
+}
+
+struct aws_cryptosdk_edk_index *aws_cryptosdk_edk_index_new(
+    struct aws_allocator *alloc, const struct aws_array_list *edks) {
+    AWS_PRECONDITION(aws_allocator_is_valid(alloc));
+    AWS_PRECONDITION(aws_cryptosdk_edk_list_is_valid(edks));
+
+    struct aws_cryptosdk_edk_index *index = aws_mem_acquire(alloc, sizeof(*index));
+    if (!index) {
+        aws_raise_error(AWS_ERROR_OOM);
+        return NULL;
+    }
+
+    AWS_ZERO_STRUCT(*index);
+    index->alloc = alloc;
+    index->edks  = edks;
+    aws_atomic_init_ptr(&index->sorted, NULL);
+
+    if (aws_mutex_init(&index->build_lock)) {
+        aws_mem_release(alloc, index);
+        return NULL;
+    }
+
+    return index;
+}
+
+void aws_cryptosdk_edk_index_destroy(struct aws_cryptosdk_edk_index *index) {
+    if (!index) return;
+
+    size_t *sorted = aws_atomic_load_ptr(&index->sorted);
+    if (sorted) aws_mem_release(index->alloc, sorted);
+    aws_mutex_clean_up(&index->build_lock);
+    aws_mem_release(index->alloc, index);
+}
+
+int aws_cryptosdk_edk_index_find(
+    const struct aws_cryptosdk_edk_index *index,
+    struct aws_byte_cursor provider_id,
+    const struct aws_byte_cursor *provider_info,
+    const size_t **positions,
+    size_t *num_positions) {
+    *positions     = NULL;
+    *num_positions = 0;
+
+    size_t num_edks = aws_array_list_length(index->edks);
+    if (!num_edks) return AWS_OP_SUCCESS;
+
+    /* Lookups only ever build the index once, so it is still read-only to the callers sharing it */
+    size_t *sorted = aws_atomic_load_ptr(&((struct aws_cryptosdk_edk_index *)index)->sorted);
+    if (!sorted && !(sorted = edk_index_build((struct aws_cryptosdk_edk_index *)index))) {
+        return AWS_OP_ERR;
+    }
+
+    const size_t *candidates = provider_info ? sorted + num_edks : sorted;
+    size_t lo = 0, hi = num_edks;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (edk_index_cmp(index->edks, candidates[mid], provider_id, provider_info) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    size_t end = lo;
+    hi         = num_edks;
+    while (end < hi) {
+        size_t mid = end + (hi - end) / 2;
+        if (edk_index_cmp(index->edks, candidates[mid], provider_id, provider_info) <= 0) {
+            end = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (end > lo) {
+        *positions     = candidates + lo;
+        *num_positions = end - lo;
+    }
+    return AWS_OP_SUCCESS;
+}
@@ -14,12 +14,14 @@
  */
 
 #include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/private/cipher.h>
 #include <aws/cryptosdk/private/enc_ctx.h>
 #include <aws/cryptosdk/private/utils.h>
 
 #include <aws/common/byte_buf.h>
 #include <aws/common/common.h>
 #include <aws/common/hash_table.h>
+#include <aws/common/string.h>
 
 int aws_cryptosdk_enc_ctx_init(struct aws_allocator *alloc, struct aws_hash_table *enc_ctx) {
     AWS_PRECONDITION(alloc);
@@ -76,53 +78,361 @@ int aws_cryptosdk_enc_ctx_size(size_t *size, const struct aws_hash_table *enc_ct
     return AWS_OP_SUCCESS;
 }
 
+static int compare_cursors(const struct aws_byte_cursor *a, const struct aws_byte_cursor *b) {
+    /* The same order as aws_string_compare, i.e. that of the serialized form */
+    size_t len = a->len < b->len ? a->len : b->len;
+    int rv     = len ? memcmp(a->ptr, b->ptr, len) : 0;
+    if (rv) return rv;
+    return (a->len > b->len) - (a->len < b->len);
+}
+
+static int compare_entries_by_key(const void *a, const void *b) {
+    const struct aws_cryptosdk_enc_ctx_entry *entry_a = a;
+    const struct aws_cryptosdk_enc_ctx_entry *entry_b = b;
+    return compare_cursors(&entry_a->key, &entry_b->key);
+}
+
+static void flat_invalidate(struct aws_cryptosdk_enc_ctx_flat *flat) {
+    flat->serialized.len = 0;
+    flat->has_serialized = false;
+    flat->has_digest     = false;
+}
+
+/* Makes room for count entries, moving them out of caller-provided storage if it is too small */
+static int flat_reserve(struct aws_cryptosdk_enc_ctx_flat *flat, size_t count) {
+    if (count <= aws_array_list_capacity(&flat->entries)) return AWS_OP_SUCCESS;
+    if (flat->entries.alloc) {
+        /* Grow dynamic lists in one step, rather than by repeated doubling */
+        return aws_array_list_ensure_capacity(&flat->entries, count - 1);
+    }
+
+    struct aws_array_list grown;
+    if (aws_array_list_init_dynamic(&grown, flat->alloc, count, sizeof(struct aws_cryptosdk_enc_ctx_entry))) {
+        return AWS_OP_ERR;
+    }
+    for (size_t i = 0; i < aws_array_list_length(&flat->entries); i++) {
+        struct aws_cryptosdk_enc_ctx_entry *entry = NULL;
+        aws_array_list_get_at_ptr(&flat->entries, (void **)&entry, i);
+        aws_array_list_push_back(&grown, entry); /* cannot fail, as the capacity is sufficient */
+    }
+    /* A list over caller-provided storage needs no clean up */
+    flat->entries = grown;
+    return AWS_OP_SUCCESS;
+}
+
+static int flat_serialized_size(size_t *size, const struct aws_cryptosdk_enc_ctx_flat *flat) {
+    size_t num_entries = aws_array_list_length(&flat->entries);
+    if (num_entries > UINT16_MAX) return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    if (num_entries == 0) {
+        *size = 0;
+        return AWS_OP_SUCCESS;
+    }
+
+    size_t serialized_len = 2;  // First two bytes are the number of k-v pairs
+    for (size_t i = 0; i < num_entries; i++) {
+        struct aws_cryptosdk_enc_ctx_entry *entry = NULL;
+        aws_array_list_get_at_ptr(&flat->entries, (void **)&entry, i);
+        if (aws_add_size_checked_varargs(
+                4, &serialized_len, serialized_len, entry->key.len, entry->value.len, (size_t)4)) {
+            return AWS_OP_ERR;
+        }
+        if (serialized_len > UINT16_MAX) return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    }
+
+    *size = serialized_len;
+    return AWS_OP_SUCCESS;
+}
+
+/* Appends the serialized form to output; the caller must have checked its size. Returns false if output is full. */
+static bool flat_write(const struct aws_cryptosdk_enc_ctx_flat *flat, struct aws_byte_buf *output) {
+    size_t num_entries = aws_array_list_length(&flat->entries);
+    if (num_entries == 0) return true;  // Empty encryption context
+
+    if (!aws_byte_buf_write_be16(output, (uint16_t)num_entries)) return false;
+    for (size_t i = 0; i < num_entries; i++) {
+        struct aws_cryptosdk_enc_ctx_entry *entry = NULL;
+        aws_array_list_get_at_ptr(&flat->entries, (void **)&entry, i);
+        // Assert that we don't truncate data when we write out the fields.
+        // This should have already been assured by flat_serialized_size()
+        AWS_ASSERT(entry->key.len <= UINT16_MAX);
+        AWS_ASSERT(entry->value.len <= UINT16_MAX);
+        if (!aws_byte_buf_write_be16(output, (uint16_t)entry->key.len)) return false;
+        if (!aws_byte_buf_write_from_whole_cursor(output, entry->key)) return false;
+        if (!aws_byte_buf_write_be16(output, (uint16_t)entry->value.len)) return false;
+        if (!aws_byte_buf_write_from_whole_cursor(output, entry->value)) return false;
+    }
+    return true;
+}
+
+void aws_cryptosdk_enc_ctx_flat_init(
+    struct aws_cryptosdk_enc_ctx_flat *flat,
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_enc_ctx_entry *storage,
+    size_t storage_len) {
+    AWS_PRECONDITION(AWS_OBJECT_PTR_IS_WRITABLE(flat));
+    AWS_PRECONDITION(aws_allocator_is_valid(alloc));
+
+    memset(flat, 0, sizeof(*flat));
+    flat->alloc = alloc;
+    if (storage && storage_len) {
+        aws_array_list_init_static(&flat->entries, storage, storage_len, sizeof(struct aws_cryptosdk_enc_ctx_entry));
+    } else {
+        /* Allocates nothing, so cannot fail */
+        aws_array_list_init_dynamic(&flat->entries, alloc, 0, sizeof(struct aws_cryptosdk_enc_ctx_entry));
+    }
+}
+
+void aws_cryptosdk_enc_ctx_flat_clean_up(struct aws_cryptosdk_enc_ctx_flat *flat) {
+    aws_array_list_clean_up(&flat->entries);
+    aws_byte_buf_clean_up(&flat->serialized);
+    memset(flat, 0, sizeof(*flat));
+}
+
+void aws_cryptosdk_enc_ctx_flat_clear(struct aws_cryptosdk_enc_ctx_flat *flat) {
+    aws_array_list_clear(&flat->entries);
+    flat_invalidate(flat);
+}
+
+int aws_cryptosdk_enc_ctx_flat_set(struct aws_cryptosdk_enc_ctx_flat *flat, const struct aws_hash_table *enc_ctx) {
+    AWS_PRECONDITION(aws_hash_table_is_valid(enc_ctx));
+
+    aws_cryptosdk_enc_ctx_flat_clear(flat);
+    if (flat_reserve(flat, aws_hash_table_get_entry_count(enc_ctx))) return AWS_OP_ERR;
+
+    for (struct aws_hash_iter iter = aws_hash_iter_begin(enc_ctx); !aws_hash_iter_done(&iter);
+         aws_hash_iter_next(&iter)) {
+        struct aws_cryptosdk_enc_ctx_entry entry = { .key   = aws_byte_cursor_from_string(iter.element.key),
+                                                     .value = aws_byte_cursor_from_string(iter.element.value) };
+        if (aws_array_list_push_back(&flat->entries, &entry)) {
+            aws_cryptosdk_enc_ctx_flat_clear(flat);
+            return AWS_OP_ERR;
+        }
+    }
+
+    aws_array_list_sort(&flat->entries, compare_entries_by_key);
+    return AWS_OP_SUCCESS;
+}
+
+/* Returns the entry for key, or NULL */
+static struct aws_cryptosdk_enc_ctx_entry *flat_find(
+    const struct aws_cryptosdk_enc_ctx_flat *flat, const struct aws_byte_cursor *key) {
+    size_t lo = 0;
+    size_t hi = aws_array_list_length(&flat->entries);
+
+    while (lo < hi) {
+        size_t mid                                = lo + (hi - lo) / 2;
+        struct aws_cryptosdk_enc_ctx_entry *entry = NULL;
+        aws_array_list_get_at_ptr(&flat->entries, (void **)&entry, mid);
+
+        int cmp = compare_cursors(&entry->key, key);
+        if (cmp == 0) return entry;
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+int aws_cryptosdk_enc_ctx_flat_put(
+    struct aws_cryptosdk_enc_ctx_flat *flat, struct aws_byte_cursor key, struct aws_byte_cursor value) {
+    struct aws_cryptosdk_enc_ctx_entry *entry = flat_find(flat, &key);
+
+    flat_invalidate(flat);
+    if (entry) {
+        entry->value = value;
+        return AWS_OP_SUCCESS;
+    }
+
+    size_t num_entries                           = aws_array_list_length(&flat->entries);
+    struct aws_cryptosdk_enc_ctx_entry new_entry = { .key = key, .value = value };
+    if (flat_reserve(flat, num_entries + 1) || aws_array_list_push_back(&flat->entries, &new_entry)) {
+        return AWS_OP_ERR;
+    }
+
+    /* Move the new entry down into place */
+    for (size_t i = num_entries; i > 0; i--) {
+        struct aws_cryptosdk_enc_ctx_entry *prev = NULL;
+        aws_array_list_get_at_ptr(&flat->entries, (void **)&prev, i - 1);
+        if (compare_cursors(&prev->key, &key) < 0) break;
+        aws_array_list_swap(&flat->entries, i - 1, i);
+    }
+    return AWS_OP_SUCCESS;
+}
+
+const struct aws_byte_cursor *aws_cryptosdk_enc_ctx_flat_get(
+    const struct aws_cryptosdk_enc_ctx_flat *flat, struct aws_byte_cursor key) {
+    struct aws_cryptosdk_enc_ctx_entry *entry = flat_find(flat, &key);
+    return entry ? &entry->value : NULL;
+}
+
+int aws_cryptosdk_enc_ctx_flat_deserialize(struct aws_cryptosdk_enc_ctx_flat *flat, struct aws_byte_cursor *cursor) {
+    AWS_PRECONDITION(aws_byte_cursor_is_valid(cursor));
+
+    aws_cryptosdk_enc_ctx_flat_clear(flat);
+    /* The serialized form becomes a view of the input, so release any buffer of our own */
+    aws_byte_buf_clean_up(&flat->serialized);
+
+    const uint8_t *start = cursor->ptr;
+    if (cursor->len) {
+        uint16_t elem_count;
+        if (!aws_byte_cursor_read_be16(cursor, &elem_count)) goto SHORT_BUF;
+        if (!elem_count) {
+            aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+            goto RETHROW;
+        }
+        if (flat_reserve(flat, elem_count)) goto RETHROW;
+
+        for (uint16_t i = 0; i < elem_count; i++) {
+            struct aws_cryptosdk_enc_ctx_entry entry;
+            uint16_t len;
+
+            if (!aws_byte_cursor_read_be16(cursor, &len)) goto SHORT_BUF;
+            entry.key = aws_byte_cursor_advance_nospec(cursor, len);
+            if (!entry.key.ptr) goto SHORT_BUF;
+
+            if (!aws_byte_cursor_read_be16(cursor, &len)) goto SHORT_BUF;
+            entry.value = aws_byte_cursor_advance_nospec(cursor, len);
+            if (!entry.value.ptr) goto SHORT_BUF;
+
+            aws_array_list_push_back(&flat->entries, &entry); /* cannot fail, as the capacity is sufficient */
+        }
+
+        aws_array_list_sort(&flat->entries, compare_entries_by_key);
+        for (size_t i = 1; i < elem_count; i++) {
+            struct aws_cryptosdk_enc_ctx_entry *prev = NULL;
+            struct aws_cryptosdk_enc_ctx_entry *entry = NULL;
+            aws_array_list_get_at_ptr(&flat->entries, (void **)&prev, i - 1);
+            aws_array_list_get_at_ptr(&flat->entries, (void **)&entry, i);
+            if (!compare_entries_by_key(prev, entry)) {
+                // A duplicate key in serialized encryption context, so fail
+                aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+                goto RETHROW;
+            }
+        }
+    }
+
+    // An empty context's serialized form stays zeroed, as a valid empty buffer must be
+    if (cursor->ptr != start) flat->serialized = aws_byte_buf_from_array(start, cursor->ptr - start);
+    flat->has_serialized = true;
+    return AWS_OP_SUCCESS;
+
+SHORT_BUF:
+    aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+RETHROW:
+    aws_cryptosdk_enc_ctx_flat_clear(flat);
+    return AWS_OP_ERR;
+}
+
+static void rebase_cursor(struct aws_byte_cursor *cur, const uint8_t *old_base, const uint8_t *new_base) {
+    if (cur->ptr) cur->ptr = (uint8_t *)new_base + (cur->ptr - old_base);
+}
+
+void aws_cryptosdk_enc_ctx_flat_rebase(
+    struct aws_cryptosdk_enc_ctx_flat *flat, const uint8_t *old_base, const uint8_t *new_base) {
+    for (size_t i = 0; i < aws_array_list_length(&flat->entries); i++) {
+        struct aws_cryptosdk_enc_ctx_entry *entry = NULL;
+        aws_array_list_get_at_ptr(&flat->entries, (void **)&entry, i);
+        rebase_cursor(&entry->key, old_base, new_base);
+        rebase_cursor(&entry->value, old_base, new_base);
+    }
+    if (!flat->serialized.allocator && flat->serialized.buffer) {
+        flat->serialized.buffer = (uint8_t *)new_base + (flat->serialized.buffer - old_base);
+    }
+}
+
+int aws_cryptosdk_enc_ctx_flat_export(struct aws_cryptosdk_enc_ctx_flat *flat, struct aws_hash_table *enc_ctx) {
+    AWS_PRECONDITION(aws_hash_table_is_valid(enc_ctx));
+    AWS_PRECONDITION(aws_hash_table_get_entry_count(enc_ctx) == 0);
+
+    for (size_t i = 0; i < aws_array_list_length(&flat->entries); i++) {
+        struct aws_cryptosdk_enc_ctx_entry *entry = NULL;
+        aws_array_list_get_at_ptr(&flat->entries, (void **)&entry, i);
+
+        struct aws_string *key   = aws_string_new_from_array(flat->alloc, entry->key.ptr, entry->key.len);
+        struct aws_string *value = aws_string_new_from_array(flat->alloc, entry->value.ptr, entry->value.len);
+        if (!key || !value || aws_hash_table_put(enc_ctx, key, value, NULL)) {
+            aws_string_destroy(key);
+            aws_string_destroy(value);
+            aws_cryptosdk_enc_ctx_clear(enc_ctx);
+            return AWS_OP_ERR;
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_enc_ctx_flat_serialize(
+    struct aws_cryptosdk_enc_ctx_flat *flat, struct aws_byte_cursor *serialized) {
+    AWS_PRECONDITION(AWS_OBJECT_PTR_IS_WRITABLE(serialized));
+
+    if (!flat->has_serialized) {
+        size_t size;
+        if (flat_serialized_size(&size, flat)) return AWS_OP_ERR;
+
+        flat->serialized.len = 0;
+        /* A deserialized context's serialized form is a view of its input, which must not be overwritten */
+        if (flat->serialized.capacity < size || !flat->serialized.allocator) {
+            aws_byte_buf_clean_up(&flat->serialized);
+            if (aws_byte_buf_init(&flat->serialized, flat->alloc, size)) return AWS_OP_ERR;
+        }
+        if (!flat_write(flat, &flat->serialized)) return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+        flat->has_serialized = true;
+    }
+
+    *serialized = aws_byte_cursor_from_buf(&flat->serialized);
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_enc_ctx_flat_digest(struct aws_cryptosdk_enc_ctx_flat *flat, uint8_t *digest) {
+    if (!flat->has_digest) {
+        struct aws_cryptosdk_md_context *md_context = NULL;
+        struct aws_byte_cursor serialized;
+        size_t digest_len;
+
+        if (aws_cryptosdk_enc_ctx_flat_serialize(flat, &serialized)) return AWS_OP_ERR;
+        if (aws_cryptosdk_md_init(flat->alloc, &md_context, AWS_CRYPTOSDK_MD_SHA512) ||
+            aws_cryptosdk_md_update(md_context, serialized.ptr, serialized.len)) {
+            aws_cryptosdk_md_abort(md_context);
+            return AWS_OP_ERR;
+        }
+        if (aws_cryptosdk_md_finish(md_context, flat->digest, &digest_len)) return AWS_OP_ERR;
+        AWS_ASSERT(digest_len == AWS_CRYPTOSDK_ENC_CTX_DIGEST_LEN);
+        flat->has_digest = true;
+    }
+
+    memcpy(digest, flat->digest, AWS_CRYPTOSDK_ENC_CTX_DIGEST_LEN);
+    return AWS_OP_SUCCESS;
+}
+
 int aws_cryptosdk_enc_ctx_serialize(
     struct aws_allocator *alloc, struct aws_byte_buf *output, const struct aws_hash_table *enc_ctx) {
     AWS_PRECONDITION(AWS_OBJECT_PTR_IS_READABLE(alloc));
     AWS_PRECONDITION(aws_byte_buf_is_valid(output));
     AWS_PRECONDITION(aws_hash_table_is_valid(enc_ctx));
 
-    size_t num_elems = aws_hash_table_get_entry_count(enc_ctx);
-    if (num_elems > UINT16_MAX) return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
-
     size_t length;
     if (aws_cryptosdk_enc_ctx_size(&length, enc_ctx)) return AWS_OP_ERR;
     if (length == 0) return AWS_OP_SUCCESS;  // Empty encryption context
     if (output->capacity < length) return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
 
-    if (!aws_byte_buf_write_be16(output, (uint16_t)num_elems)) {
+    /* Small contexts (the common case) are sorted on the stack, without allocating */
+    struct aws_cryptosdk_enc_ctx_entry storage[AWS_CRYPTOSDK_ENC_CTX_SMALL_SIZE];
+    struct aws_cryptosdk_enc_ctx_flat flat;
+    aws_cryptosdk_enc_ctx_flat_init(&flat, alloc, storage, AWS_CRYPTOSDK_ENC_CTX_SMALL_SIZE);
+    if (aws_cryptosdk_enc_ctx_flat_set(&flat, enc_ctx)) {
+        aws_cryptosdk_enc_ctx_flat_clean_up(&flat);
+        return AWS_OP_ERR;
+    }
+
+    bool written = flat_write(&flat, output);
+    aws_cryptosdk_enc_ctx_flat_clean_up(&flat);
+    if (!written) {
         aws_byte_buf_clean_up(output);
         return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
     }
-
-    struct aws_array_list elems;
-    if (aws_cryptosdk_hash_elems_array_init(alloc, &elems, enc_ctx)) return AWS_OP_ERR;
-    aws_array_list_sort(&elems, aws_cryptosdk_compare_hash_elems_by_key_string);
-
-    for (size_t idx = 0; idx < num_elems; ++idx) {
-        struct aws_hash_element *elem;
-        if (aws_array_list_get_at_ptr(&elems, (void **)&elem, idx)) {
-            aws_array_list_clean_up(&elems);
-            return AWS_OP_ERR;
-        }
-        const struct aws_string *key   = (const struct aws_string *)elem->key;
-        const struct aws_string *value = (const struct aws_string *)elem->value;
-        // Assert that we don't truncate data when we write out the fields.
-        // This should have already been assured by aws_aws_cryptosdk_enc_ctx_size()
-        AWS_ASSERT(key->len <= UINT16_MAX);
-        AWS_ASSERT(value->len <= UINT16_MAX);
-        if (!aws_byte_buf_write_be16(output, (uint16_t)key->len)) goto WRITE_ERR;
-        if (!aws_byte_buf_write_from_whole_string(output, key)) goto WRITE_ERR;
-        if (!aws_byte_buf_write_be16(output, (uint16_t)value->len)) goto WRITE_ERR;
-        if (!aws_byte_buf_write_from_whole_string(output, value)) goto WRITE_ERR;
-    }
-    aws_array_list_clean_up(&elems);
     return AWS_OP_SUCCESS;
-
-WRITE_ERR:
-    aws_array_list_clean_up(&elems);
-    aws_byte_buf_clean_up(output);
-    return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
 }
 
 int aws_cryptosdk_enc_ctx_deserialize(
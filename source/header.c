@@ -120,6 +120,7 @@ int aws_cryptosdk_hdr_init(struct aws_cryptosdk_hdr *hdr, struct aws_allocator *
         return AWS_OP_ERR;
     }
 
+    aws_cryptosdk_enc_ctx_flat_init(&hdr->enc_ctx_flat, alloc, NULL, 0);
     hdr->alloc = alloc;
 
     return AWS_OP_SUCCESS;
@@ -137,10 +138,25 @@ void aws_cryptosdk_hdr_clear(struct aws_cryptosdk_hdr *hdr) {
 
     aws_cryptosdk_edk_list_clear(&hdr->edk_list);
     aws_cryptosdk_enc_ctx_clear(&hdr->enc_ctx);
+    aws_cryptosdk_enc_ctx_flat_clear(&hdr->enc_ctx_flat);
+    hdr->enc_ctx_frozen = false;
 
     hdr->auth_len = 0;
 }
 
+int aws_cryptosdk_hdr_freeze_enc_ctx(struct aws_cryptosdk_hdr *hdr) {
+    struct aws_byte_cursor serialized;
+
+    hdr->enc_ctx_frozen = false;
+    if (aws_cryptosdk_enc_ctx_flat_set(&hdr->enc_ctx_flat, &hdr->enc_ctx) ||
+        aws_cryptosdk_enc_ctx_flat_serialize(&hdr->enc_ctx_flat, &serialized)) {
+        return AWS_OP_ERR;
+    }
+    hdr->enc_ctx_frozen = true;
+
+    return AWS_OP_SUCCESS;
+}
+
 void aws_cryptosdk_hdr_clean_up(struct aws_cryptosdk_hdr *hdr) {
     if (!hdr->alloc) {
         // Idempotent cleanup
@@ -153,40 +169,47 @@ void aws_cryptosdk_hdr_clean_up(struct aws_cryptosdk_hdr *hdr) {
 
     aws_cryptosdk_edk_list_clean_up(&hdr->edk_list);
     aws_cryptosdk_enc_ctx_clean_up(&hdr->enc_ctx);
+    aws_cryptosdk_enc_ctx_flat_clean_up(&hdr->enc_ctx_flat);
 
     aws_secure_zero(hdr, sizeof(*hdr));
 }
 
-static inline int parse_edk(
-    struct aws_allocator *allocator, struct aws_cryptosdk_edk *edk, struct aws_byte_cursor *cur) {
+/* Reads one length-prefixed EDK field. With no allocator, field is left as a view of the bytes at cur. */
+static inline int parse_edk_field(
+    struct aws_allocator *allocator, struct aws_byte_buf *field, struct aws_byte_cursor *cur) {
     uint16_t field_len;
 
-    memset(edk, 0, sizeof(*edk));
-
-    if (!aws_byte_cursor_read_be16(cur, &field_len)) goto SHORT_BUF;
-    if (aws_byte_buf_init(&edk->provider_id, allocator, field_len)) goto MEM_ERR;
-    if (!aws_byte_cursor_read_and_fill_buffer(cur, &edk->provider_id)) goto SHORT_BUF;
+    if (!aws_byte_cursor_read_be16(cur, &field_len)) return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
 
-    if (!aws_byte_cursor_read_be16(cur, &field_len)) goto SHORT_BUF;
-    if (aws_byte_buf_init(&edk->provider_info, allocator, field_len)) goto MEM_ERR;
-    if (!aws_byte_cursor_read_and_fill_buffer(cur, &edk->provider_info)) goto SHORT_BUF;
+    if (!allocator) {
+        struct aws_byte_cursor bytes = aws_byte_cursor_advance_nospec(cur, field_len);
+        if (!bytes.ptr) return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+        // An empty field stays zeroed, as aws_byte_buf_init would leave it
+        if (bytes.len) *field = aws_byte_buf_from_array(bytes.ptr, bytes.len);
+        return AWS_OP_SUCCESS;
+    }
 
-    if (!aws_byte_cursor_read_be16(cur, &field_len)) goto SHORT_BUF;
-    if (aws_byte_buf_init(&edk->ciphertext, allocator, field_len)) goto MEM_ERR;
-    if (!aws_byte_cursor_read_and_fill_buffer(cur, &edk->ciphertext)) goto SHORT_BUF;
+    // The _init function raises AWS_ERROR_OOM on failure
+    if (aws_byte_buf_init(field, allocator, field_len)) return AWS_OP_ERR;
+    if (!aws_byte_cursor_read_and_fill_buffer(cur, field)) return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
 
     return AWS_OP_SUCCESS;
+}
 
-SHORT_BUF:
-    aws_cryptosdk_edk_clean_up(edk);
-    return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
-MEM_ERR:
-    aws_cryptosdk_edk_clean_up(edk);
-    // The _init function should have already raised an AWS_ERROR_OOM
-    return AWS_OP_ERR;
+static inline int parse_edk(
+    struct aws_allocator *allocator, struct aws_cryptosdk_edk *edk, struct aws_byte_cursor *cur) {
+    memset(edk, 0, sizeof(*edk));
+
+    if (parse_edk_field(allocator, &edk->provider_id, cur) || parse_edk_field(allocator, &edk->provider_info, cur) ||
+        parse_edk_field(allocator, &edk->ciphertext, cur)) {
+        aws_cryptosdk_edk_clean_up(edk);
+        return AWS_OP_ERR;
+    }
+
+    return AWS_OP_SUCCESS;
 }
 
-int aws_cryptosdk_hdr_parse(struct aws_cryptosdk_hdr *hdr, struct aws_byte_cursor *pcursor) {
+static int hdr_parse(struct aws_cryptosdk_hdr *hdr, struct aws_byte_cursor *pcursor, bool borrow) {
     struct aws_byte_cursor cur = *pcursor;
 
     aws_cryptosdk_hdr_clear(hdr);
@@ -216,7 +239,15 @@ int aws_cryptosdk_hdr_parse(struct aws_cryptosdk_hdr *hdr, struct aws_byte_curso
     uint16_t aad_len;
     if (!aws_byte_cursor_read_be16(&cur, &aad_len)) goto SHORT_BUF;
 
-    if (aad_len) {
+    if (borrow) {
+        struct aws_byte_cursor aad = aws_byte_cursor_advance_nospec(&cur, aad_len);
+        if (!aad.ptr) goto SHORT_BUF;
+
+        // As below, a short encryption context is a parse error. hdr->enc_ctx is only filled in once the
+        // whole header has been parsed, so that parsing a partial header again and again allocates nothing.
+        if (aws_cryptosdk_enc_ctx_flat_deserialize(&hdr->enc_ctx_flat, &aad)) goto PARSE_ERR;
+        if (aad.len) goto PARSE_ERR;
+    } else if (aad_len) {
         struct aws_byte_cursor aad = aws_byte_cursor_advance_nospec(&cur, aad_len);
 
         // Note that, even if this fails with SHORT_BUF, we report a parse error, since we know we
@@ -231,11 +262,13 @@ int aws_cryptosdk_hdr_parse(struct aws_cryptosdk_hdr *hdr, struct aws_byte_curso
     uint16_t edk_count;
     if (!aws_byte_cursor_read_be16(&cur, &edk_count)) goto SHORT_BUF;
     if (!edk_count) goto PARSE_ERR;
+    // Make room for all of the EDKs at once, so that adding them below cannot fail
+    if (aws_array_list_ensure_capacity(&hdr->edk_list, edk_count - 1)) goto MEM_ERR;
 
     for (uint16_t i = 0; i < edk_count; ++i) {
         struct aws_cryptosdk_edk edk;
 
-        if (parse_edk(hdr->alloc, &edk, &cur)) {
+        if (parse_edk(borrow ? NULL : hdr->alloc, &edk, &cur)) {
             goto RETHROW;
         }
 
@@ -285,6 +318,8 @@ int aws_cryptosdk_hdr_parse(struct aws_cryptosdk_hdr *hdr, struct aws_byte_curso
     if (aws_byte_buf_init(&hdr->auth_tag, hdr->alloc, tag_len)) goto MEM_ERR;
     if (!aws_byte_cursor_read_and_fill_buffer(&cur, &hdr->auth_tag)) goto SHORT_BUF;
 
+    if (borrow && aws_cryptosdk_enc_ctx_flat_export(&hdr->enc_ctx_flat, &hdr->enc_ctx)) goto RETHROW;
+
     *pcursor = cur;
 
     return AWS_OP_SUCCESS;
@@ -301,6 +336,33 @@ RETHROW:
     return AWS_OP_ERR;  // Error code will already have been raised in aws_mem_acquire
 }
 
+int aws_cryptosdk_hdr_parse(struct aws_cryptosdk_hdr *hdr, struct aws_byte_cursor *pcursor) {
+    return hdr_parse(hdr, pcursor, false);
+}
+
+int aws_cryptosdk_hdr_parse_borrowed(struct aws_cryptosdk_hdr *hdr, struct aws_byte_cursor *pcursor) {
+    return hdr_parse(hdr, pcursor, true);
+}
+
+static void rebase_buf(struct aws_byte_buf *buf, const uint8_t *old_base, const uint8_t *new_base) {
+    // Only views (with no allocator) refer to the parsed bytes
+    if (!buf->allocator && buf->buffer) buf->buffer = (uint8_t *)new_base + (buf->buffer - old_base);
+}
+
+void aws_cryptosdk_hdr_rebase(struct aws_cryptosdk_hdr *hdr, const uint8_t *old_base, const uint8_t *new_base) {
+    aws_cryptosdk_enc_ctx_flat_rebase(&hdr->enc_ctx_flat, old_base, new_base);
+
+    size_t edk_count = aws_array_list_length(&hdr->edk_list);
+    for (size_t idx = 0; idx < edk_count; ++idx) {
+        struct aws_cryptosdk_edk *edk = NULL;
+
+        aws_array_list_get_at_ptr(&hdr->edk_list, (void **)&edk, idx);
+        rebase_buf(&edk->provider_id, old_base, new_base);
+        rebase_buf(&edk->provider_info, old_base, new_base);
+        rebase_buf(&edk->ciphertext, old_base, new_base);
+    }
+}
+
 /*
  * Declaring a struct which is initialized to zero does not technically guarantee that the
  * padding bytes will all be zero, according to the C spec, though in practice they generally
@@ -335,7 +397,9 @@ int aws_cryptosdk_hdr_size(const struct aws_cryptosdk_hdr *hdr) {
     size_t bytes              = static_fields_len + dynamic_fields_len + authtag_len;
     size_t aad_len;
 
-    if (aws_cryptosdk_enc_ctx_size(&aad_len, &hdr->enc_ctx)) {
+    if (hdr->enc_ctx_frozen) {
+        aad_len = hdr->enc_ctx_flat.serialized.len;
+    } else if (aws_cryptosdk_enc_ctx_size(&aad_len, &hdr->enc_ctx)) {
         return 0;
     }
     bytes += aad_len;
@@ -389,7 +453,11 @@ int aws_cryptosdk_hdr_write(
     if (!aws_byte_buf_advance(&output, &aad_length_field, 2)) goto WRITE_ERR;
 
     size_t old_len = output.len;
-    if (aws_cryptosdk_enc_ctx_serialize(aws_default_allocator(), &output, &hdr->enc_ctx)) goto WRITE_ERR;
+    if (hdr->enc_ctx_frozen) {
+        if (!aws_byte_buf_write_from_whole_buffer(&output, hdr->enc_ctx_flat.serialized)) goto WRITE_ERR;
+    } else if (aws_cryptosdk_enc_ctx_serialize(aws_default_allocator(), &output, &hdr->enc_ctx)) {
+        goto WRITE_ERR;
+    }
 
     if (!aws_byte_buf_write_be16(&aad_length_field, (uint16_t)(output.len - old_len))) goto WRITE_ERR;
 
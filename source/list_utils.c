@@ -111,6 +111,42 @@ int aws_cryptosdk_edk_list_copy_all(
         alloc, dest, src, (clone_item_fn)aws_cryptosdk_edk_init_clone, (clean_up_item_fn)aws_cryptosdk_edk_clean_up);
 }
 
+int aws_cryptosdk_edk_list_borrow_all(struct aws_array_list *dest, const struct aws_array_list *src) {
+    AWS_ERROR_PRECONDITION(src != dest);
+    AWS_ERROR_PRECONDITION(aws_array_list_is_valid(dest));
+    AWS_ERROR_PRECONDITION(aws_array_list_is_valid(src));
+    AWS_ERROR_PRECONDITION(dest->item_size == src->item_size);
+
+    size_t initial_length = aws_array_list_length(dest);
+    size_t src_length     = aws_array_list_length(src);
+
+    for (size_t i = 0; i < src_length; i++) {
+        struct aws_cryptosdk_edk edk;
+
+        if (aws_array_list_get_at(src, &edk, i)) {
+            goto err;
+        }
+
+        /* Clear the allocators so that cleaning up dest never frees the buffers owned by src */
+        edk.provider_id.allocator   = NULL;
+        edk.provider_info.allocator = NULL;
+        edk.ciphertext.allocator    = NULL;
+
+        if (aws_array_list_push_back(dest, &edk)) {
+            goto err;
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+err:
+    /* Borrowed EDKs own nothing, so we can simply truncate the list back to its original length */
+    while (aws_array_list_length(dest) > initial_length) {
+        aws_array_list_pop_back(dest);
+    }
+
+    return AWS_OP_ERR;
+}
+
 int aws_cryptosdk_keyring_trace_copy_all(
     struct aws_allocator *alloc, struct aws_array_list *dest, const struct aws_array_list *src) {
     return list_copy_all(
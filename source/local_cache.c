@@ -21,13 +21,39 @@
 #include <aws/cryptosdk/private/enc_ctx.h>
 
 #include <aws/common/array_list.h>
+#include <aws/common/condition_variable.h>
 #include <aws/common/linked_list.h>
+#include <aws/common/math.h>
 #include <aws/common/mutex.h>
 #include <aws/common/priority_queue.h>
+#include <aws/common/thread.h>
 
 #define CACHE_ID_MD_ALG AWS_CRYPTOSDK_MD_SHA512
 #define TTL_EXPIRATION_BATCH_SIZE 8
 #define NO_EXPIRY UINT64_MAX
+/* Assumed bookkeeping overhead of each heap allocation, for memory budget purposes */
+#define ALLOCATION_OVERHEAD 16
+/* Assumed size of a parsed signing or verification key, for memory budget purposes */
+#define SIGNING_KEY_SIZE_ESTIMATE 512
+/* Number of rows (independent hash functions) in the TinyLFU frequency sketch */
+#define SKETCH_DEPTH 4
+/* Sketch counters saturate at this value */
+#define SKETCH_MAX_COUNT 15
+/* The sketch is aged (all counters halved) after this many increments per unit of cache capacity */
+#define SKETCH_SAMPLE_FACTOR 10
+/* Percentage of the cache capacity given to the TinyLFU admission window */
+#define TINYLFU_WINDOW_PERCENT 1
+
+/*
+ * A count-min sketch estimating how often each cache ID has been looked up recently; used by the TinyLFU
+ * eviction policy to decide whether a new entry is worth more than the entry it would displace.
+ */
+struct frequency_sketch {
+    /* SKETCH_DEPTH rows of (width_mask + 1) counters */
+    uint8_t *counters;
+    size_t width_mask;
+    size_t additions, sample_size;
+};
 
 /*
  * An entry in the local cache. This is what the aws_cryptosdk_materials_cache_entry pointers actually
@@ -62,13 +88,23 @@ struct local_cache_entry {
     struct aws_hash_table enc_ctx;
 
     /*
-     * we extract the public or private key out of the enc/dec materials and store it
-     * separately, in order to initialize the signing context later on
+     * A signing (encrypt-mode) or verification (decrypt-mode) context holding the key parsed out of the
+     * enc/dec materials. This context is never updated; instead, we start fresh contexts which share its
+     * parsed key when handing out materials.
+     */
+    struct aws_cryptosdk_sig_ctx *signing_key;
+
+    /*
+     * Materials handed out by get_enc_materials borrow the EDKs above rather than copying them. Each
+     * such borrow holds a reference to this entry (and to the owning cache), released via this owner.
      */
-    struct aws_string *key_materials;
+    struct aws_cryptosdk_materials_owner materials_owner;
 
     struct aws_atomic_var usage_messages, usage_bytes;
 
+    /* Approximate memory used by this entry; counted against the cache's memory budget while the entry is live */
+    size_t approx_size;
+
     /*
      * Cache entries are organized into a binary heap sorted by (expiration timestamp, thisptr)
      *
@@ -86,9 +122,12 @@ struct local_cache_entry {
      *
      * When the zombie flag is set:
      *   * The entry is not in the TTL heap (expiry_time = NO_EXPIRY)
-     *   * lru_node is not in the LRU list
+     *   * lru_node is not in the LRU list (but may link the entry into the cache's graveyard)
      */
     bool zombie;
+
+    /* Under the TinyLFU policy, true if lru_node is in the admission window rather than the main LRU list */
+    bool in_window;
 };
 
 struct aws_cryptosdk_local_cache {
@@ -105,6 +144,9 @@ struct aws_cryptosdk_local_cache {
 
     size_t capacity;
 
+    /* Memory budget (zero if none) and approximate memory used by live entries; see entry_approx_size */
+    size_t max_bytes, total_bytes;
+
     /* aws_string (hash of request) -> local_cache_entry */
     struct aws_hash_table entries;
 
@@ -117,10 +159,41 @@ struct aws_cryptosdk_local_cache {
      */
     struct aws_linked_list_node lru_head;
 
+    /*
+     * Under the TinyLFU policy, new entries first enter a small LRU admission window (rooted at window_head, and
+     * organized like lru_head). Entries leaving the window only join the main region (lru_head) if the sketch
+     * says they are used more often than the main region's LRU entry, which they then displace.
+     */
+    enum aws_cryptosdk_local_cache_eviction_policy eviction_policy;
+    struct aws_linked_list_node window_head;
+    size_t window_len, window_capacity;
+    struct frequency_sketch sketch;
+
     /*
      * Time source - overridable in tests
      */
     int (*clock_get_ticks)(uint64_t *timestamp);
+
+    /*
+     * Unless expiry_mode is AWS_CRYPTOSDK_LOCAL_CACHE_EXPIRE_INLINE, request paths leave the TTL heap to the
+     * expiry sweep, and entries whose last reference is dropped while the mutex is held are parked on this
+     * circular list (via lru_node) so that the sweep can destroy them without holding the mutex. In EXTERNAL
+     * mode, nothing drains the graveyard unless the application sweeps, so it holds at most capacity entries;
+     * past that, the thread dropping the last reference destroys the entry itself.
+     */
+    enum aws_cryptosdk_local_cache_expiry_mode expiry_mode;
+    struct aws_linked_list_node graveyard_head;
+    size_t graveyard_len;
+
+    /* Background sweep state; only used in AWS_CRYPTOSDK_LOCAL_CACHE_EXPIRE_BACKGROUND mode */
+    struct aws_thread janitor;
+    struct aws_condition_variable janitor_signal;
+    uint64_t janitor_interval_ns;
+    /* Protected by the mutex */
+    bool janitor_stop;
+
+    /* Hit, miss and eviction counters; protected by the mutex */
+    struct aws_cryptosdk_materials_cache_stats stats;
 };
 
 /********** General helpers **********/
@@ -139,10 +212,17 @@ static inline int ttl_heap_cmp(const void *vpa, const void *vpb);
 static void locked_invalidate_entry(
     struct aws_cryptosdk_local_cache *cache, struct local_cache_entry *entry, bool skip_hash);
 static inline void locked_lru_move_to_head(struct aws_linked_list_node *head, struct aws_linked_list_node *entry);
+static struct local_cache_entry *locked_lru_victim(
+    struct aws_cryptosdk_local_cache *cache, const struct local_cache_entry *keep);
+static void locked_tinylfu_evict(struct aws_cryptosdk_local_cache *cache, const struct local_cache_entry *keep);
+static size_t locked_expire_entries(struct aws_cryptosdk_local_cache *cache, uint64_t now, size_t max_items_to_expire);
 static int locked_process_ttls(struct aws_cryptosdk_local_cache *cache);
+static void locked_take_graveyard(struct aws_cryptosdk_local_cache *cache, struct aws_linked_list_node *graveyard);
+static bool locked_bury_entry(struct aws_cryptosdk_local_cache *cache, struct local_cache_entry *entry);
 static bool locked_find_entry(
     struct aws_cryptosdk_local_cache *cache, struct local_cache_entry **entry, const struct aws_byte_buf *cache_id);
 static int locked_insert_entry(struct aws_cryptosdk_local_cache *cache, struct local_cache_entry *entry);
+static void locked_enforce_max_bytes(struct aws_cryptosdk_local_cache *cache, const struct local_cache_entry *keep);
 static void locked_release_entry(
     struct aws_cryptosdk_local_cache *cache, struct local_cache_entry *entry, bool invalidate);
 
@@ -150,6 +230,13 @@ static struct local_cache_entry *new_entry(
     struct aws_cryptosdk_local_cache *cache, const struct aws_byte_buf *cache_id);
 static void destroy_cache_entry(struct local_cache_entry *entry);
 static void destroy_cache_entry_vp(void *vp_entry);
+static void destroy_graveyard(struct aws_linked_list_node *graveyard);
+static int sweep_expired_entries(struct aws_cryptosdk_local_cache *cache);
+static void release_borrowed_materials(struct aws_cryptosdk_materials_owner *materials_owner);
+static void release_entry(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry *generic_entry,
+    bool invalidate);
 static int copy_enc_materials(
     struct aws_allocator *alloc, struct aws_cryptosdk_enc_materials *out, const struct aws_cryptosdk_enc_materials *in);
 
@@ -246,6 +333,13 @@ static void locked_invalidate_entry(
     entry->lru_node.next = entry->lru_node.prev = &entry->lru_node;
     entry->zombie                               = true;
 
+    if (entry->in_window) {
+        entry->in_window = false;
+        cache->window_len--;
+    }
+
+    cache->total_bytes -= entry->approx_size;
+
     /* Release the reference count owned by the cache itself */
     locked_release_entry(entry->owner, entry, false);
 }
@@ -255,39 +349,251 @@ static inline void locked_lru_move_to_head(struct aws_linked_list_node *head, st
     aws_linked_list_insert_after(head, entry);
 }
 
-static int locked_process_ttls(struct aws_cryptosdk_local_cache *cache) {
-    size_t max_items_to_expire = TTL_EXPIRATION_BATCH_SIZE;
+/**
+ * Returns the entry to evict when making room: the LRU entry of the main list, or failing that of the TinyLFU
+ * admission window. Returns NULL if there is no such entry, or if it is keep.
+ */
+static struct local_cache_entry *locked_lru_victim(
+    struct aws_cryptosdk_local_cache *cache, const struct local_cache_entry *keep) {
+    struct aws_linked_list_node *node = cache->lru_head.prev;
+
+    if (node == &cache->lru_head) {
+        node = cache->window_head.prev;
+        if (node == &cache->window_head) {
+            return NULL;
+        }
+    }
 
-    void *vp_item;
-    struct local_cache_entry *entry;
-    uint64_t now;
+    if (keep && node == &keep->lru_node) {
+        return NULL;
+    }
 
-    if (cache->clock_get_ticks(&now)) {
+    return AWS_CONTAINER_OF(node, struct local_cache_entry, lru_node);
+}
+
+/********** TinyLFU frequency sketch **********/
+
+static const uint64_t sketch_seeds[SKETCH_DEPTH] = {
+    0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL, 0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL
+};
+
+static int sketch_init(struct aws_allocator *alloc, struct frequency_sketch *sketch, size_t capacity) {
+    size_t width, n_counters;
+
+    /* A sketch several times wider than the cache keeps collisions between cold and hot IDs rare */
+    if (aws_mul_size_checked(capacity, 4, &width) || aws_round_up_to_power_of_two(width < 64 ? 64 : width, &width) ||
+        aws_mul_size_checked(width, SKETCH_DEPTH, &n_counters) ||
+        aws_mul_size_checked(capacity, SKETCH_SAMPLE_FACTOR, &sketch->sample_size)) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    sketch->counters = aws_mem_acquire(alloc, n_counters);
+    if (!sketch->counters) {
         return AWS_OP_ERR;
     }
 
-    while (max_items_to_expire-- && aws_priority_queue_size(&cache->ttl_heap) &&
+    memset(sketch->counters, 0, n_counters);
+    sketch->width_mask = width - 1;
+    sketch->additions  = 0;
+
+    return AWS_OP_SUCCESS;
+}
+
+static void sketch_clean_up(struct aws_allocator *alloc, struct frequency_sketch *sketch) {
+    if (sketch->counters) {
+        aws_mem_release(alloc, sketch->counters);
+    }
+
+    sketch->counters = NULL;
+}
+
+static inline uint8_t *sketch_counter(const struct frequency_sketch *sketch, uint64_t hash_code, size_t row) {
+    uint64_t h = (hash_code + sketch_seeds[row]) * sketch_seeds[row];
+    h ^= h >> 32;
+
+    return &sketch->counters[row * (sketch->width_mask + 1) + (size_t)(h & sketch->width_mask)];
+}
+
+static void sketch_increment(struct frequency_sketch *sketch, uint64_t hash_code) {
+    for (size_t row = 0; row < SKETCH_DEPTH; row++) {
+        uint8_t *counter = sketch_counter(sketch, hash_code, row);
+
+        if (*counter < SKETCH_MAX_COUNT) {
+            (*counter)++;
+        }
+    }
+
+    if (++sketch->additions >= sketch->sample_size) {
+        /* Age the sketch, so that entries which were popular long ago don't stay in the cache forever */
+        for (size_t i = 0; i < SKETCH_DEPTH * (sketch->width_mask + 1); i++) {
+            sketch->counters[i] >>= 1;
+        }
+
+        sketch->additions /= 2;
+    }
+}
+
+static uint8_t sketch_frequency(const struct frequency_sketch *sketch, uint64_t hash_code) {
+    uint8_t frequency = SKETCH_MAX_COUNT;
+
+    for (size_t row = 0; row < SKETCH_DEPTH; row++) {
+        uint8_t count = *sketch_counter(sketch, hash_code, row);
+
+        if (count < frequency) {
+            frequency = count;
+        }
+    }
+
+    return frequency;
+}
+
+/**
+ * Moves entries out of the TinyLFU admission window until it is back within its capacity. Each such candidate
+ * joins the main list if the cache has room; otherwise, either the candidate or the main list's LRU entry,
+ * whichever the sketch reports as less frequently used, is evicted. The entry keep is never evicted.
+ */
+static void locked_tinylfu_evict(struct aws_cryptosdk_local_cache *cache, const struct local_cache_entry *keep) {
+    while (cache->window_len > cache->window_capacity) {
+        struct local_cache_entry *candidate =
+            AWS_CONTAINER_OF(cache->window_head.prev, struct local_cache_entry, lru_node);
+
+        locked_lru_move_to_head(&cache->lru_head, &candidate->lru_node);
+        candidate->in_window = false;
+        cache->window_len--;
+
+        if (aws_hash_table_get_entry_count(&cache->entries) <= cache->capacity) {
+            continue;
+        }
+
+        struct local_cache_entry *victim = AWS_CONTAINER_OF(cache->lru_head.prev, struct local_cache_entry, lru_node);
+
+        if (victim != candidate && sketch_frequency(&cache->sketch, hash_cache_id(&candidate->cache_id)) <=
+                                       sketch_frequency(&cache->sketch, hash_cache_id(&victim->cache_id))) {
+            victim = candidate;
+        }
+
+        locked_invalidate_entry(cache, victim, false);
+        cache->stats.evictions_capacity++;
+    }
+
+    /* If the policy was switched while the cache was full, the window alone may not get us back to capacity */
+    while (aws_hash_table_get_entry_count(&cache->entries) > cache->capacity) {
+        struct local_cache_entry *victim = locked_lru_victim(cache, keep);
+
+        assert(victim);
+        locked_invalidate_entry(cache, victim, false);
+        cache->stats.evictions_capacity++;
+    }
+}
+
+/**
+ * Invalidates up to max_items_to_expire entries which expired at or before now; returns the number invalidated.
+ */
+static size_t locked_expire_entries(struct aws_cryptosdk_local_cache *cache, uint64_t now, size_t max_items_to_expire) {
+    size_t expired = 0;
+
+    void *vp_item;
+    struct local_cache_entry *entry;
+
+    while (expired < max_items_to_expire && aws_priority_queue_size(&cache->ttl_heap) &&
            !aws_priority_queue_top(&cache->ttl_heap, &vp_item) &&
            (entry = *(struct local_cache_entry **)vp_item)->expiry_time <= now) {
         locked_invalidate_entry(cache, entry, false);
+        cache->stats.evictions_ttl++;
+        expired++;
     }
 
+    return expired;
+}
+
+static int locked_process_ttls(struct aws_cryptosdk_local_cache *cache) {
+    uint64_t now;
+
+    /* With a background or external sweep, request paths do no TTL heap maintenance */
+    if (cache->expiry_mode != AWS_CRYPTOSDK_LOCAL_CACHE_EXPIRE_INLINE) {
+        return AWS_OP_SUCCESS;
+    }
+
+    if (cache->clock_get_ticks(&now)) {
+        return AWS_OP_ERR;
+    }
+
+    locked_expire_entries(cache, now, TTL_EXPIRATION_BATCH_SIZE);
+
     return AWS_OP_SUCCESS;
 }
 
+/**
+ * Moves all entries parked on the cache's graveyard onto the (uninitialized) list head graveyard,
+ * leaving the cache's graveyard empty.
+ */
+static void locked_take_graveyard(struct aws_cryptosdk_local_cache *cache, struct aws_linked_list_node *graveyard) {
+    struct aws_linked_list_node *head = &cache->graveyard_head;
+
+    if (head->next == head) {
+        graveyard->next = graveyard->prev = graveyard;
+        return;
+    }
+
+    graveyard->next       = head->next;
+    graveyard->prev       = head->prev;
+    graveyard->next->prev = graveyard;
+    graveyard->prev->next = graveyard;
+
+    head->next = head->prev = head;
+
+    cache->graveyard_len = 0;
+}
+
+/**
+ * Parks a zombie entry whose last reference has been dropped on the cache's graveyard, for the expiry sweep
+ * to destroy. Returns false, leaving the entry for the caller to destroy, when expiring inline or when the
+ * graveyard of an EXTERNAL mode cache is full.
+ */
+static bool locked_bury_entry(struct aws_cryptosdk_local_cache *cache, struct local_cache_entry *entry) {
+    if (cache->expiry_mode == AWS_CRYPTOSDK_LOCAL_CACHE_EXPIRE_INLINE ||
+        (cache->expiry_mode == AWS_CRYPTOSDK_LOCAL_CACHE_EXPIRE_EXTERNAL && cache->graveyard_len >= cache->capacity)) {
+        return false;
+    }
+
+    /* Zombies are not on the LRU list, so lru_node is free to link the entry into the graveyard */
+    aws_linked_list_insert_after(&cache->graveyard_head, &entry->lru_node);
+    cache->graveyard_len++;
+
+    return true;
+}
+
 static bool locked_find_entry(
     struct aws_cryptosdk_local_cache *cache, struct local_cache_entry **entry, const struct aws_byte_buf *cache_id) {
     struct aws_hash_element *element;
 
     locked_process_ttls(cache);
 
+    if (cache->eviction_policy == AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_TINYLFU) {
+        sketch_increment(&cache->sketch, hash_cache_id(cache_id));
+    }
+
     if (aws_hash_table_find(&cache->entries, cache_id, &element) || !element) {
+        cache->stats.misses++;
         return false;
     }
 
     *entry = element->value;
 
-    locked_lru_move_to_head(&cache->lru_head, &(*entry)->lru_node);
+    if (cache->expiry_mode != AWS_CRYPTOSDK_LOCAL_CACHE_EXPIRE_INLINE && (*entry)->expiry_time != NO_EXPIRY) {
+        uint64_t now;
+
+        /* The rest of the heap is left to the sweep, but we must not hand out an entry we know has expired */
+        if (!cache->clock_get_ticks(&now) && (*entry)->expiry_time <= now) {
+            locked_invalidate_entry(cache, *entry, false);
+            cache->stats.evictions_ttl++;
+            cache->stats.misses++;
+            return false;
+        }
+    }
+
+    locked_lru_move_to_head((*entry)->in_window ? &cache->window_head : &cache->lru_head, &(*entry)->lru_node);
+    cache->stats.hits++;
 
     return true;
 }
@@ -305,25 +611,63 @@ static int locked_insert_entry(struct aws_cryptosdk_local_cache *cache, struct l
     if (!was_created) {
         /* Invalidate the old entry first. skip_hash = true as we'll remove it by replacing the hash value directly */
         locked_invalidate_entry(cache, element->value, true);
+        cache->stats.evictions_invalidated++;
     }
 
     /* Update the key pointer in case we're overwriting an existing entry */
     element->key   = &entry->cache_id;
     element->value = entry;
 
-    aws_linked_list_insert_after(&cache->lru_head, &entry->lru_node);
+    cache->total_bytes += entry->approx_size;
 
-    while (aws_hash_table_get_entry_count(&cache->entries) > cache->capacity) {
-        assert(cache->lru_head.prev != &cache->lru_head);
-        assert(cache->lru_head.prev != &entry->lru_node);
+    if (cache->eviction_policy == AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_TINYLFU) {
+        aws_linked_list_insert_after(&cache->window_head, &entry->lru_node);
+        entry->in_window = true;
+        cache->window_len++;
+
+        locked_tinylfu_evict(cache, entry);
+    } else {
+        aws_linked_list_insert_after(&cache->lru_head, &entry->lru_node);
 
-        locked_invalidate_entry(
-            cache, AWS_CONTAINER_OF(cache->lru_head.prev, struct local_cache_entry, lru_node), false);
+        while (aws_hash_table_get_entry_count(&cache->entries) > cache->capacity) {
+            assert(cache->lru_head.prev != &cache->lru_head);
+            assert(cache->lru_head.prev != &entry->lru_node);
+
+            locked_invalidate_entry(
+                cache, AWS_CONTAINER_OF(cache->lru_head.prev, struct local_cache_entry, lru_node), false);
+            cache->stats.evictions_capacity++;
+        }
     }
 
+    locked_enforce_max_bytes(cache, entry);
+
     return AWS_OP_SUCCESS;
 }
 
+/**
+ * Evicts entries until the cache is within its memory budget, if it has one: first any expired entries, then
+ * entries in LRU order. The entry keep (if non-NULL) is never evicted.
+ */
+static void locked_enforce_max_bytes(struct aws_cryptosdk_local_cache *cache, const struct local_cache_entry *keep) {
+    uint64_t now;
+
+    if (!cache->max_bytes || cache->total_bytes <= cache->max_bytes) {
+        return;
+    }
+
+    /* The expiry sweep may not have got to these yet, but they're the cheapest entries to give up */
+    if (!cache->clock_get_ticks(&now)) {
+        while (cache->total_bytes > cache->max_bytes && locked_expire_entries(cache, now, 1)) {
+        }
+    }
+
+    struct local_cache_entry *victim;
+    while (cache->total_bytes > cache->max_bytes && (victim = locked_lru_victim(cache, keep))) {
+        locked_invalidate_entry(cache, victim, false);
+        cache->stats.evictions_capacity++;
+    }
+}
+
 static void locked_release_entry(
     struct aws_cryptosdk_local_cache *cache, struct local_cache_entry *entry, bool invalidate) {
     /*
@@ -357,7 +701,9 @@ static void locked_release_entry(
     if (old_count == 1) {
         assert(entry->zombie);
 
-        destroy_cache_entry(entry);
+        if (!locked_bury_entry(cache, entry)) {
+            destroy_cache_entry(entry);
+        }
 
         return;
     }
@@ -371,6 +717,7 @@ static void locked_release_entry(
          * (and potentially free the entry)
          */
         locked_invalidate_entry(cache, entry, false);
+        cache->stats.evictions_invalidated++;
     }
 }
 
@@ -403,6 +750,8 @@ static struct local_cache_entry *new_entry(
 
     entry->lru_node.next = entry->lru_node.prev = &entry->lru_node;
 
+    entry->materials_owner.release = release_borrowed_materials;
+
     return entry;
 }
 
@@ -417,7 +766,7 @@ static void destroy_cache_entry(struct local_cache_entry *entry) {
     entry->enc_materials = NULL;
     entry->dec_materials = NULL;
 
-    aws_string_destroy_secure(entry->key_materials);
+    aws_cryptosdk_sig_abort(entry->signing_key);
     aws_cryptosdk_enc_ctx_clean_up(&entry->enc_ctx);
 
     aws_byte_buf_clean_up(&entry->cache_id);
@@ -425,6 +774,88 @@ static void destroy_cache_entry(struct local_cache_entry *entry) {
     aws_mem_release(entry->owner->allocator, entry);
 }
 
+static void release_borrowed_materials(struct aws_cryptosdk_materials_owner *materials_owner) {
+    struct local_cache_entry *entry = AWS_CONTAINER_OF(materials_owner, struct local_cache_entry, materials_owner);
+    struct aws_cryptosdk_local_cache *cache = entry->owner;
+
+    /* Drop the entry first; this may need the cache (and its allocator) to still be around */
+    release_entry(&cache->base, (struct aws_cryptosdk_materials_cache_entry *)entry, false);
+    aws_cryptosdk_materials_cache_release(&cache->base);
+}
+
+static void destroy_graveyard(struct aws_linked_list_node *graveyard) {
+    while (graveyard->next != graveyard) {
+        struct aws_linked_list_node *node = graveyard->next;
+
+        aws_linked_list_remove(node);
+        destroy_cache_entry(AWS_CONTAINER_OF(node, struct local_cache_entry, lru_node));
+    }
+}
+
+/**
+ * Expires all entries whose TTL has passed, and destroys everything parked on the graveyard. The mutex is
+ * released between batches, and entries are destroyed without holding it, so request threads are never
+ * blocked for more than one batch.
+ */
+static int sweep_expired_entries(struct aws_cryptosdk_local_cache *cache) {
+    struct aws_linked_list_node graveyard;
+    uint64_t now;
+    size_t expired;
+
+    if (cache->clock_get_ticks(&now)) {
+        return AWS_OP_ERR;
+    }
+
+    do {
+        if (aws_mutex_lock(&cache->mutex)) {
+            return AWS_OP_ERR;
+        }
+
+        expired = locked_expire_entries(cache, now, TTL_EXPIRATION_BATCH_SIZE);
+        locked_take_graveyard(cache, &graveyard);
+
+        if (aws_mutex_unlock(&cache->mutex)) {
+            abort();
+        }
+
+        destroy_graveyard(&graveyard);
+    } while (expired == TTL_EXPIRATION_BATCH_SIZE);
+
+    return AWS_OP_SUCCESS;
+}
+
+static void janitor_thread_fn(void *vp_cache) {
+    struct aws_cryptosdk_local_cache *cache = vp_cache;
+
+    if (aws_mutex_lock(&cache->mutex)) {
+        abort();
+    }
+
+    while (!cache->janitor_stop) {
+        /* Timeouts and spurious wakeups both just mean it's time for another sweep */
+        aws_condition_variable_wait_for(&cache->janitor_signal, &cache->mutex, (int64_t)cache->janitor_interval_ns);
+
+        if (cache->janitor_stop) {
+            break;
+        }
+
+        if (aws_mutex_unlock(&cache->mutex)) {
+            abort();
+        }
+
+        /* If the clock fails, there's nothing better to do than to try again next time */
+        sweep_expired_entries(cache);
+
+        if (aws_mutex_lock(&cache->mutex)) {
+            abort();
+        }
+    }
+
+    if (aws_mutex_unlock(&cache->mutex)) {
+        abort();
+    }
+}
+
 static void destroy_cache_entry_vp(void *vp_entry) {
     /*
      * We enter this function already holding the cache mutex; because aws-common mutexes are non-reentrant,
@@ -477,8 +908,28 @@ static int copy_dec_materials(
 static void destroy_cache(struct aws_cryptosdk_materials_cache *generic_cache) {
     struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
 
+    if (cache->expiry_mode == AWS_CRYPTOSDK_LOCAL_CACHE_EXPIRE_BACKGROUND) {
+        /* The janitor holds no reference on the cache, so it may still be running; stop it first */
+        if (aws_mutex_lock(&cache->mutex)) {
+            abort();
+        }
+
+        cache->janitor_stop = true;
+        aws_condition_variable_notify_one(&cache->janitor_signal);
+
+        if (aws_mutex_unlock(&cache->mutex)) {
+            abort();
+        }
+
+        aws_thread_join(&cache->janitor);
+        aws_thread_clean_up(&cache->janitor);
+        aws_condition_variable_clean_up(&cache->janitor_signal);
+    }
+
     /* No need to take a lock - we're the only thread with a reference now */
 
+    destroy_graveyard(&cache->graveyard_head);
+
     /*
      * Destroy the pqueue first - when we destroy the hash table, destroy_cache_entry_vp will
      * free all entries in the cache, and so we want to make sure the pqueue references to
@@ -487,6 +938,7 @@ static void destroy_cache(struct aws_cryptosdk_materials_cache *generic_cache) {
     aws_priority_queue_clean_up(&cache->ttl_heap);
     aws_hash_table_clean_up(&cache->entries);
     aws_mutex_clean_up(&cache->mutex);
+    sketch_clean_up(cache->allocator, &cache->sketch);
 
     aws_mem_release(cache->allocator, cache);
 }
@@ -575,7 +1027,22 @@ static int get_enc_materials(
         return AWS_OP_ERR;
     }
 
-    if (copy_enc_materials(allocator, materials, local_entry->enc_materials)) {
+    /*
+     * The cached materials are immutable, so rather than copying the EDKs we lend them out, keeping the
+     * entry alive for as long as the materials (or the session header they end up in) need them. The
+     * caller already holds a reference on the entry, so it's safe to take another without the lock.
+     */
+    const struct aws_cryptosdk_enc_materials *cached = local_entry->enc_materials;
+    if (aws_byte_buf_init_copy(&materials->unencrypted_data_key, allocator, &cached->unencrypted_data_key) ||
+        aws_cryptosdk_edk_list_borrow_all(&materials->encrypted_data_keys, &cached->encrypted_data_keys)) {
+        goto out;
+    }
+
+    aws_atomic_fetch_add_explicit(&local_entry->refcount, 1, aws_memory_order_relaxed);
+    aws_cryptosdk_materials_cache_retain(&local_entry->owner->base);
+    materials->owner = &local_entry->materials_owner;
+
+    if (aws_cryptosdk_keyring_trace_copy_all(allocator, &materials->keyring_trace, &cached->keyring_trace)) {
         goto out;
     }
 
@@ -583,12 +1050,8 @@ static int get_enc_materials(
         goto out;
     }
 
-    if (local_entry->key_materials && aws_cryptosdk_sig_sign_start(
-                                          &materials->signctx,
-                                          allocator,
-                                          NULL,
-                                          aws_cryptosdk_alg_props(materials->alg),
-                                          local_entry->key_materials)) {
+    if (local_entry->signing_key &&
+        aws_cryptosdk_sig_start_from_ctx(&materials->signctx, allocator, local_entry->signing_key)) {
         goto out;
     }
 
@@ -621,9 +1084,8 @@ static int get_dec_materials(
         goto out;
     }
 
-    if (local_entry->key_materials &&
-        aws_cryptosdk_sig_verify_start(
-            &materials->signctx, allocator, local_entry->key_materials, aws_cryptosdk_alg_props(materials->alg))) {
+    if (local_entry->signing_key &&
+        aws_cryptosdk_sig_start_from_ctx(&materials->signctx, allocator, local_entry->signing_key)) {
         goto out;
     }
 
@@ -635,6 +1097,85 @@ out:
     return *materials_out ? AWS_OP_SUCCESS : AWS_OP_ERR;
 }
 
+static size_t buf_approx_size(const struct aws_byte_buf *buf) {
+    return buf->allocator ? buf->capacity + ALLOCATION_OVERHEAD : 0;
+}
+
+static size_t string_approx_size(const struct aws_string *str) {
+    return str ? sizeof(*str) + str->len + 1 + ALLOCATION_OVERHEAD : 0;
+}
+
+static size_t list_approx_size(const struct aws_array_list *list) {
+    return list->current_size + ALLOCATION_OVERHEAD;
+}
+
+static size_t trace_approx_size(const struct aws_array_list *trace) {
+    size_t size = list_approx_size(trace);
+
+    for (size_t i = 0; i < aws_array_list_length(trace); i++) {
+        struct aws_cryptosdk_keyring_trace_record *record;
+
+        if (!aws_array_list_get_at_ptr(trace, (void **)&record, i)) {
+            size += string_approx_size(record->wrapping_key_namespace) + string_approx_size(record->wrapping_key_name);
+        }
+    }
+
+    return size;
+}
+
+/**
+ * Returns a rough estimate of the heap memory owned by a fully populated entry. This needn't be exact, but it
+ * should scale with everything that varies between entries.
+ */
+static size_t entry_approx_size(const struct local_cache_entry *entry) {
+    size_t size = sizeof(*entry) + ALLOCATION_OVERHEAD + buf_approx_size(&entry->cache_id);
+
+    if (entry->enc_materials) {
+        const struct aws_cryptosdk_enc_materials *materials = entry->enc_materials;
+
+        size += sizeof(*materials) + ALLOCATION_OVERHEAD + buf_approx_size(&materials->unencrypted_data_key) +
+                trace_approx_size(&materials->keyring_trace) + list_approx_size(&materials->encrypted_data_keys);
+
+        for (size_t i = 0; i < aws_array_list_length(&materials->encrypted_data_keys); i++) {
+            struct aws_cryptosdk_edk *edk;
+
+            if (!aws_array_list_get_at_ptr(&materials->encrypted_data_keys, (void **)&edk, i)) {
+                size += buf_approx_size(&edk->provider_id) + buf_approx_size(&edk->provider_info) +
+                        buf_approx_size(&edk->ciphertext);
+            }
+        }
+
+        /* Each context element costs a key string, a value string and a hash table slot */
+        for (struct aws_hash_iter iter = aws_hash_iter_begin(&entry->enc_ctx); !aws_hash_iter_done(&iter);
+             aws_hash_iter_next(&iter)) {
+            size += string_approx_size(iter.element.key) + string_approx_size(iter.element.value) +
+                    2 * sizeof(struct aws_hash_element);
+        }
+    }
+
+    if (entry->dec_materials) {
+        const struct aws_cryptosdk_dec_materials *materials = entry->dec_materials;
+
+        size += sizeof(*materials) + ALLOCATION_OVERHEAD + buf_approx_size(&materials->unencrypted_data_key) +
+                trace_approx_size(&materials->keyring_trace);
+    }
+
+    if (entry->signing_key) {
+        size += SIGNING_KEY_SIZE_ESTIMATE;
+    }
+
+    return size;
+}
+
+/**
+ * Computes the entry's approximate size, and returns false if the entry is too large to cache at all
+ */
+static bool entry_fits_budget(const struct aws_cryptosdk_local_cache *cache, struct local_cache_entry *entry) {
+    entry->approx_size = entry_approx_size(entry);
+
+    return !cache->max_bytes || entry->approx_size <= cache->max_bytes;
+}
+
 static void put_entry_for_encrypt(
     struct aws_cryptosdk_materials_cache *generic_cache,
     struct aws_cryptosdk_materials_cache_entry **ret_entry,
@@ -674,11 +1215,15 @@ static void put_entry_for_encrypt(
     }
 
     if (materials->signctx) {
-        if (aws_cryptosdk_sig_get_privkey(materials->signctx, cache->allocator, &entry->key_materials)) {
+        if (aws_cryptosdk_sig_start_from_ctx(&entry->signing_key, cache->allocator, materials->signctx)) {
             goto out;
         }
     }
 
+    if (!entry_fits_budget(cache, entry)) {
+        goto out;
+    }
+
     if (!locked_insert_entry(cache, entry)) {
         /* Prevent the entry from being freed - and prepare to return it */
         *ret_entry = (struct aws_cryptosdk_materials_cache_entry *)entry;
@@ -728,11 +1273,15 @@ static void put_entry_for_decrypt(
     }
 
     if (materials->signctx) {
-        if (aws_cryptosdk_sig_get_pubkey(materials->signctx, cache->allocator, &entry->key_materials)) {
+        if (aws_cryptosdk_sig_start_from_ctx(&entry->signing_key, cache->allocator, materials->signctx)) {
             goto out;
         }
     }
 
+    if (!entry_fits_budget(cache, entry)) {
+        goto out;
+    }
+
     if (!locked_insert_entry(cache, entry)) {
         /* Prevent the entry from being freed - and prepare to return it */
         *ret_entry = (struct aws_cryptosdk_materials_cache_entry *)entry;
@@ -861,6 +1410,25 @@ static void release_entry(
          * so all we need to do now is actually free the entry structure.
          */
         assert(entry->zombie);
+
+        /*
+         * Unless expiring inline, the expiry sweep owns the destruction of evicted materials, so that
+         * request threads only do constant work; park the entry on the graveyard, as locked_release_entry
+         * does. If the graveyard is full or we can't take the lock, destroying the entry here (outside the
+         * lock) is still better than letting it grow or leaking the entry.
+         */
+        if (cache->expiry_mode != AWS_CRYPTOSDK_LOCAL_CACHE_EXPIRE_INLINE && !aws_mutex_lock(&cache->mutex)) {
+            bool buried = locked_bury_entry(cache, entry);
+
+            if (aws_mutex_unlock(&cache->mutex)) {
+                abort();
+            }
+
+            if (buried) {
+                return;
+            }
+        }
+
         destroy_cache_entry(entry);
     }
 }
@@ -882,15 +1450,39 @@ static void clear_cache(struct aws_cryptosdk_materials_cache *generic_cache) {
          * iterator.
          */
         locked_invalidate_entry(cache, entry, true);
+        cache->stats.evictions_invalidated++;
 
         aws_hash_iter_delete(&iter, false);
     }
 
+    if (cache->expiry_mode == AWS_CRYPTOSDK_LOCAL_CACHE_EXPIRE_BACKGROUND) {
+        /* Have the janitor dispose of the cleared entries now rather than at its next scheduled sweep */
+        aws_condition_variable_notify_one(&cache->janitor_signal);
+    }
+
     if (aws_mutex_unlock(&cache->mutex)) {
         abort();
     }
 }
 
+static int get_stats(
+    const struct aws_cryptosdk_materials_cache *generic_cache, struct aws_cryptosdk_materials_cache_stats *stats) {
+    // Removing const so we can lock the cache mutex
+    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+
+    if (aws_mutex_lock(&cache->mutex)) {
+        return AWS_OP_ERR;
+    }
+
+    *stats = cache->stats;
+
+    if (aws_mutex_unlock(&cache->mutex)) {
+        abort();
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
 static const struct aws_cryptosdk_materials_cache_vt local_cache_vt = { .vt_size            = sizeof(local_cache_vt),
                                                                         .name               = "Local materials cache",
                                                                         .find_entry         = find_entry,
@@ -904,7 +1496,8 @@ static const struct aws_cryptosdk_materials_cache_vt local_cache_vt = { .vt_size
                                                                         .entry_release         = release_entry,
                                                                         .entry_get_creation_time = get_creation_time,
                                                                         .entry_ttl_hint          = set_expiration_hint,
-                                                                        .clear                   = clear_cache };
+                                                                        .clear                   = clear_cache,
+                                                                        .get_stats               = get_stats };
 
 AWS_CRYPTOSDK_TEST_STATIC
 void aws_cryptosdk_local_cache_set_clock(
@@ -915,11 +1508,129 @@ void aws_cryptosdk_local_cache_set_clock(
     cache->clock_get_ticks = clock_get_ticks;
 }
 
+int aws_cryptosdk_local_cache_set_max_bytes(struct aws_cryptosdk_materials_cache *generic_cache, size_t max_bytes) {
+    if (generic_cache->vt != &local_cache_vt) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+
+    if (aws_mutex_lock(&cache->mutex)) {
+        return AWS_OP_ERR;
+    }
+
+    cache->max_bytes = max_bytes;
+    locked_enforce_max_bytes(cache, NULL);
+
+    if (aws_mutex_unlock(&cache->mutex)) {
+        abort();
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_local_cache_set_eviction_policy(
+    struct aws_cryptosdk_materials_cache *generic_cache, enum aws_cryptosdk_local_cache_eviction_policy policy) {
+    if (generic_cache->vt != &local_cache_vt || (policy != AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_LRU &&
+                                                 policy != AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_TINYLFU)) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+    int rv                                  = AWS_OP_SUCCESS;
+
+    if (aws_mutex_lock(&cache->mutex)) {
+        return AWS_OP_ERR;
+    }
+
+    if (policy == cache->eviction_policy) {
+        goto out;
+    }
+
+    if (policy == AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_TINYLFU) {
+        if (sketch_init(cache->allocator, &cache->sketch, cache->capacity)) {
+            rv = AWS_OP_ERR;
+            goto out;
+        }
+
+        /* Existing entries all stay in the main list */
+        cache->window_capacity = cache->capacity * TINYLFU_WINDOW_PERCENT / 100;
+        if (!cache->window_capacity) {
+            cache->window_capacity = 1;
+        }
+    } else {
+        /* Window entries are the most recently inserted, so they go to the head of the LRU list, oldest first */
+        while (cache->window_head.prev != &cache->window_head) {
+            struct local_cache_entry *entry =
+                AWS_CONTAINER_OF(cache->window_head.prev, struct local_cache_entry, lru_node);
+
+            locked_lru_move_to_head(&cache->lru_head, &entry->lru_node);
+            entry->in_window = false;
+        }
+
+        cache->window_len = 0;
+        sketch_clean_up(cache->allocator, &cache->sketch);
+    }
+
+    cache->eviction_policy = policy;
+
+out:
+    if (aws_mutex_unlock(&cache->mutex)) {
+        abort();
+    }
+
+    return rv;
+}
+
+size_t aws_cryptosdk_local_cache_get_approx_bytes(const struct aws_cryptosdk_materials_cache *generic_cache) {
+    if (generic_cache->vt != &local_cache_vt) {
+        return SIZE_MAX;
+    }
+
+    // Removing const so we can lock the cache mutex
+    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+
+    if (aws_mutex_lock(&cache->mutex)) {
+        return SIZE_MAX;
+    }
+
+    size_t total_bytes = cache->total_bytes;
+
+    if (aws_mutex_unlock(&cache->mutex)) {
+        abort();
+    }
+
+    return total_bytes;
+}
+
+int aws_cryptosdk_local_cache_process_expirations(struct aws_cryptosdk_materials_cache *generic_cache) {
+    if (generic_cache->vt != &local_cache_vt) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    return sweep_expired_entries((struct aws_cryptosdk_local_cache *)generic_cache);
+}
+
 struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_local_new(
     struct aws_allocator *alloc, size_t capacity) {
+    return aws_cryptosdk_materials_cache_local_new_with_expiry(
+        alloc, capacity, AWS_CRYPTOSDK_LOCAL_CACHE_EXPIRE_INLINE, 0, AWS_TIMESTAMP_NANOS);
+}
+
+struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_local_new_with_expiry(
+    struct aws_allocator *alloc,
+    size_t capacity,
+    enum aws_cryptosdk_local_cache_expiry_mode expiry_mode,
+    uint64_t sweep_interval,
+    enum aws_timestamp_unit sweep_interval_units) {
     /* Suppress unused static method warnings */
     (void)aws_cryptosdk_local_cache_set_clock;
 
+    if (expiry_mode == AWS_CRYPTOSDK_LOCAL_CACHE_EXPIRE_BACKGROUND && !sweep_interval) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        goto err_alloc;
+    }
+
     if (capacity < 2) {
         /* This miniumum capacity avoids some annoying edge conditions in the LRU removal logic */
         capacity = 2;
@@ -938,6 +1649,9 @@ struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_local_new(
     cache->lru_head.next = cache->lru_head.prev = &cache->lru_head;
     cache->capacity                             = capacity;
     cache->clock_get_ticks                      = aws_sys_clock_get_ticks;
+    cache->expiry_mode                          = expiry_mode;
+    cache->graveyard_head.next = cache->graveyard_head.prev = &cache->graveyard_head;
+    cache->window_head.next = cache->window_head.prev = &cache->window_head;
 
     if (aws_mutex_init(&cache->mutex)) {
         goto err_mutex;
@@ -953,8 +1667,34 @@ struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_local_new(
         goto err_pq;
     }
 
+    if (expiry_mode == AWS_CRYPTOSDK_LOCAL_CACHE_EXPIRE_BACKGROUND) {
+        cache->janitor_interval_ns =
+            aws_timestamp_convert(sweep_interval, sweep_interval_units, AWS_TIMESTAMP_NANOS, NULL);
+        if (cache->janitor_interval_ns > INT64_MAX) {
+            cache->janitor_interval_ns = INT64_MAX;
+        }
+
+        if (aws_condition_variable_init(&cache->janitor_signal)) {
+            goto err_cv;
+        }
+
+        if (aws_thread_init(&cache->janitor, alloc)) {
+            goto err_thread_init;
+        }
+
+        if (aws_thread_launch(&cache->janitor, janitor_thread_fn, cache, aws_default_thread_options())) {
+            goto err_thread_launch;
+        }
+    }
+
     return &cache->base;
 
+err_thread_launch:
+    aws_thread_clean_up(&cache->janitor);
+err_thread_init:
+    aws_condition_variable_clean_up(&cache->janitor_signal);
+err_cv:
+    aws_priority_queue_clean_up(&cache->ttl_heap);
 err_pq:
     aws_hash_table_clean_up(&cache->entries);
 err_hash_table:
@@ -14,6 +14,9 @@
  */
 #include <aws/cryptosdk/cipher.h>
 #include <aws/cryptosdk/materials.h>
+#include <aws/cryptosdk/private/edk.h>
+
+#include <stddef.h>
 
 struct aws_cryptosdk_enc_materials *aws_cryptosdk_enc_materials_new(
     struct aws_allocator *alloc, enum aws_cryptosdk_alg_id alg) {
@@ -26,6 +29,7 @@ struct aws_cryptosdk_enc_materials *aws_cryptosdk_enc_materials_new(
     enc_mat->alg   = alg;
     memset(&enc_mat->unencrypted_data_key, 0, sizeof(struct aws_byte_buf));
     enc_mat->signctx = NULL;
+    enc_mat->owner   = NULL;
 
     if (aws_cryptosdk_edk_list_init(alloc, &enc_mat->encrypted_data_keys)) {
         aws_mem_release(alloc, enc_mat);
@@ -49,6 +53,7 @@ void aws_cryptosdk_enc_materials_destroy(struct aws_cryptosdk_enc_materials *enc
         aws_byte_buf_clean_up_secure(&enc_mat->unencrypted_data_key);
         aws_cryptosdk_edk_list_clean_up(&enc_mat->encrypted_data_keys);
         aws_cryptosdk_keyring_trace_clean_up(&enc_mat->keyring_trace);
+        aws_cryptosdk_materials_owner_release(enc_mat->owner);
         aws_mem_release(enc_mat->alloc, enc_mat);
     }
 }
@@ -133,6 +138,28 @@ int aws_cryptosdk_keyring_on_encrypt(
     return ret;
 }
 
+static int keyring_call_on_decrypt(
+    struct aws_cryptosdk_keyring *keyring,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_cryptosdk_edk_index *edk_index,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    const struct aws_cryptosdk_keyring_vt *vt = keyring->vtable;
+    size_t indexed_end = offsetof(struct aws_cryptosdk_keyring_vt, on_decrypt_indexed) + sizeof(vt->on_decrypt_indexed);
+
+    /* An index built over some other list (e.g. a copy) would give the wrong positions */
+    if (edk_index && edk_index->edks == edks && vt->vt_size >= indexed_end && vt->on_decrypt_indexed) {
+        return vt->on_decrypt_indexed(
+            keyring, request_alloc, unencrypted_data_key, keyring_trace, edks, edk_index, enc_ctx, alg);
+    }
+    AWS_CRYPTOSDK_PRIVATE_VF_CALL(
+        on_decrypt, keyring, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
+    return ret;
+}
+
 int aws_cryptosdk_keyring_on_decrypt(
     struct aws_cryptosdk_keyring *keyring,
     struct aws_allocator *request_alloc,
@@ -141,6 +168,19 @@ int aws_cryptosdk_keyring_on_decrypt(
     const struct aws_array_list *edks,
     const struct aws_hash_table *enc_ctx,
     enum aws_cryptosdk_alg_id alg) {
+    return aws_cryptosdk_keyring_on_decrypt_indexed(
+        keyring, request_alloc, unencrypted_data_key, keyring_trace, edks, NULL, enc_ctx, alg);
+}
+
+int aws_cryptosdk_keyring_on_decrypt_indexed(
+    struct aws_cryptosdk_keyring *keyring,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_cryptosdk_edk_index *edk_index,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
     AWS_PRECONDITION(aws_allocator_is_valid(request_alloc));
     AWS_PRECONDITION(aws_cryptosdk_keyring_is_valid(keyring) && (keyring->vtable != NULL));
     AWS_PRECONDITION(aws_byte_buf_is_valid(unencrypted_data_key));
@@ -150,8 +190,9 @@ int aws_cryptosdk_keyring_on_decrypt(
 
     /* Precondition: data key buffer must be unset. */
     if (unencrypted_data_key->buffer) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
-    AWS_CRYPTOSDK_PRIVATE_VF_CALL(
-        on_decrypt, keyring, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
+
+    int ret = keyring_call_on_decrypt(
+        keyring, request_alloc, unencrypted_data_key, keyring_trace, edks, edk_index, enc_ctx, alg);
 
     /* Postcondition: if data key was decrypted, its length must agree with algorithm
      * specification. If this is not the case, it either means ciphertext was tampered
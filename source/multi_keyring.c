@@ -13,6 +13,11 @@
  * limitations under the License.
  */
 #include <assert.h>
+#include <aws/common/clock.h>
+#include <aws/common/condition_variable.h>
+#include <aws/common/math.h>
+#include <aws/common/mutex.h>
+#include <aws/cryptosdk/enc_ctx.h>
 #include <aws/cryptosdk/list_utils.h>
 #include <aws/cryptosdk/materials.h>
 #include <aws/cryptosdk/private/multi_keyring.h>
@@ -36,6 +41,169 @@ static int call_on_encrypt_on_list(
     return AWS_OP_SUCCESS;
 }
 
+/*
+ * Concurrent child keyring calls
+ *
+ * Each child call is a task handed to the executor. The requesting thread runs one of the tasks itself, and
+ * then waits on the batch until the rest have completed.
+ */
+struct child_batch {
+    struct aws_mutex lock;
+    struct aws_condition_variable done;
+    size_t pending;
+};
+
+static int child_batch_init(struct child_batch *batch, size_t pending) {
+    if (aws_mutex_init(&batch->lock)) {
+        return AWS_OP_ERR;
+    }
+
+    if (aws_condition_variable_init(&batch->done)) {
+        aws_mutex_clean_up(&batch->lock);
+        return AWS_OP_ERR;
+    }
+
+    batch->pending = pending;
+    return AWS_OP_SUCCESS;
+}
+
+static void child_batch_clean_up(struct child_batch *batch) {
+    aws_condition_variable_clean_up(&batch->done);
+    aws_mutex_clean_up(&batch->lock);
+}
+
+/* Nobody else can make progress if this fails, so there's no way to back out */
+static void child_batch_task_done(struct child_batch *batch) {
+    if (aws_mutex_lock(&batch->lock)) {
+        abort();
+    }
+
+    batch->pending--;
+    aws_condition_variable_notify_all(&batch->done);
+
+    if (aws_mutex_unlock(&batch->lock)) {
+        abort();
+    }
+}
+
+static void child_batch_wait(struct child_batch *batch) {
+    if (aws_mutex_lock(&batch->lock)) {
+        abort();
+    }
+
+    while (batch->pending) {
+        aws_condition_variable_wait(&batch->done, &batch->lock);
+    }
+
+    if (aws_mutex_unlock(&batch->lock)) {
+        abort();
+    }
+}
+
+/*
+ * Hands fn(arg) to the executor, which the concurrent modes require. If it does not accept it, runs it here.
+ */
+static void dispatch_child_task(struct multi_keyring *self, void (*fn)(void *), void *arg) {
+    if (self->executor(self->executor_data, fn, arg)) {
+        fn(arg);
+    }
+}
+
+struct child_encrypt_task {
+    struct child_batch *batch;
+    struct aws_cryptosdk_keyring *child;
+    struct aws_allocator *request_alloc;
+    /* Shallow copy of the data key, so that no two children share the struct itself */
+    struct aws_byte_buf data_key;
+    struct aws_array_list edks, trace;
+    const struct aws_hash_table *enc_ctx;
+    enum aws_cryptosdk_alg_id alg;
+    int result, error;
+};
+
+static void child_encrypt_task_fn(void *vp_task) {
+    struct child_encrypt_task *task = vp_task;
+
+    task->result = aws_cryptosdk_keyring_on_encrypt(
+        task->child, task->request_alloc, &task->data_key, &task->trace, &task->edks, task->enc_ctx, task->alg);
+    /* The error code is thread-local, so we need to pass it back to the requesting thread */
+    task->error = task->result ? aws_last_error() : AWS_ERROR_SUCCESS;
+
+    child_batch_task_done(task->batch);
+}
+
+static int call_on_encrypt_concurrently(
+    struct multi_keyring *self,
+    struct aws_allocator *request_alloc,
+    const struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    size_t num_keyrings = aws_array_list_length(&self->children);
+    size_t n_tasks      = 0;
+    int ret             = AWS_OP_ERR;
+
+    struct child_batch batch;
+    struct child_encrypt_task *tasks = aws_mem_acquire(request_alloc, num_keyrings * sizeof(*tasks));
+    if (!tasks) return aws_raise_error(AWS_ERROR_OOM);
+
+    if (child_batch_init(&batch, num_keyrings)) {
+        aws_mem_release(request_alloc, tasks);
+        return AWS_OP_ERR;
+    }
+
+    for (; n_tasks < num_keyrings; n_tasks++) {
+        struct child_encrypt_task *task = &tasks[n_tasks];
+
+        memset(task, 0, sizeof(*task));
+        task->batch         = &batch;
+        task->request_alloc = request_alloc;
+        task->data_key      = *unencrypted_data_key;
+        task->enc_ctx       = enc_ctx;
+        task->alg           = alg;
+
+        if (aws_array_list_get_at(&self->children, (void *)&task->child, n_tasks)) goto out;
+        if (aws_cryptosdk_edk_list_init(request_alloc, &task->edks)) goto out;
+        if (aws_cryptosdk_keyring_trace_init(request_alloc, &task->trace)) {
+            aws_cryptosdk_edk_list_clean_up(&task->edks);
+            goto out;
+        }
+    }
+
+    /* The first child runs on this thread, once all the others have been handed off */
+    for (size_t i = num_keyrings - 1; i > 0; i--) {
+        dispatch_child_task(self, child_encrypt_task_fn, &tasks[i]);
+    }
+    child_encrypt_task_fn(&tasks[0]);
+
+    child_batch_wait(&batch);
+
+    for (size_t i = 0; i < num_keyrings; i++) {
+        if (tasks[i].result) {
+            aws_raise_error(tasks[i].error);
+            goto out;
+        }
+    }
+
+    for (size_t i = 0; i < num_keyrings; i++) {
+        if (aws_cryptosdk_transfer_list(edks, &tasks[i].edks)) goto out;
+        aws_cryptosdk_transfer_list(keyring_trace, &tasks[i].trace);
+    }
+
+    ret = AWS_OP_SUCCESS;
+
+out:
+    for (size_t i = 0; i < n_tasks; i++) {
+        aws_cryptosdk_edk_list_clean_up(&tasks[i].edks);
+        aws_cryptosdk_keyring_trace_clean_up(&tasks[i].trace);
+    }
+    child_batch_clean_up(&batch);
+    aws_mem_release(request_alloc, tasks);
+
+    return ret;
+}
+
 static int multi_keyring_on_encrypt(
     struct aws_cryptosdk_keyring *multi,
     struct aws_allocator *request_alloc,
@@ -75,9 +243,19 @@ static int multi_keyring_on_encrypt(
         goto out;
     }
 
-    if (call_on_encrypt_on_list(
-            &self->children, request_alloc, unencrypted_data_key, &my_trace, &my_edks, enc_ctx, alg) ||
-        aws_cryptosdk_transfer_list(edks, &my_edks)) {
+    if (self->concurrent_encrypt && self->executor && aws_array_list_length(&self->children) > 1) {
+        if (call_on_encrypt_concurrently(
+                self, request_alloc, unencrypted_data_key, &my_trace, &my_edks, enc_ctx, alg)) {
+            ret = AWS_OP_ERR;
+            goto out;
+        }
+    } else if (call_on_encrypt_on_list(
+                   &self->children, request_alloc, unencrypted_data_key, &my_trace, &my_edks, enc_ctx, alg)) {
+        ret = AWS_OP_ERR;
+        goto out;
+    }
+
+    if (aws_cryptosdk_transfer_list(edks, &my_edks)) {
         ret = AWS_OP_ERR;
         goto out;
     }
@@ -89,12 +267,250 @@ out:
     return ret;
 }
 
-static int multi_keyring_on_decrypt(
+/*
+ * Hedged On Decrypt
+ *
+ * Keyring calls are started one after another on the executor, and the first one to produce a data key wins.
+ * The request returns as soon as there is a winner, without waiting for losing calls which are still running,
+ * so the race is reference counted: it retains the keyrings and owns copies of the EDKs and encryption context,
+ * and whichever of the request and its calls lets go of it last frees it. The keyrings allocate with the
+ * multi-keyring's allocator, since the request's allocator may be gone by the time a losing call returns.
+ */
+struct hedged_race;
+
+struct hedged_task {
+    struct hedged_race *race;
+    size_t idx;
+    struct aws_cryptosdk_keyring *keyring;
+    struct aws_byte_buf data_key;
+    struct aws_array_list trace;
+    int result, error;
+};
+
+struct hedged_race {
+    struct aws_allocator *alloc;
+    struct aws_array_list edks;
+    struct aws_hash_table enc_ctx;
+    bool have_enc_ctx;
+    enum aws_cryptosdk_alg_id alg;
+
+    /* Everything below is protected by lock; done is signalled whenever a task finishes */
+    struct aws_mutex lock;
+    struct aws_condition_variable done;
+    /* One reference for the request, and one for each task it has started */
+    size_t refcount;
+    size_t n_tasks, n_started, n_finished;
+    /* Index of the first task to produce a data key, or SIZE_MAX */
+    size_t winner;
+    struct hedged_task *tasks;
+};
+
+static void hedged_race_destroy(struct hedged_race *race) {
+    for (size_t i = 0; i < race->n_tasks; i++) {
+        aws_byte_buf_clean_up_secure(&race->tasks[i].data_key);
+        aws_cryptosdk_keyring_trace_clean_up(&race->tasks[i].trace);
+        aws_cryptosdk_keyring_release(race->tasks[i].keyring);
+    }
+
+    if (race->have_enc_ctx) aws_cryptosdk_enc_ctx_clean_up(&race->enc_ctx);
+    aws_cryptosdk_edk_list_clean_up(&race->edks);
+    aws_condition_variable_clean_up(&race->done);
+    aws_mutex_clean_up(&race->lock);
+    aws_mem_release(race->alloc, race->tasks);
+    aws_mem_release(race->alloc, race);
+}
+
+/* Drops a reference to race, whose lock must be held by the caller; releases the lock */
+static void hedged_race_unlock_and_release(struct hedged_race *race) {
+    bool last = !--race->refcount;
+
+    if (aws_mutex_unlock(&race->lock)) abort();
+
+    if (last) hedged_race_destroy(race);
+}
+
+static struct hedged_race *hedged_race_new(
+    struct multi_keyring *self,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    size_t n_children = aws_array_list_length(&self->children);
+    size_t n_tasks    = n_children + (self->generator ? 1 : 0);
+
+    struct hedged_race *race = aws_mem_acquire(self->alloc, sizeof(*race));
+    if (!race) {
+        aws_raise_error(AWS_ERROR_OOM);
+        return NULL;
+    }
+    memset(race, 0, sizeof(*race));
+    race->alloc    = self->alloc;
+    race->alg      = alg;
+    race->refcount = 1;
+    race->winner   = SIZE_MAX;
+
+    if (!(race->tasks = aws_mem_acquire(self->alloc, n_tasks * sizeof(*race->tasks)))) {
+        aws_raise_error(AWS_ERROR_OOM);
+        goto err_tasks;
+    }
+    memset(race->tasks, 0, n_tasks * sizeof(*race->tasks));
+
+    if (aws_mutex_init(&race->lock)) goto err_lock;
+    if (aws_condition_variable_init(&race->done)) goto err_done;
+    if (aws_cryptosdk_edk_list_init(self->alloc, &race->edks)) goto err_edks;
+
+    /* From here on, hedged_race_destroy can clean up whatever has been set up */
+    if (aws_cryptosdk_edk_list_copy_all(self->alloc, &race->edks, edks)) goto err;
+    if (enc_ctx) {
+        if (aws_cryptosdk_enc_ctx_init(self->alloc, &race->enc_ctx)) goto err;
+        race->have_enc_ctx = true;
+        if (aws_cryptosdk_enc_ctx_clone(self->alloc, &race->enc_ctx, enc_ctx)) goto err;
+    }
+
+    for (; race->n_tasks < n_tasks; race->n_tasks++) {
+        struct hedged_task *task = &race->tasks[race->n_tasks];
+        struct aws_cryptosdk_keyring *keyring;
+
+        task->race = race;
+        task->idx  = race->n_tasks;
+
+        /* The generator, if any, goes first */
+        if (self->generator && !task->idx) {
+            keyring = self->generator;
+        } else if (aws_array_list_get_at(&self->children, (void *)&keyring, task->idx - (self->generator ? 1 : 0))) {
+            goto err;
+        }
+
+        if (aws_cryptosdk_keyring_trace_init(self->alloc, &task->trace)) goto err;
+        aws_cryptosdk_keyring_retain(keyring);
+        task->keyring = keyring;
+    }
+
+    return race;
+
+err:
+    hedged_race_destroy(race);
+    return NULL;
+
+err_edks:
+    aws_condition_variable_clean_up(&race->done);
+err_done:
+    aws_mutex_clean_up(&race->lock);
+err_lock:
+    aws_mem_release(self->alloc, race->tasks);
+err_tasks:
+    aws_mem_release(self->alloc, race);
+    return NULL;
+}
+
+static void hedged_task_fn(void *vp_task) {
+    struct hedged_task *task = vp_task;
+    struct hedged_race *race = task->race;
+    bool lost;
+
+    if (aws_mutex_lock(&race->lock)) abort();
+    lost = race->winner != SIZE_MAX;
+    if (aws_mutex_unlock(&race->lock)) abort();
+
+    /* A task which was still queued when the race was won has nothing left to do */
+    if (!lost) {
+        task->result = aws_cryptosdk_keyring_on_decrypt(
+            task->keyring,
+            race->alloc,
+            &task->data_key,
+            &task->trace,
+            &race->edks,
+            race->have_enc_ctx ? &race->enc_ctx : NULL,
+            race->alg);
+        /* The error code is thread-local, so we need to pass it back to the requesting thread */
+        task->error = task->result ? aws_last_error() : AWS_ERROR_SUCCESS;
+    }
+
+    if (aws_mutex_lock(&race->lock)) abort();
+
+    if (task->data_key.buffer && race->winner == SIZE_MAX) {
+        race->winner = task->idx;
+    }
+
+    race->n_finished++;
+    aws_condition_variable_notify_all(&race->done);
+
+    hedged_race_unlock_and_release(race);
+}
+
+static int hedged_on_decrypt(
+    struct multi_keyring *self,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    int error           = AWS_ERROR_SUCCESS;
+    uint64_t next_start = 0;
+    struct hedged_race *race;
+
+    if (!(race = hedged_race_new(self, edks, enc_ctx, alg))) return AWS_OP_ERR;
+
+    if (aws_mutex_lock(&race->lock)) abort();
+
+    while (race->winner == SIZE_MAX && race->n_finished < race->n_tasks) {
+        uint64_t now = 0;
+        aws_high_res_clock_get_ticks(&now);
+
+        /* Start the next keyring once the delay has passed, or right away if all those started so far failed */
+        if (race->n_started < race->n_tasks && (race->n_finished == race->n_started || now >= next_start)) {
+            struct hedged_task *task = &race->tasks[race->n_started++];
+
+            race->refcount++;
+            next_start = aws_add_u64_saturating(now, self->hedge_delay_nanos);
+
+            if (aws_mutex_unlock(&race->lock)) abort();
+            dispatch_child_task(self, hedged_task_fn, task);
+            if (aws_mutex_lock(&race->lock)) abort();
+            continue;
+        }
+
+        if (race->n_started < race->n_tasks) {
+            /* next_start saturates for very long delays, and the wait takes a signed timeout */
+            uint64_t timeout = next_start - now;
+            aws_condition_variable_wait_for(
+                &race->done, &race->lock, timeout > INT64_MAX ? INT64_MAX : (int64_t)timeout);
+        } else {
+            aws_condition_variable_wait(&race->done, &race->lock);
+        }
+    }
+
+    /*
+     * Losing calls which are still running are not waited for; they finish on their own, and the last one
+     * frees the race. The winner's data key and trace were allocated with the multi-keyring's allocator,
+     * which they carry with them.
+     */
+    if (race->winner != SIZE_MAX) {
+        struct hedged_task *winner = &race->tasks[race->winner];
+
+        *unencrypted_data_key = winner->data_key;
+        memset(&winner->data_key, 0, sizeof(winner->data_key));
+        aws_cryptosdk_transfer_list(keyring_trace, &winner->trace);
+    } else {
+        /* As in sequential mode, report an error only if there was no data key and some keyring failed */
+        for (size_t i = 0; i < race->n_started; i++) {
+            if (race->tasks[i].result) {
+                error = race->tasks[i].error;
+                break;
+            }
+        }
+    }
+
+    hedged_race_unlock_and_release(race);
+    return error ? aws_raise_error(error) : AWS_OP_SUCCESS;
+}
+
+static int multi_keyring_on_decrypt_indexed(
     struct aws_cryptosdk_keyring *multi,
     struct aws_allocator *request_alloc,
     struct aws_byte_buf *unencrypted_data_key,
     struct aws_array_list *keyring_trace,
     const struct aws_array_list *edks,
+    const struct aws_cryptosdk_edk_index *edk_index,
     const struct aws_hash_table *enc_ctx,
     enum aws_cryptosdk_alg_id alg) {
     /* If one of the contained keyrings succeeds at decrypting the data key, return success,
@@ -105,9 +521,15 @@ static int multi_keyring_on_decrypt(
 
     struct multi_keyring *self = (struct multi_keyring *)multi;
 
+    /* Hedged children may outlive the request, and with it the index, so they go without it */
+    if (self->hedged_decrypt && self->executor &&
+        aws_array_list_length(&self->children) + (self->generator ? 1 : 0) > 1) {
+        return hedged_on_decrypt(self, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
+    }
+
     if (self->generator) {
-        int decrypt_err = aws_cryptosdk_keyring_on_decrypt(
-            self->generator, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
+        int decrypt_err = aws_cryptosdk_keyring_on_decrypt_indexed(
+            self->generator, request_alloc, unencrypted_data_key, keyring_trace, edks, edk_index, enc_ctx, alg);
         if (unencrypted_data_key->buffer) return AWS_OP_SUCCESS;
         if (decrypt_err) ret_if_no_decrypt = AWS_OP_ERR;
     }
@@ -118,14 +540,33 @@ static int multi_keyring_on_decrypt(
         if (aws_array_list_get_at(&self->children, (void *)&child, child_idx)) return AWS_OP_ERR;
 
         // if decrypt data key fails, keep trying with other keyrings
-        int decrypt_err = aws_cryptosdk_keyring_on_decrypt(
-            child, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
+        int decrypt_err = aws_cryptosdk_keyring_on_decrypt_indexed(
+            child, request_alloc, unencrypted_data_key, keyring_trace, edks, edk_index, enc_ctx, alg);
         if (unencrypted_data_key->buffer) return AWS_OP_SUCCESS;
         if (decrypt_err) ret_if_no_decrypt = AWS_OP_ERR;
     }
     return ret_if_no_decrypt;
 }
 
+static int multi_keyring_on_decrypt(
+    struct aws_cryptosdk_keyring *multi,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    /* Called without an index from the caller, so build one to share between our children */
+    struct aws_cryptosdk_edk_index *edk_index = NULL;
+    if (aws_array_list_length(edks) > 1 && !(edk_index = aws_cryptosdk_edk_index_new(request_alloc, edks))) {
+        return AWS_OP_ERR;
+    }
+    int ret = multi_keyring_on_decrypt_indexed(
+        multi, request_alloc, unencrypted_data_key, keyring_trace, edks, edk_index, enc_ctx, alg);
+    aws_cryptosdk_edk_index_destroy(edk_index);
+    return ret;
+}
+
 static void multi_keyring_destroy(struct aws_cryptosdk_keyring *multi) {
     struct multi_keyring *self = (struct multi_keyring *)multi;
     size_t n_keys              = aws_array_list_length(&self->children);
@@ -143,11 +584,12 @@ static void multi_keyring_destroy(struct aws_cryptosdk_keyring *multi) {
     aws_mem_release(self->alloc, self);
 }
 
-static const struct aws_cryptosdk_keyring_vt vt = { .vt_size    = sizeof(struct aws_cryptosdk_keyring_vt),
-                                                    .name       = "multi keyring",
-                                                    .destroy    = multi_keyring_destroy,
-                                                    .on_encrypt = multi_keyring_on_encrypt,
-                                                    .on_decrypt = multi_keyring_on_decrypt };
+static const struct aws_cryptosdk_keyring_vt vt = { .vt_size            = sizeof(struct aws_cryptosdk_keyring_vt),
+                                                    .name               = "multi keyring",
+                                                    .destroy            = multi_keyring_destroy,
+                                                    .on_encrypt         = multi_keyring_on_encrypt,
+                                                    .on_decrypt         = multi_keyring_on_decrypt,
+                                                    .on_decrypt_indexed = multi_keyring_on_decrypt_indexed };
 
 struct aws_cryptosdk_keyring *aws_cryptosdk_multi_keyring_new(
     struct aws_allocator *alloc, struct aws_cryptosdk_keyring *generator) {
@@ -163,8 +605,13 @@ struct aws_cryptosdk_keyring *aws_cryptosdk_multi_keyring_new(
     aws_cryptosdk_keyring_base_init(&multi->base, &vt);
 
     if (generator) aws_cryptosdk_keyring_retain(generator);
-    multi->generator = generator;
-    multi->alloc     = alloc;
+    multi->generator          = generator;
+    multi->alloc              = alloc;
+    multi->executor           = NULL;
+    multi->executor_data      = NULL;
+    multi->concurrent_encrypt = false;
+    multi->hedged_decrypt     = false;
+    multi->hedge_delay_nanos  = 0;
     AWS_POSTCONDITION(aws_cryptosdk_multi_keyring_is_valid((struct aws_cryptosdk_keyring *)multi));
     return (struct aws_cryptosdk_keyring *)multi;
 }
@@ -187,3 +634,48 @@ int aws_cryptosdk_multi_keyring_add_child(struct aws_cryptosdk_keyring *multi, s
 
     return aws_array_list_push_back(&self->children, (void *)&child);
 }
+
+int aws_cryptosdk_multi_keyring_set_executor(
+    struct aws_cryptosdk_keyring *multi, aws_cryptosdk_keyring_executor_fn executor, void *executor_data) {
+    AWS_PRECONDITION(aws_cryptosdk_multi_keyring_is_valid(multi));
+    struct multi_keyring *self = (struct multi_keyring *)multi;
+
+    if (multi->vtable != &vt) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    self->executor      = executor;
+    self->executor_data = executor_data;
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_multi_keyring_set_concurrent_encrypt(struct aws_cryptosdk_keyring *multi, bool concurrent) {
+    AWS_PRECONDITION(aws_cryptosdk_multi_keyring_is_valid(multi));
+    struct multi_keyring *self = (struct multi_keyring *)multi;
+
+    if (multi->vtable != &vt) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    self->concurrent_encrypt = concurrent;
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_multi_keyring_set_hedged_decrypt(
+    struct aws_cryptosdk_keyring *multi, bool hedged, uint64_t delay, enum aws_timestamp_unit delay_units) {
+    AWS_PRECONDITION(aws_cryptosdk_multi_keyring_is_valid(multi));
+    struct multi_keyring *self = (struct multi_keyring *)multi;
+
+    if (multi->vtable != &vt) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    if (delay_units != AWS_TIMESTAMP_SECS && delay_units != AWS_TIMESTAMP_MILLIS &&
+        delay_units != AWS_TIMESTAMP_MICROS && delay_units != AWS_TIMESTAMP_NANOS) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    self->hedged_decrypt    = hedged;
+    self->hedge_delay_nanos = aws_mul_u64_saturating(AWS_TIMESTAMP_NANOS / delay_units, delay);
+    return AWS_OP_SUCCESS;
+}
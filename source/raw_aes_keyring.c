@@ -24,17 +24,37 @@ struct raw_aes_keyring {
     struct aws_string *key_namespace;
     struct aws_string *key_name;
     struct aws_string *raw_key;
+    /* Key schedule computed at construction; NULL if that failed, in which case raw_key is used directly */
+    struct aws_cryptosdk_aes_gcm_key *aes_key;
 };
 
+/* Encryption contexts which serialize to at most this many bytes are kept on the caller's stack */
+#define RAW_AES_KR_AAD_STORAGE_LEN 512
+
+/**
+ * Serializes the encryption context into aad. When it fits, the caller-provided storage is used and
+ * nothing is allocated; otherwise the buffer is allocated from alloc. Either way the caller must call
+ * aws_byte_buf_clean_up on aad afterward.
+ */
 static int serialize_aad_init(
-    struct aws_allocator *alloc, struct aws_byte_buf *aad, const struct aws_hash_table *enc_ctx) {
+    struct aws_allocator *alloc,
+    struct aws_byte_buf *aad,
+    const struct aws_hash_table *enc_ctx,
+    uint8_t *storage,
+    size_t storage_len) {
     size_t aad_len;
     // This does not zero out the bytes of the byte buffer.
     // It assures that the buffer object is in proper uninitialized state.
     memset(aad, 0, sizeof(*aad));
 
-    if (aws_cryptosdk_enc_ctx_size(&aad_len, enc_ctx) || aws_byte_buf_init(aad, alloc, aad_len) ||
-        aws_cryptosdk_enc_ctx_serialize(alloc, aad, enc_ctx)) {
+    if (aws_cryptosdk_enc_ctx_size(&aad_len, enc_ctx)) return AWS_OP_ERR;
+    if (aad_len <= storage_len) {
+        *aad = aws_byte_buf_from_empty_array(storage, storage_len);
+    } else if (aws_byte_buf_init(aad, alloc, aad_len)) {
+        return AWS_OP_ERR;
+    }
+
+    if (aws_cryptosdk_enc_ctx_serialize(alloc, aad, enc_ctx)) {
         aws_byte_buf_clean_up(aad);
         return AWS_OP_ERR;
     }
@@ -100,8 +120,9 @@ int aws_cryptosdk_raw_aes_keyring_encrypt_data_key_with_iv(
     const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(alg);
     size_t data_key_len                              = props->data_key_len;
 
+    uint8_t aad_storage[RAW_AES_KR_AAD_STORAGE_LEN];
     struct aws_byte_buf aad;
-    if (serialize_aad_init(request_alloc, &aad, enc_ctx)) {
+    if (serialize_aad_init(request_alloc, &aad, enc_ctx, aad_storage, sizeof(aad_storage))) {
         return AWS_OP_ERR;
     }
 
@@ -115,14 +136,13 @@ int aws_cryptosdk_raw_aes_keyring_encrypt_data_key_with_iv(
     }
     struct aws_byte_buf edk_bytes = aws_byte_buf_from_array(edk.ciphertext.buffer, data_key_len);
     struct aws_byte_buf tag       = aws_byte_buf_from_array(edk.ciphertext.buffer + data_key_len, RAW_AES_KR_TAG_LEN);
-    if (aws_cryptosdk_aes_gcm_encrypt(
-            &edk_bytes,
-            &tag,
-            aws_byte_cursor_from_buf(unencrypted_data_key),
-            aws_byte_cursor_from_array(iv, RAW_AES_KR_IV_LEN),
-            aws_byte_cursor_from_buf(&aad),
-            self->raw_key))
-        goto err;
+    struct aws_byte_cursor plain   = aws_byte_cursor_from_buf(unencrypted_data_key);
+    struct aws_byte_cursor iv_cur  = aws_byte_cursor_from_array(iv, RAW_AES_KR_IV_LEN);
+    struct aws_byte_cursor aad_cur = aws_byte_cursor_from_buf(&aad);
+    int encrypt_err =
+        self->aes_key ? aws_cryptosdk_aes_gcm_encrypt_with_key(&edk_bytes, &tag, plain, iv_cur, aad_cur, self->aes_key)
+                      : aws_cryptosdk_aes_gcm_encrypt(&edk_bytes, &tag, plain, iv_cur, aad_cur, self->raw_key);
+    if (encrypt_err) goto err;
     edk.ciphertext.len = edk.ciphertext.capacity;
 
     if (aws_cryptosdk_serialize_provider_info_init(request_alloc, &edk.provider_info, self->key_name, iv)) goto err;
@@ -182,23 +202,34 @@ static int raw_aes_keyring_on_encrypt(
     return ret;
 }
 
-static int raw_aes_keyring_on_decrypt(
+static int raw_aes_keyring_on_decrypt_indexed(
     struct aws_cryptosdk_keyring *kr,
     struct aws_allocator *request_alloc,
     struct aws_byte_buf *unencrypted_data_key,
     struct aws_array_list *keyring_trace,
     const struct aws_array_list *edks,
+    const struct aws_cryptosdk_edk_index *edk_index,
     const struct aws_hash_table *enc_ctx,
     enum aws_cryptosdk_alg_id alg) {
     struct raw_aes_keyring *self = (struct raw_aes_keyring *)kr;
 
+    /* Provider info carries the IV, so with an index we can only narrow down by provider ID */
+    const size_t *positions = NULL;
+    size_t num_edks         = aws_array_list_length(edks);
+    if (edk_index) {
+        if (aws_cryptosdk_edk_index_find(
+                edk_index, aws_byte_cursor_from_string(self->key_namespace), NULL, &positions, &num_edks)) {
+            return AWS_OP_ERR;
+        }
+        if (!num_edks) return AWS_OP_SUCCESS;
+    }
+
+    uint8_t aad_storage[RAW_AES_KR_AAD_STORAGE_LEN];
     struct aws_byte_buf aad;
-    if (serialize_aad_init(request_alloc, &aad, enc_ctx)) {
+    if (serialize_aad_init(request_alloc, &aad, enc_ctx, aad_storage, sizeof(aad_storage))) {
         return AWS_OP_ERR;
     }
 
-    size_t num_edks = aws_array_list_length(edks);
-
     const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(alg);
     size_t data_key_len                              = props->data_key_len;
 
@@ -207,7 +238,8 @@ static int raw_aes_keyring_on_decrypt(
         return AWS_OP_ERR;
     }
 
-    for (size_t edk_idx = 0; edk_idx < num_edks; ++edk_idx) {
+    for (size_t i = 0; i < num_edks; ++i) {
+        size_t edk_idx = positions ? positions[i] : i;
         const struct aws_cryptosdk_edk *edk;
         if (aws_array_list_get_at_ptr(edks, (void **)&edk, edk_idx)) {
             aws_byte_buf_clean_up(&aad);
@@ -227,13 +259,15 @@ static int raw_aes_keyring_on_decrypt(
          */
         if (data_key_len + RAW_AES_KR_TAG_LEN != edk_bytes->len) continue;
 
-        if (aws_cryptosdk_aes_gcm_decrypt(
-                unencrypted_data_key,
-                aws_byte_cursor_from_array(edk_bytes->buffer, data_key_len),
-                aws_byte_cursor_from_array(edk_bytes->buffer + data_key_len, RAW_AES_KR_TAG_LEN),
-                aws_byte_cursor_from_buf(&iv),
-                aws_byte_cursor_from_buf(&aad),
-                self->raw_key)) {
+        struct aws_byte_cursor cipher = aws_byte_cursor_from_array(edk_bytes->buffer, data_key_len);
+        struct aws_byte_cursor tag = aws_byte_cursor_from_array(edk_bytes->buffer + data_key_len, RAW_AES_KR_TAG_LEN);
+        struct aws_byte_cursor iv_cur  = aws_byte_cursor_from_buf(&iv);
+        struct aws_byte_cursor aad_cur = aws_byte_cursor_from_buf(&aad);
+        struct aws_byte_buf *plain     = unencrypted_data_key;
+        int decrypt_err =
+            self->aes_key ? aws_cryptosdk_aes_gcm_decrypt_with_key(plain, cipher, tag, iv_cur, aad_cur, self->aes_key)
+                          : aws_cryptosdk_aes_gcm_decrypt(plain, cipher, tag, iv_cur, aad_cur, self->raw_key);
+        if (decrypt_err) {
             /* We are here either because of a ciphertext/tag mismatch (e.g., wrong encryption
              * context) or because of an OpenSSL error. In either case, nothing better to do
              * than just moving on to next EDK, so clear the error code.
@@ -257,19 +291,35 @@ success:
     return AWS_OP_SUCCESS;
 }
 
+static int raw_aes_keyring_on_decrypt(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    return raw_aes_keyring_on_decrypt_indexed(
+        kr, request_alloc, unencrypted_data_key, keyring_trace, edks, NULL, enc_ctx, alg);
+}
+
 static void raw_aes_keyring_destroy(struct aws_cryptosdk_keyring *kr) {
     struct raw_aes_keyring *self = (struct raw_aes_keyring *)kr;
     aws_string_destroy(self->key_name);
     aws_string_destroy(self->key_namespace);
     aws_string_destroy_secure(self->raw_key);
+    aws_cryptosdk_aes_gcm_key_destroy(self->aes_key);
     aws_mem_release(self->alloc, self);
 }
 
-static const struct aws_cryptosdk_keyring_vt raw_aes_keyring_vt = { .vt_size = sizeof(struct aws_cryptosdk_keyring_vt),
-                                                                    .name    = "raw AES keyring",
-                                                                    .destroy = raw_aes_keyring_destroy,
-                                                                    .on_encrypt = raw_aes_keyring_on_encrypt,
-                                                                    .on_decrypt = raw_aes_keyring_on_decrypt };
+static const struct aws_cryptosdk_keyring_vt raw_aes_keyring_vt = {
+    .vt_size            = sizeof(struct aws_cryptosdk_keyring_vt),
+    .name               = "raw AES keyring",
+    .destroy            = raw_aes_keyring_destroy,
+    .on_encrypt         = raw_aes_keyring_on_encrypt,
+    .on_decrypt         = raw_aes_keyring_on_decrypt,
+    .on_decrypt_indexed = raw_aes_keyring_on_decrypt_indexed
+};
 
 struct aws_cryptosdk_keyring *aws_cryptosdk_raw_aes_keyring_new(
     struct aws_allocator *alloc,
@@ -298,6 +348,12 @@ struct aws_cryptosdk_keyring *aws_cryptosdk_raw_aes_keyring_new(
     kr->raw_key = aws_string_new_from_array(alloc, raw_key_bytes, key_len);
     if (!kr->raw_key) goto oom_err;
 
+    /* A key of unsupported length is reported when the keyring is used, as before, so on failure we
+     * fall back to passing the raw key on each call.
+     */
+    kr->aes_key = aws_cryptosdk_aes_gcm_key_new(alloc, raw_key_bytes, key_len);
+    if (!kr->aes_key) aws_reset_error();
+
     kr->alloc = alloc;
     return (struct aws_cryptosdk_keyring *)kr;
 
@@ -27,6 +27,12 @@ struct raw_rsa_keyring {
     struct aws_string *key_name;
     struct aws_string *rsa_private_key_pem;
     struct aws_string *rsa_public_key_pem;
+    /*
+     * The keys parsed from the PEM strings above. These are NULL if the corresponding string could not be parsed,
+     * in which case we keep passing the string to the cipher functions, so that the error is reported on use.
+     */
+    struct aws_cryptosdk_rsa_key *rsa_private_key;
+    struct aws_cryptosdk_rsa_key *rsa_public_key;
     enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode;
 };
 
@@ -39,13 +45,13 @@ static int encrypt_data_key(
 
     struct aws_cryptosdk_edk edk = { { 0 } };
 
-    if (aws_cryptosdk_rsa_encrypt(
-            &edk.ciphertext,
-            request_alloc,
-            aws_byte_cursor_from_buf(unencrypted_data_key),
-            self->rsa_public_key_pem,
-            self->rsa_padding_mode))
+    struct aws_byte_cursor plain = aws_byte_cursor_from_buf(unencrypted_data_key);
+    if (self->rsa_public_key) {
+        if (aws_cryptosdk_rsa_encrypt_with_key(&edk.ciphertext, request_alloc, plain, self->rsa_public_key)) goto err;
+    } else if (aws_cryptosdk_rsa_encrypt(
+                   &edk.ciphertext, request_alloc, plain, self->rsa_public_key_pem, self->rsa_padding_mode)) {
         goto err;
+    }
 
     if (aws_byte_buf_init(&edk.provider_id, request_alloc, self->key_namespace->len)) goto err;
 
@@ -102,12 +108,13 @@ static int raw_rsa_keyring_on_encrypt(
     return ret;
 }
 
-static int raw_rsa_keyring_on_decrypt(
+static int raw_rsa_keyring_on_decrypt_indexed(
     struct aws_cryptosdk_keyring *kr,
     struct aws_allocator *request_alloc,
     struct aws_byte_buf *unencrypted_data_key,
     struct aws_array_list *keyring_trace,
     const struct aws_array_list *edks,
+    const struct aws_cryptosdk_edk_index *edk_index,
     const struct aws_hash_table *enc_ctx,
     enum aws_cryptosdk_alg_id alg) {
     (void)enc_ctx;
@@ -115,9 +122,18 @@ static int raw_rsa_keyring_on_decrypt(
     struct raw_rsa_keyring *self = (struct raw_rsa_keyring *)kr;
     if (!self->rsa_private_key_pem) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
 
-    size_t num_edks = aws_array_list_length(edks);
+    const size_t *positions = NULL;
+    size_t num_edks         = aws_array_list_length(edks);
+    if (edk_index) {
+        struct aws_byte_cursor key_name = aws_byte_cursor_from_string(self->key_name);
+        if (aws_cryptosdk_edk_index_find(
+                edk_index, aws_byte_cursor_from_string(self->key_namespace), &key_name, &positions, &num_edks)) {
+            return AWS_OP_ERR;
+        }
+    }
 
-    for (size_t edk_idx = 0; edk_idx < num_edks; ++edk_idx) {
+    for (size_t i = 0; i < num_edks; ++i) {
+        size_t edk_idx = positions ? positions[i] : i;
         const struct aws_cryptosdk_edk *edk;
         if (aws_array_list_get_at_ptr(edks, (void **)&edk, edk_idx)) {
             return AWS_OP_ERR;
@@ -127,12 +143,13 @@ static int raw_rsa_keyring_on_decrypt(
         if (!aws_string_eq_byte_buf(self->key_namespace, &edk->provider_id)) continue;
         if (!aws_string_eq_byte_buf(self->key_name, &edk->provider_info)) continue;
 
-        if (aws_cryptosdk_rsa_decrypt(
-                unencrypted_data_key,
-                request_alloc,
-                aws_byte_cursor_from_array(edk->ciphertext.buffer, edk->ciphertext.len),
-                self->rsa_private_key_pem,
-                self->rsa_padding_mode)) {
+        struct aws_byte_cursor cipher = aws_byte_cursor_from_array(edk->ciphertext.buffer, edk->ciphertext.len);
+        int decrypt_err =
+            self->rsa_private_key
+                ? aws_cryptosdk_rsa_decrypt_with_key(unencrypted_data_key, request_alloc, cipher, self->rsa_private_key)
+                : aws_cryptosdk_rsa_decrypt(
+                      unencrypted_data_key, request_alloc, cipher, self->rsa_private_key_pem, self->rsa_padding_mode);
+        if (decrypt_err) {
             /* We are here either because of a ciphertext mismatch
              * or because of an OpenSSL error. In either case, nothing
              * better to do than just moving on to next EDK, so clear the error code.
@@ -152,20 +169,37 @@ static int raw_rsa_keyring_on_decrypt(
     return AWS_OP_SUCCESS;
 }
 
+static int raw_rsa_keyring_on_decrypt(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    return raw_rsa_keyring_on_decrypt_indexed(
+        kr, request_alloc, unencrypted_data_key, keyring_trace, edks, NULL, enc_ctx, alg);
+}
+
 static void raw_rsa_keyring_destroy(struct aws_cryptosdk_keyring *kr) {
     struct raw_rsa_keyring *self = (struct raw_rsa_keyring *)kr;
     aws_string_destroy(self->key_name);
     aws_string_destroy(self->key_namespace);
     aws_string_destroy_secure(self->rsa_private_key_pem);
     aws_string_destroy_secure(self->rsa_public_key_pem);
+    aws_cryptosdk_rsa_key_destroy(self->rsa_private_key);
+    aws_cryptosdk_rsa_key_destroy(self->rsa_public_key);
     aws_mem_release(self->alloc, self);
 }
 
-static const struct aws_cryptosdk_keyring_vt raw_rsa_keyring_vt = { .vt_size = sizeof(struct aws_cryptosdk_keyring_vt),
-                                                                    .name    = "raw RSA keyring",
-                                                                    .destroy = raw_rsa_keyring_destroy,
-                                                                    .on_encrypt = raw_rsa_keyring_on_encrypt,
-                                                                    .on_decrypt = raw_rsa_keyring_on_decrypt };
+static const struct aws_cryptosdk_keyring_vt raw_rsa_keyring_vt = {
+    .vt_size            = sizeof(struct aws_cryptosdk_keyring_vt),
+    .name               = "raw RSA keyring",
+    .destroy            = raw_rsa_keyring_destroy,
+    .on_encrypt         = raw_rsa_keyring_on_encrypt,
+    .on_decrypt         = raw_rsa_keyring_on_decrypt,
+    .on_decrypt_indexed = raw_rsa_keyring_on_decrypt_indexed
+};
 
 struct aws_cryptosdk_keyring *aws_cryptosdk_raw_rsa_keyring_new(
     struct aws_allocator *alloc,
@@ -198,13 +232,18 @@ struct aws_cryptosdk_keyring *aws_cryptosdk_raw_rsa_keyring_new(
     if (rsa_public_key_pem) {
         kr->rsa_public_key_pem = aws_string_new_from_c_str(alloc, rsa_public_key_pem);
         if (!kr->rsa_public_key_pem) goto err;
+        kr->rsa_public_key = aws_cryptosdk_rsa_key_new(alloc, kr->rsa_public_key_pem, false, rsa_padding_mode);
     }
 
     if (rsa_private_key_pem) {
         kr->rsa_private_key_pem = aws_string_new_from_c_str(alloc, rsa_private_key_pem);
         if (!kr->rsa_private_key_pem) goto err;
+        kr->rsa_private_key = aws_cryptosdk_rsa_key_new(alloc, kr->rsa_private_key_pem, true, rsa_padding_mode);
     }
 
+    /* Keys which fail to parse are reported when they are used, as before */
+    aws_reset_error();
+
     kr->rsa_padding_mode = rsa_padding_mode;
     kr->alloc            = alloc;
 
@@ -215,6 +254,10 @@ struct aws_cryptosdk_keyring *aws_cryptosdk_raw_rsa_keyring_new(
 err:
     aws_string_destroy(kr->key_name);
     aws_string_destroy(kr->key_namespace);
+    aws_string_destroy_secure(kr->rsa_public_key_pem);
+    aws_string_destroy_secure(kr->rsa_private_key_pem);
+    aws_cryptosdk_rsa_key_destroy(kr->rsa_public_key);
+    aws_cryptosdk_rsa_key_destroy(kr->rsa_private_key);
     aws_mem_release(alloc, kr);
     return NULL;
 }
@@ -46,6 +46,8 @@ int aws_cryptosdk_session_reset(struct aws_cryptosdk_session *session, enum aws_
     session->header_copy = NULL;
     session->header_size = 0;
     aws_cryptosdk_hdr_clear(&session->header);
+    aws_cryptosdk_materials_owner_release(session->materials_owner);
+    session->materials_owner = NULL;
     aws_cryptosdk_keyring_trace_clear(&session->keyring_trace);
     /* session->frame_size is preserved */
     session->input_size_estimate  = 1;
@@ -30,40 +30,16 @@
 
 /** Session decrypt path routines **/
 
-static int fill_request(struct aws_cryptosdk_dec_request *request, struct aws_cryptosdk_session *session) {
+static void fill_request(struct aws_cryptosdk_dec_request *request, struct aws_cryptosdk_session *session) {
     request->alloc = session->alloc;
     request->alg   = session->alg_props->alg_id;
 
-    size_t n_keys = aws_array_list_length(&session->header.edk_list);
-
-    // TODO: Make encrypted_data_keys a pointer?
-    if (aws_cryptosdk_edk_list_init(session->alloc, &request->encrypted_data_keys)) {
-        return AWS_OP_ERR;
-    }
-
     request->enc_ctx = &session->header.enc_ctx;
 
-    for (size_t i = 0; i < n_keys; i++) {
-        struct aws_cryptosdk_edk edk;
-
-        if (aws_array_list_get_at(&session->header.edk_list, &edk, i)) {
-            goto UNEXPECTED_ERROR;
-        }
-        // Because the session header owns the EDKs, clear the allocators to avoid any unfortunate double frees
-        edk.provider_id.allocator   = NULL;
-        edk.provider_info.allocator = NULL;
-        edk.ciphertext.allocator    = NULL;
-
-        if (aws_array_list_push_back(&request->encrypted_data_keys, &edk)) {
-            goto UNEXPECTED_ERROR;
-        }
-    }
-
-    return AWS_OP_SUCCESS;
-
-UNEXPECTED_ERROR:
-    aws_array_list_clean_up(&request->encrypted_data_keys);
-    return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+    // Refer to the header's EDKs rather than copying them. Without an allocator, cleaning up the request's
+    // list frees nothing, and the EDKs themselves are views of header_copy, so nothing is freed twice.
+    request->encrypted_data_keys       = session->header.edk_list;
+    request->encrypted_data_keys.alloc = NULL;
 }
 
 static int derive_data_key(struct aws_cryptosdk_session *session, struct aws_cryptosdk_dec_materials *materials) {
@@ -131,7 +107,7 @@ int aws_cryptosdk_priv_unwrap_keys(struct aws_cryptosdk_session *AWS_RESTRICT se
         return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
     }
 
-    if (fill_request(&request, session)) return AWS_OP_ERR;
+    fill_request(&request, session);
     int rv = AWS_OP_ERR;
 
     if (aws_cryptosdk_cmm_decrypt_materials(session->cmm, &materials, &request)) goto out;
@@ -174,7 +150,7 @@ out:
 int aws_cryptosdk_priv_try_parse_header(
     struct aws_cryptosdk_session *AWS_RESTRICT session, struct aws_byte_cursor *AWS_RESTRICT input) {
     const uint8_t *header_start = input->ptr;
-    int rv                      = aws_cryptosdk_hdr_parse(&session->header, input);
+    int rv                      = aws_cryptosdk_hdr_parse_borrowed(&session->header, input);
 
     if (rv != AWS_OP_SUCCESS) {
         if (aws_last_error() == AWS_ERROR_SHORT_BUFFER) {
@@ -208,6 +184,8 @@ int aws_cryptosdk_priv_try_parse_header(
     }
 
     memcpy(session->header_copy, header_start, session->header_size);
+    // The header refers to the input until now; make it refer to our copy, which lives as long as it does
+    aws_cryptosdk_hdr_rebase(&session->header, header_start, session->header_copy);
 
     aws_cryptosdk_priv_session_change_state(session, ST_UNWRAP_KEY);
 
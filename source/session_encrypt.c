@@ -138,6 +138,13 @@ cleanup:
 
 static int build_header(struct aws_cryptosdk_session *session, struct aws_cryptosdk_enc_materials *materials) {
     session->header.alg_id = session->alg_props->alg_id;
+
+    // The CMMs are done with the encryption context, so it can be serialized once for all the
+    // times the header is sized and written below.
+    if (aws_cryptosdk_hdr_freeze_enc_ctx(&session->header)) {
+        return AWS_OP_ERR;
+    }
+
     if (session->frame_size > UINT32_MAX) {
         return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
     }
@@ -153,6 +160,11 @@ static int build_header(struct aws_cryptosdk_session *session, struct aws_crypto
     // zero EDKs (otherwise we'd need to destroy the old EDKs as well).
     assert(aws_array_list_length(&materials->encrypted_data_keys) == 0);
 
+    // If the EDKs were borrowed (e.g. from a cache entry), the header now needs to keep their owner alive.
+    assert(!session->materials_owner);
+    session->materials_owner = materials->owner;
+    materials->owner         = NULL;
+
     if (aws_byte_buf_init(&session->header.iv, session->alloc, session->alg_props->iv_len)) {
         return AWS_OP_ERR;
     }
@@ -0,0 +1,1512 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+/* Required for MAP_ANONYMOUS, MADV_DONTDUMP and robust mutexes when building in strict C99 mode */
+#    define _GNU_SOURCE
+#endif
+
+#include <aws/cryptosdk/cache.h>
+#include <aws/cryptosdk/cipher.h>
+#include <aws/cryptosdk/edk.h>
+#include <aws/cryptosdk/enc_ctx.h>
+#include <aws/cryptosdk/keyring_trace.h>
+#include <aws/cryptosdk/list_utils.h>
+#include <aws/cryptosdk/private/cipher.h>
+#include <aws/cryptosdk/private/enc_ctx.h>
+
+#include <aws/common/atomics.h>
+#include <aws/common/byte_buf.h>
+#include <aws/common/linked_list.h>
+#include <aws/common/math.h>
+#include <aws/common/mutex.h>
+
+#ifdef __linux__
+
+#    include <errno.h>
+#    include <pthread.h>
+#    include <sys/mman.h>
+
+#    define NO_EXPIRY UINT64_MAX
+/* Cache IDs longer than this (which the caching CMM never produces) are not cached */
+#    define SHM_CACHE_ID_MAX AWS_CRYPTOSDK_MD_MAX_SIZE
+/* Number of consecutive slots in which an entry may be stored; this bounds the cost of lookups and inserts */
+#    define SHM_BUCKET_SIZE 8
+
+enum shm_slot_state { SLOT_EMPTY = 0, SLOT_ENCRYPT, SLOT_DECRYPT };
+
+/*
+ * A slot in the shared segment. Everything here is protected by the region lock.
+ */
+struct shm_slot {
+    uint32_t state;
+    uint32_t cache_id_len;
+    /*
+     * Unique (within the region) identifier for the current contents of the slot. Entry handles record this,
+     * so that they can tell if the slot has been reused since they were created.
+     */
+    uint64_t generation;
+    uint8_t cache_id[SHM_CACHE_ID_MAX];
+    uint64_t creation_time, expiry_time, last_used;
+    uint64_t usage_messages, usage_bytes;
+    uint64_t payload_len;
+    /* Serialized materials; see serialize_materials */
+    uint8_t payload[];
+};
+
+/*
+ * The header of the shared segment. The slots follow, each slot_stride bytes long.
+ */
+struct shm_region {
+    pthread_mutex_t lock;
+    /* Protected by lock */
+    uint64_t lru_clock, next_generation;
+    struct aws_cryptosdk_materials_cache_stats stats;
+    /* Immutable after creation */
+    size_t slot_count, slot_size, slot_stride, header_size;
+};
+
+/*
+ * A process-local copy of the payload of one generation of a slot, parsed once so that cache hits don't have to
+ * copy and parse the whole payload again. Hits lend out its EDKs rather than copying them, so it is reference
+ * counted: materials holding borrowed EDKs keep it alive through their owner reference, even past the entry
+ * being evicted or the cache being destroyed.
+ *
+ * The data key is zeroed out of the copy; hits read it from the slot itself, so that data keys are kept only in
+ * the (locked, where possible) shared segment and in the materials handed out.
+ */
+struct shm_payload_view {
+    struct aws_cryptosdk_materials_owner owner;
+    struct aws_atomic_var refcount;
+    struct aws_allocator *alloc;
+    struct aws_byte_buf payload;
+    enum aws_cryptosdk_alg_id alg;
+    /* Position of the data key in the payload, both in the slot and in the copy */
+    size_t data_key_offset, data_key_len;
+    /* The part of the payload following the data key, which deserialize_common parses */
+    struct aws_byte_cursor after_data_key;
+    /* Encrypt entries only: EDKs borrowing their buffers from payload, and the serialized encryption context */
+    struct aws_array_list edks;
+    struct aws_byte_cursor enc_ctx;
+};
+
+/*
+ * What this process has parsed from the payload of a slot, so that cache hits don't re-parse it.
+ */
+struct shm_parsed_slot {
+    /* The slot generation these belong to; they are stale once the slot's generation moves past this */
+    uint64_t generation;
+    struct aws_cryptosdk_sig_ctx *signing_key;
+    struct shm_payload_view *view;
+};
+
+struct aws_cryptosdk_shm_cache {
+    struct aws_cryptosdk_materials_cache base;
+    struct aws_allocator *allocator;
+    struct shm_region *region;
+    size_t map_len;
+
+    /*
+     * Parsed signing keys and payload views, one record per slot. These belong to this process alone, so they
+     * are protected by parsed_lock rather than by the region lock.
+     */
+    struct aws_mutex parsed_lock;
+    struct shm_parsed_slot *parsed;
+
+    /* Links the cache into fork_registry, so that parsed_lock can be held across fork() */
+    struct aws_linked_list_node fork_node;
+
+    /*
+     * Time source - overridable in tests
+     */
+    int (*clock_get_ticks)(uint64_t *timestamp);
+};
+
+/*
+ * The aws_cryptosdk_materials_cache_entry pointers handed out by this cache point to these process-local handles,
+ * which refer to a slot as it was when the handle was created.
+ */
+struct shm_cache_entry {
+    struct aws_cryptosdk_shm_cache *owner;
+    size_t slot;
+    uint64_t generation;
+    uint64_t creation_time;
+    bool is_encrypt;
+};
+
+/********** Shared segment helpers **********/
+
+static inline struct shm_slot *get_slot(struct shm_region *region, size_t idx) {
+    return (struct shm_slot *)((uint8_t *)region + region->header_size + idx * region->slot_stride);
+}
+
+static void locked_clear_slot(struct shm_slot *slot) {
+    aws_secure_zero(slot->payload, slot->payload_len);
+    slot->payload_len = 0;
+    slot->state       = SLOT_EMPTY;
+}
+
+static void locked_clear_all(struct shm_region *region) {
+    for (size_t i = 0; i < region->slot_count; i++) {
+        struct shm_slot *slot = get_slot(region, i);
+
+        if (slot->state != SLOT_EMPTY) {
+            locked_clear_slot(slot);
+            region->stats.evictions_invalidated++;
+        }
+    }
+}
+
+static int lock_region(struct aws_cryptosdk_shm_cache *cache) {
+    int rv = pthread_mutex_lock(&cache->region->lock);
+
+    if (rv == EOWNERDEAD) {
+        /*
+         * Another process died while holding the lock, possibly in the middle of updating a slot.
+         * As this is just a cache, the simplest safe recovery is to discard everything.
+         */
+        locked_clear_all(cache->region);
+        if (pthread_mutex_consistent(&cache->region->lock)) {
+            abort();
+        }
+
+        return AWS_OP_SUCCESS;
+    }
+
+    return rv ? aws_raise_error(AWS_ERROR_SYS_CALL_FAILURE) : AWS_OP_SUCCESS;
+}
+
+static void unlock_region(struct aws_cryptosdk_shm_cache *cache) {
+    if (pthread_mutex_unlock(&cache->region->lock)) {
+        abort();
+    }
+}
+
+static bool slot_matches(const struct shm_slot *slot, const struct aws_byte_buf *cache_id) {
+    return slot->state != SLOT_EMPTY && slot->cache_id_len == cache_id->len &&
+           !memcmp(slot->cache_id, cache_id->buffer, cache_id->len);
+}
+
+static size_t bucket_start(const struct shm_region *region, const struct aws_byte_buf *cache_id) {
+    /* Our cache IDs are already (large) hashes, so we can use any part of them as the hash code */
+    uint64_t hash_code = 0;
+    memcpy(&hash_code, cache_id->buffer, cache_id->len < sizeof(hash_code) ? cache_id->len : sizeof(hash_code));
+
+    return (size_t)(hash_code % region->slot_count);
+}
+
+static size_t bucket_size(const struct shm_region *region) {
+    return region->slot_count < SHM_BUCKET_SIZE ? region->slot_count : SHM_BUCKET_SIZE;
+}
+
+/*
+ * Returns the index of the live slot holding cache_id, or SIZE_MAX if there is none. Expired entries found along
+ * the way are cleared.
+ */
+static size_t locked_find_slot(struct shm_region *region, const struct aws_byte_buf *cache_id, uint64_t now) {
+    size_t start = bucket_start(region, cache_id);
+
+    for (size_t i = 0; i < bucket_size(region); i++) {
+        size_t idx            = (start + i) % region->slot_count;
+        struct shm_slot *slot = get_slot(region, idx);
+
+        if (slot->state != SLOT_EMPTY && slot->expiry_time <= now) {
+            locked_clear_slot(slot);
+            region->stats.evictions_ttl++;
+        } else if (slot_matches(slot, cache_id)) {
+            region->stats.hits++;
+            return idx;
+        }
+    }
+
+    region->stats.misses++;
+    return SIZE_MAX;
+}
+
+/*
+ * Picks the slot to store cache_id in: its existing slot if any, else an empty or expired slot in its bucket,
+ * else the least recently used slot in its bucket.
+ */
+static size_t locked_choose_slot(struct shm_region *region, const struct aws_byte_buf *cache_id, uint64_t now) {
+    size_t start  = bucket_start(region, cache_id);
+    size_t victim = SIZE_MAX;
+
+    for (size_t i = 0; i < bucket_size(region); i++) {
+        size_t idx            = (start + i) % region->slot_count;
+        struct shm_slot *slot = get_slot(region, idx);
+
+        if (slot_matches(slot, cache_id)) {
+            return idx;
+        }
+
+        if (slot->state == SLOT_EMPTY || slot->expiry_time <= now) {
+            if (victim == SIZE_MAX || get_slot(region, victim)->state != SLOT_EMPTY) {
+                victim = idx;
+            }
+        } else if (victim == SIZE_MAX || (get_slot(region, victim)->state != SLOT_EMPTY &&
+                                          get_slot(region, victim)->last_used > slot->last_used)) {
+            victim = idx;
+        }
+    }
+
+    return victim;
+}
+
+/********** Parsed signing keys and payload views **********/
+
+static void release_payload_view(struct aws_cryptosdk_materials_owner *owner) {
+    struct shm_payload_view *view = AWS_CONTAINER_OF(owner, struct shm_payload_view, owner);
+
+    /* acq_rel, so that whichever thread frees the view sees every other holder's reads of it as done */
+    if (aws_atomic_fetch_sub_explicit(&view->refcount, 1, aws_memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    /* The EDKs only borrow from payload, so cleaning up the list frees nothing else */
+    aws_array_list_clean_up(&view->edks);
+    aws_byte_buf_clean_up_secure(&view->payload);
+    aws_mem_release(view->alloc, view);
+}
+
+static void payload_view_release(struct shm_payload_view *view) {
+    if (view) {
+        release_payload_view(&view->owner);
+    }
+}
+
+/*
+ * Takes ownership of signing_key and of a reference to view (either of which may be NULL), and records them as
+ * parsed from the given generation of slot idx. They are dropped instead if the record already belongs to a
+ * newer generation, or already holds the same kind of object for this one. Generations only increase, so this
+ * keeps the newest.
+ */
+static void cache_parsed(
+    struct aws_cryptosdk_shm_cache *cache,
+    size_t idx,
+    uint64_t generation,
+    struct aws_cryptosdk_sig_ctx *signing_key,
+    struct shm_payload_view *view) {
+    struct aws_cryptosdk_sig_ctx *stale_key = signing_key;
+    struct shm_payload_view *stale_view     = view;
+
+    if (!aws_mutex_lock(&cache->parsed_lock)) {
+        struct shm_parsed_slot *parsed = &cache->parsed[idx];
+
+        if (parsed->generation < generation) {
+            /* Swap in the new objects (NULL where we have none), handing back the old generation's */
+            stale_key           = parsed->signing_key;
+            stale_view          = parsed->view;
+            parsed->generation  = generation;
+            parsed->signing_key = signing_key;
+            parsed->view        = view;
+        } else if (parsed->generation == generation) {
+            if (!parsed->signing_key) {
+                parsed->signing_key = signing_key;
+                stale_key           = NULL;
+            }
+            if (!parsed->view) {
+                parsed->view = view;
+                stale_view   = NULL;
+            }
+        }
+
+        if (aws_mutex_unlock(&cache->parsed_lock)) {
+            abort();
+        }
+    }
+
+    aws_cryptosdk_sig_abort(stale_key);
+    payload_view_release(stale_view);
+}
+
+/*
+ * If a parsed signing key is recorded for the given generation of slot idx, starts a new context sharing it
+ * in *signctx. Otherwise leaves *signctx unchanged.
+ */
+static int clone_parsed_key(
+    struct aws_cryptosdk_shm_cache *cache,
+    size_t idx,
+    uint64_t generation,
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_sig_ctx **signctx) {
+    int rv = AWS_OP_SUCCESS;
+
+    if (aws_mutex_lock(&cache->parsed_lock)) {
+        return AWS_OP_ERR;
+    }
+
+    const struct shm_parsed_slot *parsed = &cache->parsed[idx];
+    if (parsed->signing_key && parsed->generation == generation) {
+        rv = aws_cryptosdk_sig_start_from_ctx(signctx, alloc, parsed->signing_key);
+    }
+
+    if (aws_mutex_unlock(&cache->parsed_lock)) {
+        abort();
+    }
+
+    return rv;
+}
+
+/*
+ * If a payload view is recorded for the given generation of slot idx, sets *view to a new reference to it.
+ * Otherwise sets *view to NULL.
+ */
+static int retain_parsed_view(
+    struct aws_cryptosdk_shm_cache *cache, size_t idx, uint64_t generation, struct shm_payload_view **view) {
+    *view = NULL;
+
+    if (aws_mutex_lock(&cache->parsed_lock)) {
+        return AWS_OP_ERR;
+    }
+
+    const struct shm_parsed_slot *parsed = &cache->parsed[idx];
+    if (parsed->view && parsed->generation == generation) {
+        *view = parsed->view;
+        aws_atomic_fetch_add_explicit(&parsed->view->refcount, 1, aws_memory_order_relaxed);
+    }
+
+    if (aws_mutex_unlock(&cache->parsed_lock)) {
+        abort();
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/********** Materials serialization **********/
+
+/*
+ * The payload of a slot consists of the following fields, where each variable-length field is preceded by its
+ * length as a big-endian uint16:
+ *
+ *   alg (uint16), unencrypted data key, serialized private (encrypt) or public (decrypt) key (possibly empty),
+ *   keyring trace record count (uint16), then for each record its namespace, name and flags (uint32),
+ *   and for encrypt entries only:
+ *   EDK count (uint16), then for each EDK its provider ID, provider info and ciphertext,
+ *   serialized encryption context.
+ *
+ * As the payload never leaves the machine, this format is private to this file and may change at any time.
+ */
+
+static int write_field(struct aws_byte_buf *buf, const uint8_t *data, size_t len) {
+    if (len > UINT16_MAX || !aws_byte_buf_write_be16(buf, (uint16_t)len) || !aws_byte_buf_write(buf, data, len)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static int write_buf_field(struct aws_byte_buf *buf, const struct aws_byte_buf *field) {
+    return write_field(buf, field->buffer, field->len);
+}
+
+static int write_string_field(struct aws_byte_buf *buf, const struct aws_string *field) {
+    return field ? write_field(buf, aws_string_bytes(field), field->len) : write_field(buf, NULL, 0);
+}
+
+static int write_count(struct aws_byte_buf *buf, size_t count) {
+    if (count > UINT16_MAX || !aws_byte_buf_write_be16(buf, (uint16_t)count)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static int read_field(struct aws_byte_cursor *cursor, struct aws_byte_cursor *field) {
+    uint16_t len;
+
+    if (!aws_byte_cursor_read_be16(cursor, &len)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    *field = aws_byte_cursor_advance(cursor, len);
+    if (field->len != len) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static int serialize_materials(
+    struct aws_allocator *alloc,
+    struct aws_byte_buf *out,
+    enum aws_cryptosdk_alg_id alg,
+    const struct aws_byte_buf *data_key,
+    const struct aws_cryptosdk_sig_ctx *signctx,
+    const struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx) {
+    struct aws_string *sig_key = NULL;
+    int rv                     = AWS_OP_ERR;
+
+    if (signctx && (edks ? aws_cryptosdk_sig_get_privkey(signctx, alloc, &sig_key)
+                         : aws_cryptosdk_sig_get_pubkey(signctx, alloc, &sig_key))) {
+        return AWS_OP_ERR;
+    }
+
+    if (!aws_byte_buf_write_be16(out, (uint16_t)alg)) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+        goto out;
+    }
+
+    if (write_buf_field(out, data_key) || write_string_field(out, sig_key)) {
+        goto out;
+    }
+
+    size_t n_records = aws_array_list_length(keyring_trace);
+    if (write_count(out, n_records)) {
+        goto out;
+    }
+
+    for (size_t i = 0; i < n_records; i++) {
+        struct aws_cryptosdk_keyring_trace_record *record;
+
+        if (aws_array_list_get_at_ptr(keyring_trace, (void **)&record, i) ||
+            write_string_field(out, record->wrapping_key_namespace) ||
+            write_string_field(out, record->wrapping_key_name)) {
+            goto out;
+        }
+
+        if (!aws_byte_buf_write_be32(out, record->flags)) {
+            aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+            goto out;
+        }
+    }
+
+    if (edks) {
+        size_t n_edks = aws_array_list_length(edks);
+        if (write_count(out, n_edks)) {
+            goto out;
+        }
+
+        for (size_t i = 0; i < n_edks; i++) {
+            struct aws_cryptosdk_edk *edk;
+
+            if (aws_array_list_get_at_ptr(edks, (void **)&edk, i) || write_buf_field(out, &edk->provider_id) ||
+                write_buf_field(out, &edk->provider_info) || write_buf_field(out, &edk->ciphertext)) {
+                goto out;
+            }
+        }
+
+        size_t enc_ctx_len;
+        if (aws_cryptosdk_enc_ctx_size(&enc_ctx_len, enc_ctx) || write_count(out, enc_ctx_len) ||
+            aws_cryptosdk_enc_ctx_serialize(alloc, out, enc_ctx)) {
+            goto out;
+        }
+    }
+
+    rv = AWS_OP_SUCCESS;
+out:
+    aws_string_destroy_secure(sig_key);
+
+    return rv;
+}
+
+/* Reads a keyring trace record, leaving the namespace and name pointing into the payload */
+static int read_trace_record(
+    struct aws_byte_cursor *cursor,
+    struct aws_byte_cursor *wrapping_key_namespace,
+    struct aws_byte_cursor *wrapping_key_name,
+    uint32_t *flags) {
+    if (read_field(cursor, wrapping_key_namespace) || read_field(cursor, wrapping_key_name)) {
+        return AWS_OP_ERR;
+    }
+
+    if (!aws_byte_cursor_read_be32(cursor, flags)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/*
+ * Parses the fields common to encrypt and decrypt payloads from a payload view, starting just after the data key.
+ * The signing key is only parsed if this process has not already parsed it for the same slot generation. The
+ * caller is responsible for cleaning up the trace on failure.
+ */
+static int deserialize_common(
+    struct aws_allocator *alloc,
+    const struct shm_cache_entry *entry,
+    struct aws_byte_cursor *cursor,
+    struct aws_cryptosdk_sig_ctx **signctx,
+    struct aws_array_list *keyring_trace,
+    enum aws_cryptosdk_alg_id alg) {
+    struct aws_cryptosdk_shm_cache *cache = entry->owner;
+    struct aws_byte_cursor field;
+    uint16_t n_records;
+
+    if (read_field(cursor, &field)) {
+        return AWS_OP_ERR;
+    }
+
+    if (field.len) {
+        if (clone_parsed_key(cache, entry->slot, entry->generation, alloc, signctx)) {
+            return AWS_OP_ERR;
+        }
+    }
+
+    if (field.len && !*signctx) {
+        const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(alg);
+        struct aws_string *sig_key                       = aws_string_new_from_array(alloc, field.ptr, field.len);
+        struct aws_cryptosdk_sig_ctx *parsed_key         = NULL;
+        int rv;
+
+        if (!sig_key) {
+            return AWS_OP_ERR;
+        }
+
+        rv = entry->is_encrypt ? aws_cryptosdk_sig_sign_start(signctx, alloc, NULL, props, sig_key)
+                               : aws_cryptosdk_sig_verify_start(signctx, alloc, sig_key, props);
+        aws_string_destroy_secure(sig_key);
+
+        if (rv) {
+            return AWS_OP_ERR;
+        }
+
+        /* Keep a copy for later hits on this entry; if we can't, we'll just parse it again next time */
+        if (aws_cryptosdk_sig_start_from_ctx(&parsed_key, cache->allocator, *signctx)) {
+            aws_reset_error();
+        } else {
+            cache_parsed(cache, entry->slot, entry->generation, parsed_key, NULL);
+        }
+    }
+
+    if (!aws_byte_cursor_read_be16(cursor, &n_records)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    for (uint16_t i = 0; i < n_records; i++) {
+        struct aws_byte_cursor namespace_field, name_field;
+        uint32_t flags;
+
+        if (read_trace_record(cursor, &namespace_field, &name_field, &flags)) {
+            return AWS_OP_ERR;
+        }
+
+        struct aws_byte_buf wrapping_key_namespace = aws_byte_buf_from_array(namespace_field.ptr, namespace_field.len);
+        struct aws_byte_buf wrapping_key_name      = aws_byte_buf_from_array(name_field.ptr, name_field.len);
+
+        if (aws_cryptosdk_keyring_trace_add_record_buf(
+                alloc, keyring_trace, &wrapping_key_namespace, &wrapping_key_name, flags)) {
+            return AWS_OP_ERR;
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Parses the EDKs of an encrypt payload into edks, which is initialized here; the EDKs borrow from the payload */
+static int borrow_edks(struct aws_allocator *alloc, struct aws_byte_cursor *cursor, struct aws_array_list *edks) {
+    uint16_t n_edks;
+
+    if (!aws_byte_cursor_read_be16(cursor, &n_edks)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    if (aws_array_list_init_dynamic(edks, alloc, n_edks, sizeof(struct aws_cryptosdk_edk))) {
+        return AWS_OP_ERR;
+    }
+
+    for (uint16_t i = 0; i < n_edks; i++) {
+        struct aws_cryptosdk_edk edk;
+        struct aws_byte_cursor provider_id, provider_info, ciphertext;
+
+        if (read_field(cursor, &provider_id) || read_field(cursor, &provider_info) ||
+            read_field(cursor, &ciphertext)) {
+            return AWS_OP_ERR;
+        }
+
+        edk.provider_id   = aws_byte_buf_from_array(provider_id.ptr, provider_id.len);
+        edk.provider_info = aws_byte_buf_from_array(provider_info.ptr, provider_info.len);
+        edk.ciphertext    = aws_byte_buf_from_array(ciphertext.ptr, ciphertext.len);
+
+        if (aws_array_list_push_back(edks, &edk)) {
+            return AWS_OP_ERR;
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/*
+ * Builds a view over payload, taking ownership of it (even on failure), and zeroes the data key out of it.
+ * Everything but the signing key and trace, which deserialize_common parses on each hit, is parsed up front.
+ */
+static struct shm_payload_view *payload_view_new(
+    struct aws_allocator *alloc, struct aws_byte_buf *payload, enum shm_slot_state state) {
+    struct shm_payload_view *view = aws_mem_acquire(alloc, sizeof(*view));
+    struct aws_byte_cursor cursor, field;
+    uint16_t alg, n_records;
+
+    if (!view) {
+        aws_byte_buf_clean_up_secure(payload);
+        return NULL;
+    }
+
+    memset(view, 0, sizeof(*view));
+    view->owner.release = release_payload_view;
+    aws_atomic_init_int(&view->refcount, 1);
+    view->alloc   = alloc;
+    view->payload = *payload;
+    memset(payload, 0, sizeof(*payload));
+
+    cursor = aws_byte_cursor_from_buf(&view->payload);
+    if (!aws_byte_cursor_read_be16(&cursor, &alg)) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+        goto err;
+    }
+    view->alg = alg;
+
+    if (read_field(&cursor, &field)) {
+        goto err;
+    }
+    view->data_key_offset = (size_t)(field.ptr - view->payload.buffer);
+    view->data_key_len    = field.len;
+    aws_secure_zero(field.ptr, field.len);
+    view->after_data_key = cursor;
+
+    if (state == SLOT_ENCRYPT) {
+        /* Skip over the signing key and trace to get to the EDKs */
+        if (read_field(&cursor, &field)) {
+            goto err;
+        }
+
+        if (!aws_byte_cursor_read_be16(&cursor, &n_records)) {
+            aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+            goto err;
+        }
+
+        for (uint16_t i = 0; i < n_records; i++) {
+            struct aws_byte_cursor namespace_field, name_field;
+            uint32_t flags;
+
+            if (read_trace_record(&cursor, &namespace_field, &name_field, &flags)) {
+                goto err;
+            }
+        }
+
+        if (borrow_edks(alloc, &cursor, &view->edks) || read_field(&cursor, &view->enc_ctx)) {
+            goto err;
+        }
+    }
+
+    return view;
+
+err:
+    payload_view_release(view);
+    return NULL;
+}
+
+/********** Entry handles **********/
+
+static struct shm_cache_entry *new_handle(
+    struct aws_cryptosdk_shm_cache *cache, size_t idx, const struct shm_slot *slot) {
+    struct shm_cache_entry *entry = aws_mem_acquire(cache->allocator, sizeof(*entry));
+
+    if (entry) {
+        entry->owner         = cache;
+        entry->slot          = idx;
+        entry->generation    = slot->generation;
+        entry->creation_time = slot->creation_time;
+        entry->is_encrypt    = slot->state == SLOT_ENCRYPT;
+    }
+
+    return entry;
+}
+
+/* Returns the slot referenced by entry, or NULL if it has since been invalidated or reused */
+static struct shm_slot *locked_entry_slot(struct shm_cache_entry *entry) {
+    struct shm_slot *slot = get_slot(entry->owner->region, entry->slot);
+
+    if (slot->state == SLOT_EMPTY || slot->generation != entry->generation) {
+        return NULL;
+    }
+
+    return slot;
+}
+
+/*
+ * Copies the payload of the entry's slot into payload, which is allocated (with room for any payload) before
+ * the lock is taken. The caller must clean up payload with aws_byte_buf_clean_up_secure, even on failure.
+ */
+static int copy_payload(
+    struct aws_cryptosdk_shm_cache *cache,
+    struct shm_cache_entry *entry,
+    struct aws_allocator *alloc,
+    struct aws_byte_buf *payload,
+    enum shm_slot_state expected_state) {
+    if (aws_byte_buf_init(payload, alloc, cache->region->slot_size)) {
+        return AWS_OP_ERR;
+    }
+
+    if (lock_region(cache)) {
+        return AWS_OP_ERR;
+    }
+
+    struct shm_slot *slot = locked_entry_slot(entry);
+    bool ok               = slot && slot->state == expected_state && slot->payload_len <= payload->capacity;
+
+    if (ok) {
+        memcpy(payload->buffer, slot->payload, slot->payload_len);
+        payload->len = slot->payload_len;
+    }
+
+    unlock_region(cache);
+
+    return ok ? AWS_OP_SUCCESS : aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+}
+
+/*
+ * Sets *view to a reference to the payload view of the entry's slot, building (and recording) it if this is the
+ * first hit in this process on this generation of the slot.
+ */
+static int acquire_payload_view(
+    struct aws_cryptosdk_shm_cache *cache,
+    struct shm_cache_entry *entry,
+    enum shm_slot_state expected_state,
+    struct shm_payload_view **view) {
+    struct aws_byte_buf payload = { 0 };
+
+    if (retain_parsed_view(cache, entry->slot, entry->generation, view)) {
+        return AWS_OP_ERR;
+    }
+
+    if (*view) {
+        return AWS_OP_SUCCESS;
+    }
+
+    if (copy_payload(cache, entry, cache->allocator, &payload, expected_state)) {
+        aws_byte_buf_clean_up_secure(&payload);
+        return AWS_OP_ERR;
+    }
+
+    if (!(*view = payload_view_new(cache->allocator, &payload, expected_state))) {
+        return AWS_OP_ERR;
+    }
+
+    /* One reference for the caller, and one for the parsed record */
+    aws_atomic_fetch_add_explicit(&(*view)->refcount, 1, aws_memory_order_relaxed);
+    cache_parsed(cache, entry->slot, entry->generation, NULL, *view);
+
+    return AWS_OP_SUCCESS;
+}
+
+/*
+ * Copies the data key of the entry's slot, at the position recorded in view, into data_key. This also checks
+ * that the slot still holds the entry, so a hit fails once the entry has been invalidated.
+ */
+static int copy_data_key(
+    struct aws_cryptosdk_shm_cache *cache,
+    struct shm_cache_entry *entry,
+    const struct shm_payload_view *view,
+    enum shm_slot_state expected_state,
+    struct aws_allocator *alloc,
+    struct aws_byte_buf *data_key) {
+    if (aws_byte_buf_init(data_key, alloc, view->data_key_len)) {
+        return AWS_OP_ERR;
+    }
+
+    if (lock_region(cache)) {
+        return AWS_OP_ERR;
+    }
+
+    struct shm_slot *slot = locked_entry_slot(entry);
+    bool ok               = slot && slot->state == expected_state &&
+                            view->data_key_offset + view->data_key_len <= slot->payload_len;
+
+    if (ok) {
+        memcpy(data_key->buffer, slot->payload + view->data_key_offset, view->data_key_len);
+        data_key->len = view->data_key_len;
+    }
+
+    unlock_region(cache);
+
+    return ok ? AWS_OP_SUCCESS : aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+}
+
+/********** Fork safety **********/
+
+/*
+ * parsed_lock is an ordinary process-private mutex, so a child forked while another thread of the parent held it
+ * would inherit it locked, with no thread left to unlock it, and hang on its first cache hit. Every live cache is
+ * registered here, and fork handlers hold all of their parsed_locks across fork(), so that both the parent and
+ * the child come out of it with them unlocked. (The region lock needs none of this: it is robust and shared, so
+ * the thread holding it carries on in the parent and releases it for the child too.)
+ */
+static struct aws_linked_list fork_registry;
+static pthread_mutex_t fork_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t fork_handlers_once  = PTHREAD_ONCE_INIT;
+static int fork_handlers_rv;
+
+static void fork_prepare(void) {
+    if (pthread_mutex_lock(&fork_registry_lock)) {
+        abort();
+    }
+
+    for (struct aws_linked_list_node *node = aws_linked_list_begin(&fork_registry);
+         node != aws_linked_list_end(&fork_registry);
+         node = aws_linked_list_next(node)) {
+        struct aws_cryptosdk_shm_cache *cache = AWS_CONTAINER_OF(node, struct aws_cryptosdk_shm_cache, fork_node);
+
+        if (aws_mutex_lock(&cache->parsed_lock)) {
+            abort();
+        }
+    }
+}
+
+/* Runs in both the parent and the child; in the child, the forking thread is the one which took the locks */
+static void fork_release(void) {
+    for (struct aws_linked_list_node *node = aws_linked_list_begin(&fork_registry);
+         node != aws_linked_list_end(&fork_registry);
+         node = aws_linked_list_next(node)) {
+        struct aws_cryptosdk_shm_cache *cache = AWS_CONTAINER_OF(node, struct aws_cryptosdk_shm_cache, fork_node);
+
+        if (aws_mutex_unlock(&cache->parsed_lock)) {
+            abort();
+        }
+    }
+
+    if (pthread_mutex_unlock(&fork_registry_lock)) {
+        abort();
+    }
+}
+
+static void install_fork_handlers(void) {
+    aws_linked_list_init(&fork_registry);
+    fork_handlers_rv = pthread_atfork(fork_prepare, fork_release, fork_release);
+}
+
+static int fork_registry_add(struct aws_cryptosdk_shm_cache *cache) {
+    if (pthread_once(&fork_handlers_once, install_fork_handlers) || fork_handlers_rv) {
+        return aws_raise_error(AWS_ERROR_SYS_CALL_FAILURE);
+    }
+
+    if (pthread_mutex_lock(&fork_registry_lock)) {
+        return aws_raise_error(AWS_ERROR_SYS_CALL_FAILURE);
+    }
+
+    aws_linked_list_push_back(&fork_registry, &cache->fork_node);
+
+    if (pthread_mutex_unlock(&fork_registry_lock)) {
+        abort();
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static void fork_registry_remove(struct aws_cryptosdk_shm_cache *cache) {
+    if (pthread_mutex_lock(&fork_registry_lock)) {
+        abort();
+    }
+
+    aws_linked_list_remove(&cache->fork_node);
+
+    if (pthread_mutex_unlock(&fork_registry_lock)) {
+        abort();
+    }
+}
+
+/********** Shared memory cache vtable methods **********/
+
+static void destroy_cache(struct aws_cryptosdk_materials_cache *generic_cache) {
+    struct aws_cryptosdk_shm_cache *cache = (struct aws_cryptosdk_shm_cache *)generic_cache;
+
+    /*
+     * Other processes may still be using the segment (and its mutex), so we only drop our own mapping.
+     * The segment is freed by the kernel once the last process unmaps it or exits.
+     */
+    for (size_t i = 0; i < cache->region->slot_count; i++) {
+        aws_cryptosdk_sig_abort(cache->parsed[i].signing_key);
+        /* Materials may still be borrowing from the view, in which case they free it */
+        payload_view_release(cache->parsed[i].view);
+    }
+
+    fork_registry_remove(cache);
+    munmap(cache->region, cache->map_len);
+    aws_mem_release(cache->allocator, cache->parsed);
+    aws_mutex_clean_up(&cache->parsed_lock);
+    aws_mem_release(cache->allocator, cache);
+}
+
+static size_t entry_count(const struct aws_cryptosdk_materials_cache *generic_cache) {
+    // Removing const so we can lock the region
+    struct aws_cryptosdk_shm_cache *cache = (struct aws_cryptosdk_shm_cache *)generic_cache;
+    size_t count                          = 0;
+
+    if (lock_region(cache)) {
+        return SIZE_MAX;
+    }
+
+    for (size_t i = 0; i < cache->region->slot_count; i++) {
+        if (get_slot(cache->region, i)->state != SLOT_EMPTY) {
+            count++;
+        }
+    }
+
+    unlock_region(cache);
+
+    return count;
+}
+
+static int find_entry(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry **ret_entry,
+    bool *is_encrypt,
+    const struct aws_byte_buf *cache_id) {
+    struct aws_cryptosdk_shm_cache *cache = (struct aws_cryptosdk_shm_cache *)generic_cache;
+    struct shm_cache_entry *entry         = NULL;
+    uint64_t now;
+
+    *ret_entry = NULL;
+
+    if (cache_id->len > SHM_CACHE_ID_MAX) {
+        return AWS_OP_SUCCESS;
+    }
+
+    if (cache->clock_get_ticks(&now) || lock_region(cache)) {
+        return AWS_OP_ERR;
+    }
+
+    size_t idx = locked_find_slot(cache->region, cache_id, now);
+    if (idx != SIZE_MAX) {
+        struct shm_slot *slot = get_slot(cache->region, idx);
+
+        slot->last_used = ++cache->region->lru_clock;
+        entry           = new_handle(cache, idx, slot);
+    }
+
+    unlock_region(cache);
+
+    if (idx != SIZE_MAX && !entry) {
+        return AWS_OP_ERR;
+    }
+
+    if (entry) {
+        *ret_entry = (struct aws_cryptosdk_materials_cache_entry *)entry;
+        if (is_encrypt) {
+            *is_encrypt = entry->is_encrypt;
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static int update_usage_stats(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry *generic_entry,
+    struct aws_cryptosdk_cache_usage_stats *usage_stats) {
+    struct aws_cryptosdk_shm_cache *cache = (struct aws_cryptosdk_shm_cache *)generic_cache;
+    struct shm_cache_entry *entry         = (struct shm_cache_entry *)generic_entry;
+
+    if (lock_region(cache)) {
+        return AWS_OP_ERR;
+    }
+
+    struct shm_slot *slot = locked_entry_slot(entry);
+    if (slot && slot->state == SLOT_ENCRYPT) {
+        slot->usage_bytes    = aws_add_u64_saturating(slot->usage_bytes, usage_stats->bytes_encrypted);
+        slot->usage_messages = aws_add_u64_saturating(slot->usage_messages, usage_stats->messages_encrypted);
+
+        usage_stats->bytes_encrypted    = slot->usage_bytes;
+        usage_stats->messages_encrypted = slot->usage_messages;
+    }
+
+    unlock_region(cache);
+
+    return (slot && slot->state == SLOT_ENCRYPT) ? AWS_OP_SUCCESS : aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+}
+
+static int get_enc_materials(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_allocator *allocator,
+    struct aws_cryptosdk_enc_materials **materials_out,
+    struct aws_hash_table *enc_ctx,
+    struct aws_cryptosdk_materials_cache_entry *generic_entry) {
+    struct aws_cryptosdk_shm_cache *cache         = (struct aws_cryptosdk_shm_cache *)generic_cache;
+    struct shm_cache_entry *entry                 = (struct shm_cache_entry *)generic_entry;
+    struct aws_cryptosdk_enc_materials *materials = NULL;
+    struct shm_payload_view *view                 = NULL;
+    struct aws_byte_cursor cursor, enc_ctx_field;
+
+    *materials_out = NULL;
+
+    if (acquire_payload_view(cache, entry, SLOT_ENCRYPT, &view)) {
+        goto out;
+    }
+
+    if (!(materials = aws_cryptosdk_enc_materials_new(allocator, view->alg))) {
+        goto out;
+    }
+
+    cursor        = view->after_data_key;
+    enc_ctx_field = view->enc_ctx;
+
+    if (copy_data_key(cache, entry, view, SLOT_ENCRYPT, allocator, &materials->unencrypted_data_key) ||
+        aws_cryptosdk_edk_list_borrow_all(&materials->encrypted_data_keys, &view->edks)) {
+        goto out;
+    }
+
+    /* The materials lend out the view's EDKs, so they take over our reference to it */
+    materials->owner = &view->owner;
+    view             = NULL;
+
+    if (deserialize_common(
+            allocator, entry, &cursor, &materials->signctx, &materials->keyring_trace, materials->alg) ||
+        aws_cryptosdk_enc_ctx_deserialize(allocator, enc_ctx, &enc_ctx_field)) {
+        goto out;
+    }
+
+    *materials_out = materials;
+    materials      = NULL;
+
+out:
+    aws_cryptosdk_enc_materials_destroy(materials);
+    payload_view_release(view);
+
+    return *materials_out ? AWS_OP_SUCCESS : AWS_OP_ERR;
+}
+
+static int get_dec_materials(
+    const struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_allocator *allocator,
+    struct aws_cryptosdk_dec_materials **materials_out,
+    const struct aws_cryptosdk_materials_cache_entry *generic_entry) {
+    struct aws_cryptosdk_shm_cache *cache         = (struct aws_cryptosdk_shm_cache *)generic_cache;
+    struct shm_cache_entry *entry                 = (struct shm_cache_entry *)generic_entry;
+    struct aws_cryptosdk_dec_materials *materials = NULL;
+    struct shm_payload_view *view                 = NULL;
+    struct aws_byte_cursor cursor;
+
+    *materials_out = NULL;
+
+    if (acquire_payload_view(cache, entry, SLOT_DECRYPT, &view)) {
+        goto out;
+    }
+
+    if (!(materials = aws_cryptosdk_dec_materials_new(allocator, view->alg))) {
+        goto out;
+    }
+
+    cursor = view->after_data_key;
+
+    if (copy_data_key(cache, entry, view, SLOT_DECRYPT, allocator, &materials->unencrypted_data_key) ||
+        deserialize_common(
+            allocator, entry, &cursor, &materials->signctx, &materials->keyring_trace, materials->alg)) {
+        goto out;
+    }
+
+    *materials_out = materials;
+    materials      = NULL;
+
+out:
+    aws_cryptosdk_dec_materials_destroy(materials);
+    payload_view_release(view);
+
+    return *materials_out ? AWS_OP_SUCCESS : AWS_OP_ERR;
+}
+
+/*
+ * Stores the serialized payload under cache_id, replacing any existing entry for that ID.
+ */
+static void put_entry(
+    struct aws_cryptosdk_shm_cache *cache,
+    struct aws_cryptosdk_materials_cache_entry **ret_entry,
+    enum shm_slot_state state,
+    const struct aws_byte_buf *payload,
+    const struct aws_cryptosdk_sig_ctx *signctx,
+    struct aws_cryptosdk_cache_usage_stats initial_usage,
+    const struct aws_byte_buf *cache_id) {
+    struct shm_cache_entry *entry             = NULL;
+    struct aws_cryptosdk_sig_ctx *signing_key = NULL;
+    struct shm_payload_view *view             = NULL;
+    struct aws_byte_buf view_payload;
+    uint64_t now, generation;
+
+    *ret_entry = NULL;
+
+    if (cache_id->len > SHM_CACHE_ID_MAX || payload->len > cache->region->slot_size) {
+        return;
+    }
+
+    /* Hits in this process can then share the caller's parsed key instead of parsing the serialized one */
+    if (signctx && aws_cryptosdk_sig_start_from_ctx(&signing_key, cache->allocator, signctx)) {
+        aws_reset_error();
+    }
+
+    /* ...and don't need to copy the payload back out of the slot to build its view */
+    if (aws_byte_buf_init_copy(&view_payload, cache->allocator, payload) ||
+        !(view = payload_view_new(cache->allocator, &view_payload, state))) {
+        aws_reset_error();
+    }
+
+    if (cache->clock_get_ticks(&now) || lock_region(cache)) {
+        aws_cryptosdk_sig_abort(signing_key);
+        payload_view_release(view);
+        return;
+    }
+
+    struct shm_region *region = cache->region;
+    size_t idx                = locked_choose_slot(region, cache_id, now);
+    struct shm_slot *slot     = get_slot(region, idx);
+
+    if (slot->state != SLOT_EMPTY) {
+        if (slot_matches(slot, cache_id)) {
+            region->stats.evictions_invalidated++;
+        } else if (slot->expiry_time <= now) {
+            region->stats.evictions_ttl++;
+        } else {
+            region->stats.evictions_capacity++;
+        }
+    }
+
+    if (slot->payload_len > payload->len) {
+        aws_secure_zero(slot->payload + payload->len, slot->payload_len - payload->len);
+    }
+
+    slot->state        = state;
+    slot->generation   = ++region->next_generation;
+    slot->cache_id_len = (uint32_t)cache_id->len;
+    memcpy(slot->cache_id, cache_id->buffer, cache_id->len);
+    slot->creation_time  = now;
+    slot->expiry_time    = NO_EXPIRY;
+    slot->last_used      = ++region->lru_clock;
+    slot->usage_bytes    = initial_usage.bytes_encrypted;
+    slot->usage_messages = initial_usage.messages_encrypted;
+    slot->payload_len    = payload->len;
+    memcpy(slot->payload, payload->buffer, payload->len);
+
+    generation = slot->generation;
+    entry      = new_handle(cache, idx, slot);
+
+    unlock_region(cache);
+
+    cache_parsed(cache, idx, generation, signing_key, view);
+
+    *ret_entry = (struct aws_cryptosdk_materials_cache_entry *)entry;
+}
+
+static void put_entry_for_encrypt(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry **ret_entry,
+    const struct aws_cryptosdk_enc_materials *materials,
+    struct aws_cryptosdk_cache_usage_stats initial_usage,
+    const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_buf *cache_id) {
+    struct aws_cryptosdk_shm_cache *cache = (struct aws_cryptosdk_shm_cache *)generic_cache;
+    struct aws_byte_buf payload;
+
+    *ret_entry = NULL;
+
+    if (aws_byte_buf_init(&payload, cache->allocator, cache->region->slot_size)) {
+        return;
+    }
+
+    if (!serialize_materials(
+            cache->allocator,
+            &payload,
+            materials->alg,
+            &materials->unencrypted_data_key,
+            materials->signctx,
+            &materials->keyring_trace,
+            &materials->encrypted_data_keys,
+            enc_ctx)) {
+        put_entry(cache, ret_entry, SLOT_ENCRYPT, &payload, materials->signctx, initial_usage, cache_id);
+    }
+
+    aws_byte_buf_clean_up_secure(&payload);
+}
+
+static void put_entry_for_decrypt(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry **ret_entry,
+    const struct aws_cryptosdk_dec_materials *materials,
+    const struct aws_byte_buf *cache_id) {
+    struct aws_cryptosdk_shm_cache *cache            = (struct aws_cryptosdk_shm_cache *)generic_cache;
+    struct aws_cryptosdk_cache_usage_stats no_usage = { 0, 0 };
+    struct aws_byte_buf payload;
+
+    *ret_entry = NULL;
+
+    if (aws_byte_buf_init(&payload, cache->allocator, cache->region->slot_size)) {
+        return;
+    }
+
+    if (!serialize_materials(
+            cache->allocator,
+            &payload,
+            materials->alg,
+            &materials->unencrypted_data_key,
+            materials->signctx,
+            &materials->keyring_trace,
+            NULL,
+            NULL)) {
+        put_entry(cache, ret_entry, SLOT_DECRYPT, &payload, materials->signctx, no_usage, cache_id);
+    }
+
+    aws_byte_buf_clean_up_secure(&payload);
+}
+
+static uint64_t get_creation_time(
+    const struct aws_cryptosdk_materials_cache *cache,
+    const struct aws_cryptosdk_materials_cache_entry *generic_entry) {
+    const struct shm_cache_entry *entry = (const struct shm_cache_entry *)generic_entry;
+
+    assert(&entry->owner->base == cache);
+    (void)cache;
+
+    return entry->creation_time;
+}
+
+static void set_expiration_hint(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry *generic_entry,
+    uint64_t expiry_time) {
+    struct aws_cryptosdk_shm_cache *cache = (struct aws_cryptosdk_shm_cache *)generic_cache;
+    struct shm_cache_entry *entry         = (struct shm_cache_entry *)generic_entry;
+
+    if (lock_region(cache)) {
+        return;
+    }
+
+    struct shm_slot *slot = locked_entry_slot(entry);
+    if (slot && slot->expiry_time > expiry_time) {
+        slot->expiry_time = expiry_time;
+    }
+
+    unlock_region(cache);
+}
+
+static void release_entry(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry *generic_entry,
+    bool invalidate) {
+    struct aws_cryptosdk_shm_cache *cache = (struct aws_cryptosdk_shm_cache *)generic_cache;
+    struct shm_cache_entry *entry         = (struct shm_cache_entry *)generic_entry;
+
+    if (!entry) {
+        return;
+    }
+
+    assert(entry->owner == cache);
+
+    if (invalidate && !lock_region(cache)) {
+        struct shm_slot *slot = locked_entry_slot(entry);
+
+        if (slot) {
+            locked_clear_slot(slot);
+            cache->region->stats.evictions_invalidated++;
+        }
+
+        unlock_region(cache);
+    }
+
+    aws_mem_release(cache->allocator, entry);
+}
+
+static void clear_cache(struct aws_cryptosdk_materials_cache *generic_cache) {
+    struct aws_cryptosdk_shm_cache *cache = (struct aws_cryptosdk_shm_cache *)generic_cache;
+
+    if (lock_region(cache)) {
+        return;
+    }
+
+    locked_clear_all(cache->region);
+
+    unlock_region(cache);
+}
+
+static int get_stats(
+    const struct aws_cryptosdk_materials_cache *generic_cache, struct aws_cryptosdk_materials_cache_stats *stats) {
+    // Removing const so we can lock the region
+    struct aws_cryptosdk_shm_cache *cache = (struct aws_cryptosdk_shm_cache *)generic_cache;
+
+    if (lock_region(cache)) {
+        return AWS_OP_ERR;
+    }
+
+    *stats = cache->region->stats;
+
+    unlock_region(cache);
+
+    return AWS_OP_SUCCESS;
+}
+
+static const struct aws_cryptosdk_materials_cache_vt shm_cache_vt = { .vt_size               = sizeof(shm_cache_vt),
+                                                                      .name                  = "Shared memory cache",
+                                                                      .find_entry            = find_entry,
+                                                                      .update_usage_stats    = update_usage_stats,
+                                                                      .get_enc_materials     = get_enc_materials,
+                                                                      .get_dec_materials     = get_dec_materials,
+                                                                      .put_entry_for_encrypt = put_entry_for_encrypt,
+                                                                      .put_entry_for_decrypt = put_entry_for_decrypt,
+                                                                      .destroy               = destroy_cache,
+                                                                      .entry_count           = entry_count,
+                                                                      .entry_release         = release_entry,
+                                                                      .entry_get_creation_time = get_creation_time,
+                                                                      .entry_ttl_hint          = set_expiration_hint,
+                                                                      .clear                   = clear_cache,
+                                                                      .get_stats               = get_stats };
+
+AWS_CRYPTOSDK_TEST_STATIC
+void aws_cryptosdk_shm_cache_set_clock(
+    struct aws_cryptosdk_materials_cache *generic_cache, int (*clock_get_ticks)(uint64_t *timestamp)) {
+    assert(generic_cache->vt == &shm_cache_vt);
+    struct aws_cryptosdk_shm_cache *cache = (struct aws_cryptosdk_shm_cache *)generic_cache;
+
+    cache->clock_get_ticks = clock_get_ticks;
+}
+
+static int init_region_lock(struct shm_region *region) {
+    pthread_mutexattr_t attr;
+    int rv = AWS_OP_ERR;
+
+    if (pthread_mutexattr_init(&attr)) {
+        return aws_raise_error(AWS_ERROR_SYS_CALL_FAILURE);
+    }
+
+    if (pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) ||
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST) || pthread_mutex_init(&region->lock, &attr)) {
+        aws_raise_error(AWS_ERROR_SYS_CALL_FAILURE);
+    } else {
+        rv = AWS_OP_SUCCESS;
+    }
+
+    pthread_mutexattr_destroy(&attr);
+
+    return rv;
+}
+
+struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_shm_new_with_mlock(
+    struct aws_allocator *alloc,
+    size_t slot_count,
+    size_t slot_size,
+    enum aws_cryptosdk_shm_cache_mlock_policy mlock_policy) {
+    /* Suppress unused static method warnings */
+    (void)aws_cryptosdk_shm_cache_set_clock;
+
+    struct aws_cryptosdk_shm_cache *cache = NULL;
+    size_t header_size                    = (sizeof(struct shm_region) + 63) & ~(size_t)63;
+    size_t slot_stride, map_len;
+    void *mapping;
+
+    if (!slot_count || !slot_size || (mlock_policy != AWS_CRYPTOSDK_SHM_CACHE_MLOCK_BEST_EFFORT &&
+                                       mlock_policy != AWS_CRYPTOSDK_SHM_CACHE_MLOCK_REQUIRED)) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        goto err_args;
+    }
+
+    if (aws_add_size_checked(sizeof(struct shm_slot), slot_size, &slot_stride) ||
+        aws_add_size_checked(slot_stride, 7, &slot_stride)) {
+        goto err_args;
+    }
+    slot_stride &= ~(size_t)7;
+
+    if (aws_mul_size_checked(slot_stride, slot_count, &map_len) ||
+        aws_add_size_checked(map_len, header_size, &map_len)) {
+        goto err_args;
+    }
+
+    cache = aws_mem_acquire(alloc, sizeof(*cache));
+    if (!cache) {
+        goto err_args;
+    }
+
+    memset(cache, 0, sizeof(*cache));
+
+    aws_cryptosdk_materials_cache_base_init(&cache->base, &shm_cache_vt);
+    cache->allocator       = alloc;
+    cache->map_len         = map_len;
+    cache->clock_get_ticks = aws_sys_clock_get_ticks;
+
+    if (aws_mutex_init(&cache->parsed_lock)) {
+        goto err_mutex;
+    }
+
+    /* slot_stride * slot_count didn't overflow, and a parsed slot record is smaller than a slot */
+    cache->parsed = aws_mem_acquire(alloc, slot_count * sizeof(*cache->parsed));
+    if (!cache->parsed) {
+        goto err_parsed;
+    }
+    memset(cache->parsed, 0, slot_count * sizeof(*cache->parsed));
+
+    /* Anonymous mappings are zero-filled, so every slot starts out empty */
+    mapping = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        aws_raise_error(AWS_ERROR_OOM);
+        goto err_mmap;
+    }
+    cache->region = mapping;
+
+    /*
+     * Keep data keys out of swap and core dumps. Unless the caller requires it, this is best effort: a small
+     * RLIMIT_MEMLOCK (as in many containers) shouldn't stop the cache from working.
+     */
+    if (mlock(mapping, map_len) && mlock_policy == AWS_CRYPTOSDK_SHM_CACHE_MLOCK_REQUIRED) {
+        aws_raise_error(AWS_ERROR_SYS_CALL_FAILURE);
+        goto err_lock;
+    }
+
+#    ifdef MADV_DONTDUMP
+    if (madvise(mapping, map_len, MADV_DONTDUMP) && mlock_policy == AWS_CRYPTOSDK_SHM_CACHE_MLOCK_REQUIRED) {
+        aws_raise_error(AWS_ERROR_SYS_CALL_FAILURE);
+        goto err_lock;
+    }
+#    endif
+
+    cache->region->slot_count  = slot_count;
+    cache->region->slot_size   = slot_size;
+    cache->region->slot_stride = slot_stride;
+    cache->region->header_size = header_size;
+
+    if (init_region_lock(cache->region) || fork_registry_add(cache)) {
+        goto err_lock;
+    }
+
+    return &cache->base;
+
+err_lock:
+    munmap(mapping, map_len);
+err_mmap:
+    aws_mem_release(alloc, cache->parsed);
+err_parsed:
+    aws_mutex_clean_up(&cache->parsed_lock);
+err_mutex:
+    aws_mem_release(alloc, cache);
+err_args:
+    return NULL;
+}
+
+#else /* !__linux__ */
+
+struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_shm_new_with_mlock(
+    struct aws_allocator *alloc,
+    size_t slot_count,
+    size_t slot_size,
+    enum aws_cryptosdk_shm_cache_mlock_policy mlock_policy) {
+    (void)alloc;
+    (void)slot_count;
+    (void)slot_size;
+    (void)mlock_policy;
+
+    aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    return NULL;
+}
+
+#endif /* __linux__ */
+
+struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_shm_new(
+    struct aws_allocator *alloc, size_t slot_count, size_t slot_size) {
+    return aws_cryptosdk_materials_cache_shm_new_with_mlock(
+        alloc, slot_count, slot_size, AWS_CRYPTOSDK_SHM_CACHE_MLOCK_BEST_EFFORT);
+}
@@ -29,6 +29,14 @@ struct aws_cryptosdk_keyring *raw_rsa_keyring_tv_new_with_wrong_key(
 
 int raw_rsa_keyring_tv_trace_updated_properly(struct aws_array_list *trace, uint32_t flags);
 
+/* The PEM keys used by raw_rsa_keyring_tv_new, and a private key which does not parse */
+TESTLIB_API
+extern const char raw_rsa_keyring_tv_public_key[];
+TESTLIB_API
+extern const char raw_rsa_keyring_tv_private_key[];
+TESTLIB_API
+extern const char wrong_raw_rsa_keyring_tv_private_key[];
+
 struct raw_rsa_keyring_test_vector {
     enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode;
     enum aws_cryptosdk_alg_id alg;
@@ -19,7 +19,10 @@
 #include <aws/cryptosdk/private/cipher.h>
 #include <aws/cryptosdk/session.h>
 
+#include <aws/common/condition_variable.h>
 #include <aws/common/encoding.h>
+#include <aws/common/mutex.h>
+#include <aws/common/thread.h>
 
 #include <stdarg.h>
 
@@ -372,6 +375,82 @@ static int enc_cache_id_test_vecs() {
     return 0;
 }
 
+static int check_memoized_enc_cache_id(
+    struct aws_cryptosdk_cmm *caching_cmm, struct aws_string *partition_id, struct aws_cryptosdk_enc_request *request) {
+    uint8_t expected_arr[AWS_CRYPTOSDK_MD_MAX_SIZE];
+    struct aws_byte_buf expected = aws_byte_buf_from_array(expected_arr, sizeof(expected_arr));
+    TEST_ASSERT_SUCCESS(hash_enc_request(partition_id, &expected, request));
+
+    /* The first request may populate the digest memo and the second may be served from it */
+    for (int i = 0; i < 2; i++) {
+        struct aws_cryptosdk_enc_materials *materials = NULL;
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_cmm_generate_enc_materials(caching_cmm, &materials, request));
+        aws_cryptosdk_enc_materials_destroy(materials);
+        TEST_ASSERT(aws_byte_buf_eq(&expected, &mock_materials_cache->last_cache_id));
+    }
+
+    return 0;
+}
+
+static int enc_cache_id_memo() {
+    struct aws_allocator *alloc            = aws_default_allocator();
+    struct aws_byte_buf partition_name_buf = aws_byte_buf_from_c_str("c15b9079-6d0e-42b6-8784-5e804b025692");
+    struct aws_string *partition_id        = hash_or_generate_partition_id(alloc, &partition_name_buf);
+    TEST_ASSERT_ADDR_NOT_NULL(partition_id);
+
+    setup_mocks();
+    struct aws_cryptosdk_cmm *caching_cmm = aws_cryptosdk_caching_cmm_new_from_cmm(
+        alloc,
+        &mock_materials_cache->base,
+        &mock_upstream_cmm->base,
+        &partition_name_buf,
+        UINT64_MAX,
+        AWS_TIMESTAMP_NANOS);
+    release_mocks();
+
+    struct aws_hash_table req_context;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &req_context));
+
+    struct aws_cryptosdk_enc_request request;
+    request.alloc          = alloc;
+    request.requested_alg  = 0;
+    request.plaintext_size = 32768;
+    request.enc_ctx        = &req_context;
+
+    mock_upstream_cmm->n_edks       = 1;
+    mock_upstream_cmm->returned_alg = ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384;
+
+    TEST_ASSERT_SUCCESS(check_memoized_enc_cache_id(caching_cmm, partition_id, &request));
+
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(
+        &req_context, aws_string_new_from_c_str(alloc, "foo"), aws_string_new_from_c_str(alloc, "bar"), NULL));
+    TEST_ASSERT_SUCCESS(check_memoized_enc_cache_id(caching_cmm, partition_id, &request));
+
+    /* Same key, different value: must not be served from the memo entry for the previous context */
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(
+        &req_context, aws_string_new_from_c_str(alloc, "foo"), aws_string_new_from_c_str(alloc, "baz"), NULL));
+    TEST_ASSERT_SUCCESS(check_memoized_enc_cache_id(caching_cmm, partition_id, &request));
+
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(
+        &req_context, aws_string_new_from_c_str(alloc, "qux"), aws_string_new_from_c_str(alloc, ""), NULL));
+    TEST_ASSERT_SUCCESS(check_memoized_enc_cache_id(caching_cmm, partition_id, &request));
+
+    /* Same context, with an algorithm requested */
+    request.requested_alg = ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384;
+    TEST_ASSERT_SUCCESS(check_memoized_enc_cache_id(caching_cmm, partition_id, &request));
+
+    aws_hash_table_clear(&req_context);
+    TEST_ASSERT_SUCCESS(check_memoized_enc_cache_id(caching_cmm, partition_id, &request));
+
+    aws_cryptosdk_enc_ctx_clean_up(&req_context);
+    aws_cryptosdk_cmm_release(caching_cmm);
+    aws_string_destroy(partition_id);
+
+    teardown();
+
+    return 0;
+}
+
 static int access_cache(
     struct aws_cryptosdk_cmm *cmm,
     struct aws_cryptosdk_enc_request *request,
@@ -615,6 +694,513 @@ static int ttl_test() {
     return 0;
 }
 
+/*
+ * An upstream CMM which delegates to the mock upstream CMM and counts calls under a lock. The first hold_after
+ * calls go straight through; later calls are held until the test opens the gate. This lets tests wait for,
+ * and control the timing of, upstream calls made on other threads without sleeping.
+ */
+struct gated_upstream_cmm {
+    struct aws_cryptosdk_cmm base;
+    struct mock_upstream_cmm *delegate;
+    struct aws_mutex lock;
+    /* Signalled whenever calls or open changes */
+    struct aws_condition_variable signal;
+    int calls;
+    int hold_after;
+    bool open;
+};
+
+/* Upper bound on any wait in a gated upstream test, so that a broken test fails rather than hanging */
+#define GATE_TIMEOUT_NS (10LL * 1000 * 1000 * 1000)
+
+static void gated_upstream_destroy(struct aws_cryptosdk_cmm *cmm) {
+    struct gated_upstream_cmm *gated = (struct gated_upstream_cmm *)cmm;
+
+    aws_condition_variable_clean_up(&gated->signal);
+    aws_mutex_clean_up(&gated->lock);
+    aws_cryptosdk_cmm_release(&gated->delegate->base);
+    aws_mem_release(aws_default_allocator(), gated);
+}
+
+static int gated_upstream_generate_enc_materials(
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_cryptosdk_enc_materials **output,
+    struct aws_cryptosdk_enc_request *request) {
+    struct gated_upstream_cmm *gated = (struct gated_upstream_cmm *)cmm;
+    int rv                           = AWS_OP_SUCCESS;
+
+    if (aws_mutex_lock(&gated->lock)) {
+        return AWS_OP_ERR;
+    }
+
+    int call = gated->calls++;
+    aws_condition_variable_notify_all(&gated->signal);
+
+    while (!rv && call >= gated->hold_after && !gated->open) {
+        rv = aws_condition_variable_wait_for(&gated->signal, &gated->lock, GATE_TIMEOUT_NS);
+    }
+
+    /* Each call returns distinct materials; the mock is only ever touched with the lock held */
+    if (!rv) {
+        gated->delegate->materials_index = call;
+        rv = aws_cryptosdk_cmm_generate_enc_materials(&gated->delegate->base, output, request);
+    }
+
+    if (aws_mutex_unlock(&gated->lock)) {
+        abort();
+    }
+
+    return rv;
+}
+
+static const struct aws_cryptosdk_cmm_vt gated_upstream_vt = { .vt_size = sizeof(gated_upstream_vt),
+                                                               .name    = "Gated upstream CMM",
+                                                               .destroy = gated_upstream_destroy,
+                                                               .generate_enc_materials =
+                                                                   gated_upstream_generate_enc_materials };
+
+static struct gated_upstream_cmm *gated_upstream_new(struct mock_upstream_cmm *delegate, int hold_after) {
+    struct gated_upstream_cmm *gated = aws_mem_acquire(aws_default_allocator(), sizeof(*gated));
+
+    if (!gated) {
+        return NULL;
+    }
+
+    if (aws_mutex_init(&gated->lock)) {
+        aws_mem_release(aws_default_allocator(), gated);
+        return NULL;
+    }
+
+    if (aws_condition_variable_init(&gated->signal)) {
+        aws_mutex_clean_up(&gated->lock);
+        aws_mem_release(aws_default_allocator(), gated);
+        return NULL;
+    }
+
+    aws_cryptosdk_cmm_base_init(&gated->base, &gated_upstream_vt);
+    aws_cryptosdk_cmm_retain(&delegate->base);
+    gated->delegate   = delegate;
+    gated->calls      = 0;
+    gated->hold_after = hold_after;
+    gated->open       = false;
+
+    return gated;
+}
+
+static int gated_upstream_calls(struct gated_upstream_cmm *gated) {
+    if (aws_mutex_lock(&gated->lock)) {
+        abort();
+    }
+
+    int calls = gated->calls;
+
+    if (aws_mutex_unlock(&gated->lock)) {
+        abort();
+    }
+
+    return calls;
+}
+
+/* Waits until at least the given number of upstream calls have started */
+static int gated_upstream_wait_for_calls(struct gated_upstream_cmm *gated, int calls) {
+    int rv = AWS_OP_SUCCESS;
+
+    if (aws_mutex_lock(&gated->lock)) {
+        return AWS_OP_ERR;
+    }
+
+    while (!rv && gated->calls < calls) {
+        rv = aws_condition_variable_wait_for(&gated->signal, &gated->lock, GATE_TIMEOUT_NS);
+    }
+
+    if (aws_mutex_unlock(&gated->lock)) {
+        abort();
+    }
+
+    return rv;
+}
+
+/* Lets held and future upstream calls proceed */
+static void gated_upstream_open(struct gated_upstream_cmm *gated) {
+    if (aws_mutex_lock(&gated->lock)) {
+        abort();
+    }
+
+    gated->open = true;
+    aws_condition_variable_notify_all(&gated->signal);
+
+    if (aws_mutex_unlock(&gated->lock)) {
+        abort();
+    }
+}
+
+AWS_STATIC_STRING_FROM_LITERAL(refresh_context_key, "Context key");
+AWS_STATIC_STRING_FROM_LITERAL(refresh_original_value, "Encryption materials #0");
+AWS_STATIC_STRING_FROM_LITERAL(refresh_refreshed_value, "Encryption materials #1");
+
+/* Makes one encrypt request and checks which upstream call's materials it was served */
+static int check_refresh_ahead_request(
+    struct aws_cryptosdk_cmm *cmm, struct aws_cryptosdk_enc_request *request, const struct aws_string *expected) {
+    struct aws_cryptosdk_enc_materials *materials = NULL;
+    struct aws_hash_element *element              = NULL;
+
+    aws_hash_table_clear(request->enc_ctx);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_cmm_generate_enc_materials(cmm, &materials, request));
+    aws_cryptosdk_enc_materials_destroy(materials);
+
+    TEST_ASSERT_SUCCESS(aws_hash_table_find(request->enc_ctx, refresh_context_key, &element));
+    TEST_ASSERT_ADDR_NOT_NULL(element);
+    TEST_ASSERT(aws_string_eq(element->value, expected));
+
+    return 0;
+}
+
+static int refresh_ahead() {
+    struct aws_allocator *alloc            = aws_default_allocator();
+    struct aws_byte_buf partition_name_buf = aws_byte_buf_from_c_str("refresh ahead");
+
+    setup_mocks();
+    mock_upstream_cmm->n_edks       = 1;
+    mock_upstream_cmm->returned_alg = ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256;
+
+    /* The initial miss goes straight through; the refresh is held until we open the gate */
+    struct gated_upstream_cmm *gated = gated_upstream_new(mock_upstream_cmm, 1);
+    TEST_ASSERT_ADDR_NOT_NULL(gated);
+
+    struct aws_cryptosdk_materials_cache *local_cache = aws_cryptosdk_materials_cache_local_new(alloc, 16);
+    struct aws_cryptosdk_cmm *cmm                     = aws_cryptosdk_caching_cmm_new_from_cmm(
+        alloc, local_cache, &gated->base, &partition_name_buf, UINT64_MAX, AWS_TIMESTAMP_NANOS);
+    release_mocks();
+
+    TEST_ASSERT_ERROR(AWS_ERROR_INVALID_ARGUMENT, aws_cryptosdk_caching_cmm_set_refresh_ahead(cmm, 100));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_limit_messages(cmm, 1000));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_refresh_ahead(cmm, 10));
+
+    struct aws_hash_table req_context;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &req_context));
+
+    struct aws_cryptosdk_enc_request request;
+    request.alloc          = alloc;
+    request.requested_alg  = 0;
+    request.plaintext_size = 1;
+    request.enc_ctx        = &req_context;
+
+    /*
+     * A refresh is scheduled by the request which uses the 100th of the 1000 messages. Until then, every
+     * request after the first is served from the cache without calling the upstream CMM.
+     */
+    for (int i = 0; i < 100; i++) {
+        TEST_ASSERT_SUCCESS(check_refresh_ahead_request(cmm, &request, refresh_original_value));
+        if (i < 99) {
+            TEST_ASSERT_INT_EQ(1, gated_upstream_calls(gated));
+        }
+    }
+
+    /* The refresh calls the upstream CMM from the background thread; meanwhile the old entry is still served */
+    TEST_ASSERT_SUCCESS(gated_upstream_wait_for_calls(gated, 2));
+    TEST_ASSERT_SUCCESS(check_refresh_ahead_request(cmm, &request, refresh_original_value));
+    TEST_ASSERT_INT_EQ(2, gated_upstream_calls(gated));
+
+    /* Releasing the CMM waits for the refresh in progress, which replaces the entry */
+    gated_upstream_open(gated);
+    aws_cryptosdk_cmm_release(cmm);
+
+    /* A CMM with the same partition finds the refreshed entry, again without calling the upstream CMM */
+    cmm = aws_cryptosdk_caching_cmm_new_from_cmm(
+        alloc, local_cache, &gated->base, &partition_name_buf, UINT64_MAX, AWS_TIMESTAMP_NANOS);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    TEST_ASSERT_SUCCESS(check_refresh_ahead_request(cmm, &request, refresh_refreshed_value));
+    TEST_ASSERT_INT_EQ(2, gated_upstream_calls(gated));
+
+    aws_cryptosdk_enc_ctx_clean_up(&req_context);
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_cmm_release(&gated->base);
+    aws_cryptosdk_materials_cache_release(local_cache);
+
+    teardown();
+
+    return 0;
+}
+
+#define COALESCE_THREADS 8
+
+struct coalesce_thread_args {
+    struct aws_cryptosdk_cmm *cmm;
+    int rv;
+};
+
+static void coalesce_thread_fn(void *vp_args) {
+    struct coalesce_thread_args *args             = vp_args;
+    struct aws_cryptosdk_enc_materials *materials = NULL;
+    struct aws_hash_table enc_ctx;
+    struct aws_cryptosdk_enc_request request;
+
+    args->rv = AWS_OP_ERR;
+    if (aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &enc_ctx)) {
+        return;
+    }
+
+    request.alloc          = aws_default_allocator();
+    request.requested_alg  = 0;
+    request.plaintext_size = 1;
+    request.enc_ctx        = &enc_ctx;
+
+    args->rv = aws_cryptosdk_cmm_generate_enc_materials(args->cmm, &materials, &request);
+
+    aws_cryptosdk_enc_materials_destroy(materials);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+}
+
+void caching_cmm_set_flight_wait(struct aws_cryptosdk_cmm *generic_cmm, uint64_t flight_wait_nanos);
+
+static int concurrent_misses_coalesce() {
+    struct aws_allocator *alloc = aws_default_allocator();
+
+    setup_mocks();
+    mock_upstream_cmm->n_edks       = 1;
+    mock_upstream_cmm->returned_alg = ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256;
+
+    /* The first miss is held in the upstream CMM until all the threads have been launched */
+    struct gated_upstream_cmm *gated = gated_upstream_new(mock_upstream_cmm, 0);
+    TEST_ASSERT_ADDR_NOT_NULL(gated);
+
+    struct aws_cryptosdk_materials_cache *local_cache = aws_cryptosdk_materials_cache_local_new(alloc, 16);
+    struct aws_cryptosdk_cmm *cmm =
+        aws_cryptosdk_caching_cmm_new_from_cmm(alloc, local_cache, &gated->base, NULL, UINT64_MAX, AWS_TIMESTAMP_NANOS);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    aws_cryptosdk_materials_cache_release(local_cache);
+    release_mocks();
+
+    struct aws_thread threads[COALESCE_THREADS];
+    struct coalesce_thread_args args[COALESCE_THREADS];
+    for (int i = 0; i < COALESCE_THREADS; i++) {
+        args[i].cmm = cmm;
+        TEST_ASSERT_SUCCESS(aws_thread_init(&threads[i], alloc));
+        TEST_ASSERT_SUCCESS(aws_thread_launch(&threads[i], coalesce_thread_fn, &args[i], aws_default_thread_options()));
+    }
+
+    TEST_ASSERT_SUCCESS(gated_upstream_wait_for_calls(gated, 1));
+    gated_upstream_open(gated);
+
+    for (int i = 0; i < COALESCE_THREADS; i++) {
+        aws_thread_join(&threads[i]);
+        aws_thread_clean_up(&threads[i]);
+        TEST_ASSERT_SUCCESS(args[i].rv);
+    }
+
+    /* Every thread either waited for the first miss or arrived after it, and was served from the cache */
+    TEST_ASSERT_INT_EQ(1, gated_upstream_calls(gated));
+
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_cmm_release(&gated->base);
+    teardown();
+
+    return 0;
+}
+
+static int flight_wait_times_out() {
+    struct aws_allocator *alloc = aws_default_allocator();
+
+    setup_mocks();
+    mock_upstream_cmm->n_edks       = 1;
+    mock_upstream_cmm->returned_alg = ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256;
+
+    /* Only the first call is held, so a request which gives up waiting on it can complete on its own */
+    struct gated_upstream_cmm *gated = gated_upstream_new(mock_upstream_cmm, 1);
+    TEST_ASSERT_ADDR_NOT_NULL(gated);
+
+    struct aws_cryptosdk_materials_cache *local_cache = aws_cryptosdk_materials_cache_local_new(alloc, 16);
+    struct aws_cryptosdk_cmm *cmm =
+        aws_cryptosdk_caching_cmm_new_from_cmm(alloc, local_cache, &gated->base, NULL, UINT64_MAX, AWS_TIMESTAMP_NANOS);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    aws_cryptosdk_materials_cache_release(local_cache);
+    release_mocks();
+
+    caching_cmm_set_flight_wait(cmm, 1000 * 1000);
+
+    struct aws_thread thread;
+    struct coalesce_thread_args held_args = { .cmm = cmm }, waiting_args = { .cmm = cmm };
+    TEST_ASSERT_SUCCESS(aws_thread_init(&thread, alloc));
+    TEST_ASSERT_SUCCESS(aws_thread_launch(&thread, coalesce_thread_fn, &held_args, aws_default_thread_options()));
+    TEST_ASSERT_SUCCESS(gated_upstream_wait_for_calls(gated, 1));
+
+    /* The held call is still outstanding, so this request can only complete by calling the upstream CMM itself */
+    coalesce_thread_fn(&waiting_args);
+    TEST_ASSERT_SUCCESS(waiting_args.rv);
+    TEST_ASSERT_INT_EQ(2, gated_upstream_calls(gated));
+
+    gated_upstream_open(gated);
+    aws_thread_join(&thread);
+    aws_thread_clean_up(&thread);
+    TEST_ASSERT_SUCCESS(held_args.rv);
+
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_cmm_release(&gated->base);
+    teardown();
+
+    return 0;
+}
+
+static int cmm_stats() {
+    struct aws_allocator *alloc = aws_default_allocator();
+
+    setup_mocks();
+    struct aws_cryptosdk_materials_cache *local_cache = aws_cryptosdk_materials_cache_local_new(alloc, 16);
+    struct aws_cryptosdk_cmm *cmm                     = aws_cryptosdk_caching_cmm_new_from_cmm(
+        alloc, local_cache, &mock_upstream_cmm->base, NULL, UINT64_MAX, AWS_TIMESTAMP_NANOS);
+    release_mocks();
+
+    struct aws_cryptosdk_caching_cmm_stats stats;
+    struct aws_cryptosdk_materials_cache_stats cache_stats;
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_UNSUPPORTED_OPERATION, aws_cryptosdk_caching_cmm_get_stats(&mock_upstream_cmm->base, &stats));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_limit_messages(cmm, 2));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_limit_bytes(cmm, 100));
+
+    struct aws_hash_table req_context;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &req_context));
+
+    struct aws_cryptosdk_enc_request request;
+    request.alloc          = alloc;
+    request.requested_alg  = 0;
+    request.plaintext_size = 1;
+    request.enc_ctx        = &req_context;
+
+    mock_upstream_cmm->n_edks       = 1;
+    mock_upstream_cmm->returned_alg = ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256;
+
+    /* Miss, then a hit which uses up the message limit, then another miss; the last request is too large */
+    for (int i = 0; i < 4; i++) {
+        struct aws_cryptosdk_enc_materials *materials = NULL;
+
+        request.plaintext_size = i == 3 ? 1000 : 1;
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_cmm_generate_enc_materials(cmm, &materials, &request));
+        aws_cryptosdk_enc_materials_destroy(materials);
+    }
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_get_stats(cmm, &stats));
+    TEST_ASSERT_INT_EQ(1, stats.hits);
+    TEST_ASSERT_INT_EQ(2, stats.misses);
+    TEST_ASSERT_INT_EQ(1, stats.bypasses);
+    TEST_ASSERT_INT_EQ(1, stats.invalidations_usage_limit);
+    TEST_ASSERT_INT_EQ(0, stats.invalidations_ttl);
+    TEST_ASSERT_INT_EQ(2, stats.upstream_encrypt_latency.count);
+    TEST_ASSERT_INT_EQ(0, stats.upstream_decrypt_latency.count);
+
+    uint64_t bucket_total = 0;
+    for (int i = 0; i < AWS_CRYPTOSDK_LATENCY_HISTOGRAM_BUCKETS; i++) {
+        bucket_total += stats.upstream_encrypt_latency.buckets[i];
+    }
+    TEST_ASSERT_INT_EQ(2, bucket_total);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(local_cache, &cache_stats));
+    TEST_ASSERT_INT_EQ(1, cache_stats.hits);
+    TEST_ASSERT_INT_EQ(2, cache_stats.misses);
+    TEST_ASSERT_INT_EQ(1, cache_stats.evictions_invalidated);
+
+    aws_cryptosdk_enc_ctx_clean_up(&req_context);
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_materials_cache_release(local_cache);
+
+    teardown();
+
+    return 0;
+}
+
+static int per_edk_decrypt() {
+    struct aws_allocator *alloc = aws_default_allocator();
+
+    setup_mocks();
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_UNSUPPORTED_OPERATION, aws_cryptosdk_caching_cmm_set_per_edk_decrypt(&mock_upstream_cmm->base, true));
+    teardown();
+
+    struct aws_cryptosdk_materials_cache *local_cache = aws_cryptosdk_materials_cache_local_new(alloc, 16);
+    struct aws_cryptosdk_keyring *kr                  = aws_cryptosdk_counting_keyring_new(alloc);
+    struct aws_cryptosdk_cmm *cmm =
+        aws_cryptosdk_caching_cmm_new_from_keyring(alloc, local_cache, kr, NULL, UINT64_MAX, AWS_TIMESTAMP_SECS);
+    aws_cryptosdk_keyring_release(kr);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_per_edk_decrypt(cmm, true));
+
+    struct aws_hash_table enc_ctx;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+
+    /* Only the counting EDK can be decrypted by the counting keyring */
+    struct aws_cryptosdk_edk edks[3];
+    edks[0].provider_id   = aws_byte_buf_from_c_str("test_counting");
+    edks[0].provider_info = aws_byte_buf_from_c_str("test_counting_prov_info");
+    edks[0].ciphertext    = aws_byte_buf_from_c_str("\x40\x41\x42\x43\x44");
+    for (int i = 1; i < 3; i++) {
+        edks[i].provider_id   = aws_byte_buf_from_c_str("other_provider");
+        edks[i].provider_info = aws_byte_buf_from_c_str(i == 1 ? "key_1" : "key_2");
+        edks[i].ciphertext    = aws_byte_buf_from_c_str("undecryptable");
+    }
+
+    struct aws_cryptosdk_edk first_message[2]  = { edks[1], edks[0] };
+    struct aws_cryptosdk_edk second_message[2] = { edks[2], edks[0] };
+
+    struct aws_cryptosdk_dec_request request = { 0 };
+    request.alloc                            = alloc;
+    request.alg                              = ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256;
+    request.enc_ctx                          = &enc_ctx;
+
+    struct aws_cryptosdk_dec_materials *materials = NULL;
+    struct aws_cryptosdk_caching_cmm_stats stats;
+
+    /* A miss: the upstream CMM is called once with both EDKs, and only the counting EDK's entry is populated */
+    aws_array_list_init_static(&request.encrypted_data_keys, first_message, 2, sizeof(first_message[0]));
+    request.encrypted_data_keys.length = 2;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_cmm_decrypt_materials(cmm, &materials, &request));
+    TEST_ASSERT_INT_EQ(materials->unencrypted_data_key.len, 32);
+    TEST_ASSERT_INT_EQ(materials->unencrypted_data_key.buffer[31], 31);
+    aws_cryptosdk_dec_materials_destroy(materials);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_get_stats(cmm, &stats));
+    TEST_ASSERT_INT_EQ(0, stats.hits);
+    TEST_ASSERT_INT_EQ(1, stats.misses);
+    TEST_ASSERT_INT_EQ(1, stats.upstream_decrypt_latency.count);
+
+    /* A different EDK list which shares the counting EDK is served from its entry */
+    aws_array_list_init_static(&request.encrypted_data_keys, second_message, 2, sizeof(second_message[0]));
+    request.encrypted_data_keys.length = 2;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_cmm_decrypt_materials(cmm, &materials, &request));
+    TEST_ASSERT_INT_EQ(materials->unencrypted_data_key.len, 32);
+    aws_cryptosdk_dec_materials_destroy(materials);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_get_stats(cmm, &stats));
+    TEST_ASSERT_INT_EQ(1, stats.hits);
+    TEST_ASSERT_INT_EQ(1, stats.upstream_decrypt_latency.count);
+
+    /* Whole-list caching keys the same request on both EDKs, so it misses */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_per_edk_decrypt(cmm, false));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_cmm_decrypt_materials(cmm, &materials, &request));
+    aws_cryptosdk_dec_materials_destroy(materials);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_get_stats(cmm, &stats));
+    TEST_ASSERT_INT_EQ(1, stats.hits);
+    TEST_ASSERT_INT_EQ(2, stats.upstream_decrypt_latency.count);
+
+    /*
+     * The undecryptable EDK of the first message was not cached, so a message with only undecryptable EDKs
+     * misses, and the upstream CMM's error is reported
+     */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_per_edk_decrypt(cmm, true));
+    second_message[1] = edks[1];
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_CANNOT_DECRYPT, aws_cryptosdk_cmm_decrypt_materials(cmm, &materials, &request));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_get_stats(cmm, &stats));
+    TEST_ASSERT_INT_EQ(1, stats.hits);
+    TEST_ASSERT_INT_EQ(3, stats.upstream_decrypt_latency.count);
+
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_materials_cache_release(local_cache);
+
+    return 0;
+}
+
 static int zero_byte_limit_zero_length_messages() {
     setup_mocks();
     struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_caching_cmm_new_from_cmm(
@@ -769,6 +1355,86 @@ static int dec_cache_id_test_vecs() {
     return 0;
 }
 
+static int check_memoized_dec_cache_id(
+    struct aws_cryptosdk_cmm *caching_cmm, struct aws_string *partition_id, struct aws_cryptosdk_dec_request *request) {
+    uint8_t expected_arr[AWS_CRYPTOSDK_MD_MAX_SIZE];
+    struct aws_byte_buf expected = aws_byte_buf_from_array(expected_arr, sizeof(expected_arr));
+    TEST_ASSERT_SUCCESS(hash_dec_request(partition_id, &expected, request));
+
+    /* The first request may populate the digest memos and the second may be served from them */
+    for (int i = 0; i < 2; i++) {
+        struct aws_cryptosdk_dec_materials *materials = NULL;
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_cmm_decrypt_materials(caching_cmm, &materials, request));
+        aws_cryptosdk_dec_materials_destroy(materials);
+        TEST_ASSERT(aws_byte_buf_eq(&expected, &mock_materials_cache->last_cache_id));
+    }
+
+    return 0;
+}
+
+static int dec_cache_id_memo() {
+    struct aws_allocator *alloc            = aws_default_allocator();
+    struct aws_byte_buf partition_name_buf = aws_byte_buf_from_c_str("c15b9079-6d0e-42b6-8784-5e804b025692");
+    struct aws_string *partition_id        = hash_or_generate_partition_id(alloc, &partition_name_buf);
+    TEST_ASSERT_ADDR_NOT_NULL(partition_id);
+
+    setup_mocks();
+    struct aws_cryptosdk_cmm *caching_cmm = aws_cryptosdk_caching_cmm_new_from_cmm(
+        alloc,
+        &mock_materials_cache->base,
+        &mock_upstream_cmm->base,
+        &partition_name_buf,
+        UINT64_MAX,
+        AWS_TIMESTAMP_NANOS);
+    release_mocks();
+
+    struct aws_hash_table enc_ctx;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+
+    struct aws_cryptosdk_edk edks[3];
+    edks[0].provider_id   = aws_byte_buf_from_c_str("provider_id");
+    edks[0].provider_info = aws_byte_buf_from_c_str("provider_info");
+    edks[0].ciphertext    = aws_byte_buf_from_c_str("enc_data_key");
+    edks[1].provider_id   = aws_byte_buf_from_c_str("other_provider_id");
+    edks[1].provider_info = aws_byte_buf_from_c_str("other_provider_info");
+    edks[1].ciphertext    = aws_byte_buf_from_c_str("other_enc_data_key");
+    edks[2].provider_id   = aws_byte_buf_from_c_str("");
+    edks[2].provider_info = aws_byte_buf_from_c_str("");
+    edks[2].ciphertext    = aws_byte_buf_from_c_str("");
+
+    struct aws_cryptosdk_dec_request request = { 0 };
+    request.alloc                            = alloc;
+    request.alg                              = ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384;
+    request.enc_ctx                          = &enc_ctx;
+    aws_array_list_init_static(&request.encrypted_data_keys, edks, 3, sizeof(*edks));
+    request.encrypted_data_keys.length = 2;
+
+    TEST_ASSERT_SUCCESS(check_memoized_dec_cache_id(caching_cmm, partition_id, &request));
+
+    /* Same ciphertext, different provider info: must not be served from the memo entry for the previous EDK */
+    edks[1].provider_info = aws_byte_buf_from_c_str("changed_provider_info");
+    TEST_ASSERT_SUCCESS(check_memoized_dec_cache_id(caching_cmm, partition_id, &request));
+
+    request.encrypted_data_keys.length = 3;
+    TEST_ASSERT_SUCCESS(check_memoized_dec_cache_id(caching_cmm, partition_id, &request));
+
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(
+        &enc_ctx, aws_string_new_from_c_str(alloc, "foo"), aws_string_new_from_c_str(alloc, "bar"), NULL));
+    TEST_ASSERT_SUCCESS(check_memoized_dec_cache_id(caching_cmm, partition_id, &request));
+
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(
+        &enc_ctx, aws_string_new_from_c_str(alloc, "foo"), aws_string_new_from_c_str(alloc, "baz"), NULL));
+    TEST_ASSERT_SUCCESS(check_memoized_dec_cache_id(caching_cmm, partition_id, &request));
+
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_cmm_release(caching_cmm);
+    aws_string_destroy(partition_id);
+
+    teardown();
+
+    return 0;
+}
+
 static int dec_materials() {
     setup_mocks();
     struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_caching_cmm_new_from_cmm(
@@ -1329,11 +1995,18 @@ struct test_case caching_cmm_test_cases[] = { TEST_CASE(create_destroy),
                                               TEST_CASE(enc_cache_miss),
                                               TEST_CASE(enc_cache_unique_ids),
                                               TEST_CASE(enc_cache_id_test_vecs),
+                                              TEST_CASE(enc_cache_id_memo),
                                               TEST_CASE(enc_cache_hit),
                                               TEST_CASE(byte_and_message_limits_test),
                                               TEST_CASE(ttl_test),
+                                              TEST_CASE(refresh_ahead),
+                                              TEST_CASE(concurrent_misses_coalesce),
+                                              TEST_CASE(flight_wait_times_out),
+                                              TEST_CASE(cmm_stats),
+                                              TEST_CASE(per_edk_decrypt),
                                               TEST_CASE(zero_byte_limit_zero_length_messages),
                                               TEST_CASE(dec_cache_id_test_vecs),
+                                              TEST_CASE(dec_cache_id_memo),
                                               TEST_CASE(dec_materials),
                                               TEST_CASE(cache_miss_failed_put),
                                               TEST_CASE(same_partition_id_cache_ids_match),
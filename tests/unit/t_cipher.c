@@ -18,6 +18,7 @@
 #include "testutil.h"
 
 #include <stdlib.h>
+#include "raw_rsa_keyring_test_vectors.h"
 #include "testing.h"
 #include "testutil.h"
 
@@ -860,6 +861,175 @@ static int test_digest_sha512() {
     return 0;
 }
 
+static int test_aes_gcm_with_key() {
+    struct aws_allocator *alloc        = aws_default_allocator();
+    static const uint8_t key_bytes[]   = "0123456789abcdef0123456789abcdef";
+    static const uint8_t iv_bytes[]    = "abcdefghijkl";
+    static const uint8_t plain_bytes[] = "The quick brown fox jumps over the lazy dog";
+    struct aws_byte_cursor iv          = aws_byte_cursor_from_array(iv_bytes, 12);
+    struct aws_byte_cursor plain       = aws_byte_cursor_from_array(plain_bytes, sizeof(plain_bytes) - 1);
+    struct aws_byte_cursor aad         = aws_byte_cursor_from_c_str("aad");
+
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_aes_gcm_key_new(alloc, key_bytes, 17));
+    TEST_ASSERT_INT_EQ(AWS_ERROR_INVALID_BUFFER_SIZE, aws_last_error());
+
+    const enum aws_cryptosdk_aes_key_len key_lens[] = { AWS_CRYPTOSDK_AES128,
+                                                        AWS_CRYPTOSDK_AES192,
+                                                        AWS_CRYPTOSDK_AES256 };
+    for (size_t i = 0; i < sizeof(key_lens) / sizeof(key_lens[0]); i++) {
+        struct aws_string *key_str            = aws_string_new_from_array(alloc, key_bytes, key_lens[i]);
+        struct aws_cryptosdk_aes_gcm_key *key = aws_cryptosdk_aes_gcm_key_new(alloc, key_bytes, key_lens[i]);
+        TEST_ASSERT_ADDR_NOT_NULL(key_str);
+        TEST_ASSERT_ADDR_NOT_NULL(key);
+
+        uint8_t expected_ct[sizeof(plain_bytes)], expected_tag[16], ct[sizeof(plain_bytes)], tag[16];
+        uint8_t decrypted[sizeof(plain_bytes)];
+        struct aws_byte_buf expected_ct_buf  = aws_byte_buf_from_empty_array(expected_ct, sizeof(expected_ct));
+        struct aws_byte_buf expected_tag_buf = aws_byte_buf_from_empty_array(expected_tag, sizeof(expected_tag));
+        TEST_ASSERT_SUCCESS(
+            aws_cryptosdk_aes_gcm_encrypt(&expected_ct_buf, &expected_tag_buf, plain, iv, aad, key_str));
+
+        /* The prepared key must be reusable, so run it more than once */
+        for (int round = 0; round < 2; round++) {
+            struct aws_byte_buf ct_buf  = aws_byte_buf_from_empty_array(ct, sizeof(ct));
+            struct aws_byte_buf tag_buf = aws_byte_buf_from_empty_array(tag, sizeof(tag));
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_aes_gcm_encrypt_with_key(&ct_buf, &tag_buf, plain, iv, aad, key));
+            TEST_ASSERT(aws_byte_buf_eq(&ct_buf, &expected_ct_buf));
+            TEST_ASSERT(aws_byte_buf_eq(&tag_buf, &expected_tag_buf));
+
+            struct aws_byte_buf decrypted_buf = aws_byte_buf_from_empty_array(decrypted, sizeof(decrypted));
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_aes_gcm_decrypt_with_key(
+                &decrypted_buf, aws_byte_cursor_from_buf(&ct_buf), aws_byte_cursor_from_buf(&tag_buf), iv, aad, key));
+            TEST_ASSERT_INT_EQ(plain.len, decrypted_buf.len);
+            TEST_ASSERT_INT_EQ(0, memcmp(plain.ptr, decrypted, plain.len));
+
+            /* A modified tag must be rejected */
+            tag[0] ^= 1;
+            decrypted_buf = aws_byte_buf_from_empty_array(decrypted, sizeof(decrypted));
+            TEST_ASSERT_ERROR(
+                AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT,
+                aws_cryptosdk_aes_gcm_decrypt_with_key(
+                    &decrypted_buf,
+                    aws_byte_cursor_from_buf(&ct_buf),
+                    aws_byte_cursor_from_buf(&tag_buf),
+                    iv,
+                    aad,
+                    key));
+            TEST_ASSERT_INT_EQ(0, decrypted_buf.len);
+        }
+
+        aws_cryptosdk_aes_gcm_key_destroy(key);
+        aws_string_destroy(key_str);
+    }
+
+    return 0;
+}
+
+static int test_rsa_with_key() {
+    struct aws_allocator *alloc        = aws_default_allocator();
+    static const uint8_t plain_bytes[] = "0123456789abcdef0123456789abcdef";
+    struct aws_byte_cursor plain       = aws_byte_cursor_from_array(plain_bytes, sizeof(plain_bytes) - 1);
+    struct aws_string *public_pem      = aws_string_new_from_c_str(alloc, raw_rsa_keyring_tv_public_key);
+    struct aws_string *private_pem     = aws_string_new_from_c_str(alloc, raw_rsa_keyring_tv_private_key);
+    TEST_ASSERT_ADDR_NOT_NULL(public_pem);
+    TEST_ASSERT_ADDR_NOT_NULL(private_pem);
+
+    const enum aws_cryptosdk_rsa_padding_mode modes[] = { AWS_CRYPTOSDK_RSA_PKCS1,
+                                                          AWS_CRYPTOSDK_RSA_OAEP_SHA1_MGF1,
+                                                          AWS_CRYPTOSDK_RSA_OAEP_SHA256_MGF1 };
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        struct aws_cryptosdk_rsa_key *public_key  = aws_cryptosdk_rsa_key_new(alloc, public_pem, false, modes[i]);
+        struct aws_cryptosdk_rsa_key *private_key = aws_cryptosdk_rsa_key_new(alloc, private_pem, true, modes[i]);
+        TEST_ASSERT_ADDR_NOT_NULL(public_key);
+        TEST_ASSERT_ADDR_NOT_NULL(private_key);
+
+        /* Each call duplicates the prepared context, so the keys must be reusable; run them more than once */
+        for (int round = 0; round < 3; round++) {
+            struct aws_byte_buf cipher = { 0 }, decrypted = { 0 }, decrypted_pem = { 0 };
+
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_rsa_encrypt_with_key(&cipher, alloc, plain, public_key));
+            TEST_ASSERT_SUCCESS(
+                aws_cryptosdk_rsa_decrypt_with_key(&decrypted, alloc, aws_byte_cursor_from_buf(&cipher), private_key));
+            TEST_ASSERT(aws_byte_cursor_eq_byte_buf(&plain, &decrypted));
+
+            /* The prepared keys interoperate with the PEM functions */
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_rsa_decrypt(
+                &decrypted_pem, alloc, aws_byte_cursor_from_buf(&cipher), private_pem, modes[i]));
+            TEST_ASSERT(aws_byte_cursor_eq_byte_buf(&plain, &decrypted_pem));
+
+            aws_byte_buf_clean_up(&cipher);
+            aws_byte_buf_clean_up_secure(&decrypted);
+            aws_byte_buf_clean_up_secure(&decrypted_pem);
+        }
+
+        /* Each key only works in the direction it was prepared for */
+        struct aws_byte_buf out = { 0 };
+        TEST_ASSERT_ERROR(
+            AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_rsa_encrypt_with_key(&out, alloc, plain, private_key));
+        TEST_ASSERT_ERROR(
+            AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_rsa_decrypt_with_key(&out, alloc, plain, public_key));
+        TEST_ASSERT_ADDR_NULL(out.buffer);
+
+        aws_cryptosdk_rsa_key_destroy(public_key);
+        aws_cryptosdk_rsa_key_destroy(private_key);
+    }
+
+    /* Known answers */
+    for (struct raw_rsa_keyring_test_vector *tv = raw_rsa_keyring_test_vectors; tv->data_key; ++tv) {
+        struct aws_cryptosdk_rsa_key *private_key =
+            aws_cryptosdk_rsa_key_new(alloc, private_pem, true, tv->rsa_padding_mode);
+        struct aws_byte_buf decrypted = { 0 };
+        struct aws_byte_buf expected  = aws_byte_buf_from_array(tv->data_key, tv->data_key_len);
+        TEST_ASSERT_ADDR_NOT_NULL(private_key);
+
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_rsa_decrypt_with_key(
+            &decrypted, alloc, aws_byte_cursor_from_array(tv->edk_bytes, tv->edk_bytes_len), private_key));
+        TEST_ASSERT(aws_byte_buf_eq(&expected, &decrypted));
+
+        aws_byte_buf_clean_up_secure(&decrypted);
+        aws_cryptosdk_rsa_key_destroy(private_key);
+    }
+
+    aws_string_destroy(public_pem);
+    aws_string_destroy_secure(private_pem);
+
+    return 0;
+}
+
+static int test_rsa_key_new_rejects_bad_keys() {
+    struct aws_allocator *alloc    = aws_default_allocator();
+    struct aws_string *garbage     = aws_string_new_from_c_str(alloc, "-----BEGIN PUBLIC KEY-----\nnope\n");
+    struct aws_string *partial     = aws_string_new_from_c_str(alloc, wrong_raw_rsa_keyring_tv_private_key);
+    struct aws_string *public_pem  = aws_string_new_from_c_str(alloc, raw_rsa_keyring_tv_public_key);
+    struct aws_string *private_pem = aws_string_new_from_c_str(alloc, raw_rsa_keyring_tv_private_key);
+    TEST_ASSERT_ADDR_NOT_NULL(garbage);
+    TEST_ASSERT_ADDR_NOT_NULL(partial);
+    TEST_ASSERT_ADDR_NOT_NULL(public_pem);
+    TEST_ASSERT_ADDR_NOT_NULL(private_pem);
+
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_rsa_key_new(alloc, garbage, false, AWS_CRYPTOSDK_RSA_PKCS1));
+    TEST_ASSERT_INT_EQ(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN, aws_last_error());
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_rsa_key_new(alloc, partial, true, AWS_CRYPTOSDK_RSA_PKCS1));
+    TEST_ASSERT_INT_EQ(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN, aws_last_error());
+
+    /* A public key is not a private key, and vice versa */
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_rsa_key_new(alloc, public_pem, true, AWS_CRYPTOSDK_RSA_PKCS1));
+    TEST_ASSERT_INT_EQ(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN, aws_last_error());
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_rsa_key_new(alloc, private_pem, false, AWS_CRYPTOSDK_RSA_PKCS1));
+    TEST_ASSERT_INT_EQ(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN, aws_last_error());
+
+    TEST_ASSERT_ADDR_NULL(
+        aws_cryptosdk_rsa_key_new(alloc, public_pem, false, (enum aws_cryptosdk_rsa_padding_mode)0x1234));
+    TEST_ASSERT_INT_EQ(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT, aws_last_error());
+
+    aws_string_destroy(garbage);
+    aws_string_destroy_secure(partial);
+    aws_string_destroy(public_pem);
+    aws_string_destroy_secure(private_pem);
+
+    return 0;
+}
+
 struct test_case cipher_test_cases[] = { { "cipher", "test_kdf", test_kdf },
                                          { "cipher", "test_decrypt_frame_aad", test_decrypt_frame_aad },
                                          { "cipher", "test_decrypt_frame_all_algos", test_decrypt_frame_all_algos },
@@ -868,4 +1038,9 @@ struct test_case cipher_test_cases[] = { { "cipher", "test_kdf", test_kdf },
                                          { "cipher", "test_encrypt_body", test_encrypt_body },
                                          { "cipher", "test_sign_header", test_sign_header },
                                          { "cipher", "test_digest_sha512", test_digest_sha512 },
+                                         { "cipher", "test_aes_gcm_with_key", test_aes_gcm_with_key },
+                                         { "cipher", "test_rsa_with_key", test_rsa_with_key },
+                                         { "cipher",
+                                           "test_rsa_key_new_rejects_bad_keys",
+                                           test_rsa_key_new_rejects_bad_keys },
                                          { NULL } };
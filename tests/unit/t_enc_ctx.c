@@ -399,10 +399,90 @@ int deserialize_error_when_duplicate_key_in_context() {
 
     TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT, aws_cryptosdk_enc_ctx_deserialize(alloc, &enc_ctx, &cursor));
 
+    struct aws_cryptosdk_enc_ctx_flat flat;
+    aws_cryptosdk_enc_ctx_flat_init(&flat, alloc, NULL, 0);
+    cursor = aws_byte_cursor_from_array(serialized_enc_ctx, sizeof(serialized_enc_ctx));
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT, aws_cryptosdk_enc_ctx_flat_deserialize(&flat, &cursor));
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&flat.entries), 0);
+
+    aws_cryptosdk_enc_ctx_flat_clean_up(&flat);
     aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
     return 0;
 }
 
+int flat_enc_ctx_sorted_with_cached_serialization() {
+    struct aws_allocator *alloc = aws_default_allocator();
+
+    struct aws_hash_table enc_ctx;
+    TEST_ASSERT_SUCCESS(
+        aws_hash_table_init(&enc_ctx, alloc, 10, aws_hash_string, aws_hash_callback_string_eq, NULL, NULL));
+    const struct aws_string *keys[] = { foo, bar_null_food, empty };
+    const struct aws_string *vals[] = { bar, bar_null_back, bar_food };
+    for (int idx = 0; idx < 3; ++idx) {
+        struct aws_hash_element *elem;
+        TEST_ASSERT_SUCCESS(aws_hash_table_create(&enc_ctx, (void *)keys[idx], &elem, NULL));
+        elem->value = (void *)vals[idx];
+    }
+
+    /* Two entries of storage, so the flat context has to move out of it */
+    struct aws_cryptosdk_enc_ctx_entry storage[2];
+    struct aws_cryptosdk_enc_ctx_flat flat;
+    aws_cryptosdk_enc_ctx_flat_init(&flat, alloc, storage, 2);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_flat_set(&flat, &enc_ctx));
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&flat.entries), 3);
+
+    struct aws_byte_buf expected;
+    TEST_ASSERT_SUCCESS(serialize_init(alloc, &expected, &enc_ctx));
+    struct aws_byte_cursor serialized;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_flat_serialize(&flat, &serialized));
+    TEST_ASSERT(aws_byte_buf_eq(&flat.serialized, &expected));
+    aws_byte_buf_clean_up(&expected);
+
+    struct aws_byte_cursor expected_value = aws_byte_cursor_from_string(bar_null_back);
+    const struct aws_byte_cursor *value =
+        aws_cryptosdk_enc_ctx_flat_get(&flat, aws_byte_cursor_from_string(bar_null_food));
+    TEST_ASSERT_ADDR_NOT_NULL(value);
+    TEST_ASSERT(aws_byte_cursor_eq(value, &expected_value));
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_enc_ctx_flat_get(&flat, aws_byte_cursor_from_string(bar)));
+
+    uint8_t digest[AWS_CRYPTOSDK_ENC_CTX_DIGEST_LEN];
+    uint8_t new_digest[AWS_CRYPTOSDK_ENC_CTX_DIGEST_LEN];
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_flat_digest(&flat, digest));
+    TEST_ASSERT(flat.has_serialized && flat.has_digest);
+
+    /* Changing the context drops the cached forms, which then match the changed context */
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_enc_ctx_flat_put(&flat, aws_byte_cursor_from_string(bar), aws_byte_cursor_from_string(foo)));
+    TEST_ASSERT(!flat.has_serialized && !flat.has_digest);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_flat_digest(&flat, new_digest));
+    TEST_ASSERT(memcmp(digest, new_digest, sizeof(digest)));
+
+    struct aws_hash_element *elem;
+    TEST_ASSERT_SUCCESS(aws_hash_table_create(&enc_ctx, (void *)bar, &elem, NULL));
+    elem->value = (void *)foo;
+    TEST_ASSERT_SUCCESS(serialize_init(alloc, &expected, &enc_ctx));
+    TEST_ASSERT(aws_byte_buf_eq(&flat.serialized, &expected));
+    aws_byte_buf_clean_up(&expected);
+
+    struct aws_cryptosdk_enc_ctx_flat rebuilt;
+    aws_cryptosdk_enc_ctx_flat_init(&rebuilt, alloc, NULL, 0);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_flat_set(&rebuilt, &enc_ctx));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_flat_digest(&rebuilt, digest));
+    TEST_ASSERT(!memcmp(digest, new_digest, sizeof(digest)));
+
+    /* Replacing a value keeps the order */
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_enc_ctx_flat_put(&rebuilt, aws_byte_cursor_from_string(bar), aws_byte_cursor_from_string(bar)));
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&rebuilt.entries), 4);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_flat_digest(&rebuilt, digest));
+    TEST_ASSERT(memcmp(digest, new_digest, sizeof(digest)));
+
+    aws_cryptosdk_enc_ctx_flat_clean_up(&rebuilt);
+    aws_cryptosdk_enc_ctx_flat_clean_up(&flat);
+    aws_hash_table_clean_up(&enc_ctx);
+    return 0;
+}
+
 struct test_case enc_ctx_test_cases[] = {
     { "enc_ctx", "get_sorted_elems_array_test", get_sorted_elems_array_test },
     { "enc_ctx", "serialize_empty_enc_ctx", serialize_empty_enc_ctx },
@@ -414,5 +494,6 @@ struct test_case enc_ctx_test_cases[] = {
     { "enc_ctx", "serialize_error_when_too_many_elements", serialize_error_when_too_many_elements },
     { "enc_ctx", "clone_test", enc_ctx_clone_test },
     { "enc_ctx", "deserialize_error_when_duplicate_key_in_context", deserialize_error_when_duplicate_key_in_context },
+    { "enc_ctx", "flat_enc_ctx_sorted_with_cached_serialization", flat_enc_ctx_sorted_with_cached_serialization },
     { NULL }
 };
@@ -922,10 +922,88 @@ int overwrite() {
 }
 #endif
 
+int borrowed_parse_views_header_bytes() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    size_t header_len           = sizeof(test_header_1) - 1;
+    uint8_t *input              = aws_mem_acquire(alloc, header_len);
+    uint8_t *copy               = aws_mem_acquire(alloc, header_len);
+    memcpy(input, test_header_1, header_len);
+
+    struct aws_cryptosdk_hdr hdr;
+    struct aws_byte_cursor cursor = aws_byte_cursor_from_array(input, header_len);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_hdr_init(&hdr, alloc));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_hdr_parse_borrowed(&hdr, &cursor));
+    TEST_ASSERT_INT_EQ(cursor.len, 0);
+    TEST_ASSERT_INT_EQ(aws_cryptosdk_hdr_size(&hdr), header_len);
+
+    // Move the header bytes, as the decrypt session does, and destroy the originals
+    memcpy(copy, input, header_len);
+    aws_cryptosdk_hdr_rebase(&hdr, input, copy);
+    memset(input, 0xff, header_len);
+    aws_mem_release(alloc, input);
+
+    struct aws_byte_cursor k1 = aws_byte_cursor_from_array("\x01\x02\x03\x04", 4);
+    const struct aws_byte_cursor *v1 = aws_cryptosdk_enc_ctx_flat_get(&hdr.enc_ctx_flat, k1);
+    TEST_ASSERT_ADDR_NOT_NULL(v1);
+    TEST_ASSERT(v1->ptr > copy && v1->ptr < copy + header_len);
+    TEST_ASSERT_CUR_EQ(*v1, 0x01, 0x00, 0x01, 0x00, 0x01);
+
+    struct aws_cryptosdk_edk *edk = NULL;
+    TEST_ASSERT_SUCCESS(aws_array_list_get_at_ptr(&hdr.edk_list, (void **)&edk, 1));
+    TEST_ASSERT_ADDR_NULL(edk->ciphertext.allocator);
+    TEST_ASSERT(edk->ciphertext.buffer > copy && edk->ciphertext.buffer < copy + header_len);
+    TEST_ASSERT_BUF_EQ(edk->provider_id, 0x10, 0x11, 0x12, 0x00);
+    TEST_ASSERT_BUF_EQ(edk->ciphertext, 0x11, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x88);
+    TEST_ASSERT_SUCCESS(aws_array_list_get_at_ptr(&hdr.edk_list, (void **)&edk, 0));
+    TEST_ASSERT_ADDR_NULL(edk->provider_id.buffer);
+
+    // The header is written out as it was read
+    uint8_t *outbuf = aws_mem_acquire(alloc, header_len);
+    size_t bytes_written;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_hdr_write(&hdr, &bytes_written, outbuf, header_len));
+    TEST_ASSERT_INT_EQ(bytes_written, header_len);
+    TEST_ASSERT(!memcmp(outbuf, test_header_1, header_len));
+    aws_mem_release(alloc, outbuf);
+
+    // The encryption context works as usual, and a clone of it outlives the header and its bytes;
+    AWS_STATIC_STRING_FROM_LITERAL(k1_str, "\x01\x02\x03\x04");
+    AWS_STATIC_STRING_FROM_LITERAL(v1_str, "\x01\x00\x01\x00\x01");
+    AWS_STATIC_STRING_FROM_LITERAL(empty, "");
+    struct aws_hash_table clone;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &clone));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_clone(alloc, &clone, &hdr.enc_ctx));
+    TEST_ASSERT_SUCCESS(aws_hash_table_remove(&hdr.enc_ctx, empty, NULL, NULL));
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(&hdr.enc_ctx, empty, (void *)v1_str, NULL));
+
+    // and the header is sized and written with the modified context, not the parsed bytes
+    TEST_ASSERT_INT_EQ(aws_cryptosdk_hdr_size(&hdr), header_len + v1_str->len);
+    outbuf = aws_mem_acquire(alloc, header_len + v1_str->len);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_hdr_write(&hdr, &bytes_written, outbuf, header_len + v1_str->len));
+    TEST_ASSERT_INT_EQ(bytes_written, header_len + v1_str->len);
+    aws_mem_release(alloc, outbuf);
+
+    aws_cryptosdk_hdr_clean_up(&hdr);
+    memset(copy, 0xff, header_len);
+    aws_mem_release(alloc, copy);
+
+    struct aws_hash_element *elem = NULL;
+    TEST_ASSERT_INT_EQ(2, aws_hash_table_get_entry_count(&clone));
+    TEST_ASSERT_SUCCESS(aws_hash_table_find(&clone, k1_str, &elem));
+    TEST_ASSERT_ADDR_NOT_NULL(elem);
+    TEST_ASSERT(aws_string_eq(elem->value, v1_str));
+    TEST_ASSERT_SUCCESS(aws_hash_table_find(&clone, empty, &elem));
+    TEST_ASSERT_ADDR_NOT_NULL(elem);
+    TEST_ASSERT(aws_string_eq(elem->value, empty));
+
+    aws_cryptosdk_enc_ctx_clean_up(&clone);
+    return 0;
+}
+
 struct test_case header_test_cases[] = {
     { "header", "parse", simple_header_parse },
     { "header", "parseHeaderV2", simple_headerV2_parse },
     { "header", "parse2", simple_header_parse2 },
+    { "header", "borrowed_parse_views_header_bytes", borrowed_parse_views_header_bytes },
     { "header", "failed_parse", failed_parse },
     { "header", "overread", overread },
     { "header", "size", header_size },
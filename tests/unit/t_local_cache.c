@@ -14,6 +14,7 @@
  */
 
 #include <aws/common/byte_buf.h>
+#include <aws/common/thread.h>
 #include <aws/cryptosdk/cache.h>
 #include <aws/cryptosdk/cipher.h>
 #include <aws/cryptosdk/enc_ctx.h>
@@ -162,6 +163,59 @@ static int entry_refcount() {
     return 0;
 }
 
+static int borrowed_materials() {
+    /*
+     * Materials returned from the cache borrow their EDKs from the cache entry; make sure they remain
+     * usable after the entry has been invalidated and the cache itself has been released.
+     */
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 16);
+    struct aws_cryptosdk_enc_materials *enc_mat_1, *enc_mat_2, *enc_mat_3;
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+    struct aws_hash_table enc_ctx;
+    struct aws_byte_buf cache_id;
+    struct aws_cryptosdk_cache_usage_stats stats = { 0 };
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+
+    gen_enc_materials(alloc, &enc_mat_1, 1, ALG_AES128_GCM_IV12_TAG16_HKDF_SHA256_ECDSA_P256, 3);
+    byte_buf_printf(&cache_id, alloc, "Cache ID 1");
+
+    aws_cryptosdk_materials_cache_put_entry_for_encrypt(cache, &entry, enc_mat_1, stats, &enc_ctx, &cache_id);
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_enc_materials(cache, alloc, &enc_mat_2, &enc_ctx, entry));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_enc_materials(cache, alloc, &enc_mat_3, &enc_ctx, entry));
+    TEST_ASSERT_ADDR_NOT_NULL(enc_mat_2->owner);
+    TEST_ASSERT_ADDR_NOT_NULL(enc_mat_2->signctx);
+
+    /* Both sets of materials share the same (borrowed) EDK buffers */
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&enc_mat_2->encrypted_data_keys), 3);
+    for (size_t i = 0; i < 3; i++) {
+        struct aws_cryptosdk_edk *edk_2, *edk_3;
+        TEST_ASSERT_SUCCESS(aws_array_list_get_at_ptr(&enc_mat_2->encrypted_data_keys, (void **)&edk_2, i));
+        TEST_ASSERT_SUCCESS(aws_array_list_get_at_ptr(&enc_mat_3->encrypted_data_keys, (void **)&edk_3, i));
+        TEST_ASSERT_ADDR_NULL(edk_2->ciphertext.allocator);
+        TEST_ASSERT_ADDR_EQ(edk_2->ciphertext.buffer, edk_3->ciphertext.buffer);
+    }
+
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, true);
+    aws_cryptosdk_materials_cache_clear(cache);
+    aws_cryptosdk_materials_cache_release(cache);
+
+    /* The borrowed EDKs must still be intact */
+    TEST_ASSERT(materials_eq(enc_mat_1, enc_mat_2));
+    aws_cryptosdk_enc_materials_destroy(enc_mat_2);
+    TEST_ASSERT(materials_eq(enc_mat_1, enc_mat_3));
+    aws_cryptosdk_enc_materials_destroy(enc_mat_3);
+
+    aws_byte_buf_clean_up(&cache_id);
+    aws_cryptosdk_enc_materials_destroy(enc_mat_1);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+
+    return 0;
+}
+
 static int setup_enc_params(
     int index,
     struct aws_cryptosdk_enc_materials **enc_mat,
@@ -380,6 +434,176 @@ static int test_ttl() {
     return 0;
 }
 
+static int test_external_expiry() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new_with_expiry(
+        alloc, 32, AWS_CRYPTOSDK_LOCAL_CACHE_EXPIRE_EXTERNAL, 0, AWS_TIMESTAMP_NANOS);
+    struct aws_cryptosdk_materials_cache_entry *entry;
+
+    TEST_ASSERT_ADDR_NOT_NULL(cache);
+
+    now = 10000;
+    aws_cryptosdk_local_cache_set_clock(cache, test_clock);
+
+    /* More expiring entries than fit in a single sweep batch */
+    for (int i = 0; i < 20; i++) {
+        insert_enc_entry(cache, i, &entry);
+        aws_cryptosdk_materials_cache_entry_ttl_hint(cache, entry, i < 18 ? 10010 : 20000);
+        aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    }
+    insert_enc_entry(cache, 20, NULL);
+
+    now = 10010;
+
+    /* Inserts leave the TTL heap alone... */
+    insert_enc_entry(cache, 21, NULL);
+    TEST_ASSERT_INT_EQ(22, aws_cryptosdk_materials_cache_entry_count(cache));
+
+    /* ...but an expired entry is never returned */
+    if (check_enc_entry(cache, 0, false, false, NULL)) return 1;
+    TEST_ASSERT_INT_EQ(21, aws_cryptosdk_materials_cache_entry_count(cache));
+
+    /* Entries evicted while referenced are destroyed once the last reference goes */
+    if (check_enc_entry(cache, 19, true, false, &entry)) return 1;
+    if (check_enc_entry(cache, 19, true, true, NULL)) return 1;
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_local_cache_process_expirations(cache));
+    TEST_ASSERT_INT_EQ(3, aws_cryptosdk_materials_cache_entry_count(cache));
+
+    for (int i = 1; i < 18; i++) {
+        if (check_enc_entry(cache, i, false, false, NULL)) return 1;
+    }
+    if (check_enc_entry(cache, 18, true, false, NULL)) return 1;
+    if (check_enc_entry(cache, 20, true, false, NULL)) return 1;
+    if (check_enc_entry(cache, 21, true, false, NULL)) return 1;
+
+    /* Leave some evicted entries for teardown to destroy */
+    aws_cryptosdk_materials_cache_clear(cache);
+    aws_cryptosdk_materials_cache_release(cache);
+
+    struct mock_materials_cache *mock = mock_materials_cache_new(alloc);
+    TEST_ASSERT_ADDR_NOT_NULL(mock);
+    TEST_ASSERT_ERROR(AWS_ERROR_INVALID_ARGUMENT, aws_cryptosdk_local_cache_process_expirations(&mock->base));
+    aws_cryptosdk_materials_cache_release(&mock->base);
+
+    return 0;
+}
+
+/* Counts frees, to check which thread destroys evicted entries */
+static size_t counting_frees;
+
+static void *counting_acquire(struct aws_allocator *allocator, size_t size) {
+    (void)allocator;
+    return aws_mem_acquire(aws_default_allocator(), size);
+}
+
+static void counting_release(struct aws_allocator *allocator, void *ptr) {
+    (void)allocator;
+    counting_frees++;
+    aws_mem_release(aws_default_allocator(), ptr);
+}
+
+static struct aws_allocator counting_allocator = { .mem_acquire = counting_acquire, .mem_release = counting_release };
+
+static int test_release_defers_destruction() {
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new_with_expiry(
+        &counting_allocator, 16, AWS_CRYPTOSDK_LOCAL_CACHE_EXPIRE_EXTERNAL, 0, AWS_TIMESTAMP_NANOS);
+    struct aws_cryptosdk_materials_cache_entry *entry;
+
+    TEST_ASSERT_ADDR_NOT_NULL(cache);
+
+    /* Evict the entry while we still hold a reference to it */
+    insert_enc_entry(cache, 0, &entry);
+    aws_cryptosdk_materials_cache_clear(cache);
+    TEST_ASSERT_INT_EQ(0, aws_cryptosdk_materials_cache_entry_count(cache));
+
+    /* Dropping the last reference, outside the cache lock, frees nothing on this thread... */
+    size_t frees = counting_frees;
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    TEST_ASSERT_INT_EQ(frees, counting_frees);
+
+    /* ...but leaves the entry for the expiry sweep to destroy */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_local_cache_process_expirations(cache));
+    TEST_ASSERT(counting_frees > frees);
+
+    aws_cryptosdk_materials_cache_release(cache);
+    return 0;
+}
+
+static int test_external_graveyard_cap() {
+    /* The minimum capacity, so that the graveyard holds at most two entries */
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new_with_expiry(
+        &counting_allocator, 2, AWS_CRYPTOSDK_LOCAL_CACHE_EXPIRE_EXTERNAL, 0, AWS_TIMESTAMP_NANOS);
+    struct aws_cryptosdk_materials_cache_entry *entries[3];
+
+    TEST_ASSERT_ADDR_NOT_NULL(cache);
+
+    for (int i = 0; i < 3; i++) {
+        insert_enc_entry(cache, i, &entries[i]);
+    }
+    aws_cryptosdk_materials_cache_clear(cache);
+
+    /* Without a sweep, the first two evicted entries wait on the graveyard... */
+    size_t frees = counting_frees;
+    aws_cryptosdk_materials_cache_entry_release(cache, entries[0], false);
+    aws_cryptosdk_materials_cache_entry_release(cache, entries[1], false);
+    TEST_ASSERT_INT_EQ(frees, counting_frees);
+
+    /* ...but once it is full, the releasing thread destroys the entry itself */
+    aws_cryptosdk_materials_cache_entry_release(cache, entries[2], false);
+    TEST_ASSERT(counting_frees > frees);
+
+    /* A sweep empties the graveyard, making room for more */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_local_cache_process_expirations(cache));
+    insert_enc_entry(cache, 3, &entries[0]);
+    aws_cryptosdk_materials_cache_clear(cache);
+    frees = counting_frees;
+    aws_cryptosdk_materials_cache_entry_release(cache, entries[0], false);
+    TEST_ASSERT_INT_EQ(frees, counting_frees);
+
+    aws_cryptosdk_materials_cache_release(cache);
+    return 0;
+}
+
+static int test_background_expiry() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache;
+    struct aws_cryptosdk_materials_cache_entry *entry;
+
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_materials_cache_local_new_with_expiry(
+        alloc, 16, AWS_CRYPTOSDK_LOCAL_CACHE_EXPIRE_BACKGROUND, 0, AWS_TIMESTAMP_MILLIS));
+    TEST_ASSERT_INT_EQ(AWS_ERROR_INVALID_ARGUMENT, aws_last_error());
+
+    cache = aws_cryptosdk_materials_cache_local_new_with_expiry(
+        alloc, 16, AWS_CRYPTOSDK_LOCAL_CACHE_EXPIRE_BACKGROUND, 1, AWS_TIMESTAMP_MILLIS);
+    TEST_ASSERT_ADDR_NOT_NULL(cache);
+
+    now = 10000;
+    aws_cryptosdk_local_cache_set_clock(cache, test_clock);
+
+    for (int i = 0; i < 12; i++) {
+        insert_enc_entry(cache, i, &entry);
+        aws_cryptosdk_materials_cache_entry_ttl_hint(cache, entry, 10010);
+        aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    }
+    insert_enc_entry(cache, 12, NULL);
+
+    now = 10010;
+
+    /* Give the janitor up to ten seconds to notice */
+    for (int i = 0; i < 10000 && aws_cryptosdk_materials_cache_entry_count(cache) != 1; i++) {
+        aws_thread_current_sleep(1000 * 1000);
+    }
+
+    TEST_ASSERT_INT_EQ(1, aws_cryptosdk_materials_cache_entry_count(cache));
+    if (check_enc_entry(cache, 12, true, false, NULL)) return 1;
+
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
 static int overwrite_enc_entry() {
     struct aws_allocator *alloc                 = aws_default_allocator();
     struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 16);
@@ -560,16 +784,204 @@ static int test_materials_cache_entry_count() {
     return 0;
 }
 
+static int test_stats() {
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(aws_default_allocator(), 2);
+    struct aws_cryptosdk_materials_cache_entry *entry;
+    struct aws_cryptosdk_materials_cache_stats stats;
+
+    now = 10000;
+    aws_cryptosdk_local_cache_set_clock(cache, test_clock);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(0, stats.hits + stats.misses + stats.evictions_capacity);
+
+    insert_enc_entry(cache, 0, &entry);
+    aws_cryptosdk_materials_cache_entry_ttl_hint(cache, entry, 10010);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    insert_enc_entry(cache, 1, NULL);
+
+    if (check_enc_entry(cache, 0, true, false, NULL)) return 1;
+    if (check_enc_entry(cache, 2, false, false, NULL)) return 1;
+
+    /* Entry 1 is now least recently used, so this evicts it */
+    insert_enc_entry(cache, 2, NULL);
+    /* Invalidate entry 2 as the caching CMM would on reaching a usage limit */
+    if (check_enc_entry(cache, 2, true, true, NULL)) return 1;
+
+    now = 10010;
+    if (check_enc_entry(cache, 0, false, false, NULL)) return 1;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(2, stats.hits);
+    TEST_ASSERT_INT_EQ(2, stats.misses);
+    TEST_ASSERT_INT_EQ(1, stats.evictions_capacity);
+    TEST_ASSERT_INT_EQ(1, stats.evictions_ttl);
+    TEST_ASSERT_INT_EQ(1, stats.evictions_invalidated);
+
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static int test_max_bytes() {
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(aws_default_allocator(), 16);
+
+    TEST_ASSERT_INT_EQ(0, aws_cryptosdk_local_cache_get_approx_bytes(cache));
+
+    for (int i = 0; i < 4; i++) {
+        insert_enc_entry(cache, i, NULL);
+    }
+
+    size_t total_bytes = aws_cryptosdk_local_cache_get_approx_bytes(cache);
+    TEST_ASSERT(total_bytes > 0);
+
+    /* Lowering the budget evicts least recently used entries, starting with entry 0 */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_local_cache_set_max_bytes(cache, total_bytes - 1));
+    TEST_ASSERT(aws_cryptosdk_materials_cache_entry_count(cache) < 4);
+    TEST_ASSERT(aws_cryptosdk_local_cache_get_approx_bytes(cache) <= total_bytes - 1);
+    if (check_enc_entry(cache, 0, false, false, NULL)) return 1;
+    if (check_enc_entry(cache, 3, true, false, NULL)) return 1;
+
+    /* New entries push out old ones to stay within the budget */
+    insert_enc_entry(cache, 4, NULL);
+    TEST_ASSERT(aws_cryptosdk_local_cache_get_approx_bytes(cache) <= total_bytes - 1);
+    if (check_enc_entry(cache, 4, true, false, NULL)) return 1;
+
+    /* Entries larger than the budget are not cached at all */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_local_cache_set_max_bytes(cache, 1));
+    TEST_ASSERT_INT_EQ(0, aws_cryptosdk_materials_cache_entry_count(cache));
+    TEST_ASSERT_INT_EQ(0, aws_cryptosdk_local_cache_get_approx_bytes(cache));
+
+    struct aws_cryptosdk_enc_materials *enc_mat;
+    struct aws_hash_table enc_ctx;
+    struct aws_byte_buf cache_id;
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+    struct aws_cryptosdk_cache_usage_stats stats      = { 0, 0 };
+
+    TEST_ASSERT_SUCCESS(setup_enc_params(5, &enc_mat, &enc_ctx, &cache_id));
+    aws_cryptosdk_materials_cache_put_entry_for_encrypt(cache, &entry, enc_mat, stats, &enc_ctx, &cache_id);
+    TEST_ASSERT_ADDR_NULL(entry);
+
+    /* Removing the budget allows it again */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_local_cache_set_max_bytes(cache, 0));
+    aws_cryptosdk_materials_cache_put_entry_for_encrypt(cache, &entry, enc_mat, stats, &enc_ctx, &cache_id);
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+
+    aws_cryptosdk_enc_materials_destroy(enc_mat);
+    aws_byte_buf_clean_up(&cache_id);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+/* Looks up entry #index, inserting it on a miss as the caching CMM would; returns true on a hit */
+static bool access_entry(struct aws_cryptosdk_materials_cache *cache, int index) {
+    struct aws_byte_buf cache_id;
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+
+    byte_buf_printf(&cache_id, aws_default_allocator(), "ID %d", index);
+    if (aws_cryptosdk_materials_cache_find_entry(cache, &entry, NULL, &cache_id)) abort();
+    aws_byte_buf_clean_up(&cache_id);
+
+    if (entry) {
+        aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+        return true;
+    }
+
+    insert_enc_entry(cache, index, NULL);
+    return false;
+}
+
+/*
+ * Runs a workload in which a hot set of 8 entries is used repeatedly, then a scan touches 64 cold entries once
+ * each, then the hot set is used again; returns the number of hot set hits after the scan.
+ */
+static int hot_hits_after_scan(enum aws_cryptosdk_local_cache_eviction_policy policy) {
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(aws_default_allocator(), 16);
+    int hits                                    = 0;
+
+    if (aws_cryptosdk_local_cache_set_eviction_policy(cache, policy)) abort();
+
+    for (int round = 0; round < 10; round++) {
+        for (int i = 0; i < 8; i++) {
+            access_entry(cache, i);
+        }
+    }
+
+    for (int i = 100; i < 164; i++) {
+        access_entry(cache, i);
+    }
+
+    for (int i = 0; i < 8; i++) {
+        hits += access_entry(cache, i);
+    }
+
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return hits;
+}
+
+static int test_tinylfu_scan_resistance() {
+    /* A scan larger than the cache flushes the hot set under LRU, but not under TinyLFU */
+    TEST_ASSERT_INT_EQ(0, hot_hits_after_scan(AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_LRU));
+    TEST_ASSERT_INT_EQ(8, hot_hits_after_scan(AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_TINYLFU));
+
+    return 0;
+}
+
+static int test_tinylfu_policy_switch() {
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(aws_default_allocator(), 16);
+
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT,
+        aws_cryptosdk_local_cache_set_eviction_policy(cache, (enum aws_cryptosdk_local_cache_eviction_policy)42));
+
+    /* Switching while full must still respect the capacity, and keep the entries */
+    for (int i = 0; i < 16; i++) {
+        insert_enc_entry(cache, i, NULL);
+    }
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_local_cache_set_eviction_policy(cache, AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_TINYLFU));
+    TEST_ASSERT_INT_EQ(16, aws_cryptosdk_materials_cache_entry_count(cache));
+
+    insert_enc_entry(cache, 16, NULL);
+    insert_enc_entry(cache, 17, NULL);
+    TEST_ASSERT_INT_EQ(16, aws_cryptosdk_materials_cache_entry_count(cache));
+    if (check_enc_entry(cache, 17, true, false, NULL)) return 1;
+
+    /* Switching back moves the admission window into the LRU list */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_local_cache_set_eviction_policy(cache, AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_LRU));
+    TEST_ASSERT_INT_EQ(16, aws_cryptosdk_materials_cache_entry_count(cache));
+    if (check_enc_entry(cache, 17, true, false, NULL)) return 1;
+
+    aws_cryptosdk_materials_cache_clear(cache);
+    TEST_ASSERT_INT_EQ(0, aws_cryptosdk_materials_cache_entry_count(cache));
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
 #define TEST_CASE(name) \
     { "local_cache", #name, name }
 struct test_case local_cache_test_cases[] = { TEST_CASE(create_destroy),
                                               TEST_CASE(single_put),
                                               TEST_CASE(entry_refcount),
+                                              TEST_CASE(borrowed_materials),
                                               TEST_CASE(test_lru),
                                               TEST_CASE(test_ttl),
+                                              TEST_CASE(test_external_expiry),
+                                              TEST_CASE(test_release_defers_destruction),
+                                              TEST_CASE(test_external_graveyard_cap),
+                                              TEST_CASE(test_background_expiry),
                                               TEST_CASE(overwrite_enc_entry),
                                               TEST_CASE(clear_cache),
                                               TEST_CASE(hash_truncation),
                                               TEST_CASE(test_decrypt_entries),
                                               TEST_CASE(test_materials_cache_entry_count),
+                                              TEST_CASE(test_stats),
+                                              TEST_CASE(test_max_bytes),
+                                              TEST_CASE(test_tinylfu_scan_resistance),
+                                              TEST_CASE(test_tinylfu_policy_switch),
                                               { NULL } };
@@ -473,6 +473,108 @@ int on_decrypt_postcondition_violation() {
     return 0;
 }
 
+static int edk_index_find() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_array_list edks;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_edk_list_init(alloc, &edks));
+
+    const char *ids[]   = { "raw", "aws-kms", "raw", "raw", "aws-kms" };
+    const char *infos[] = { "key-a", "arn-1", "key-b", "key-a", "arn-2" };
+    for (size_t i = 0; i < sizeof(ids) / sizeof(ids[0]); i++) {
+        struct aws_cryptosdk_edk edk = { .provider_id   = aws_byte_buf_from_c_str(ids[i]),
+                                         .provider_info = aws_byte_buf_from_c_str(infos[i]),
+                                         .ciphertext    = aws_byte_buf_from_c_str("ciphertext") };
+        TEST_ASSERT_SUCCESS(aws_array_list_push_back(&edks, &edk));
+    }
+
+    struct aws_cryptosdk_edk_index *index = aws_cryptosdk_edk_index_new(alloc, &edks);
+    TEST_ASSERT_ADDR_NOT_NULL(index);
+
+    const size_t *positions;
+    size_t num_positions;
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_edk_index_find(index, aws_byte_cursor_from_c_str("raw"), NULL, &positions, &num_positions));
+    TEST_ASSERT_INT_EQ(3, num_positions);
+    TEST_ASSERT_INT_EQ(0, positions[0]);
+    TEST_ASSERT_INT_EQ(2, positions[1]);
+    TEST_ASSERT_INT_EQ(3, positions[2]);
+
+    struct aws_byte_cursor info = aws_byte_cursor_from_c_str("key-a");
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_edk_index_find(index, aws_byte_cursor_from_c_str("raw"), &info, &positions, &num_positions));
+    TEST_ASSERT_INT_EQ(2, num_positions);
+    TEST_ASSERT_INT_EQ(0, positions[0]);
+    TEST_ASSERT_INT_EQ(3, positions[1]);
+
+    /* Provider info under a different provider ID must not match */
+    info = aws_byte_cursor_from_c_str("arn-1");
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_edk_index_find(index, aws_byte_cursor_from_c_str("raw"), &info, &positions, &num_positions));
+    TEST_ASSERT_INT_EQ(0, num_positions);
+    TEST_ASSERT_ADDR_NULL(positions);
+
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_edk_index_find(index, aws_byte_cursor_from_c_str("none"), NULL, &positions, &num_positions));
+    TEST_ASSERT_INT_EQ(0, num_positions);
+
+    aws_cryptosdk_edk_index_destroy(index);
+    aws_cryptosdk_edk_list_clean_up(&edks);
+    return 0;
+}
+
+/* Checks every lookup in an index over many EDKs against a scan of the list */
+static int edk_index_find_matches_scan() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_array_list edks;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_edk_list_init(alloc, &edks));
+
+    const char *ids[]   = { "raw", "aws-kms", "a" };
+    const char *infos[] = { "key-a", "key-b", "arn-1", "", "arn-22" };
+    for (size_t i = 0; i < 100; i++) {
+        struct aws_cryptosdk_edk edk = { .provider_id   = aws_byte_buf_from_c_str(ids[(i * 7) % 3]),
+                                         .provider_info = aws_byte_buf_from_c_str(infos[(i * 3) % 5]),
+                                         .ciphertext    = aws_byte_buf_from_c_str("ciphertext") };
+        TEST_ASSERT_SUCCESS(aws_array_list_push_back(&edks, &edk));
+    }
+
+    /* Never looked up, so never built */
+    struct aws_cryptosdk_edk_index *index = aws_cryptosdk_edk_index_new(alloc, &edks);
+    TEST_ASSERT_ADDR_NOT_NULL(index);
+    aws_cryptosdk_edk_index_destroy(index);
+
+    index = aws_cryptosdk_edk_index_new(alloc, &edks);
+    TEST_ASSERT_ADDR_NOT_NULL(index);
+    for (size_t id = 0; id < sizeof(ids) / sizeof(ids[0]); id++) {
+        for (size_t info = 0; info <= sizeof(infos) / sizeof(infos[0]); info++) {
+            struct aws_byte_cursor provider_id   = aws_byte_cursor_from_c_str(ids[id]);
+            struct aws_byte_cursor provider_info = { 0 };
+            bool any_info                        = info == sizeof(infos) / sizeof(infos[0]);
+            if (!any_info) provider_info = aws_byte_cursor_from_c_str(infos[info]);
+
+            const size_t *positions;
+            size_t num_positions;
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_edk_index_find(
+                index, provider_id, any_info ? NULL : &provider_info, &positions, &num_positions));
+
+            size_t found = 0;
+            for (size_t idx = 0; idx < aws_array_list_length(&edks); idx++) {
+                struct aws_cryptosdk_edk *edk;
+                TEST_ASSERT_SUCCESS(aws_array_list_get_at_ptr(&edks, (void **)&edk, idx));
+                if (!aws_byte_cursor_eq_byte_buf(&provider_id, &edk->provider_id)) continue;
+                if (!any_info && !aws_byte_cursor_eq_byte_buf(&provider_info, &edk->provider_info)) continue;
+                TEST_ASSERT(found < num_positions);
+                TEST_ASSERT_INT_EQ(idx, positions[found]);
+                found++;
+            }
+            TEST_ASSERT_INT_EQ(found, num_positions);
+        }
+    }
+
+    aws_cryptosdk_edk_index_destroy(index);
+    aws_cryptosdk_edk_list_clean_up(&edks);
+    return 0;
+}
+
 struct test_case materials_test_cases[] = {
     { "materials", "default_cmm_zero_keyring_enc_mat", default_cmm_zero_keyring_enc_mat },
     { "materials", "default_cmm_zero_keyring_dec_mat", default_cmm_zero_keyring_dec_mat },
@@ -490,5 +592,7 @@ struct test_case materials_test_cases[] = {
     { "materials", "on_encrypt_postcondition_violation", on_encrypt_postcondition_violation },
     { "materials", "on_decrypt_precondition_violation", on_decrypt_precondition_violation },
     { "materials", "on_decrypt_postcondition_violation", on_decrypt_postcondition_violation },
+    { "materials", "edk_index_find", edk_index_find },
+    { "materials", "edk_index_find_matches_scan", edk_index_find_matches_scan },
     { NULL }
 };
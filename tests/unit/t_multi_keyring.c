@@ -12,6 +12,9 @@
  * implied. See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <aws/common/condition_variable.h>
+#include <aws/common/mutex.h>
+#include <aws/common/thread.h>
 #include <aws/cryptosdk/multi_keyring.h>
 #include "test_keyring.h"
 #include "testing.h"
@@ -354,6 +357,269 @@ int fail_when_error_and_no_decrypt() {
     return 0;
 }
 
+static int inline_executor_calls;
+
+static int inline_executor(void *executor_data, void (*task)(void *task_data), void *task_data) {
+    TEST_ASSERT_ADDR_EQ(executor_data, &inline_executor_calls);
+    inline_executor_calls++;
+    task(task_data);
+    return AWS_OP_SUCCESS;
+}
+
+/* Runs each task on a thread of its own; thread_executor_join_all joins them */
+static struct aws_thread executor_threads[8];
+static size_t num_executor_threads;
+
+static int thread_executor(void *executor_data, void (*task)(void *task_data), void *task_data) {
+    struct aws_thread *thread;
+    (void)executor_data;
+
+    if (num_executor_threads == sizeof(executor_threads) / sizeof(*executor_threads)) return AWS_OP_ERR;
+    thread = &executor_threads[num_executor_threads];
+    if (aws_thread_init(thread, alloc)) return AWS_OP_ERR;
+    if (aws_thread_launch(thread, task, task_data, aws_default_thread_options())) {
+        aws_thread_clean_up(thread);
+        return AWS_OP_ERR;
+    }
+
+    num_executor_threads++;
+    return AWS_OP_SUCCESS;
+}
+
+static void thread_executor_join_all() {
+    for (size_t i = 0; i < num_executor_threads; i++) {
+        aws_thread_join(&executor_threads[i]);
+        aws_thread_clean_up(&executor_threads[i]);
+    }
+    num_executor_threads = 0;
+}
+
+int concurrent_encrypt_calls_all_children() {
+    /* First without an executor, which leaves the children called in turn, then with one */
+    for (int use_executor = 0; use_executor < 2; ++use_executor) {
+        TEST_ASSERT_SUCCESS(set_up_all_the_things(true));
+        struct aws_byte_buf unencrypted_data_key = { 0 };
+
+        inline_executor_calls = 0;
+        if (use_executor) {
+            TEST_ASSERT_SUCCESS(
+                aws_cryptosdk_multi_keyring_set_executor(multi, inline_executor, &inline_executor_calls));
+        }
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_multi_keyring_set_concurrent_encrypt(multi, true));
+
+        TEST_ASSERT_SUCCESS(
+            aws_cryptosdk_keyring_on_encrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+        TEST_ASSERT_ADDR_EQ(unencrypted_data_key.buffer, test_data_key);
+
+        for (size_t kr_idx = 0; kr_idx < num_test_keyrings; ++kr_idx) {
+            TEST_ASSERT(test_keyrings[kr_idx].on_encrypt_called);
+            uint32_t flags = AWS_CRYPTOSDK_WRAPPING_KEY_ENCRYPTED_DATA_KEY;
+            if (!kr_idx) flags |= AWS_CRYPTOSDK_WRAPPING_KEY_GENERATED_DATA_KEY;
+            TEST_ASSERT_SUCCESS(assert_keyring_trace_record(&keyring_trace, kr_idx, NULL, NULL, flags));
+        }
+        TEST_ASSERT_INT_EQ(aws_array_list_length(&edks), num_test_keyrings);
+
+        /* The first child runs on the requesting thread */
+        TEST_ASSERT_INT_EQ(inline_executor_calls, use_executor ? num_test_keyrings - 2 : 0);
+
+        tear_down_all_the_things();
+    }
+    return 0;
+}
+
+int concurrent_encrypt_fails_when_any_child_fails() {
+    TEST_ASSERT_SUCCESS(set_up_all_the_things(true));
+    struct aws_byte_buf unencrypted_data_key = { 0 };
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_multi_keyring_set_executor(multi, inline_executor, &inline_executor_calls));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_multi_keyring_set_concurrent_encrypt(multi, true));
+    test_keyrings[2].ret = AWS_OP_ERR;
+
+    TEST_ASSERT_INT_EQ(
+        AWS_OP_ERR,
+        aws_cryptosdk_keyring_on_encrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+
+    /* Unlike sequential mode, the children after the failing one are still called */
+    for (size_t kr_idx = 0; kr_idx < num_test_keyrings; ++kr_idx) {
+        TEST_ASSERT(test_keyrings[kr_idx].on_encrypt_called);
+    }
+
+    TEST_ASSERT(!aws_array_list_length(&edks));
+    TEST_ASSERT(!aws_array_list_length(&keyring_trace));
+
+    tear_down_all_the_things();
+    return 0;
+}
+
+int hedged_decrypt_stops_at_first_key() {
+    TEST_ASSERT_SUCCESS(set_up_all_the_things(true));
+
+    /* Synchronous executor: each keyring fails or finds nothing before the delay, so the next starts at once */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_multi_keyring_set_executor(multi, inline_executor, &inline_executor_calls));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_multi_keyring_set_hedged_decrypt(multi, true, 3600, AWS_TIMESTAMP_SECS));
+
+    test_keyrings[2].ret = AWS_OP_ERR;
+
+    const size_t successful_keyring = 3;
+
+    test_keyrings[successful_keyring].decrypted_data_key_to_return = aws_byte_buf_from_c_str(test_data_key);
+
+    struct aws_byte_buf unencrypted_data_key = { 0 };
+
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_keyring_on_decrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+    TEST_ASSERT_ADDR_EQ(unencrypted_data_key.buffer, test_data_key);
+
+    size_t kr_idx = 0;
+    for (; kr_idx <= successful_keyring; ++kr_idx) {
+        TEST_ASSERT(test_keyrings[kr_idx].on_decrypt_called);
+    }
+    for (; kr_idx < num_test_keyrings; ++kr_idx) {
+        TEST_ASSERT(!test_keyrings[kr_idx].on_decrypt_called);
+    }
+
+    /* Only the winner's trace is kept */
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&keyring_trace), 1);
+    TEST_ASSERT_SUCCESS(
+        assert_keyring_trace_record(&keyring_trace, 0, NULL, NULL, AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY));
+
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT,
+        aws_cryptosdk_multi_keyring_set_hedged_decrypt(multi, true, 1, (enum aws_timestamp_unit)7));
+
+    tear_down_all_the_things();
+    return 0;
+}
+
+int hedged_decrypt_fails_when_error_and_no_decrypt() {
+    TEST_ASSERT_SUCCESS(set_up_all_the_things(true));
+
+    /* A thread per keyring, all started at once */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_multi_keyring_set_executor(multi, thread_executor, NULL));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_multi_keyring_set_hedged_decrypt(multi, true, 0, AWS_TIMESTAMP_NANOS));
+
+    test_keyrings[1].ret = AWS_OP_ERR;
+
+    struct aws_byte_buf unencrypted_data_key = { 0 };
+
+    TEST_ASSERT_INT_EQ(
+        AWS_OP_ERR,
+        aws_cryptosdk_keyring_on_decrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+    TEST_ASSERT_ADDR_NULL(unencrypted_data_key.buffer);
+
+    /*
+     * Without a winner, On Decrypt returns only once every keyring has finished, and the race has released
+     * them, so only the multi-keyring and the test hold references. The threads are joined all the same,
+     * so that none of them is still running when the next test resets test_keyrings.
+     */
+    thread_executor_join_all();
+    for (size_t kr_idx = 0; kr_idx < num_test_keyrings; ++kr_idx) {
+        TEST_ASSERT(test_keyrings[kr_idx].on_decrypt_called);
+        TEST_ASSERT_INT_EQ(2, aws_atomic_load_int(&test_keyrings[kr_idx].base.refcount));
+    }
+    TEST_ASSERT(!aws_array_list_length(&keyring_trace));
+
+    tear_down_all_the_things();
+    return 0;
+}
+
+/* A keyring which finds nothing, but only once its gate has been opened */
+struct gated_keyring {
+    struct aws_cryptosdk_keyring base;
+    struct aws_mutex lock;
+    struct aws_condition_variable opened;
+    bool open, returned;
+};
+
+static void gated_keyring_destroy(struct aws_cryptosdk_keyring *kr) {
+    (void)kr;
+}
+
+static int gated_keyring_on_decrypt(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    struct gated_keyring *self = (struct gated_keyring *)kr;
+    (void)request_alloc;
+    (void)unencrypted_data_key;
+    (void)keyring_trace;
+    (void)edks;
+    (void)enc_ctx;
+    (void)alg;
+
+    if (aws_mutex_lock(&self->lock)) abort();
+    while (!self->open) {
+        aws_condition_variable_wait(&self->opened, &self->lock);
+    }
+    self->returned = true;
+    if (aws_mutex_unlock(&self->lock)) abort();
+    return AWS_OP_SUCCESS;
+}
+
+static const struct aws_cryptosdk_keyring_vt gated_keyring_vt = { .vt_size    = sizeof(gated_keyring_vt),
+                                                                  .name       = "gated keyring",
+                                                                  .destroy    = gated_keyring_destroy,
+                                                                  .on_decrypt = gated_keyring_on_decrypt };
+
+int hedged_decrypt_returns_before_losing_keyrings() {
+    struct gated_keyring gated = { { 0 } };
+    bool returned;
+
+    TEST_ASSERT_SUCCESS(aws_mutex_init(&gated.lock));
+    TEST_ASSERT_SUCCESS(aws_condition_variable_init(&gated.opened));
+
+    TEST_ASSERT_SUCCESS(set_up_all_the_things(false));
+    aws_cryptosdk_keyring_release(multi);
+
+    /* The gated generator starts first, and the child wins while it is still blocked */
+    aws_cryptosdk_keyring_base_init(&gated.base, &gated_keyring_vt);
+    multi = aws_cryptosdk_multi_keyring_new(alloc, &gated.base);
+    TEST_ASSERT_ADDR_NOT_NULL(multi);
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_multi_keyring_add_child(multi, (struct aws_cryptosdk_keyring *)&test_keyrings[1]));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_multi_keyring_set_executor(multi, thread_executor, NULL));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_multi_keyring_set_hedged_decrypt(multi, true, 0, AWS_TIMESTAMP_NANOS));
+
+    test_keyrings[1].decrypted_data_key_to_return = aws_byte_buf_from_c_str(test_data_key);
+
+    struct aws_byte_buf unencrypted_data_key = { 0 };
+
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_keyring_on_decrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+    TEST_ASSERT_ADDR_EQ(unencrypted_data_key.buffer, test_data_key);
+
+    /* Only the winner's trace is kept */
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&keyring_trace), 1);
+
+    /* On Decrypt did not wait for the generator, which the race still holds a reference to */
+    if (aws_mutex_lock(&gated.lock)) abort();
+    returned = gated.returned;
+    if (aws_mutex_unlock(&gated.lock)) abort();
+    TEST_ASSERT(!returned);
+    TEST_ASSERT_INT_EQ(3, aws_atomic_load_int(&gated.base.refcount));
+
+    /* The losing call keeps running after the multi-keyring and the request's lists are gone */
+    tear_down_all_the_things();
+
+    if (aws_mutex_lock(&gated.lock)) abort();
+    gated.open = true;
+    aws_condition_variable_notify_all(&gated.opened);
+    if (aws_mutex_unlock(&gated.lock)) abort();
+
+    /* Once it returns, the race is freed, and with it its reference to the generator */
+    thread_executor_join_all();
+    TEST_ASSERT(gated.returned);
+    TEST_ASSERT_INT_EQ(1, aws_atomic_load_int(&gated.base.refcount));
+
+    aws_condition_variable_clean_up(&gated.opened);
+    aws_mutex_clean_up(&gated.lock);
+    return 0;
+}
+
 struct test_case multi_keyring_test_cases[] = {
     { "multi_keyring", "delegates_on_encrypt_calls", delegates_on_encrypt_calls },
     { "multi_keyring",
@@ -371,6 +637,17 @@ struct test_case multi_keyring_test_cases[] = {
     { "multi_keyring", "fail_on_failed_generate_and_stop", fail_on_failed_generate_and_stop },
     { "multi_keyring", "succeed_when_no_error_and_no_decrypt", succeed_when_no_error_and_no_decrypt },
     { "multi_keyring", "fail_when_error_and_no_decrypt", fail_when_error_and_no_decrypt },
+    { "multi_keyring", "concurrent_encrypt_calls_all_children", concurrent_encrypt_calls_all_children },
+    { "multi_keyring",
+      "concurrent_encrypt_fails_when_any_child_fails",
+      concurrent_encrypt_fails_when_any_child_fails },
+    { "multi_keyring", "hedged_decrypt_stops_at_first_key", hedged_decrypt_stops_at_first_key },
+    { "multi_keyring",
+      "hedged_decrypt_fails_when_error_and_no_decrypt",
+      hedged_decrypt_fails_when_error_and_no_decrypt },
+    { "multi_keyring",
+      "hedged_decrypt_returns_before_losing_keyrings",
+      hedged_decrypt_returns_before_losing_keyrings },
     { "multi_keyring", "adds_and_removes_refs", adds_and_removes_refs },
     { "multi_keyring", "adds_and_removes_refs_for_generator", adds_and_removes_refs_for_generator },
     { NULL }
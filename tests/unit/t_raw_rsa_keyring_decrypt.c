@@ -221,11 +221,41 @@ int decrypt_data_key_from_bad_rsa_padding_mode() {
     return 0;
 }
 
+/**
+ * A private key which does not parse is not an error when the keyring is created. The keyring falls back to
+ * passing the PEM string to the cipher functions, which fail on each use, and the EDK is skipped as before.
+ */
+int decrypt_falls_back_to_pem_when_key_does_not_parse() {
+    struct raw_rsa_keyring_test_vector tv = raw_rsa_keyring_test_vectors[0];
+
+    /* The parse error must not leak out of the constructor, whatever error was pending beforehand */
+    aws_raise_error(AWS_ERROR_OOM);
+    TEST_ASSERT_SUCCESS(set_up_all_the_things(tv.rsa_padding_mode, false));
+    TEST_ASSERT_INT_EQ(AWS_ERROR_SUCCESS, aws_last_error());
+
+    struct aws_cryptosdk_edk edk = edk_init_test_vector(&tv);
+    aws_array_list_push_back(&edks, (void *)&edk);
+
+    for (int round = 0; round < 2; round++) {
+        TEST_ASSERT_SUCCESS(
+            aws_cryptosdk_keyring_on_decrypt(kr, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, tv.alg));
+        TEST_ASSERT_ADDR_NULL(unencrypted_data_key.buffer);
+        TEST_ASSERT(!aws_array_list_length(&keyring_trace));
+        TEST_ASSERT_INT_EQ(AWS_ERROR_SUCCESS, aws_last_error());
+    }
+
+    tear_down_all_the_things();
+    return 0;
+}
+
 struct test_case raw_rsa_keyring_decrypt_test_cases[] = {
     { "raw_rsa_keyring", "decrypt_data_key_from_test_vectors", decrypt_data_key_from_test_vectors },
     { "raw_rsa_keyring", "decrypt_data_key_from_multiple_edks", decrypt_data_key_from_multiple_edks },
     { "raw_rsa_keyring", "decrypt_data_key_from_bad_edk", decrypt_data_key_from_bad_edk },
     { "raw_rsa_keyring", "decrypt_data_key_from_bad_rsa_private_key", decrypt_data_key_from_bad_rsa_private_key },
     { "raw_rsa_keyring", "decrypt_data_key_from_bad_rsa_padding_mode", decrypt_data_key_from_bad_rsa_padding_mode },
+    { "raw_rsa_keyring",
+      "decrypt_falls_back_to_pem_when_key_does_not_parse",
+      decrypt_falls_back_to_pem_when_key_does_not_parse },
     { NULL }
 };
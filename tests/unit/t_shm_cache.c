@@ -0,0 +1,521 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/common/atomics.h>
+#include <aws/common/byte_buf.h>
+#include <aws/common/thread.h>
+#include <aws/cryptosdk/cache.h>
+#include <aws/cryptosdk/cipher.h>
+#include <aws/cryptosdk/enc_ctx.h>
+#include <aws/cryptosdk/materials.h>
+#include "cache_test_lib.h"
+#include "testing.h"
+#include "testutil.h"
+
+#ifdef __linux__
+#    include <sys/resource.h>
+#    include <sys/wait.h>
+#    include <unistd.h>
+#endif
+
+/* Keep the segment small so that the tests fit within the default RLIMIT_MEMLOCK */
+#define SLOT_COUNT 8
+#define SLOT_SIZE 2048
+/* Number of times parsed_lock_across_fork forks while another thread is hitting on the cache */
+#define FORK_ROUNDS 20
+
+#ifdef __linux__
+
+static uint64_t now = 10000;
+
+/* Exposed for unit tests only */
+void aws_cryptosdk_shm_cache_set_clock(
+    struct aws_cryptosdk_materials_cache *generic_cache, int (*clock_get_ticks)(uint64_t *timestamp));
+
+static int test_clock(uint64_t *timestamp) {
+    *timestamp = now;
+    return AWS_OP_SUCCESS;
+}
+
+static int enc_round_trip() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache =
+        aws_cryptosdk_materials_cache_shm_new(alloc, SLOT_COUNT, SLOT_SIZE);
+    struct aws_cryptosdk_enc_materials *enc_mat_1, *enc_mat_2;
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+    struct aws_hash_table enc_ctx_1, enc_ctx_2;
+    struct aws_byte_buf cache_id;
+    struct aws_cryptosdk_cache_usage_stats stats_1 = { 1234, 4567 }, stats_2 = { 90000, 80000 };
+    bool is_encrypt                                = false;
+
+    TEST_ASSERT_ADDR_NOT_NULL(cache);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx_1));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx_2));
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(
+        &enc_ctx_1, aws_string_new_from_c_str(alloc, "foo"), aws_string_new_from_c_str(alloc, "bar"), NULL));
+
+    gen_enc_materials(alloc, &enc_mat_1, 1, ALG_AES128_GCM_IV12_TAG16_HKDF_SHA256_ECDSA_P256, 3);
+    byte_buf_printf(&cache_id, alloc, "Cache ID 1");
+
+    aws_cryptosdk_materials_cache_put_entry_for_encrypt(cache, &entry, enc_mat_1, stats_1, &enc_ctx_1, &cache_id);
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    TEST_ASSERT_INT_EQ(1, aws_cryptosdk_materials_cache_entry_count(cache));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_find_entry(cache, &entry, &is_encrypt, &cache_id));
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    TEST_ASSERT(is_encrypt);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_update_usage_stats(cache, entry, &stats_2));
+    TEST_ASSERT_INT_EQ(stats_2.bytes_encrypted, 91234);
+    TEST_ASSERT_INT_EQ(stats_2.messages_encrypted, 84567);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_enc_materials(cache, alloc, &enc_mat_2, &enc_ctx_2, entry));
+    TEST_ASSERT_ADDR_NOT_NULL(enc_mat_2);
+    TEST_ASSERT(materials_eq(enc_mat_1, enc_mat_2));
+    TEST_ASSERT(aws_hash_table_eq(&enc_ctx_1, &enc_ctx_2, aws_hash_callback_string_eq));
+
+    struct aws_cryptosdk_dec_materials *dec_materials = (struct aws_cryptosdk_dec_materials *)0xAA;
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_STATE,
+        aws_cryptosdk_materials_cache_get_dec_materials(cache, alloc, &dec_materials, entry));
+    TEST_ASSERT_ADDR_NULL(dec_materials);
+
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, true);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_find_entry(cache, &entry, &is_encrypt, &cache_id));
+    TEST_ASSERT_ADDR_NULL(entry);
+    TEST_ASSERT_INT_EQ(0, aws_cryptosdk_materials_cache_entry_count(cache));
+
+    aws_byte_buf_clean_up(&cache_id);
+    aws_cryptosdk_enc_materials_destroy(enc_mat_1);
+    aws_cryptosdk_enc_materials_destroy(enc_mat_2);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx_1);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx_2);
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static int dec_round_trip() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache =
+        aws_cryptosdk_materials_cache_shm_new(alloc, SLOT_COUNT, SLOT_SIZE);
+    struct aws_byte_buf cache_id     = aws_byte_buf_from_c_str("Hello, world!");
+    struct aws_byte_buf expected_key = aws_byte_buf_from_c_str("THE MAGIC WORDS ARE SQUEAMISH OSSIFRAGE");
+    struct aws_cryptosdk_dec_materials *dec_mat_in =
+        aws_cryptosdk_dec_materials_new(alloc, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384);
+    AWS_STATIC_STRING_FROM_LITERAL(pubkey, "AoZ0mPKrKqcCyWlF47FYUrk4as696N4WUmv+54kp58hBiGJ22Fm+g4esiICWcOrgfQ==");
+
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init_copy(&dec_mat_in->unencrypted_data_key, alloc, &expected_key));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_verify_start(
+        &dec_mat_in->signctx, alloc, pubkey, aws_cryptosdk_alg_props(dec_mat_in->alg)));
+
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+    aws_cryptosdk_materials_cache_put_entry_for_decrypt(cache, &entry, dec_mat_in, &cache_id);
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+
+    struct aws_cryptosdk_dec_materials *dec_mat_out = NULL;
+    bool is_encrypt                                 = true;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_find_entry(cache, &entry, &is_encrypt, &cache_id));
+    TEST_ASSERT(!is_encrypt);
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_dec_materials(cache, alloc, &dec_mat_out, entry));
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+
+    TEST_ASSERT(dec_materials_eq(dec_mat_in, dec_mat_out));
+
+    aws_cryptosdk_dec_materials_destroy(dec_mat_in);
+    aws_cryptosdk_dec_materials_destroy(dec_mat_out);
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static int shared_across_fork() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache =
+        aws_cryptosdk_materials_cache_shm_new(alloc, SLOT_COUNT, SLOT_SIZE);
+    struct aws_cryptosdk_enc_materials *enc_mat_1, *enc_mat_2;
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+    struct aws_cryptosdk_cache_usage_stats stats      = { 0 };
+    struct aws_hash_table enc_ctx;
+    struct aws_byte_buf cache_id = aws_byte_buf_from_c_str("Forked entry");
+    bool is_encrypt;
+    int status;
+
+    TEST_ASSERT_ADDR_NOT_NULL(cache);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+    gen_enc_materials(alloc, &enc_mat_1, 7, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384, 2);
+
+    pid_t child = fork();
+    TEST_ASSERT(child >= 0);
+
+    if (child == 0) {
+        /* The child inserts the entry; the parent must be able to see it */
+        aws_cryptosdk_materials_cache_put_entry_for_encrypt(cache, &entry, enc_mat_1, stats, &enc_ctx, &cache_id);
+        _exit(entry ? 0 : 1);
+    }
+
+    TEST_ASSERT_INT_EQ(child, waitpid(child, &status, 0));
+    TEST_ASSERT(WIFEXITED(status));
+    TEST_ASSERT_INT_EQ(0, WEXITSTATUS(status));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_find_entry(cache, &entry, &is_encrypt, &cache_id));
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    TEST_ASSERT(is_encrypt);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_enc_materials(cache, alloc, &enc_mat_2, &enc_ctx, entry));
+    TEST_ASSERT(materials_eq(enc_mat_1, enc_mat_2));
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+
+    aws_cryptosdk_enc_materials_destroy(enc_mat_1);
+    aws_cryptosdk_enc_materials_destroy(enc_mat_2);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static int ttl_and_oversize() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache =
+        aws_cryptosdk_materials_cache_shm_new(alloc, SLOT_COUNT, SLOT_SIZE);
+    struct aws_cryptosdk_enc_materials *small_mat, *large_mat;
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+    struct aws_cryptosdk_cache_usage_stats stats      = { 0 };
+    struct aws_hash_table enc_ctx;
+    struct aws_byte_buf id_small = aws_byte_buf_from_c_str("small"), id_large = aws_byte_buf_from_c_str("large");
+    bool is_encrypt;
+
+    aws_cryptosdk_shm_cache_set_clock(cache, test_clock);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+    gen_enc_materials(alloc, &small_mat, 1, ALG_AES128_GCM_IV12_TAG16_HKDF_SHA256, 1);
+    /* Enough EDKs to overflow a slot */
+    gen_enc_materials(alloc, &large_mat, 2, ALG_AES128_GCM_IV12_TAG16_HKDF_SHA256, 100);
+
+    aws_cryptosdk_materials_cache_put_entry_for_encrypt(cache, &entry, large_mat, stats, &enc_ctx, &id_large);
+    TEST_ASSERT_ADDR_NULL(entry);
+
+    aws_cryptosdk_materials_cache_put_entry_for_encrypt(cache, &entry, small_mat, stats, &enc_ctx, &id_small);
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    TEST_ASSERT_INT_EQ(now, aws_cryptosdk_materials_cache_entry_get_creation_time(cache, entry));
+    aws_cryptosdk_materials_cache_entry_ttl_hint(cache, entry, now + 100);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+
+    now += 99;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_find_entry(cache, &entry, &is_encrypt, &id_small));
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+
+    now += 1;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_find_entry(cache, &entry, &is_encrypt, &id_small));
+    TEST_ASSERT_ADDR_NULL(entry);
+    TEST_ASSERT_INT_EQ(0, aws_cryptosdk_materials_cache_entry_count(cache));
+
+    aws_cryptosdk_materials_cache_put_entry_for_encrypt(cache, &entry, small_mat, stats, &enc_ctx, &id_small);
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    aws_cryptosdk_materials_cache_clear(cache);
+    TEST_ASSERT_INT_EQ(0, aws_cryptosdk_materials_cache_entry_count(cache));
+
+    aws_cryptosdk_enc_materials_destroy(small_mat);
+    aws_cryptosdk_enc_materials_destroy(large_mat);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+/*
+ * A process which hits on an entry re-parses its signing key only if the slot has since been reused, even if
+ * the process cached a parsed key for the old contents.
+ */
+static int parsed_key_follows_slot_reuse() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache =
+        aws_cryptosdk_materials_cache_shm_new(alloc, SLOT_COUNT, SLOT_SIZE);
+    struct aws_cryptosdk_enc_materials *enc_mat_1, *enc_mat_2, *enc_mat_out;
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+    struct aws_cryptosdk_cache_usage_stats stats      = { 0 };
+    struct aws_hash_table enc_ctx;
+    struct aws_byte_buf cache_id = aws_byte_buf_from_c_str("Reused entry");
+    bool is_encrypt;
+    int status;
+
+    TEST_ASSERT_ADDR_NOT_NULL(cache);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+    gen_enc_materials(alloc, &enc_mat_1, 1, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384, 1);
+    gen_enc_materials(alloc, &enc_mat_2, 2, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384, 1);
+    TEST_ASSERT(!same_signing_key(enc_mat_1->signctx, enc_mat_2->signctx));
+
+    /* This process keeps the signing key of the entry it inserts */
+    aws_cryptosdk_materials_cache_put_entry_for_encrypt(cache, &entry, enc_mat_1, stats, &enc_ctx, &cache_id);
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+
+    pid_t child = fork();
+    TEST_ASSERT(child >= 0);
+
+    if (child == 0) {
+        /* The child replaces the entry, which bumps the slot's generation */
+        aws_cryptosdk_materials_cache_put_entry_for_encrypt(cache, &entry, enc_mat_2, stats, &enc_ctx, &cache_id);
+        _exit(entry ? 0 : 1);
+    }
+
+    TEST_ASSERT_INT_EQ(child, waitpid(child, &status, 0));
+    TEST_ASSERT(WIFEXITED(status));
+    TEST_ASSERT_INT_EQ(0, WEXITSTATUS(status));
+
+    /* The first hit parses the child's key, and the second reuses it; neither may return the stale key */
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_find_entry(cache, &entry, &is_encrypt, &cache_id));
+        TEST_ASSERT_ADDR_NOT_NULL(entry);
+        TEST_ASSERT_SUCCESS(
+            aws_cryptosdk_materials_cache_get_enc_materials(cache, alloc, &enc_mat_out, &enc_ctx, entry));
+        TEST_ASSERT(materials_eq(enc_mat_2, enc_mat_out));
+        aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+        aws_cryptosdk_enc_materials_destroy(enc_mat_out);
+    }
+
+    aws_cryptosdk_enc_materials_destroy(enc_mat_1);
+    aws_cryptosdk_enc_materials_destroy(enc_mat_2);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+/*
+ * Hits lend out the EDKs of a process-local copy of the entry rather than copying them, and that copy must stay
+ * valid for as long as the materials do, even once the entry is gone and the cache destroyed.
+ */
+static int materials_outlive_cache() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache =
+        aws_cryptosdk_materials_cache_shm_new(alloc, SLOT_COUNT, SLOT_SIZE);
+    struct aws_cryptosdk_enc_materials *enc_mat_in, *enc_mat_out[2];
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+    struct aws_cryptosdk_cache_usage_stats stats      = { 0 };
+    struct aws_cryptosdk_edk *edk_1, *edk_2;
+    struct aws_hash_table enc_ctx;
+    struct aws_byte_buf cache_id = aws_byte_buf_from_c_str("Borrowed entry");
+    bool is_encrypt;
+
+    TEST_ASSERT_ADDR_NOT_NULL(cache);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+    gen_enc_materials(alloc, &enc_mat_in, 1, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384, 3);
+
+    aws_cryptosdk_materials_cache_put_entry_for_encrypt(cache, &entry, enc_mat_in, stats, &enc_ctx, &cache_id);
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_find_entry(cache, &entry, &is_encrypt, &cache_id));
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_SUCCESS(
+            aws_cryptosdk_materials_cache_get_enc_materials(cache, alloc, &enc_mat_out[i], &enc_ctx, entry));
+    }
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, true);
+    aws_cryptosdk_materials_cache_release(cache);
+
+    /* Both hits borrowed the same EDK buffers */
+    TEST_ASSERT_SUCCESS(aws_array_list_get_at_ptr(&enc_mat_out[0]->encrypted_data_keys, (void **)&edk_1, 0));
+    TEST_ASSERT_SUCCESS(aws_array_list_get_at_ptr(&enc_mat_out[1]->encrypted_data_keys, (void **)&edk_2, 0));
+    TEST_ASSERT_ADDR_NULL(edk_1->ciphertext.allocator);
+    TEST_ASSERT_ADDR_EQ(edk_1->ciphertext.buffer, edk_2->ciphertext.buffer);
+
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT(materials_eq(enc_mat_in, enc_mat_out[i]));
+        aws_cryptosdk_enc_materials_destroy(enc_mat_out[i]);
+    }
+
+    aws_cryptosdk_enc_materials_destroy(enc_mat_in);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+
+    return 0;
+}
+
+/* Finds the entry for cache_id and gets its encrypt materials; returns nonzero on failure */
+static int hit_once(struct aws_cryptosdk_materials_cache *cache, const struct aws_byte_buf *cache_id) {
+    struct aws_allocator *alloc                       = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+    struct aws_cryptosdk_enc_materials *materials     = NULL;
+    struct aws_hash_table enc_ctx;
+    bool is_encrypt;
+    int rv = 1;
+
+    if (aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx)) {
+        return 1;
+    }
+
+    if (!aws_cryptosdk_materials_cache_find_entry(cache, &entry, &is_encrypt, cache_id) && entry &&
+        !aws_cryptosdk_materials_cache_get_enc_materials(cache, alloc, &materials, &enc_ctx, entry)) {
+        rv = 0;
+    }
+
+    aws_cryptosdk_enc_materials_destroy(materials);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+
+    return rv;
+}
+
+struct hit_loop_args {
+    struct aws_cryptosdk_materials_cache *cache;
+    const struct aws_byte_buf *cache_id;
+    struct aws_atomic_var stop;
+    int failures;
+};
+
+static void hit_loop_fn(void *param) {
+    struct hit_loop_args *args = param;
+
+    while (!aws_atomic_load_int(&args->stop)) {
+        args->failures += hit_once(args->cache, args->cache_id);
+    }
+}
+
+/*
+ * A child forked while another thread is in the middle of a hit (and so may hold the cache's process-local lock)
+ * must still be able to use the cache, rather than hanging on a lock that no thread of its own will release.
+ */
+static int parsed_lock_across_fork() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache =
+        aws_cryptosdk_materials_cache_shm_new(alloc, SLOT_COUNT, SLOT_SIZE);
+    struct aws_cryptosdk_enc_materials *enc_mat;
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+    struct aws_cryptosdk_cache_usage_stats stats      = { 0 };
+    struct aws_hash_table enc_ctx;
+    struct aws_byte_buf cache_id = aws_byte_buf_from_c_str("Entry hit across fork");
+    struct hit_loop_args args;
+    struct aws_thread thread;
+    int status;
+
+    TEST_ASSERT_ADDR_NOT_NULL(cache);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+    gen_enc_materials(alloc, &enc_mat, 1, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384, 2);
+
+    aws_cryptosdk_materials_cache_put_entry_for_encrypt(cache, &entry, enc_mat, stats, &enc_ctx, &cache_id);
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+
+    args.cache    = cache;
+    args.cache_id = &cache_id;
+    args.failures = 0;
+    aws_atomic_init_int(&args.stop, 0);
+    TEST_ASSERT_SUCCESS(aws_thread_init(&thread, alloc));
+    TEST_ASSERT_SUCCESS(aws_thread_launch(&thread, hit_loop_fn, &args, aws_default_thread_options()));
+
+    for (int i = 0; i < FORK_ROUNDS; i++) {
+        pid_t child = fork();
+        TEST_ASSERT(child >= 0);
+
+        if (child == 0) {
+            _exit(hit_once(cache, &cache_id));
+        }
+
+        TEST_ASSERT_INT_EQ(child, waitpid(child, &status, 0));
+        TEST_ASSERT(WIFEXITED(status));
+        TEST_ASSERT_INT_EQ(0, WEXITSTATUS(status));
+    }
+
+    aws_atomic_store_int(&args.stop, 1);
+    aws_thread_join(&thread);
+    aws_thread_clean_up(&thread);
+    TEST_ASSERT_INT_EQ(0, args.failures);
+
+    aws_cryptosdk_enc_materials_destroy(enc_mat);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+/* Runs in a child process, since RLIMIT_MEMLOCK can't be raised again once lowered */
+static int mlock_policy_child() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct rlimit no_memlock                    = { 0, 0 };
+    struct aws_cryptosdk_materials_cache *cache = NULL;
+
+    TEST_ASSERT_INT_EQ(0, setrlimit(RLIMIT_MEMLOCK, &no_memlock));
+
+    /* By default, failing to lock the segment is not fatal */
+    cache = aws_cryptosdk_materials_cache_shm_new(alloc, SLOT_COUNT, SLOT_SIZE);
+    TEST_ASSERT_ADDR_NOT_NULL(cache);
+    aws_cryptosdk_materials_cache_release(cache);
+
+    /* A process with CAP_IPC_LOCK can lock the segment regardless of the limit */
+    cache = aws_cryptosdk_materials_cache_shm_new_with_mlock(
+        alloc, SLOT_COUNT, SLOT_SIZE, AWS_CRYPTOSDK_SHM_CACHE_MLOCK_REQUIRED);
+    if (cache) {
+        aws_cryptosdk_materials_cache_release(cache);
+    } else {
+        TEST_ASSERT_INT_EQ(AWS_ERROR_SYS_CALL_FAILURE, aws_last_error());
+    }
+
+    return 0;
+}
+
+static int mlock_policy() {
+    int status;
+
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_materials_cache_shm_new_with_mlock(
+        aws_default_allocator(), SLOT_COUNT, SLOT_SIZE, (enum aws_cryptosdk_shm_cache_mlock_policy)42));
+    TEST_ASSERT_INT_EQ(AWS_ERROR_INVALID_ARGUMENT, aws_last_error());
+
+    pid_t child = fork();
+    TEST_ASSERT(child >= 0);
+
+    if (child == 0) {
+        _exit(mlock_policy_child() ? 1 : 0);
+    }
+
+    TEST_ASSERT_INT_EQ(child, waitpid(child, &status, 0));
+    TEST_ASSERT(WIFEXITED(status));
+    TEST_ASSERT_INT_EQ(0, WEXITSTATUS(status));
+
+    return 0;
+}
+
+#else /* !__linux__ */
+
+static int unsupported_platform() {
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_materials_cache_shm_new(aws_default_allocator(), SLOT_COUNT, SLOT_SIZE));
+    TEST_ASSERT_INT_EQ(AWS_ERROR_UNSUPPORTED_OPERATION, aws_last_error());
+
+    return 0;
+}
+
+#endif /* __linux__ */
+
+#define TEST_CASE(name) \
+    { "shm_cache", #name, name }
+struct test_case shm_cache_test_cases[] = {
+#ifdef __linux__
+    TEST_CASE(enc_round_trip),
+    TEST_CASE(dec_round_trip),
+    TEST_CASE(shared_across_fork),
+    TEST_CASE(ttl_and_oversize),
+    TEST_CASE(parsed_key_follows_slot_reuse),
+    TEST_CASE(materials_outlive_cache),
+    TEST_CASE(parsed_lock_across_fork),
+    TEST_CASE(mlock_policy),
+#else
+    TEST_CASE(unsupported_platform),
+#endif
+    { NULL }
+};
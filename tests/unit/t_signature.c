@@ -492,6 +492,45 @@ static int t_trailing_garbage_with_o2i_ECPublicKey() {
     return 0;
 }
 
+static int t_start_from_ctx() {
+    FOREACH_ALGORITHM(props) {
+        struct aws_cryptosdk_sig_ctx *proto, *ctx;
+        struct aws_string *pub_key, *sig;
+
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_sign_start_keygen(&proto, aws_default_allocator(), &pub_key, props));
+
+        /* A copy of a fresh context produces valid signatures, and leaves the prototype usable */
+        for (int i = 0; i < 2; i++) {
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_start_from_ctx(&ctx, aws_default_allocator(), proto));
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_update(ctx, test_cursor));
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_sign_finish(ctx, aws_default_allocator(), &sig));
+            TEST_ASSERT_SUCCESS(check_signature(props, true, pub_key, sig, &test_cursor));
+            aws_string_destroy(sig);
+        }
+
+        /* Contexts started from one which has already digested data don't inherit that data */
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_update(proto, aws_byte_cursor_from_c_str("garbage")));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_start_from_ctx(&ctx, aws_default_allocator(), proto));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_update(ctx, test_cursor));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_sign_finish(ctx, aws_default_allocator(), &sig));
+        TEST_ASSERT_SUCCESS(check_signature(props, true, pub_key, sig, &test_cursor));
+
+        /* Likewise for verification contexts */
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_verify_start(&ctx, aws_default_allocator(), pub_key, props));
+        aws_cryptosdk_sig_abort(proto);
+        proto = ctx;
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_start_from_ctx(&ctx, aws_default_allocator(), proto));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_update(ctx, test_cursor));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_verify_finish(ctx, sig));
+
+        aws_cryptosdk_sig_abort(proto);
+        aws_string_destroy(pub_key);
+        aws_string_destroy(sig);
+    }
+
+    return 0;
+}
+
 struct test_case signature_test_cases[] = {
     { "signature", "t_basic_signature_sign_verify", t_basic_signature_sign_verify },
     { "signature", "t_signature_length", t_signature_length },
@@ -501,6 +540,7 @@ struct test_case signature_test_cases[] = {
     { "signature", "t_wrong_data", t_wrong_data },
     { "signature", "t_partial_update", t_partial_update },
     { "signature", "t_serialize_privkey", t_serialize_privkey },
+    { "signature", "t_start_from_ctx", t_start_from_ctx },
     { "signature", "t_empty_signature", t_empty_signature },
     { "signature", "t_test_vectors", t_test_vectors },
     { "signature", "t_trailing_garbage", t_trailing_garbage },
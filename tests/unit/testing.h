@@ -38,6 +38,7 @@ extern struct test_case trailing_sig_test_cases[];
 extern struct test_case raw_rsa_keyring_decrypt_test_cases[];
 extern struct test_case raw_rsa_keyring_encrypt_test_cases[];
 extern struct test_case local_cache_test_cases[];
+extern struct test_case shm_cache_test_cases[];
 extern struct test_case caching_cmm_test_cases[];
 extern struct test_case keyring_trace_test_cases[];
 extern struct test_case version_test_cases[];